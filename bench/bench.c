@@ -0,0 +1,471 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/**
+ * @file bench.c
+ * @brief Micro-benchmarks of key library operations.
+ * @details Each benchmark runs on in-memory configfs populated with a tree
+ * of given size: size gadgets, each with size functions linked into one
+ * config. Results are printed one JSON object per line, so they can be
+ * collected and compared between releases.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <usbg/usbg.h>
+#include <usbg/usbg_internal.h>
+
+#define BENCH_DEFAULT_SIZES "1,8,32"
+#define BENCH_DEFAULT_ITERATIONS 100
+#define BENCH_MAX_SIZES 16
+
+struct bench
+{
+	const char *name;
+	int (*run)(usbg_state *s, int size, int iters, uint64_t *ns);
+	/* Iterations relative to the base count, cheap ops need more */
+	int weight;
+};
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_add_gadget(usbg_state *s, const char *name, int nfuncs,
+			    usbg_gadget **g)
+{
+	char instance[16], bname[16];
+	usbg_function *f;
+	usbg_config *c;
+	int i;
+	int ret;
+
+	ret = usbg_create_gadget(s, name, NULL, NULL, g);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	ret = usbg_create_config(*g, 1, "c", NULL, NULL, &c);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	for (i = 0; i < nfuncs; ++i) {
+		snprintf(instance, sizeof(instance), "%d", i);
+		snprintf(bname, sizeof(bname), "acm%d", i);
+
+		ret = usbg_create_function(*g, USBG_F_ACM, instance, NULL, &f);
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		ret = usbg_add_config_function(c, bname, f);
+		if (ret != USBG_SUCCESS)
+			return ret;
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int bench_populate(usbg_state *s, int size)
+{
+	char name[16];
+	usbg_gadget *g;
+	int i;
+	int ret = USBG_SUCCESS;
+
+	for (i = 0; i < size && ret == USBG_SUCCESS; ++i) {
+		snprintf(name, sizeof(name), "g%d", i);
+		ret = bench_add_gadget(s, name, size, &g);
+	}
+
+	return ret;
+}
+
+static int bench_init(usbg_state *s, int size, int iters, uint64_t *ns)
+{
+	usbg_state *s2;
+	uint64_t t;
+	int i;
+	int ret;
+
+	for (i = 0; i < iters; ++i) {
+		/* Second state parses the same in-memory tree */
+		t = bench_now();
+		ret = usbg_init_io(usbg_get_configfs_path(s), s->udc_path,
+				   s->io.ops, s->io.priv, &s2);
+		*ns += bench_now() - t;
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		usbg_cleanup(s2);
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int bench_get_gadget(usbg_state *s, int size, int iters, uint64_t *ns)
+{
+	char name[16];
+	uint64_t t;
+	int i;
+
+	snprintf(name, sizeof(name), "g%d", size - 1);
+
+	t = bench_now();
+	for (i = 0; i < iters; ++i)
+		if (!usbg_get_gadget(s, name))
+			return USBG_ERROR_NOT_FOUND;
+	*ns += bench_now() - t;
+
+	return USBG_SUCCESS;
+}
+
+static int bench_get_function(usbg_state *s, int size, int iters,
+			      uint64_t *ns)
+{
+	char instance[16];
+	usbg_gadget *g;
+	uint64_t t;
+	int i;
+
+	g = usbg_get_first_gadget(s);
+	snprintf(instance, sizeof(instance), "%d", size - 1);
+
+	t = bench_now();
+	for (i = 0; i < iters; ++i)
+		if (!usbg_get_function(g, USBG_F_ACM, instance))
+			return USBG_ERROR_NOT_FOUND;
+	*ns += bench_now() - t;
+
+	return USBG_SUCCESS;
+}
+
+static int bench_create_function(usbg_state *s, int size, int iters,
+				 uint64_t *ns)
+{
+	char instance[16];
+	usbg_function *f;
+	usbg_gadget *g;
+	uint64_t t;
+	int i;
+	int ret = USBG_SUCCESS;
+
+	g = usbg_get_first_gadget(s);
+
+	for (i = 0; i < iters; ++i) {
+		snprintf(instance, sizeof(instance), "b%d", i);
+
+		t = bench_now();
+		ret = usbg_create_function(g, USBG_F_ACM, instance, NULL, &f);
+		*ns += bench_now() - t;
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	for (--i; i >= 0; --i) {
+		snprintf(instance, sizeof(instance), "b%d", i);
+		f = usbg_get_function(g, USBG_F_ACM, instance);
+		if (f)
+			usbg_rm_function(f, USBG_RM_RECURSE);
+	}
+
+	return ret;
+}
+
+static int bench_add_config_function(usbg_state *s, int size, int iters,
+				     uint64_t *ns)
+{
+	char instance[16];
+	usbg_function *f;
+	usbg_config *c;
+	usbg_gadget *g;
+	uint64_t t;
+	int i, n;
+	int ret;
+
+	g = usbg_get_first_gadget(s);
+
+	ret = usbg_create_config(g, 2, "b", NULL, NULL, &c);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	for (n = 0; n < iters; ++n) {
+		snprintf(instance, sizeof(instance), "b%d", n);
+		ret = usbg_create_function(g, USBG_F_ACM, instance, NULL, &f);
+		if (ret != USBG_SUCCESS)
+			goto out;
+	}
+
+	for (i = 0; i < iters; ++i) {
+		snprintf(instance, sizeof(instance), "b%d", i);
+		f = usbg_get_function(g, USBG_F_ACM, instance);
+
+		t = bench_now();
+		ret = usbg_add_config_function(c, instance, f);
+		*ns += bench_now() - t;
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+out:
+	usbg_rm_config(c, USBG_RM_RECURSE);
+	for (--n; n >= 0; --n) {
+		snprintf(instance, sizeof(instance), "b%d", n);
+		f = usbg_get_function(g, USBG_F_ACM, instance);
+		if (f)
+			usbg_rm_function(f, USBG_RM_RECURSE);
+	}
+
+	return ret;
+}
+
+static int bench_set_attr(usbg_state *s, int size, int iters, uint64_t *ns)
+{
+	usbg_gadget *g;
+	uint64_t t;
+	int i;
+	int ret;
+
+	g = usbg_get_first_gadget(s);
+
+	t = bench_now();
+	for (i = 0; i < iters; ++i) {
+		ret = usbg_set_gadget_attr(g, USBG_ID_VENDOR, i & 0xffff);
+		if (ret != USBG_SUCCESS)
+			return ret;
+	}
+	*ns += bench_now() - t;
+
+	return USBG_SUCCESS;
+}
+
+static int bench_get_attr(usbg_state *s, int size, int iters, uint64_t *ns)
+{
+	usbg_gadget *g;
+	uint64_t t;
+	int i;
+	int ret;
+
+	g = usbg_get_first_gadget(s);
+
+	t = bench_now();
+	for (i = 0; i < iters; ++i) {
+		ret = usbg_get_gadget_attr(g, USBG_ID_VENDOR);
+		if (ret < 0)
+			return ret;
+	}
+	*ns += bench_now() - t;
+
+	return USBG_SUCCESS;
+}
+
+static int bench_export_gadget(usbg_state *s, int size, int iters,
+			       uint64_t *ns)
+{
+	usbg_gadget *g;
+	uint64_t t;
+	FILE *stream;
+	int i;
+	int ret = USBG_SUCCESS;
+
+	g = usbg_get_first_gadget(s);
+
+	stream = tmpfile();
+	if (!stream)
+		return USBG_ERROR_IO;
+
+	for (i = 0; i < iters && ret == USBG_SUCCESS; ++i) {
+		rewind(stream);
+
+		t = bench_now();
+		ret = usbg_export_gadget(g, stream);
+		*ns += bench_now() - t;
+	}
+
+	fclose(stream);
+	return ret;
+}
+
+static int bench_import_gadget(usbg_state *s, int size, int iters,
+			       uint64_t *ns)
+{
+	usbg_gadget *g;
+	uint64_t t;
+	FILE *stream;
+	int i;
+	int ret;
+
+	stream = tmpfile();
+	if (!stream)
+		return USBG_ERROR_IO;
+
+	ret = usbg_export_gadget(usbg_get_first_gadget(s), stream);
+
+	for (i = 0; i < iters && ret == USBG_SUCCESS; ++i) {
+		rewind(stream);
+
+		t = bench_now();
+		ret = usbg_import_gadget(s, stream, "imported", &g);
+		*ns += bench_now() - t;
+		if (ret != USBG_SUCCESS)
+			break;
+
+		ret = usbg_rm_gadget(g, USBG_RM_RECURSE);
+	}
+
+	fclose(stream);
+	return ret;
+}
+
+static int bench_rm_gadget(usbg_state *s, int size, int iters, uint64_t *ns)
+{
+	usbg_gadget *g;
+	uint64_t t;
+	int i;
+	int ret = USBG_SUCCESS;
+
+	for (i = 0; i < iters && ret == USBG_SUCCESS; ++i) {
+		ret = bench_add_gadget(s, "removed", size, &g);
+		if (ret != USBG_SUCCESS)
+			break;
+
+		t = bench_now();
+		ret = usbg_rm_gadget(g, USBG_RM_RECURSE);
+		*ns += bench_now() - t;
+	}
+
+	return ret;
+}
+
+static struct bench benches[] = {
+	{ "init", bench_init, 1 },
+	{ "get_gadget", bench_get_gadget, 1000 },
+	{ "get_function", bench_get_function, 1000 },
+	{ "create_function", bench_create_function, 1 },
+	{ "add_config_function", bench_add_config_function, 1 },
+	{ "set_gadget_attr", bench_set_attr, 10 },
+	{ "get_gadget_attr", bench_get_attr, 10 },
+	{ "export_gadget", bench_export_gadget, 1 },
+	{ "import_gadget", bench_import_gadget, 1 },
+	{ "rm_gadget_recurse", bench_rm_gadget, 1 },
+};
+
+static int bench_run(struct bench *b, int size, int iters)
+{
+	usbg_state *s;
+	uint64_t ns = 0;
+	int ret;
+
+	ret = usbg_init_memfs(1, &s);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	ret = bench_populate(s, size);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	iters *= b->weight;
+	ret = b->run(s, size, iters, &ns);
+	if (ret == USBG_ERROR_NOT_SUPPORTED) {
+		printf("{\"bench\": \"%s\", \"size\": %d, \"skipped\": true}\n",
+		       b->name, size);
+		ret = USBG_SUCCESS;
+	} else if (ret == USBG_SUCCESS) {
+		printf("{\"bench\": \"%s\", \"size\": %d, \"iterations\": %d, "
+		       "\"ns_per_op\": %.1f}\n",
+		       b->name, size, iters, (double)ns / iters);
+	}
+
+out:
+	usbg_cleanup(s);
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-s SIZE,...] [-i ITERATIONS] [-b BENCH]\n"
+		"  -s  tree sizes, default " BENCH_DEFAULT_SIZES "\n"
+		"  -i  base number of iterations, default %d\n"
+		"  -b  run only the named benchmark\n",
+		name, BENCH_DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+	const char *sizes_arg = BENCH_DEFAULT_SIZES;
+	const char *only = NULL;
+	int sizes[BENCH_MAX_SIZES];
+	int nsizes = 0;
+	int iters = BENCH_DEFAULT_ITERATIONS;
+	char *end;
+	int opt, i, j;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "s:i:b:h")) != -1) {
+		switch (opt) {
+		case 's':
+			sizes_arg = optarg;
+			break;
+		case 'i':
+			iters = atoi(optarg);
+			break;
+		case 'b':
+			only = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	for (end = (char *)sizes_arg; *end && nsizes < BENCH_MAX_SIZES; ) {
+		sizes[nsizes] = strtol(end, &end, 10);
+		if (sizes[nsizes] <= 0 || (*end && *end != ',')) {
+			usage(argv[0]);
+			return 1;
+		}
+		nsizes++;
+		if (*end == ',')
+			end++;
+	}
+
+	if (!nsizes || iters <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+		if (only && strcmp(only, benches[i].name))
+			continue;
+
+		for (j = 0; j < nsizes; ++j) {
+			ret = bench_run(&benches[i], sizes[j], iters);
+			if (ret != USBG_SUCCESS) {
+				fprintf(stderr, "%s (size %d): %s\n",
+					benches[i].name, sizes[j],
+					usbg_strerror(ret));
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
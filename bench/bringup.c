@@ -0,0 +1,492 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/**
+ * @file bringup.c
+ * @brief End-to-end bring-up latency on dummy_hcd.
+ * @details Each personality of examples is built in real configfs, bound
+ * to dummy UDC and timed until host side of dummy_hcd enumerates it.
+ * Phases are: creation of gadget (mkdirs and attribute writes), write
+ * of UDC, UDC state reaching "configured" and the device showing up
+ * in /sys/bus/usb/devices. Both of the latter are measured from the write
+ * of UDC. Results are printed one JSON object per line. When configfs
+ * or dummy UDC is not available, program exits with 77, which test
+ * harnesses treat as skipped.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/usb/ch9.h>
+
+#include <usbg/usbg.h>
+#include <usbg/function/hid.h>
+#include <usbg/function/midi.h>
+#include <usbg/function/ms.h>
+#include <usbg/function/uac2.h>
+#include <usbg/function/uvc.h>
+
+#define BRINGUP_EXIT_SKIP 77
+#define BRINGUP_DEFAULT_UDC "dummy_udc.0"
+#define BRINGUP_DEFAULT_ITERATIONS 5
+#define BRINGUP_TIMEOUT_NS (5 * 1000000000ULL)
+#define BRINGUP_POLL_NS 100000
+
+#define UDC_CLASS "/sys/class/udc"
+#define USB_DEVICES "/sys/bus/usb/devices"
+
+#define VENDOR 0x1d6b
+#define PRODUCT 0x0104
+
+struct personality
+{
+	const char *name;
+	int (*build)(usbg_gadget *g, usbg_config *c);
+};
+
+struct phases
+{
+	uint64_t create;
+	uint64_t bind;
+	uint64_t configured;
+	uint64_t enumerated;
+	uint64_t teardown;
+};
+
+static char report_desc[] = {
+	0x05, 0x01,	/* USAGE_PAGE (Generic Desktop)	          */
+	0x09, 0x06,	/* USAGE (Keyboard)                       */
+	0xa1, 0x01,	/* COLLECTION (Application)               */
+	0x05, 0x07,	/*   USAGE_PAGE (Keyboard)                */
+	0x19, 0xe0,	/*   USAGE_MINIMUM (Keyboard LeftControl) */
+	0x29, 0xe7,	/*   USAGE_MAXIMUM (Keyboard Right GUI)   */
+	0x15, 0x00,	/*   LOGICAL_MINIMUM (0)                  */
+	0x25, 0x01,	/*   LOGICAL_MAXIMUM (1)                  */
+	0x75, 0x01,	/*   REPORT_SIZE (1)                      */
+	0x95, 0x08,	/*   REPORT_COUNT (8)                     */
+	0x81, 0x02,	/*   INPUT (Data,Var,Abs)                 */
+	0x95, 0x01,	/*   REPORT_COUNT (1)                     */
+	0x75, 0x08,	/*   REPORT_SIZE (8)                      */
+	0x81, 0x03,	/*   INPUT (Cnst,Var,Abs)                 */
+	0x95, 0x05,	/*   REPORT_COUNT (5)                     */
+	0x75, 0x01,	/*   REPORT_SIZE (1)                      */
+	0x05, 0x08,	/*   USAGE_PAGE (LEDs)                    */
+	0x19, 0x01,	/*   USAGE_MINIMUM (Num Lock)             */
+	0x29, 0x05,	/*   USAGE_MAXIMUM (Kana)                 */
+	0x91, 0x02,	/*   OUTPUT (Data,Var,Abs)                */
+	0x95, 0x01,	/*   REPORT_COUNT (1)                     */
+	0x75, 0x03,	/*   REPORT_SIZE (3)                      */
+	0x91, 0x03,	/*   OUTPUT (Cnst,Var,Abs)                */
+	0x95, 0x06,	/*   REPORT_COUNT (6)                     */
+	0x75, 0x08,	/*   REPORT_SIZE (8)                      */
+	0x15, 0x00,	/*   LOGICAL_MINIMUM (0)                  */
+	0x25, 0x65,	/*   LOGICAL_MAXIMUM (101)                */
+	0x05, 0x07,	/*   USAGE_PAGE (Keyboard)                */
+	0x19, 0x00,	/*   USAGE_MINIMUM (Reserved)             */
+	0x29, 0x65,	/*   USAGE_MAXIMUM (Keyboard Application) */
+	0x81, 0x00,	/*   INPUT (Data,Ary,Abs)                 */
+	0xc0		/* END_COLLECTION                         */
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int add_function(usbg_gadget *g, usbg_config *c,
+			usbg_function_type type, const char *instance,
+			void *attrs)
+{
+	usbg_function *f;
+	char bname[32];
+	int ret;
+
+	ret = usbg_create_function(g, type, instance, attrs, &f);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	snprintf(bname, sizeof(bname), "%s.%s",
+		 usbg_get_function_type_str(type), instance);
+
+	return usbg_add_config_function(c, bname, f);
+}
+
+static int build_acm_ecm(usbg_gadget *g, usbg_config *c)
+{
+	int ret;
+
+	ret = add_function(g, c, USBG_F_ACM, "usb0", NULL);
+	if (ret == USBG_SUCCESS)
+		ret = add_function(g, c, USBG_F_ECM, "usb0", NULL);
+
+	return ret;
+}
+
+static int build_ms(usbg_gadget *g, usbg_config *c)
+{
+	struct usbg_f_ms_lun_attrs lun = {
+		.id = 0,
+		.cdrom = 1,
+		.removable = 1,
+		.file = "",
+		.inquiry_string = "Empty",
+	};
+	struct usbg_f_ms_lun_attrs *luns[] = { &lun, NULL };
+	struct usbg_f_ms_attrs attrs = {
+		.nluns = 1,
+		.luns = luns,
+	};
+
+	return add_function(g, c, USBG_F_MASS_STORAGE, "usb0", &attrs);
+}
+
+static int build_hid(usbg_gadget *g, usbg_config *c)
+{
+	struct usbg_f_hid_attrs attrs = {
+		.protocol = 1,
+		.report_desc = {
+			.desc = report_desc,
+			.len = sizeof(report_desc),
+		},
+		.report_length = 8,
+		.subclass = 0,
+	};
+
+	return add_function(g, c, USBG_F_HID, "usb0", &attrs);
+}
+
+static int build_uac2(usbg_gadget *g, usbg_config *c)
+{
+	struct usbg_f_uac2_attrs attrs = {
+		.c_chmask = 3,
+		.c_srate = 44100,
+		.c_ssize = 4,
+		.p_chmask = 3,
+		.p_srate = 44100,
+		.p_ssize = 4,
+	};
+
+	return add_function(g, c, USBG_F_UAC2, "usb0", &attrs);
+}
+
+static int build_uvc(usbg_gadget *g, usbg_config *c)
+{
+	struct usbg_f_uvc_frame_attrs frame = {
+		.bFrameIndex = 1,
+		.dwFrameInterval = 333333,
+		.wHeight = 480,
+		.wWidth = 640,
+	};
+	struct usbg_f_uvc_frame_attrs *frames[] = { &frame, NULL };
+	struct usbg_f_uvc_format_attrs format = {
+		.frames = frames,
+		.format = "mjpeg/m",
+		.bDefaultFrameIndex = 1,
+	};
+	struct usbg_f_uvc_format_attrs *formats[] = { &format, NULL };
+	struct usbg_f_uvc_attrs attrs = {
+		.formats = formats,
+	};
+
+	return add_function(g, c, USBG_F_UVC, "usb0", &attrs);
+}
+
+static int build_midi(usbg_gadget *g, usbg_config *c)
+{
+	struct usbg_f_midi_attrs attrs = {
+		.index = 0,
+		.id = "usb0",
+		.buflen = 128,
+		.qlen = 16,
+		.in_ports = 2,
+		.out_ports = 3,
+	};
+
+	return add_function(g, c, USBG_F_MIDI, "usb0", &attrs);
+}
+
+static int build_printer(usbg_gadget *g, usbg_config *c)
+{
+	return add_function(g, c, USBG_F_PRINTER, "usb0", NULL);
+}
+
+static struct personality personalities[] = {
+	{ "acm-ecm", build_acm_ecm },
+	{ "mass-storage", build_ms },
+	{ "hid", build_hid },
+	{ "uac2", build_uac2 },
+	{ "uvc", build_uvc },
+	{ "midi", build_midi },
+	{ "printer", build_printer },
+};
+
+/* Read first line of sysfs file without trailing newline */
+static int read_line(const char *path, char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+
+	buf[n] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return 0;
+}
+
+static bool udc_configured(const char *udc)
+{
+	char path[256], state[32];
+
+	snprintf(path, sizeof(path), UDC_CLASS "/%s/state", udc);
+
+	return !read_line(path, state, sizeof(state)) &&
+		!strcmp(state, "configured");
+}
+
+/* Host side device is recognized by unique serial of the gadget */
+static bool host_has_device(const char *serial)
+{
+	char path[512], buf[128];
+	struct dirent *d;
+	bool found = false;
+	DIR *dir;
+
+	dir = opendir(USB_DEVICES);
+	if (!dir)
+		return false;
+
+	while (!found && (d = readdir(dir))) {
+		/* Interfaces and root hubs have no serial of ours */
+		if (d->d_name[0] == '.' || strchr(d->d_name, ':'))
+			continue;
+
+		snprintf(path, sizeof(path), USB_DEVICES "/%s/serial",
+			 d->d_name);
+		found = !read_line(path, buf, sizeof(buf)) &&
+			!strcmp(buf, serial);
+	}
+	closedir(dir);
+
+	return found;
+}
+
+static void pause_poll(void)
+{
+	struct timespec ts = { 0, BRINGUP_POLL_NS };
+
+	nanosleep(&ts, NULL);
+}
+
+static int wait_bound(const char *udc, const char *serial, uint64_t start,
+		      struct phases *p)
+{
+	uint64_t t;
+
+	while (!p->configured || !p->enumerated) {
+		t = now();
+		if (t - start > BRINGUP_TIMEOUT_NS)
+			return USBG_ERROR_BUSY;
+
+		if (!p->configured && udc_configured(udc))
+			p->configured = t - start;
+		if (!p->enumerated && host_has_device(serial))
+			p->enumerated = t - start;
+
+		pause_poll();
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int wait_gone(const char *serial, uint64_t start)
+{
+	while (host_has_device(serial)) {
+		if (now() - start > BRINGUP_TIMEOUT_NS)
+			return USBG_ERROR_BUSY;
+		pause_poll();
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int bringup(usbg_state *s, usbg_udc *u, struct personality *pers,
+		   int iter, struct phases *p)
+{
+	struct usbg_gadget_attrs g_attrs = {
+		.bcdUSB = 0x0200,
+		.bDeviceClass = USB_CLASS_PER_INTERFACE,
+		.bMaxPacketSize0 = 64,
+		.idVendor = VENDOR,
+		.idProduct = PRODUCT,
+		.bcdDevice = 0x0001,
+	};
+	struct usbg_gadget_strs g_strs = {
+		.manufacturer = "libusbgx",
+	};
+	char serial[64], product[32];
+	usbg_gadget *g;
+	usbg_config *c;
+	uint64_t t;
+	int ret;
+
+	snprintf(serial, sizeof(serial), "bringup-%d-%s-%d", getpid(),
+		 pers->name, iter);
+	g_strs.serial = serial;
+	snprintf(product, sizeof(product), "%s", pers->name);
+	g_strs.product = product;
+
+	memset(p, 0, sizeof(*p));
+
+	t = now();
+	ret = usbg_create_gadget(s, "bringup", &g_attrs, &g_strs, &g);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	ret = usbg_create_config(g, 1, "c", NULL, NULL, &c);
+	if (ret == USBG_SUCCESS)
+		ret = pers->build(g, c);
+	p->create = now() - t;
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	t = now();
+	ret = usbg_enable_gadget(g, u);
+	p->bind = now() - t;
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = wait_bound(usbg_get_udc_name(u), serial, t, p);
+	if (ret != USBG_SUCCESS)
+		fprintf(stderr, "%s: not enumerated in time\n", pers->name);
+
+out:
+	t = now();
+	if (usbg_get_gadget_udc(g)) {
+		usbg_disable_gadget(g);
+		if (wait_gone(serial, t) != USBG_SUCCESS && ret == USBG_SUCCESS)
+			ret = USBG_ERROR_BUSY;
+	}
+	usbg_rm_gadget(g, USBG_RM_RECURSE);
+	p->teardown = now() - t;
+
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-u UDC] [-i ITERATIONS] [-p PERSONALITY]\n"
+		"  -u  UDC to bind to, default " BRINGUP_DEFAULT_UDC "\n"
+		"  -i  iterations of each personality, default %d\n"
+		"  -p  run only the named personality\n",
+		name, BRINGUP_DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+	const char *udc = BRINGUP_DEFAULT_UDC;
+	const char *only = NULL;
+	int iters = BRINGUP_DEFAULT_ITERATIONS;
+	struct phases p;
+	usbg_state *s;
+	usbg_udc *u;
+	int opt, i, j;
+	int usbg_ret;
+	int ret = 0;
+
+	while ((opt = getopt(argc, argv, "u:i:p:h")) != -1) {
+		switch (opt) {
+		case 'u':
+			udc = optarg;
+			break;
+		case 'i':
+			iters = atoi(optarg);
+			break;
+		case 'p':
+			only = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (iters <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	usbg_ret = usbg_init("/sys/kernel/config", &s);
+	if (usbg_ret != USBG_SUCCESS) {
+		fprintf(stderr, "No usable configfs: %s\n",
+			usbg_strerror(usbg_ret));
+		return BRINGUP_EXIT_SKIP;
+	}
+
+	u = usbg_get_udc(s, udc);
+	if (!u) {
+		fprintf(stderr, "UDC %s not found, is dummy_hcd loaded?\n", udc);
+		ret = BRINGUP_EXIT_SKIP;
+		goto out;
+	}
+
+	if (usbg_get_udc_gadget(u) || usbg_get_gadget(s, "bringup")) {
+		fprintf(stderr, "UDC %s or gadget name is in use\n", udc);
+		ret = BRINGUP_EXIT_SKIP;
+		goto out;
+	}
+
+	for (i = 0; i < sizeof(personalities) / sizeof(personalities[0]); ++i) {
+		if (only && strcmp(only, personalities[i].name))
+			continue;
+
+		for (j = 0; j < iters; ++j) {
+			usbg_ret = bringup(s, u, &personalities[i], j, &p);
+			if (usbg_ret != USBG_SUCCESS) {
+				fprintf(stderr, "%s: %s\n", personalities[i].name,
+					usbg_strerror(usbg_ret));
+				ret = 1;
+				break;
+			}
+
+			printf("{\"personality\": \"%s\", \"iteration\": %d, "
+			       "\"create_us\": %.1f, \"bind_us\": %.1f, "
+			       "\"configured_us\": %.1f, "
+			       "\"enumerated_us\": %.1f, "
+			       "\"teardown_us\": %.1f}\n",
+			       personalities[i].name, j, p.create / 1000.0,
+			       p.bind / 1000.0, p.configured / 1000.0,
+			       p.enumerated / 1000.0, p.teardown / 1000.0);
+			fflush(stdout);
+		}
+	}
+
+out:
+	usbg_cleanup(s);
+	return ret;
+}
@@ -0,0 +1,593 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/**
+ * @file soak.c
+ * @brief Long running stress test of gadget life cycle.
+ * @details Gadgets with random mix of functions, including UVC with frame
+ * trees and multi-LUN mass storage, are created, bound, switched between
+ * UDCs, exported and torn down on in-memory configfs. Latency percentiles
+ * of each operation, RSS, number of open fds and number of live heap
+ * allocations are printed as one JSON object per window of operations.
+ * After all gadgets are gone, resources are compared with those before
+ * the first one was created and exit status tells whether anything leaked.
+ */
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <usbg/usbg.h>
+#include <usbg/function/ms.h>
+#include <usbg/function/uvc.h>
+
+#define SOAK_DEFAULT_GADGETS 10000
+#define SOAK_DEFAULT_UDCS 4
+#define SOAK_DEFAULT_WINDOW 5000
+#define SOAK_MAX_SLOTS 64
+#define SOAK_MAX_FUNCS 4
+#define SOAK_MAX_LUNS 4
+#define SOAK_MAX_FORMATS 2
+#define SOAK_MAX_FRAMES 4
+
+#ifdef __GLIBC__
+/* Count heap operations of the library by interposing the allocator */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static long soak_allocs;
+static long soak_frees;
+
+void *malloc(size_t size)
+{
+	void *p = __libc_malloc(size);
+
+	if (p)
+		__atomic_add_fetch(&soak_allocs, 1, __ATOMIC_RELAXED);
+	return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *p = __libc_calloc(nmemb, size);
+
+	if (p)
+		__atomic_add_fetch(&soak_allocs, 1, __ATOMIC_RELAXED);
+	return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	void *p = __libc_realloc(ptr, size);
+
+	if (!ptr && p)
+		__atomic_add_fetch(&soak_allocs, 1, __ATOMIC_RELAXED);
+	else if (ptr && !size)
+		__atomic_add_fetch(&soak_frees, 1, __ATOMIC_RELAXED);
+	return p;
+}
+
+void free(void *ptr)
+{
+	if (ptr)
+		__atomic_add_fetch(&soak_frees, 1, __ATOMIC_RELAXED);
+	__libc_free(ptr);
+}
+
+static long soak_live_allocs(void)
+{
+	return __atomic_load_n(&soak_allocs, __ATOMIC_RELAXED) -
+		__atomic_load_n(&soak_frees, __ATOMIC_RELAXED);
+}
+#else
+static long soak_live_allocs(void)
+{
+	return -1;
+}
+#endif
+
+enum soak_op {
+	SOAK_OP_CREATE,
+	SOAK_OP_BIND,
+	SOAK_OP_UNBIND,
+	SOAK_OP_SWITCH,
+	SOAK_OP_EXPORT,
+	SOAK_OP_TEARDOWN,
+	SOAK_OP_MAX
+};
+
+static const char *soak_op_names[] = {
+	[SOAK_OP_CREATE] = "create",
+	[SOAK_OP_BIND] = "bind",
+	[SOAK_OP_UNBIND] = "unbind",
+	[SOAK_OP_SWITCH] = "switch",
+	[SOAK_OP_EXPORT] = "export",
+	[SOAK_OP_TEARDOWN] = "teardown",
+};
+
+struct soak_samples
+{
+	uint64_t *ns;
+	int n;
+	int size;
+};
+
+struct soak_usage
+{
+	long rss_kb;
+	int fds;
+	long allocs;
+};
+
+struct soak
+{
+	usbg_state *s;
+	usbg_gadget *slots[SOAK_MAX_SLOTS];
+	int nslots;
+	unsigned int seed;
+	int created;
+	int removed;
+	int ops;
+	bool can_export;
+	FILE *null;
+	struct soak_samples samples[SOAK_OP_MAX];
+};
+
+static uint64_t soak_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void soak_usage(struct soak_usage *u)
+{
+	struct dirent *d;
+	long pages = 0;
+	FILE *statm;
+	DIR *dir;
+
+	statm = fopen("/proc/self/statm", "r");
+	if (statm) {
+		if (fscanf(statm, "%*d %ld", &pages) != 1)
+			pages = 0;
+		fclose(statm);
+	}
+	u->rss_kb = pages * (sysconf(_SC_PAGESIZE) / 1024);
+
+	u->fds = 0;
+	dir = opendir("/proc/self/fd");
+	if (dir) {
+		while ((d = readdir(dir)))
+			if (d->d_name[0] != '.')
+				u->fds++;
+		/* Don't count fd of the directory itself */
+		u->fds--;
+		closedir(dir);
+	}
+
+	u->allocs = soak_live_allocs();
+}
+
+/* Buffers hold a whole window, so recording doesn't allocate */
+static void soak_record(struct soak *sk, enum soak_op op, uint64_t ns)
+{
+	struct soak_samples *sm = &sk->samples[op];
+
+	if (sm->n < sm->size)
+		sm->ns[sm->n++] = ns;
+}
+
+static int soak_rand(struct soak *sk, int n)
+{
+	return rand_r(&sk->seed) % n;
+}
+
+static int soak_add_ms(struct soak *sk, usbg_gadget *g, const char *instance,
+		       usbg_function **f)
+{
+	struct usbg_f_ms_lun_attrs luns[SOAK_MAX_LUNS];
+	struct usbg_f_ms_lun_attrs *plun[SOAK_MAX_LUNS + 1];
+	struct usbg_f_ms_attrs attrs = {
+		.luns = plun,
+	};
+	int i;
+
+	attrs.nluns = 1 + soak_rand(sk, SOAK_MAX_LUNS);
+	for (i = 0; i < attrs.nluns; ++i) {
+		luns[i] = (struct usbg_f_ms_lun_attrs) {
+			.id = i,
+			.cdrom = i == 0 && soak_rand(sk, 2),
+			.removable = true,
+			.file = "",
+			.inquiry_string = "Soak",
+		};
+		plun[i] = &luns[i];
+	}
+	plun[i] = NULL;
+
+	return usbg_create_function(g, USBG_F_MASS_STORAGE, instance, &attrs,
+				    f);
+}
+
+static int soak_add_uvc(struct soak *sk, usbg_gadget *g, const char *instance,
+			usbg_function **f)
+{
+	static const char * const formats[] = {
+		"mjpeg/m", "uncompressed/u",
+	};
+	struct usbg_f_uvc_frame_attrs frames[SOAK_MAX_FORMATS][SOAK_MAX_FRAMES];
+	struct usbg_f_uvc_frame_attrs *pframes[SOAK_MAX_FORMATS]
+		[SOAK_MAX_FRAMES + 1];
+	struct usbg_f_uvc_format_attrs fmts[SOAK_MAX_FORMATS];
+	struct usbg_f_uvc_format_attrs *pfmts[SOAK_MAX_FORMATS + 1];
+	struct usbg_f_uvc_attrs attrs = {
+		.formats = pfmts,
+	};
+	int nformats, nframes;
+	int i, j;
+
+	nformats = 1 + soak_rand(sk, SOAK_MAX_FORMATS);
+	for (i = 0; i < nformats; ++i) {
+		nframes = 1 + soak_rand(sk, SOAK_MAX_FRAMES);
+		for (j = 0; j < nframes; ++j) {
+			frames[i][j] = (struct usbg_f_uvc_frame_attrs) {
+				.bFrameIndex = j + 1,
+				.dwFrameInterval = 333333,
+				.wWidth = 640 << (j % 3),
+				.wHeight = 480 << (j % 3),
+			};
+			pframes[i][j] = &frames[i][j];
+		}
+		pframes[i][j] = NULL;
+
+		fmts[i] = (struct usbg_f_uvc_format_attrs) {
+			.frames = pframes[i],
+			.format = formats[i],
+			.bDefaultFrameIndex = 1,
+		};
+		pfmts[i] = &fmts[i];
+	}
+	pfmts[i] = NULL;
+
+	return usbg_create_function(g, USBG_F_UVC, instance, &attrs, f);
+}
+
+static int soak_create(struct soak *sk, usbg_gadget **g)
+{
+	static const usbg_function_type simple[] = {
+		USBG_F_ACM, USBG_F_ECM, USBG_F_NCM, USBG_F_MIDI,
+	};
+	char name[32], instance[8], bname[8];
+	usbg_function *f;
+	usbg_config *c;
+	int nfuncs, i;
+	int ret;
+
+	snprintf(name, sizeof(name), "soak%d", sk->created);
+
+	ret = usbg_create_gadget(sk->s, name, NULL, NULL, g);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	ret = usbg_create_config(*g, 1, "c", NULL, NULL, &c);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	nfuncs = 1 + soak_rand(sk, SOAK_MAX_FUNCS);
+	for (i = 0; i < nfuncs; ++i) {
+		snprintf(instance, sizeof(instance), "%d", i);
+		snprintf(bname, sizeof(bname), "f%d", i);
+
+		switch (soak_rand(sk, 6)) {
+		case 0:
+			ret = soak_add_ms(sk, *g, instance, &f);
+			break;
+		case 1:
+			ret = soak_add_uvc(sk, *g, instance, &f);
+			break;
+		default:
+			ret = usbg_create_function(*g, simple[soak_rand(sk, 4)],
+						   instance, NULL, &f);
+			break;
+		}
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		ret = usbg_add_config_function(c, bname, f);
+		if (ret != USBG_SUCCESS)
+			return ret;
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int soak_teardown(usbg_gadget *g)
+{
+	int ret;
+
+	if (usbg_get_gadget_udc(g)) {
+		ret = usbg_disable_gadget(g);
+		if (ret != USBG_SUCCESS)
+			return ret;
+	}
+
+	return usbg_rm_gadget(g, USBG_RM_RECURSE);
+}
+
+/* Single operation on random slot, returns operation done or -1 if none */
+static int soak_step(struct soak *sk, int total, int *err)
+{
+	usbg_gadget **g;
+	enum soak_op op;
+	usbg_udc *u;
+	uint64_t t;
+	int ret = USBG_SUCCESS;
+
+	g = &sk->slots[soak_rand(sk, sk->nslots)];
+
+	if (!*g) {
+		if (sk->created == total)
+			return -1;
+		op = SOAK_OP_CREATE;
+	} else {
+		switch (soak_rand(sk, 8)) {
+		case 0:
+		case 1:
+		case 2:
+			op = usbg_get_gadget_udc(*g) ?
+				SOAK_OP_UNBIND : SOAK_OP_BIND;
+			break;
+		case 3:
+		case 4:
+			op = SOAK_OP_SWITCH;
+			break;
+		case 5:
+		case 6:
+			op = SOAK_OP_EXPORT;
+			break;
+		default:
+			op = SOAK_OP_TEARDOWN;
+			break;
+		}
+	}
+
+	t = soak_now();
+	switch (op) {
+	case SOAK_OP_CREATE:
+		ret = soak_create(sk, g);
+		sk->created++;
+		break;
+	case SOAK_OP_BIND:
+		ret = usbg_enable_gadget_policy(*g, USBG_UDC_POLICY_FIRST_FREE,
+						NULL, NULL);
+		/* All UDCs taken is an expected outcome */
+		if (ret == USBG_ERROR_BUSY)
+			return -1;
+		break;
+	case SOAK_OP_UNBIND:
+		ret = usbg_disable_gadget(*g);
+		break;
+	case SOAK_OP_SWITCH:
+		u = usbg_find_free_udc(sk->s, USBG_UDC_POLICY_FIRST_FREE, NULL);
+		if (!u || !usbg_get_gadget_udc(*g))
+			return -1;
+		ret = usbg_disable_gadget(*g);
+		if (ret == USBG_SUCCESS)
+			ret = usbg_enable_gadget(*g, u);
+		break;
+	case SOAK_OP_EXPORT:
+		if (!sk->can_export)
+			return -1;
+		rewind(sk->null);
+		ret = usbg_export_gadget(*g, sk->null);
+		if (ret == USBG_ERROR_NOT_SUPPORTED) {
+			sk->can_export = false;
+			return -1;
+		}
+		break;
+	case SOAK_OP_TEARDOWN:
+		ret = soak_teardown(*g);
+		*g = NULL;
+		sk->removed++;
+		break;
+	default:
+		return -1;
+	}
+	t = soak_now() - t;
+
+	if (ret != USBG_SUCCESS) {
+		fprintf(stderr, "%s failed: %s\n", soak_op_names[op],
+			usbg_strerror(ret));
+		*err = ret;
+		return -1;
+	}
+
+	soak_record(sk, op, t);
+	sk->ops++;
+
+	return op;
+}
+
+static int soak_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double soak_percentile(struct soak_samples *sm, int p)
+{
+	return sm->ns[(sm->n - 1) * p / 100] / 1000.0;
+}
+
+static void soak_report(struct soak *sk, int window)
+{
+	struct soak_samples *sm;
+	struct soak_usage u;
+	const char *sep = "";
+	int i;
+
+	soak_usage(&u);
+
+	printf("{\"window\": %d, \"created\": %d, \"removed\": %d, "
+	       "\"rss_kb\": %ld, \"fds\": %d, \"live_allocs\": %ld, \"ops\": {",
+	       window, sk->created, sk->removed, u.rss_kb, u.fds, u.allocs);
+
+	for (i = 0; i < SOAK_OP_MAX; ++i) {
+		sm = &sk->samples[i];
+		if (!sm->n)
+			continue;
+
+		qsort(sm->ns, sm->n, sizeof(*sm->ns), soak_cmp);
+		printf("%s\"%s\": {\"n\": %d, \"p50_us\": %.1f, "
+		       "\"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}",
+		       sep, soak_op_names[i], sm->n, soak_percentile(sm, 50),
+		       soak_percentile(sm, 90), soak_percentile(sm, 99),
+		       soak_percentile(sm, 100));
+		sep = ", ";
+		sm->n = 0;
+	}
+	printf("}}\n");
+	fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-n GADGETS] [-u UDCS] [-w WINDOW] [-r SEED]\n"
+		"  -n  number of gadgets to go through, default %d\n"
+		"  -u  number of emulated UDCs, default %d\n"
+		"  -w  operations per report, default %d\n"
+		"  -r  random seed, default 1\n",
+		name, SOAK_DEFAULT_GADGETS, SOAK_DEFAULT_UDCS,
+		SOAK_DEFAULT_WINDOW);
+}
+
+int main(int argc, char **argv)
+{
+	static char null_buf[BUFSIZ];
+	struct soak sk = {
+		.seed = 1,
+		.can_export = true,
+	};
+	struct soak_usage before, after;
+	int total = SOAK_DEFAULT_GADGETS;
+	int nudcs = SOAK_DEFAULT_UDCS;
+	int window = SOAK_DEFAULT_WINDOW;
+	int opt, i, nwindow = 0;
+	int err = USBG_SUCCESS;
+	int ret = 1;
+
+	while ((opt = getopt(argc, argv, "n:u:w:r:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			total = atoi(optarg);
+			break;
+		case 'u':
+			nudcs = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'r':
+			sk.seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (total <= 0 || nudcs <= 0 || window <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Twice as many live gadgets as UDCs, so that some stay unbound */
+	sk.nslots = 2 * nudcs < SOAK_MAX_SLOTS ? 2 * nudcs : SOAK_MAX_SLOTS;
+
+	/* Stdio buffers are allocated lazily, keep them out of the counts */
+	sk.null = fopen("/dev/null", "w");
+	if (!sk.null) {
+		perror("/dev/null");
+		return 1;
+	}
+	setvbuf(sk.null, null_buf, _IOFBF, sizeof(null_buf));
+
+	printf("{\"start\": true, \"gadgets\": %d, \"udcs\": %d, "
+	       "\"seed\": %u}\n", total, nudcs, sk.seed);
+
+	for (i = 0; i < SOAK_OP_MAX; ++i) {
+		sk.samples[i].ns = calloc(window, sizeof(*sk.samples[i].ns));
+		if (!sk.samples[i].ns) {
+			err = USBG_ERROR_NO_MEM;
+			goto out;
+		}
+		sk.samples[i].size = window;
+	}
+
+	err = usbg_init_memfs(nudcs, &sk.s);
+	if (err != USBG_SUCCESS)
+		goto out;
+
+	soak_usage(&before);
+
+	while (sk.removed < total && err == USBG_SUCCESS) {
+		if (soak_step(&sk, total, &err) < 0 || sk.ops % window)
+			continue;
+
+		soak_report(&sk, nwindow++);
+		/* As long-lived daemon does once changes have been consumed */
+		usbg_drop_tombstones(sk.s, usbg_get_generation(sk.s));
+	}
+
+	for (i = 0; i < sk.nslots && err == USBG_SUCCESS; ++i)
+		if (sk.slots[i])
+			err = soak_teardown(sk.slots[i]);
+	if (err != USBG_SUCCESS)
+		goto cleanup;
+
+	soak_report(&sk, nwindow);
+
+	/* Nothing should be left over once every gadget is gone */
+	usbg_drop_tombstones(sk.s, usbg_get_generation(sk.s));
+	soak_usage(&after);
+
+	printf("{\"summary\": true, \"gadgets\": %d, \"ops\": %d, "
+	       "\"rss_growth_kb\": %ld, \"fd_growth\": %d, "
+	       "\"live_alloc_growth\": %ld}\n",
+	       sk.created, sk.ops, after.rss_kb - before.rss_kb,
+	       after.fds - before.fds, after.allocs - before.allocs);
+
+	ret = after.fds != before.fds || after.allocs > before.allocs ? 2 : 0;
+
+cleanup:
+	usbg_cleanup(sk.s);
+out:
+	if (err != USBG_SUCCESS) {
+		fprintf(stderr, "Error: %s\n", usbg_strerror(err));
+		ret = 1;
+	}
+	for (i = 0; i < SOAK_OP_MAX; ++i)
+		free(sk.samples[i].ns);
+	fclose(sk.null);
+
+	return ret;
+}
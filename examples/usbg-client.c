@@ -0,0 +1,99 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/**
+ * @file usbg-client.c
+ * @example usbg-client.c
+ * This is an example of how to manage gadgets through usbg-daemon
+ * without parsing whole configfs in each tool.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <usbg/usbg.h>
+
+static int print_gadget(const struct usbg_client_gadget *g, void *data)
+{
+	fprintf(stdout, "%s <-> %s\n", g->name, g->udc);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s list\n"
+		"       %s get <gadget>\n"
+		"       %s create <gadget> <vid> <pid>\n"
+		"       %s enable <gadget> [udc]\n"
+		"       %s disable <gadget>\n"
+		"       %s switch <gadget> <udc>\n",
+		name, name, name, name, name, name);
+}
+
+int main(int argc, char **argv)
+{
+	int usbg_ret;
+	int ret = -EINVAL;
+	usbg_client *c;
+	struct usbg_client_gadget g;
+	const char *cmd;
+
+	if (argc < 2 || (strcmp(argv[1], "list") && argc < 3)) {
+		usage(argv[0]);
+		goto out;
+	}
+	cmd = argv[1];
+
+	usbg_ret = usbg_client_connect(getenv("USBG_SOCKET"), &c);
+	if (usbg_ret != USBG_SUCCESS) {
+		fprintf(stderr, "Error on connecting to daemon\n");
+		fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+				usbg_strerror(usbg_ret));
+		goto out;
+	}
+
+	if (!strcmp(cmd, "list")) {
+		usbg_ret = usbg_client_list_gadgets(c, print_gadget, NULL);
+	} else if (!strcmp(cmd, "get")) {
+		usbg_ret = usbg_client_get_gadget(c, argv[2], &g);
+		if (usbg_ret == USBG_SUCCESS)
+			fprintf(stdout, "%s %04x:%04x <-> %s\n", g.name,
+				g.idVendor, g.idProduct, g.udc);
+	} else if (!strcmp(cmd, "create") && argc == 5) {
+		usbg_ret = usbg_client_create_gadget(c, argv[2],
+						     strtoul(argv[3], NULL, 16),
+						     strtoul(argv[4], NULL, 16));
+	} else if (!strcmp(cmd, "enable")) {
+		usbg_ret = usbg_client_enable_gadget(c, argv[2],
+						     argc > 3 ? argv[3] : NULL);
+	} else if (!strcmp(cmd, "disable")) {
+		usbg_ret = usbg_client_disable_gadget(c, argv[2]);
+	} else if (!strcmp(cmd, "switch") && argc == 4) {
+		usbg_ret = usbg_client_switch_gadget(c, argv[2], argv[3]);
+	} else {
+		usage(argv[0]);
+		goto out_close;
+	}
+
+	if (usbg_ret != USBG_SUCCESS) {
+		fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+				usbg_strerror(usbg_ret));
+		goto out_close;
+	}
+
+	ret = 0;
+out_close:
+	usbg_client_close(c);
+out:
+	return ret;
+}
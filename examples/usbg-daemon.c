@@ -0,0 +1,75 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/**
+ * @file usbg-daemon.c
+ * @example usbg-daemon.c
+ * This is an example of how to keep single state for many short-lived
+ * tools. See usbg-client.c for the other side.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <usbg/usbg.h>
+
+static volatile sig_atomic_t done;
+
+static void stop(int sig)
+{
+	done = 1;
+}
+
+int main(int argc, char **argv)
+{
+	int usbg_ret;
+	int ret = -EINVAL;
+	usbg_state *s;
+	usbg_daemon *d;
+	struct sigaction sa = { .sa_handler = stop };
+
+	usbg_ret = usbg_init("/sys/kernel/config", &s);
+	if (usbg_ret != USBG_SUCCESS) {
+		fprintf(stderr, "Error on USB state init\n");
+		fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+				usbg_strerror(usbg_ret));
+		goto out;
+	}
+
+	usbg_ret = usbg_daemon_create(s, argc > 1 ? argv[1] : NULL, &d);
+	if (usbg_ret != USBG_SUCCESS) {
+		fprintf(stderr, "Error on daemon creation\n");
+		fprintf(stderr, "Error: %s : %s\n", usbg_error_name(usbg_ret),
+				usbg_strerror(usbg_ret));
+		goto out_cleanup;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!done) {
+		usbg_ret = usbg_daemon_dispatch(d, -1);
+		if (usbg_ret < 0) {
+			fprintf(stderr, "Error: %s : %s\n",
+				usbg_error_name(usbg_ret),
+				usbg_strerror(usbg_ret));
+			break;
+		}
+	}
+
+	ret = 0;
+	usbg_daemon_destroy(d);
+out_cleanup:
+	usbg_cleanup(s);
+out:
+	return ret;
+}
@@ -154,6 +154,17 @@ static inline void usbg_f_uvc_cleanup_attrs(struct usbg_f_uvc_attrs *attrs)
 int usbg_f_uvc_get_attrs(usbg_f_uvc *uvcf, struct usbg_f_uvc_attrs *attrs);
 int usbg_f_uvc_set_attrs(usbg_f_uvc *uvcf, const struct usbg_f_uvc_attrs *attrs);
 
+/**
+ * @brief Get the value of single streaming config attribute
+ * @param[in] uvcf Pointer to uvc function
+ * @param[in] iattr Code of attribute which value should be taken
+ * @param[out] val Current value of this attribute
+ * @return 0 on success usbg_error if error occurred.
+ */
+int usbg_f_uvc_get_config_attr_val(usbg_f_uvc *uvcf,
+				   enum usbg_f_uvc_config_attr iattr,
+				   union usbg_f_uvc_config_attr_val *val);
+
 
 #ifdef __cplusplus
 }
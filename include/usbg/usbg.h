@@ -28,6 +28,8 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <stdio.h> /* For FILE * */
+#include <sys/types.h> /* For gid_t */
+#include <time.h> /* For struct timespec */
 #include <malloc.h>
 
 #include "usbg_version.h"
@@ -70,6 +72,35 @@ extern "C" {
  */
 #define USBG_RM_RECURSE 1
 
+/**
+ * @brief Additional option for usbg_rm_gadget().
+ * @details Gadget is removed recursively. Independent entries (all
+ * links, then all directories of the same depth) are removed
+ * concurrently.
+ */
+#define USBG_RM_PARALLEL 2
+
+/**
+ * @brief Additional option for usbg_rm_gadget().
+ * @details Gadget is removed recursively and removal continues after
+ * an entry which couldn't be removed. The first error is returned.
+ */
+#define USBG_RM_BEST_EFFORT 4
+
+/**
+ * @brief Additional option for usbg_compile_program().
+ * @details Compiled program binds created gadget to the same UDC
+ * as the source gadget.
+ */
+#define USBG_PROGRAM_BIND 0x01
+
+/**
+ * @brief Additional option for usbg_restore_image().
+ * @details Restored gadgets are bound to UDCs they were bound to
+ * when image was saved.
+ */
+#define USBG_IMAGE_BIND 0x01
+
 /*
  * Internal structures
  */
@@ -79,6 +110,7 @@ struct usbg_config;
 struct usbg_function;
 struct usbg_binding;
 struct usbg_udc;
+struct usbg_supervisor;
 
 /**
  * @brief State of the gadget devices in the system
@@ -110,6 +142,46 @@ typedef struct usbg_binding usbg_binding;
  */
 typedef struct usbg_udc usbg_udc;
 
+/**
+ * @brief Watcher which rebinds gadgets detached by kernel
+ */
+typedef struct usbg_supervisor usbg_supervisor;
+
+/**
+ * @brief Server which shares single state with many processes
+ */
+typedef struct usbg_daemon usbg_daemon;
+
+/**
+ * @brief Connection to usbg daemon
+ */
+typedef struct usbg_client usbg_client;
+
+/**
+ * @brief Writer side of gadget tree published in shared memory
+ */
+typedef struct usbg_publisher usbg_publisher;
+
+/**
+ * @brief Read only mapping of published gadget tree
+ */
+typedef struct usbg_snapshot usbg_snapshot;
+
+/**
+ * @brief Gadget scheme parsed once and instantiated many times
+ */
+typedef struct usbg_template usbg_template;
+
+/**
+ * @brief Gadget compiled to list of configfs operations
+ */
+typedef struct usbg_program usbg_program;
+
+/**
+ * @brief Mapped binary image of gadgets
+ */
+typedef struct usbg_image usbg_image;
+
 /**
  * @typedef usbg_gadget_attr
  * @brief Gadget attributes which can be set using
@@ -183,6 +255,41 @@ typedef enum {
 	USBG_GADGET_OS_DESC_MAX,
 } usbg_gadget_os_desc_strs;
 
+/**
+ * @typedef usbg_speed
+ * @brief USB bus speeds, in the order of increasing bandwidth
+ */
+typedef enum {
+	USBG_SPEED_UNKNOWN = 0,
+	USBG_SPEED_LOW,
+	USBG_SPEED_FULL,
+	USBG_SPEED_HIGH,
+	USBG_SPEED_WIRELESS,
+	USBG_SPEED_SUPER,
+	USBG_SPEED_SUPER_PLUS,
+} usbg_speed;
+
+/**
+ * @typedef usbg_function_availability
+ * @brief Whether function type is provided by running kernel
+ */
+typedef enum {
+	USBG_FUNC_AVAIL_UNKNOWN = 0, /**< not probed or database incomplete */
+	USBG_FUNC_AVAIL_MISSING, /**< not built and no module */
+	USBG_FUNC_AVAIL_LOADABLE, /**< module present but not loaded */
+	USBG_FUNC_AVAIL_LOADED, /**< builtin or module loaded */
+} usbg_function_availability;
+
+/**
+ * @typedef usbg_udc_policy
+ * @brief Policies of choosing UDC for a gadget
+ */
+typedef enum {
+	USBG_UDC_POLICY_FIRST_FREE = 0, /**< first free UDC in name order */
+	USBG_UDC_POLICY_FASTEST, /**< free UDC with the highest maximum speed */
+	USBG_UDC_POLICY_PINNED, /**< UDC with given name, if free */
+} usbg_udc_policy;
+
 /**
  * @brief USB configuration attributes
  */
@@ -287,6 +394,20 @@ extern const char *usbg_strerror(usbg_error e);
  */
 extern int usbg_init(const char *configfs_path, usbg_state **state);
 
+/**
+ * @brief Initialize the libusbgx library state on emulated configfs
+ * @details Configfs and UDCs are kept in memory and mimic kernel
+ * behaviour: attributes are created together with their directory,
+ * default groups cannot be removed and links are checked. Nothing
+ * touches the real filesystem and no privileges are needed, which
+ * makes it suitable for tests and benchmarks. Emulated filesystem
+ * is destroyed by usbg_cleanup().
+ * @param nudcs Number of emulated UDCs, named dummy_udc.0, dummy_udc.1...
+ * @param state Pointer to be filled with pointer to usbg_state
+ * @return 0 on success, usbg_error on error
+ */
+extern int usbg_init_memfs(int nudcs, usbg_state **state);
+
 /**
  * @brief Clean up the libusbgx library state
  * @param s Pointer to state
@@ -437,6 +558,20 @@ extern int usbg_create_gadget(usbg_state *s, const char *name,
 			      const struct usbg_gadget_strs *g_strs,
 			      usbg_gadget **g);
 
+/**
+ * @brief Create a new USB gadget device which is a copy of existing one
+ * @details Attributes, strings in all languages, OS descriptors,
+ * functions with all their attributes and configs with their bindings
+ * are copied. New gadget is not bound to any UDC.
+ * @param src Gadget to be copied
+ * @param name Name of the new gadget
+ * @param dst Pointer to be filled with pointer to new gadget
+ * @return 0 on success usbg_error if error occurred. On error nothing
+ *  is left in configfs.
+ */
+extern int usbg_clone_gadget(usbg_gadget *src, const char *name,
+			     usbg_gadget **dst);
+
 /**
  * @brief Get string representing selected gadget attribute
  * @param attr code of selected attribute
@@ -738,6 +873,74 @@ extern int usbg_set_gadget_os_descs(usbg_gadget *g,
 extern int usbg_create_function(usbg_gadget *g, usbg_function_type type,
 		 const char *instance, void *f_attrs, usbg_function **f);
 
+/**
+ * @struct usbg_function_spec
+ * @brief Function to be created by usbg_create_functions()
+ */
+struct usbg_function_spec
+{
+	usbg_function_type type;
+	const char *instance;
+	void *f_attrs;
+	/** Filled with created function, NULL if it has not been created */
+	usbg_function *f;
+};
+
+/**
+ * @brief Create functions concurrently on a pool of threads
+ */
+#define USBG_CREATE_PARALLEL	0x01
+
+/**
+ * @brief Create many functions of one gadget at once
+ * @details Functions don't depend on each other until they are added
+ *  to configs, so with USBG_CREATE_PARALLEL they are set up by a pool
+ *  of threads. All workers create their directories in the same
+ *  functions/ directory of the gadget and kernel serializes these
+ *  mkdirs, including loading of function modules, so only writes of
+ *  attributes (like mass storage LUNs or UVC frames) done afterwards
+ *  really run in parallel. Result doesn't depend on order in which
+ *  threads finish.
+ * @param g Pointer to gadget
+ * @param specs Array of functions to be created
+ * @param n Number of elements in specs
+ * @param flags USBG_CREATE_PARALLEL or 0
+ * @return 0 on success, usbg_error of the first failed spec otherwise.
+ *  On error none of given functions is left in gadget.
+ */
+extern int usbg_create_functions(usbg_gadget *g,
+				 struct usbg_function_spec *specs, int n,
+				 int flags);
+
+/**
+ * @brief Called for each entry which couldn't be removed
+ * @param path Absolute path of entry
+ * @param err usbg_error describing the failure
+ * @param data User data given to usbg_teardown_gadget()
+ */
+typedef void (*usbg_rm_error_func)(const char *path, int err, void *data);
+
+/**
+ * @brief Remove gadget with everything inside of it
+ * @details Gadget directory is scanned once and all links are removed
+ *  first, followed by directories from the deepest ones. This covers
+ *  also entries created behind library's back. Gadget is disabled
+ *  before anything is removed.
+ * @param g Pointer to gadget, invalid after successful removal
+ * @param opts USBG_RM_PARALLEL and/or USBG_RM_BEST_EFFORT
+ * @param cb Called for each failure, may be NULL
+ * @param data Passed to cb
+ * @return 0 on success, the first usbg_error otherwise. On error
+ *  gadget is parsed again if anything has been removed, so it reflects
+ *  what has been left.
+ * @warning Handles of configs, functions and bindings of this gadget
+ *  must not be used after this call, even if it failed, as they are
+ *  freed when gadget is parsed again. Get them again from gadget if
+ *  it still exists.
+ */
+extern int usbg_teardown_gadget(usbg_gadget *g, int opts,
+				usbg_rm_error_func cb, void *data);
+
 /**
  * @brief Get function instance name
  * @param f Pointer to function
@@ -1049,6 +1252,119 @@ extern int usbg_enable_gadget(usbg_gadget *g, usbg_udc *udc);
  */
 extern int usbg_disable_gadget(usbg_gadget *g);
 
+/**
+ * @brief Bind a USB gadget to UDC but keep it disconnected from the host
+ * @details Gadget is bound as with usbg_enable_gadget() and then the UDC
+ *  pull-up is switched off using its soft_connect attribute, so the host
+ *  does not start enumeration until usbg_udc_connect() is called.
+ *  This gives userspace (e.g. FFS daemons) time to finish preparation.
+ * @param g Pointer to gadget
+ * @param udc where gadget should be assigned.
+ *  If NULL, default one (first) is used.
+ * @return 0 on success or usbg_error if error occurred.
+ * @note Kernel connects the gadget while binding, so the pull-up may be
+ *  visible to the host for the time of a single sysfs write.
+ */
+extern int usbg_enable_gadget_staged(usbg_gadget *g, usbg_udc *udc);
+
+/**
+ * @brief Connect UDC to the host (switch on the pull-up)
+ * @param u Pointer to udc
+ * @return 0 on success or usbg_error if error occurred.
+ * @note Time of connection is recorded and may be obtained
+ *  using usbg_get_udc_connect_time()
+ */
+extern int usbg_udc_connect(usbg_udc *u);
+
+/**
+ * @brief Disconnect UDC from the host (switch off the pull-up)
+ * @param u Pointer to udc
+ * @return 0 on success or usbg_error if error occurred.
+ */
+extern int usbg_udc_disconnect(usbg_udc *u);
+
+/**
+ * @brief Get time of the last successful usbg_udc_connect()
+ * @param[in] u Pointer to udc
+ * @param[out] ts CLOCK_MONOTONIC time taken just before the UDC was connected
+ * @return 0 on success, USBG_ERROR_NOT_FOUND if UDC has not been
+ *  connected using usbg_udc_connect() or other usbg_error on failure.
+ */
+extern int usbg_get_udc_connect_time(usbg_udc *u, struct timespec *ts);
+
+/**
+ * @brief Check if gadget is complete enough to be enabled
+ * @details Checks, using only what state already knows, that gadget
+ *  has configurations, each configuration has functions, all bindings
+ *  and OS descriptors config refer to this gadget and that there
+ *  is an UDC available. Configurations with UAC2, UVC or HID functions
+ *  are also checked against periodic bandwidth of gadget UDC, or of
+ *  the fastest UDC if gadget is not enabled. Interfaces and endpoints
+ *  of each configuration are checked against USB limit and endpoint
+ *  inventory of UDC, if known. These two checks read attributes of
+ *  UAC2, UVC and HID functions from configfs, maximum speed of UDC
+ *  from sysfs and its endpoints from debugfs. Speed and endpoints
+ *  are read once per UDC.
+ * @param[in] g Pointer to gadget
+ * @param[out] buf Place for description of first problem found, may be NULL
+ * @param[in] len Size of buffer
+ * @return 0 if gadget is valid, usbg_error describing the problem otherwise
+ */
+extern int usbg_validate_gadget(usbg_gadget *g, char *buf, int len);
+
+/**
+ * @brief Check function availability also using trial mkdir
+ *  in a scratch gadget
+ */
+#define USBG_PROBE_MKDIR	0x01
+
+/**
+ * @brief Do all trial mkdirs concurrently, each in a scratch gadget
+ *  of its own, so kernel loads needed modules in parallel
+ */
+#define USBG_PROBE_PARALLEL	0x02
+
+/**
+ * @brief Load all available function modules at once
+ */
+#define USBG_PROBE_PRELOAD	(USBG_PROBE_MKDIR | USBG_PROBE_PARALLEL)
+
+/**
+ * @brief Probe all function types supported by library and cache
+ *  the results in state
+ * @details Builtin and loadable modules are found in module database
+ *  of running kernel and loaded ones in /sys/module. When probe is
+ *  done, usbg_create_function() fails at once for missing functions
+ *  instead of waiting for module autoloading.
+ * @param s Pointer to state
+ * @param flags Bitwise or of USBG_PROBE_* flags
+ * @return 0 on success, usbg_error if trial mkdir could not be done
+ */
+extern int usbg_probe_function_types(usbg_state *s, int flags);
+
+/**
+ * @brief Get cached availability of function type
+ * @param s Pointer to state
+ * @param type Function type
+ * @return Availability of function type
+ */
+extern usbg_function_availability usbg_get_function_type_availability(
+	usbg_state *s, usbg_function_type type);
+
+/**
+ * @brief Check if function type is provided by running kernel
+ * @details Function is available if it is built into the kernel or
+ *  its module is listed in modules.alias of running kernel.
+ *  Result of usbg_probe_function_types() is used, probe without
+ *  flags is done on first call if needed.
+ * @param s Pointer to state
+ * @param type Function type
+ * @return 0 if available, USBG_ERROR_NOT_SUPPORTED if not,
+ *  other usbg_error if it cannot be determined
+ */
+extern int usbg_function_type_available(usbg_state *s,
+					usbg_function_type type);
+
 /**
  * @brief Get name of udc
  * @param u Pointer to udc
@@ -1084,6 +1400,135 @@ extern usbg_udc *usbg_get_gadget_udc(usbg_gadget *g);
  */
 extern usbg_gadget *usbg_get_udc_gadget(usbg_udc *u);
 
+/**
+ * @brief Get maximum speed supported by UDC
+ * @param u Pointer to udc
+ * @return Maximum speed or USBG_SPEED_UNKNOWN if it cannot be determined
+ * @note Value is read from sysfs only once and cached afterwards
+ */
+extern usbg_speed usbg_get_udc_max_speed(usbg_udc *u);
+
+/**
+ * @brief Get number of non control endpoints provided by UDC
+ * @details Inventory is read from debugfs entries of UDC driver
+ *  (available for example for dwc2 and dwc3) once and cached.
+ * @param u Pointer to udc
+ * @return Number of endpoints, USBG_ERROR_NOT_SUPPORTED if it
+ *  cannot be determined or other usbg_error
+ */
+extern int usbg_get_udc_endpoints(usbg_udc *u);
+
+/**
+ * @brief Set number of non control endpoints provided by UDC
+ * @details Useful when UDC driver has no debugfs entries
+ *  or debugfs is not mounted.
+ * @param u Pointer to udc
+ * @param endpoints Number of endpoints
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_set_udc_endpoints(usbg_udc *u, int endpoints);
+
+/**
+ * @brief Find UDC which has no gadget bound
+ * @details Only bindings known to the library are taken into account,
+ *  no sysfs or configfs reads are done except reading maximum speed
+ *  of each UDC once for USBG_UDC_POLICY_FASTEST.
+ * @param s Pointer to state
+ * @param policy How the UDC should be chosen
+ * @param pinned Name of UDC for USBG_UDC_POLICY_PINNED, ignored otherwise
+ * @return Pointer to free UDC or NULL if there is no such UDC
+ */
+extern usbg_udc *usbg_find_free_udc(usbg_state *s, usbg_udc_policy policy,
+				    const char *pinned);
+
+/**
+ * @brief Enable gadget on UDC chosen according to given policy
+ * @param[in] g Pointer to gadget
+ * @param[in] policy How the UDC should be chosen
+ * @param[in] pinned Name of UDC for USBG_UDC_POLICY_PINNED, ignored otherwise
+ * @param[out] udc UDC to which gadget has been bound, may be NULL
+ * @return 0 on success, USBG_ERROR_BUSY if there is no free UDC matching
+ *  the policy, USBG_ERROR_NOT_FOUND if pinned UDC does not exist
+ *  or other usbg_error if error occurred.
+ */
+extern int usbg_enable_gadget_policy(usbg_gadget *g, usbg_udc_policy policy,
+				     const char *pinned, usbg_udc **udc);
+
+/**
+ * @brief Periodic bandwidth budget of configuration
+ * @details All values are in bytes per second.
+ */
+struct usbg_bandwidth
+{
+	/* Part of bus time which USB allows for periodic transfers */
+	uint64_t available;
+	/* Reserved by isochronous and interrupt endpoints */
+	uint64_t used;
+	/* Negative if configuration is overcommitted */
+	int64_t headroom;
+};
+
+/**
+ * @brief Estimate periodic bandwidth reserved by function
+ * @details Computed from UAC2, UVC and HID attributes, other
+ *  functions are assumed not to use significant periodic bandwidth.
+ * @param[in] f Pointer to function
+ * @param[in] speed Speed at which gadget is going to be connected
+ * @param[out] bw Bytes per second reserved by function endpoints
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_get_function_bandwidth(usbg_function *f, usbg_speed speed,
+				       uint64_t *bw);
+
+/**
+ * @brief Compare periodic bandwidth of all functions in configuration
+ *  with what the bus provides at given speed
+ * @param[in] c Pointer to config
+ * @param[in] speed Speed at which gadget is going to be connected
+ * @param[out] bw Bandwidth budget of configuration
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_get_config_bandwidth(usbg_config *c, usbg_speed speed,
+				     struct usbg_bandwidth *bw);
+
+/**
+ * @brief Maximum number of interfaces in single configuration
+ */
+#define USBG_MAX_CONFIG_INTERFACES 16
+
+/**
+ * @brief Interfaces and endpoints required by function or configuration
+ * @details Control endpoint is not counted, each direction
+ *  of endpoint number is counted as separate endpoint.
+ */
+struct usbg_ep_budget
+{
+	int interfaces;
+	int endpoints;
+};
+
+/**
+ * @brief Estimate interfaces and endpoints which kernel will
+ *  create for function
+ * @details Only UAC2 attributes are read, requirements of other
+ *  functions do not depend on their attributes. Endpoints of
+ *  FunctionFS are defined by its daemon so they are not counted.
+ * @param[in] f Pointer to function
+ * @param[out] b Requirements of function
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_get_function_ep_budget(usbg_function *f,
+				       struct usbg_ep_budget *b);
+
+/**
+ * @brief Estimate interfaces and endpoints required by configuration
+ * @param[in] c Pointer to config
+ * @param[out] b Sum of requirements of all functions in config
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_get_config_ep_budget(usbg_config *c,
+				     struct usbg_ep_budget *b);
+
 /**
  * @def usbg_for_each_gadget(g, s)
  * Iterates over each gadget
@@ -1230,6 +1675,95 @@ extern int usbg_export_config(usbg_config *c, FILE *stream);
  */
 extern int usbg_export_gadget(usbg_gadget *g, FILE *stream);
 
+/**
+ * @brief Exports usb function to file without building libconfig tree
+ * @details Output is identical to the one of usbg_export_function()
+ * but it is written while function is being read, so on error stream
+ * may contain partial output.
+ * @param f Pointer to function to be exported
+ * @param stream where function should be saved
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_export_function_stream(usbg_function *f, FILE *stream);
+
+/**
+ * @brief Exports configuration to file without building libconfig tree
+ * @details Output is identical to the one of usbg_export_config()
+ * but it is written while config is being read, so on error stream
+ * may contain partial output.
+ * @param c Pointer to configuration to be exported
+ * @param stream where configuration should be saved
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_export_config_stream(usbg_config *c, FILE *stream);
+
+/**
+ * @brief Exports whole gadget to file without building libconfig tree
+ * @details Output is identical to the one of usbg_export_gadget()
+ * but it is written while gadget is being read, so memory usage
+ * doesn't depend on size of gadget. On error stream may contain
+ * partial output.
+ * @param g Pointer to gadget to be exported
+ * @param stream where gadget should be saved
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_export_gadget_stream(usbg_gadget *g, FILE *stream);
+
+/**
+ * @brief Export/import also bindings of gadgets to UDCs
+ */
+#define USBG_STATE_BIND		0x01
+
+/**
+ * @brief Create imported gadgets concurrently
+ */
+#define USBG_STATE_PARALLEL	0x02
+
+/**
+ * @brief Exports all gadgets to one file
+ * @details Each gadget is written as element of "gadgets" list with
+ * its name and, if requested, UDC it is bound to.
+ * @param s Pointer to state
+ * @param flags USBG_STATE_BIND or 0
+ * @param stream where gadgets should be saved
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_export_state(usbg_state *s, int flags, FILE *stream);
+
+/**
+ * @brief Get current generation of state
+ * @details Generation is bumped by each function which modifies
+ *  gadgets, configs or functions of this state.
+ * @param s Pointer to state
+ * @return Current generation, mark for usbg_export_changed_since()
+ */
+extern uint64_t usbg_get_generation(usbg_state *s);
+
+/**
+ * @brief Exports only objects changed after given generation
+ * @details Output contains "removed" list with gadget, config or
+ *  function removed since then and "changed" list with gadgets whose
+ *  own attributes changed (exported completely) and changed configs
+ *  and functions of other gadgets.
+ * @param s Pointer to state
+ * @param gen Generation returned by usbg_get_generation() before
+ *  previous export, 0 for all changes since usbg_init()
+ * @param stream where changes should be saved
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_export_changed_since(usbg_state *s, uint64_t gen,
+				     FILE *stream);
+
+/**
+ * @brief Forget removals which are not newer than given generation
+ * @details Records of removed objects are kept by state until they are
+ *  dropped, so application should call this when all consumers have
+ *  seen changes up to gen.
+ * @param s Pointer to state
+ * @param gen Generation up to which removals should be forgotten
+ */
+extern void usbg_drop_tombstones(usbg_state *s, uint64_t gen);
+
 /**
  * @brief Imports usb function from file and adds it to given gadget
  * @param g Gadget where function should be placed
@@ -1256,6 +1790,8 @@ extern int usbg_import_config(usbg_gadget *g, FILE *stream, int id,
 
 /**
  * @brief Imports usb gadget from file
+ * @details Scheme is checked like usbg_validate_gadget_scheme() does,
+ *  except kernel and UDC limits, before anything is created in configfs.
  * @param s current state of library
  * @param stream from which gadget should be imported
  * @param name which should be used for new gadget
@@ -1266,6 +1802,258 @@ extern int usbg_import_config(usbg_gadget *g, FILE *stream, int id,
 extern int usbg_import_gadget(usbg_state *s, FILE *stream,
 			      const char *name, usbg_gadget **g);
 
+/**
+ * @brief Imports all gadgets from file written by usbg_export_state()
+ * @details File is parsed once. Names of gadgets and UDCs are checked
+ * before anything is created in configfs.
+ * @param s Pointer to state
+ * @param stream from which gadgets should be loaded
+ * @param flags USBG_STATE_BIND and/or USBG_STATE_PARALLEL
+ * @return 0 on success, USBG_ERROR_BUSY if UDC is already in use or
+ *  requested by more than one gadget, other usbg_error otherwise. On error
+ *  none of gadgets from file is left in configfs.
+ */
+extern int usbg_import_state(usbg_state *s, FILE *stream, int flags);
+
+/**
+ * @brief Check if gadget scheme can be imported, without touching configfs
+ * @details Checks whole scheme before any directory is created:
+ *  syntax, types and ranges of attributes, function types and their
+ *  availability in running kernel, uniqueness of functions and config ids,
+ *  function references from configs and OS descriptors config id.
+ * @param[in] s current state of library
+ * @param[in] stream from which scheme should be read
+ * @param[out] buf Place for description of first problem found, may be NULL
+ * @param[in] len Size of buffer
+ * @return 0 if scheme is valid, usbg_error describing the problem otherwise
+ */
+extern int usbg_validate_gadget_scheme(usbg_state *s, FILE *stream,
+				       char *buf, int len);
+
+/**
+ * @brief Value of placeholder used in template
+ */
+struct usbg_template_var
+{
+	const char *name;
+	const char *value;
+};
+
+/**
+ * @brief Parse and validate gadget scheme once for later instantiation
+ * @details Value strings in scheme may contain ${name} placeholders, for
+ *  example serialnumber = "SN-${serial}", which are replaced by values
+ *  given to usbg_instantiate_template(). Placeholders are not allowed in
+ *  type of function, in function referenced by binding and in interface
+ *  of OS descriptor, as these are needed to validate the scheme.
+ * @param[in] s current state of library
+ * @param[in] stream from which scheme should be read
+ * @param[out] t Pointer to be filled with template
+ * @return 0 on success, USBG_ERROR_NOT_SUPPORTED if placeholder is used
+ *  where it is not allowed, other usbg_error otherwise. Syntax errors
+ *  are available through usbg_get_gadget_import_error_text().
+ */
+extern int usbg_compile_template(usbg_state *s, FILE *stream,
+				 usbg_template **t);
+
+/**
+ * @brief Create gadget from template
+ * @details No parsing or validation is done here, only strings with
+ *  placeholders are replaced in compiled scheme before it is imported.
+ *  They are restored afterwards, so template may be instantiated many
+ *  times, but not from several threads at once. If gadget cannot be
+ *  created, copy of the expanded scheme is kept as the last failed
+ *  import of state.
+ * @param[in] t Pointer to template
+ * @param[in] name which should be used for new gadget
+ * @param[in] vars Values of placeholders, terminated by entry with NULL name
+ * @param[out] g place for pointer to created gadget, may be NULL
+ * @return 0 on success, USBG_ERROR_NOT_FOUND if value of some
+ *  placeholder is missing, other usbg_error otherwise
+ */
+extern int usbg_instantiate_template(usbg_template *t, const char *name,
+				     const struct usbg_template_var *vars,
+				     usbg_gadget **g);
+
+/**
+ * @brief Free template
+ * @param[in] t Pointer to template
+ */
+extern void usbg_destroy_template(usbg_template *t);
+
+/**
+ * @brief Compile existing gadget to list of configfs operations
+ * @details All writable attributes found in gadget directory are
+ *  recorded, including those which are unknown to the library.
+ * @param[in] g Gadget to be compiled
+ * @param[in] flags Additional flags, USBG_PROGRAM_BIND or 0
+ * @param[out] p place for pointer to compiled program
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_compile_program(usbg_gadget *g, int flags, usbg_program **p);
+
+/**
+ * @brief Compile gadget scheme to list of configfs operations
+ * @details Scheme is imported once as temporary gadget which is
+ *  removed after compilation.
+ * @param[in] s Pointer to state
+ * @param[in] stream from which scheme should be loaded
+ * @param[out] p place for pointer to compiled program
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_compile_program_scheme(usbg_state *s, FILE *stream,
+				       usbg_program **p);
+
+/**
+ * @brief Create gadget by replaying compiled program
+ * @details Operations are done on absolute paths under gadget directory
+ *  created in configfs path of state.
+ * @param[in] s Pointer to state
+ * @param[in] p Pointer to program
+ * @param[in] name which should be used for new gadget
+ * @param[out] g place for pointer to created gadget, may be NULL
+ * @return 0 on success, usbg_error otherwise. On error directory of
+ *  gadget is removed with everything created in it, even if library
+ *  couldn't parse it.
+ */
+extern int usbg_run_program(usbg_state *s, usbg_program *p, const char *name,
+			    usbg_gadget **g);
+
+/**
+ * @brief Get number of operations in program
+ * @param[in] p Pointer to program
+ * @return Number of operations or usbg_error if error occurred
+ */
+extern int usbg_get_program_length(usbg_program *p);
+
+/**
+ * @brief Save program in binary form
+ * @param[in] p Pointer to program
+ * @param[in] stream where program should be saved
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_save_program(usbg_program *p, FILE *stream);
+
+/**
+ * @brief Load program saved by usbg_save_program()
+ * @param[in] stream from which program should be loaded
+ * @param[out] p place for pointer to loaded program
+ * @return 0 on success, USBG_ERROR_INVALID_FORMAT if stream doesn't
+ *  contain valid program, other usbg_error otherwise
+ */
+extern int usbg_load_program(FILE *stream, usbg_program **p);
+
+/**
+ * @brief Free program
+ * @param[in] p Pointer to program
+ */
+extern void usbg_destroy_program(usbg_program *p);
+
+/**
+ * @brief Get fingerprint of gadget content
+ * @details Fingerprint covers all attributes, strings, functions and
+ *  configs of gadget, but neither its name nor UDC. Order in which
+ *  objects were created doesn't matter, so gadget which is already
+ *  configured may be recognized without exporting it. Fingerprints of
+ *  gadget, its configs and functions are cached, so only objects
+ *  changed by library since the previous call are read from configfs
+ *  again. Changes made behind library's back are not noticed.
+ * @param[in] g Pointer to gadget
+ * @param[out] fp Place for fingerprint
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_get_gadget_fingerprint(usbg_gadget *g, uint64_t *fp);
+
+/**
+ * @brief Get fingerprint of function content
+ * @details Instance name is not covered, neither in attributes nor in
+ *  targets of links inside function, like UVC headers.
+ * @param[in] f Pointer to function
+ * @param[out] fp Place for fingerprint
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_get_function_fingerprint(usbg_function *f, uint64_t *fp);
+
+/**
+ * @brief Get fingerprint of config content, including its bindings
+ * @param[in] c Pointer to config
+ * @param[out] fp Place for fingerprint
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_get_config_fingerprint(usbg_config *c, uint64_t *fp);
+
+/**
+ * @brief Get fingerprint of gadget which would be created by program
+ * @details Result is equal to usbg_get_gadget_fingerprint() of gadget
+ *  created by usbg_run_program(), so fingerprint of desired gadget
+ *  may be computed once and stored with saved program.
+ * @param[in] p Pointer to program
+ * @param[out] fp Place for fingerprint
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_get_program_fingerprint(usbg_program *p, uint64_t *fp);
+
+/**
+ * @brief Save binary image of all gadgets
+ * @details Image contains fixed size records and string table. It is
+ *  meant to be opened with usbg_open_image() by the same version of
+ *  library on the same architecture.
+ * @param[in] s Pointer to state
+ * @param[in] fd File descriptor where image should be written
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_save_image(usbg_state *s, int fd);
+
+/**
+ * @brief Save binary image of single gadget
+ * @param[in] g Pointer to gadget
+ * @param[in] fd File descriptor where image should be written
+ * @return 0 on success, usbg_error otherwise
+ */
+extern int usbg_save_gadget_image(usbg_gadget *g, int fd);
+
+/**
+ * @brief Map image saved by usbg_save_image()
+ * @details Image is validated once here, nothing is parsed.
+ * @param[in] file Path to image
+ * @param[out] img place for pointer to image
+ * @return 0 on success, USBG_ERROR_INVALID_FORMAT if file is not
+ *  a valid image, other usbg_error otherwise
+ */
+extern int usbg_open_image(const char *file, usbg_image **img);
+
+/**
+ * @brief Map image from file descriptor
+ * @param[in] fd File descriptor of image, may be closed afterwards
+ * @param[out] img place for pointer to image
+ * @return 0 on success, USBG_ERROR_INVALID_FORMAT if file is not
+ *  a valid image, other usbg_error otherwise
+ */
+extern int usbg_open_image_fd(int fd, usbg_image **img);
+
+/**
+ * @brief Unmap image
+ * @param[in] img Pointer to image
+ */
+extern void usbg_close_image(usbg_image *img);
+
+/**
+ * @brief Get number of gadgets stored in image
+ * @param[in] img Pointer to image
+ * @return Number of gadgets or usbg_error if error occurred
+ */
+extern int usbg_get_image_gadget_count(usbg_image *img);
+
+/**
+ * @brief Create all gadgets stored in image
+ * @param[in] s Pointer to state
+ * @param[in] img Pointer to image
+ * @param[in] flags Additional flags, USBG_IMAGE_BIND or 0
+ * @return 0 on success, usbg_error otherwise. On error none of
+ *  gadgets from image is left in configfs.
+ */
+extern int usbg_restore_image(usbg_state *s, usbg_image *img, int flags);
+
 /**
  * @brief Get text of error which occurred during last function import
  * @param g gadget where function import error occurred
@@ -1308,6 +2096,618 @@ extern const char *usbg_get_gadget_import_error_text(usbg_state *s);
  */
 extern int usbg_get_gadget_import_error_line(usbg_state *s);
 
+/* Gadget supervisor */
+
+/**
+ * @typedef usbg_recovery_policy
+ * @brief What supervisor should do when kernel detaches a gadget
+ */
+typedef enum {
+	USBG_RECOVERY_REBIND = 0, /**< bind gadget again immediately */
+	USBG_RECOVERY_WAIT_READY, /**< bind when ready callback allows it */
+	USBG_RECOVERY_GIVE_UP, /**< only record detach and stop watching */
+} usbg_recovery_policy;
+
+/**
+ * @brief Callback used by USBG_RECOVERY_WAIT_READY policy
+ * @details Should return true when gadget may be bound again,
+ *  for example when FFS daemon has written its descriptors.
+ */
+typedef bool (*usbg_ready_func)(usbg_gadget *g, void *data);
+
+/**
+ * @brief Detach and recovery statistics of supervised gadget
+ */
+struct usbg_recovery_stats
+{
+	unsigned int detaches;
+	unsigned int recoveries;
+	unsigned int failed_binds;
+	/* Time from detecting detach to successful rebind */
+	uint64_t last_latency_us;
+	uint64_t max_latency_us;
+	uint64_t total_latency_us;
+};
+
+/**
+ * @brief Create supervisor for gadgets in given state
+ * @param[in] s Pointer to state
+ * @param[out] sv Pointer to be filled with new supervisor
+ * @return 0 on success, usbg_error if error occurred
+ * @note UDCs of state created by usbg_init_memfs() send no
+ *  notifications, their gadgets are checked only when
+ *  usbg_supervisor_dispatch() times out
+ */
+extern int usbg_supervisor_create(usbg_state *s, usbg_supervisor **sv);
+
+/**
+ * @brief Destroy supervisor, gadgets are left untouched
+ * @param sv Pointer to supervisor
+ */
+extern void usbg_supervisor_destroy(usbg_supervisor *sv);
+
+/**
+ * @brief Start watching gadget bound to UDC
+ * @param sv Pointer to supervisor
+ * @param g Pointer to gadget, must be enabled
+ * @param policy What should be done after detach
+ * @param ready Callback for USBG_RECOVERY_WAIT_READY policy, may be NULL
+ * @param data Passed to ready callback
+ * @return 0 on success, usbg_error if error occurred
+ * @note Gadget has to be unwatched before it is removed
+ */
+extern int usbg_supervisor_watch(usbg_supervisor *sv, usbg_gadget *g,
+				 usbg_recovery_policy policy,
+				 usbg_ready_func ready, void *data);
+
+/**
+ * @brief Stop watching gadget
+ * @param sv Pointer to supervisor
+ * @param g Pointer to gadget
+ * @return 0 on success, USBG_ERROR_NOT_FOUND if gadget is not watched
+ */
+extern int usbg_supervisor_unwatch(usbg_supervisor *sv, usbg_gadget *g);
+
+/**
+ * @brief Get file descriptor which becomes readable when state of any
+ *  watched UDC changes
+ * @details Allows to integrate supervisor into application main loop.
+ *  usbg_supervisor_dispatch() should be called when it is readable.
+ * @param sv Pointer to supervisor
+ * @return File descriptor or usbg_error if error occurred
+ */
+extern int usbg_supervisor_get_fd(usbg_supervisor *sv);
+
+/**
+ * @brief Wait for UDC state changes and recover detached gadgets
+ * @param sv Pointer to supervisor
+ * @param timeout_ms Maximum time to wait in ms, 0 to only check gadgets
+ *  and -1 to wait until UDC state changes
+ * @return Number of gadgets bound again or usbg_error if error occurred
+ */
+extern int usbg_supervisor_dispatch(usbg_supervisor *sv, int timeout_ms);
+
+/**
+ * @brief Get recovery statistics of watched gadget
+ * @param[in] sv Pointer to supervisor
+ * @param[in] g Pointer to gadget
+ * @param[out] stats Structure to be filled
+ * @return 0 on success, USBG_ERROR_NOT_FOUND if gadget is not watched
+ */
+extern int usbg_supervisor_get_stats(usbg_supervisor *sv, usbg_gadget *g,
+				     struct usbg_recovery_stats *stats);
+
+/**
+ * @brief Default path of usbg daemon socket
+ */
+#define USBG_DAEMON_SOCKET "/run/usbg.sock"
+
+/**
+ * @brief Create daemon listening on Unix socket
+ * @details Requests of clients are served using given state, so all
+ *  changes made through daemon are done in one place. Changes made in
+ *  configfs by other processes are not noticed. Socket has mode 0600
+ *  and only the same user or root may connect. Client whose response
+ *  can't be sent at once, because it doesn't read them, is
+ *  disconnected.
+ * @param[in] s Pointer to state
+ * @param[in] path Path of socket, USBG_DAEMON_SOCKET if NULL
+ * @param[out] d Pointer to be filled with new daemon
+ * @return 0 on success, USBG_ERROR_EXIST if path is not a socket,
+ *  USBG_ERROR_BUSY if other daemon listens on it, usbg_error if
+ *  other error occurred
+ */
+extern int usbg_daemon_create(usbg_state *s, const char *path,
+			      usbg_daemon **d);
+
+/**
+ * @brief Allow members of group to connect to daemon
+ * @details Socket is given to the group with mode 0660.
+ * @param[in] d Pointer to daemon
+ * @param[in] gid Group ID
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_daemon_allow_group(usbg_daemon *d, gid_t gid);
+
+/**
+ * @brief Disconnect all clients, remove socket and free daemon
+ * @param[in] d Pointer to daemon
+ */
+extern void usbg_daemon_destroy(usbg_daemon *d);
+
+/**
+ * @brief Get file descriptor which becomes readable when daemon
+ *  has something to do
+ * @param[in] d Pointer to daemon
+ * @return File descriptor or usbg_error if error occurred
+ */
+extern int usbg_daemon_get_fd(usbg_daemon *d);
+
+/**
+ * @brief Accept new clients and serve their requests
+ * @param[in] d Pointer to daemon
+ * @param[in] timeout_ms How long to wait for clients, 0 to return at once
+ *  and -1 to wait until some client connects or sends request
+ * @return Number of requests served or usbg_error if error occurred
+ */
+extern int usbg_daemon_dispatch(usbg_daemon *d, int timeout_ms);
+
+/**
+ * @brief Gadget as seen by daemon client
+ */
+struct usbg_client_gadget
+{
+	char name[USBG_MAX_STR_LENGTH];
+	/* Empty if gadget is not enabled */
+	char udc[USBG_MAX_STR_LENGTH];
+	/* Filled only by usbg_client_get_gadget() */
+	uint16_t idVendor;
+	uint16_t idProduct;
+};
+
+/**
+ * @brief Callback called for each gadget by usbg_client_list_gadgets()
+ * @return 0 to continue, other value stops listing and is returned
+ */
+typedef int (*usbg_client_gadget_func)(const struct usbg_client_gadget *g,
+				       void *data);
+
+/**
+ * @brief Connect to usbg daemon
+ * @param[in] path Path of daemon socket, USBG_DAEMON_SOCKET if NULL
+ * @param[out] c Pointer to be filled with new connection
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_client_connect(const char *path, usbg_client **c);
+
+/**
+ * @brief Close connection to usbg daemon
+ * @param[in] c Pointer to connection
+ */
+extern void usbg_client_close(usbg_client *c);
+
+/**
+ * @brief List all gadgets known to daemon
+ * @details Daemon does not access configfs to answer this request.
+ * @param[in] c Pointer to connection
+ * @param[in] func Called for each gadget
+ * @param[in] data Passed to func
+ * @return 0 on success, value returned by func if it stopped listing,
+ *  usbg_error if error occurred
+ */
+extern int usbg_client_list_gadgets(usbg_client *c,
+				    usbg_client_gadget_func func, void *data);
+
+/**
+ * @brief Get gadget from daemon
+ * @param[in] c Pointer to connection
+ * @param[in] name Name of gadget
+ * @param[out] g Structure to be filled
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_client_get_gadget(usbg_client *c, const char *name,
+				  struct usbg_client_gadget *g);
+
+/**
+ * @brief Ask daemon to create gadget
+ * @param[in] c Pointer to connection
+ * @param[in] name Name of gadget
+ * @param[in] idVendor Gadget vendor ID
+ * @param[in] idProduct Gadget product ID
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_client_create_gadget(usbg_client *c, const char *name,
+				     uint16_t idVendor, uint16_t idProduct);
+
+/**
+ * @brief Ask daemon to enable gadget
+ * @param[in] c Pointer to connection
+ * @param[in] name Name of gadget
+ * @param[in] udc Name of UDC, first free UDC is used if NULL
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_client_enable_gadget(usbg_client *c, const char *name,
+				     const char *udc);
+
+/**
+ * @brief Ask daemon to disable gadget
+ * @param[in] c Pointer to connection
+ * @param[in] name Name of gadget
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_client_disable_gadget(usbg_client *c, const char *name);
+
+/**
+ * @brief Ask daemon to bind gadget to UDC
+ * @details Gadget which currently uses this UDC is disabled first.
+ * @param[in] c Pointer to connection
+ * @param[in] name Name of gadget
+ * @param[in] udc Name of UDC
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_client_switch_gadget(usbg_client *c, const char *name,
+				     const char *udc);
+
+/**
+ * @brief Default size of shared memory region used by publisher
+ */
+#define USBG_SNAPSHOT_DEFAULT_SIZE (256 * 1024)
+
+/**
+ * @brief Publish gadget tree of state in shared memory
+ * @details Other processes may map the region and read the tree
+ * without taking any lock and without parsing configfs.
+ * @param[in] s Pointer to state
+ * @param[in] name Name of POSIX shared memory object or NULL to use
+ *  anonymous one which may be passed to readers by usbg_publisher_get_fd()
+ * @param[in] size Size of region, USBG_SNAPSHOT_DEFAULT_SIZE if 0
+ * @param[out] p Pointer to be filled with new publisher
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_publisher_create(usbg_state *s, const char *name, size_t size,
+				 usbg_publisher **p);
+
+/**
+ * @brief Unmap region, remove shared memory object and free publisher
+ * @param[in] p Pointer to publisher
+ */
+extern void usbg_publisher_destroy(usbg_publisher *p);
+
+/**
+ * @brief Get file descriptor of shared memory region
+ * @param[in] p Pointer to publisher
+ * @return File descriptor or usbg_error if error occurred
+ */
+extern int usbg_publisher_get_fd(usbg_publisher *p);
+
+/**
+ * @brief Publish current gadget tree of state
+ * @details Should be called after each change of state. Readers which
+ * overlap with update are told to retry by usbg_snapshot_read_retry().
+ * @param[in] p Pointer to publisher
+ * @return 0 on success, usbg_error if error occurred. If tree doesn't
+ *  fit the region USBG_ERROR_NO_MEM is returned and previous snapshot
+ *  stays published.
+ */
+extern int usbg_publisher_update(usbg_publisher *p);
+
+/**
+ * @brief Map snapshot published under given name
+ * @param[in] name Name of POSIX shared memory object
+ * @param[out] snap Pointer to be filled with snapshot
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_snapshot_open(const char *name, usbg_snapshot **snap);
+
+/**
+ * @brief Map snapshot from file descriptor
+ * @details fd may be closed after this call.
+ * @param[in] fd File descriptor of shared memory region
+ * @param[out] snap Pointer to be filled with snapshot
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_snapshot_open_fd(int fd, usbg_snapshot **snap);
+
+/**
+ * @brief Unmap snapshot
+ * @param[in] snap Pointer to snapshot
+ */
+extern void usbg_snapshot_close(usbg_snapshot *snap);
+
+/**
+ * @brief Start reading of snapshot
+ * @details Values obtained by usbg_snapshot_get_*() functions are
+ * consistent only if following usbg_snapshot_read_retry() returns
+ * false. Returned strings point into shared memory so they should be
+ * copied before the check. Reading looks like this:
+ * @code
+ * do {
+ *	seq = usbg_snapshot_read_begin(snap);
+ *	...
+ * } while (usbg_snapshot_read_retry(snap, seq));
+ * @endcode
+ * @param[in] snap Pointer to snapshot
+ * @return Sequence number to be passed to usbg_snapshot_read_retry()
+ */
+extern uint32_t usbg_snapshot_read_begin(usbg_snapshot *snap);
+
+/**
+ * @brief Check if snapshot has been updated while it was read
+ * @param[in] snap Pointer to snapshot
+ * @param[in] seq Value returned by usbg_snapshot_read_begin()
+ * @return true if values read since usbg_snapshot_read_begin() should
+ *  be dropped and read again
+ */
+extern bool usbg_snapshot_read_retry(usbg_snapshot *snap, uint32_t seq);
+
+/**
+ * @brief Get number of gadgets in snapshot
+ * @param[in] snap Pointer to snapshot
+ * @return Number of gadgets or usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_gadget_count(usbg_snapshot *snap);
+
+/**
+ * @brief Get name of gadget
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @return Name of gadget or NULL if index is out of range
+ */
+extern const char *usbg_snapshot_get_gadget_name(usbg_snapshot *snap, int g);
+
+/**
+ * @brief Get UDC to which gadget is bound
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @return Index of UDC, -1 if gadget is not bound or usbg_error
+ *  if index is out of range
+ */
+extern int usbg_snapshot_get_gadget_udc(usbg_snapshot *snap, int g);
+
+/**
+ * @brief Get fingerprint of gadget
+ * @details Publisher doesn't read configfs, so fingerprints of gadget,
+ *  its configs and functions are published only if they have been
+ *  computed by usbg_get_gadget_fingerprint() after the last change.
+ *  Reader may then check if gadget is already configured without
+ *  touching configfs.
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[out] fp Place for fingerprint
+ * @return 0 on success, USBG_ERROR_NOT_FOUND if index is out of range
+ *  or fingerprint is not known, other usbg_error otherwise
+ */
+extern int usbg_snapshot_get_gadget_fingerprint(usbg_snapshot *snap, int g,
+						uint64_t *fp);
+
+/**
+ * @brief Get number of configurations of gadget
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @return Number of configurations or usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_config_count(usbg_snapshot *snap, int g);
+
+/**
+ * @brief Get label of configuration
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[in] c Index of configuration
+ * @return Label or NULL if index is out of range
+ */
+extern const char *usbg_snapshot_get_config_label(usbg_snapshot *snap, int g,
+						  int c);
+
+/**
+ * @brief Get id of configuration
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[in] c Index of configuration
+ * @return Configuration id or usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_config_id(usbg_snapshot *snap, int g, int c);
+
+/**
+ * @brief Get fingerprint of configuration
+ * @details See usbg_snapshot_get_gadget_fingerprint().
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[in] c Index of configuration
+ * @param[out] fp Place for fingerprint
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_config_fingerprint(usbg_snapshot *snap, int g,
+						int c, uint64_t *fp);
+
+/**
+ * @brief Get number of bindings in configuration
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[in] c Index of configuration
+ * @return Number of bindings or usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_binding_count(usbg_snapshot *snap, int g, int c);
+
+/**
+ * @brief Get name of binding
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[in] c Index of configuration
+ * @param[in] b Index of binding
+ * @return Name of binding or NULL if index is out of range
+ */
+extern const char *usbg_snapshot_get_binding_name(usbg_snapshot *snap, int g,
+						  int c, int b);
+
+/**
+ * @brief Get function to which binding points
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[in] c Index of configuration
+ * @param[in] b Index of binding
+ * @return Index of function in gadget or usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_binding_function(usbg_snapshot *snap, int g,
+					      int c, int b);
+
+/**
+ * @brief Get number of functions of gadget
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @return Number of functions or usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_function_count(usbg_snapshot *snap, int g);
+
+/**
+ * @brief Get type of function
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[in] f Index of function
+ * @return usbg_function_type or usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_function_type(usbg_snapshot *snap, int g, int f);
+
+/**
+ * @brief Get instance name of function
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[in] f Index of function
+ * @return Instance name or NULL if index is out of range
+ */
+extern const char *usbg_snapshot_get_function_instance(usbg_snapshot *snap,
+						       int g, int f);
+
+/**
+ * @brief Get fingerprint of function
+ * @details See usbg_snapshot_get_gadget_fingerprint().
+ * @param[in] snap Pointer to snapshot
+ * @param[in] g Index of gadget
+ * @param[in] f Index of function
+ * @param[out] fp Place for fingerprint
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_function_fingerprint(usbg_snapshot *snap, int g,
+						  int f, uint64_t *fp);
+
+/**
+ * @brief Get number of UDCs in snapshot
+ * @param[in] snap Pointer to snapshot
+ * @return Number of UDCs or usbg_error if error occurred
+ */
+extern int usbg_snapshot_get_udc_count(usbg_snapshot *snap);
+
+/**
+ * @brief Get name of UDC
+ * @param[in] snap Pointer to snapshot
+ * @param[in] u Index of UDC
+ * @return Name of UDC or NULL if index is out of range
+ */
+extern const char *usbg_snapshot_get_udc_name(usbg_snapshot *snap, int u);
+
+/**
+ * @brief Get gadget bound to UDC
+ * @param[in] snap Pointer to snapshot
+ * @param[in] u Index of UDC
+ * @return Index of gadget, -1 if UDC is free or usbg_error
+ *  if index is out of range
+ */
+extern int usbg_snapshot_get_udc_gadget(usbg_snapshot *snap, int u);
+
+/**
+ * @typedef usbg_stat_syscall
+ * @brief Filesystem operations counted by usbg_get_stats()
+ */
+typedef enum {
+	USBG_STAT_OPEN = 0,
+	USBG_STAT_READ,
+	USBG_STAT_WRITE,
+	USBG_STAT_MKDIR,
+	USBG_STAT_RMDIR,
+	USBG_STAT_UNLINK,
+	USBG_STAT_SYMLINK,
+	USBG_STAT_READLINK,
+	USBG_STAT_SCANDIR,
+	USBG_STAT_STAT,
+	USBG_STAT_SYSCALL_MAX,
+} usbg_stat_syscall;
+
+/**
+ * @typedef usbg_stat_op
+ * @brief Classes of operations with latency histogram
+ * @details Only the outermost operation is accounted, so creating gadget
+ *  with attributes counts as one create, not as create and set.
+ */
+typedef enum {
+	USBG_STAT_OP_INIT = 0, /**< usbg_init() and usbg_init_memfs() */
+	USBG_STAT_OP_CREATE, /**< creation of gadget, config or function */
+	USBG_STAT_OP_REMOVE, /**< removal of gadget, config, function or binding */
+	USBG_STAT_OP_LINK, /**< usbg_add_config_function() */
+	USBG_STAT_OP_GET_ATTRS, /**< gadget or function attributes */
+	USBG_STAT_OP_SET_ATTRS, /**< gadget or function attributes */
+	USBG_STAT_OP_ENABLE, /**< usbg_enable_gadget() */
+	USBG_STAT_OP_DISABLE, /**< usbg_disable_gadget() */
+	USBG_STAT_OP_EXPORT, /**< export of gadget or state */
+	USBG_STAT_OP_IMPORT, /**< import of gadget or state */
+	USBG_STAT_OP_MAX,
+} usbg_stat_op;
+
+/**
+ * @brief Number of buckets of latency histogram
+ * @details Bucket i counts operations which took from 2^i to 2^(i+1)
+ *  microseconds, bucket 0 also faster ones and the last one also slower.
+ */
+#define USBG_STAT_BUCKETS 32
+
+/**
+ * @brief Size of errors array in struct usbg_stats
+ * @details Errors are indexed by -usbg_error, codes which don't fit
+ *  are counted in the last slot.
+ */
+#define USBG_STAT_ERRORS 17
+
+/**
+ * @brief Latency of one class of operations
+ */
+struct usbg_stat_latency
+{
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t buckets[USBG_STAT_BUCKETS];
+};
+
+/**
+ * @brief Counters of state
+ * @details Filesystem operations are accounted to the state which
+ *  issued them, also when more states use the same configfs path.
+ */
+struct usbg_stats
+{
+	uint64_t syscalls[USBG_STAT_SYSCALL_MAX];
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	/* Gadgets, configs, functions, bindings and UDCs allocated */
+	uint64_t allocs;
+	/* Failures of operations from usbg_stat_op, by -usbg_error */
+	uint64_t errors[USBG_STAT_ERRORS];
+	struct usbg_stat_latency ops[USBG_STAT_OP_MAX];
+};
+
+/**
+ * @brief Get counters of state
+ * @details Counters are updated without locks, so each one is consistent
+ *  but they may be taken at slightly different moments.
+ * @param[in] s Pointer to state
+ * @param[out] stats Counters since state creation or last reset
+ * @return 0 on success, usbg_error if error occurred
+ */
+extern int usbg_get_stats(usbg_state *s, struct usbg_stats *stats);
+
+/**
+ * @brief Zero all counters of state
+ * @param[in] s Pointer to state
+ */
+extern void usbg_reset_stats(usbg_state *s);
+
 /**
  * @}
  */
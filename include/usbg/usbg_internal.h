@@ -17,12 +17,18 @@
 #include <string.h>
 #include <usbg/usbg.h>
 #include <malloc.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #ifdef HAS_GADGET_SCHEMES
 #include "usbg_internal_libconfig.h"
 #else
 #include "usbg_internal_none.h"
 #endif
+#ifdef HAVE_SYS_SDT_H
+/* Let probes tell whether a tracer is attached, see USBG_PROBE_ENABLED */
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -82,6 +88,12 @@ struct usbg_function_type
 	/* Free the additional memory allocated for function attributes */
 	void (*cleanup_attrs)(struct usbg_function *, void *);
 
+	/*
+	 * Copy all attributes of second function to the first one of the
+	 * same type. If not provided get_attrs and set_attrs are used.
+	 */
+	int (*clone)(struct usbg_function *, struct usbg_function *);
+
 	/* Should import all function attributes from libconfig format */
 	int (*import)(struct usbg_function *, config_setting_t *);
 
@@ -89,6 +101,18 @@ struct usbg_function_type
 	int (*export)(struct usbg_function *, config_setting_t *);
 };
 
+/*
+ * Filesystem backend used by a state, passed to each filesystem
+ * operation, see usbg_io.c
+ */
+struct usbg_io
+{
+	const struct usbg_io_ops *ops;
+	void *priv;
+	/* Where operations are accounted, may be NULL */
+	struct usbg_stats *stats;
+};
+
 struct usbg_state
 {
 	char *path;
@@ -96,7 +120,34 @@ struct usbg_state
 
 	TAILQ_HEAD(ghead, usbg_gadget) gadgets;
 	TAILQ_HEAD(uhead, usbg_udc) udcs;
+	/* UDCs sorted by name for fast lookup */
+	usbg_udc **udc_index;
+	int udc_count;
+	/* Filled by usbg_probe_function_types() */
+	usbg_function_availability func_avail[USBG_FUNCTION_TYPE_MAX];
+	bool func_probed;
 	config_t *last_failed_import;
+	/* Bumped by each modification, see usbg_export_changed_since() */
+	uint64_t generation;
+	TAILQ_HEAD(thead, usbg_tombstone) tombstones;
+	/* Directory with UDCs, UDC_CLASS_DIR unless emulated */
+	char *udc_path;
+	/* Backend of both configfs and UDC directory */
+	struct usbg_io io;
+	/* Counters of this state, io.stats points here */
+	struct usbg_stats stats;
+};
+
+/*
+ * Order independent sum of hashes of configfs operations, see
+ * usbg_fingerprint.c. Valid until owner's generation changes.
+ */
+struct usbg_fp_cache
+{
+	uint64_t sum;
+	uint64_t n;
+	uint64_t generation;
+	bool valid;
 };
 
 struct usbg_gadget
@@ -111,6 +162,10 @@ struct usbg_gadget
 	config_t *last_failed_import;
 	usbg_udc *udc;
 	usbg_config *os_desc_binding;
+	/* Generation of the last change of gadget's own attributes */
+	uint64_t generation;
+	/* Only gadget's own directories, without functions and configs */
+	struct usbg_fp_cache fp;
 };
 
 struct usbg_config
@@ -123,6 +178,8 @@ struct usbg_config
 	char *path;
 	char *label;
 	int id;
+	uint64_t generation;
+	struct usbg_fp_cache fp;
 };
 
 struct usbg_function
@@ -137,6 +194,8 @@ struct usbg_function
 	char *label;
 	usbg_function_type type;
 	struct usbg_function_type *ops;
+	uint64_t generation;
+	struct usbg_fp_cache fp;
 };
 
 struct usbg_binding
@@ -149,6 +208,23 @@ struct usbg_binding
 	char *path;
 };
 
+enum usbg_tombstone_type {
+	USBG_TOMBSTONE_GADGET = 0,
+	USBG_TOMBSTONE_CONFIG,
+	USBG_TOMBSTONE_FUNCTION,
+};
+
+/* Record of removed object, kept until dropped by application */
+struct usbg_tombstone
+{
+	TAILQ_ENTRY(usbg_tombstone) tnode;
+	uint64_t generation;
+	int type;
+	char *gadget;
+	/* Directory name of config or function, NULL for gadget */
+	char *name;
+};
+
 struct usbg_udc
 {
 	TAILQ_ENTRY(usbg_udc) unode;
@@ -156,8 +232,286 @@ struct usbg_udc
 	usbg_gadget *gadget;
 
 	char *name;
+	/* CLOCK_MONOTONIC time of the last usbg_udc_connect() */
+	struct timespec connect_ts;
+	/* maximum_speed is read only once, on first use */
+	usbg_speed max_speed;
+	bool max_speed_valid;
+	/* Non control endpoints, read from debugfs or set by user */
+	int endpoints;
+	bool endpoints_valid;
+};
+
+struct usbg_watch
+{
+	TAILQ_ENTRY(usbg_watch) wnode;
+	usbg_gadget *gadget;
+	/* UDC to which gadget should be bound again */
+	usbg_udc *udc;
+	/* UDC state attribute, -1 if not available */
+	int state_fd;
+
+	usbg_recovery_policy policy;
+	usbg_ready_func ready;
+	void *data;
+
+	bool detached;
+	bool gave_up;
+	struct timespec detach_ts;
+	struct usbg_recovery_stats stats;
+};
+
+struct usbg_supervisor
+{
+	usbg_state *parent;
+	int epoll_fd;
+	TAILQ_HEAD(whead, usbg_watch) watches;
+};
+
+struct usbg_daemon_client
+{
+	TAILQ_ENTRY(usbg_daemon_client) cnode;
+	int fd;
+};
+
+struct usbg_daemon
+{
+	usbg_state *parent;
+	int listen_fd;
+	int epoll_fd;
+	char *path;
+	char *buf;
+	/* Group allowed to connect besides owner, -1 if none */
+	gid_t group;
+	TAILQ_HEAD(dchead, usbg_daemon_client) clients;
+};
+
+/*
+ * Layout of shared snapshot. All references are offsets from the
+ * beginning of region, strings are stored at the end of it. Writer
+ * keeps seq odd while it modifies the region.
+ */
+#define USBG_SNAP_MAGIC 0x75736267
+
+struct usbg_snap_hdr
+{
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t size;
+	uint32_t ngadgets;
+	uint32_t gadgets;
+	uint32_t nudcs;
+	uint32_t udcs;
+};
+
+struct usbg_snap_gadget
+{
+	uint32_t name;
+	int32_t udc;
+	uint32_t nconfigs;
+	uint32_t configs;
+	uint32_t nfunctions;
+	uint32_t functions;
+	/* Records are only 4 byte aligned, so low half goes first */
+	uint32_t fingerprint[2];
+	uint32_t has_fingerprint;
+};
+
+struct usbg_snap_config
+{
+	uint32_t label;
+	uint32_t id;
+	uint32_t nbindings;
+	uint32_t bindings;
+	uint32_t fingerprint[2];
+	uint32_t has_fingerprint;
+};
+
+struct usbg_snap_function
+{
+	uint32_t type;
+	uint32_t instance;
+	uint32_t fingerprint[2];
+	uint32_t has_fingerprint;
+};
+
+struct usbg_snap_binding
+{
+	uint32_t name;
+	int32_t function;
+};
+
+struct usbg_snap_udc
+{
+	uint32_t name;
+	int32_t gadget;
+};
+
+struct usbg_publisher
+{
+	usbg_state *parent;
+	int fd;
+	char *name;
+	size_t size;
+	struct usbg_snap_hdr *shm;
+	/* Snapshot is built here and copied to shm under seqlock */
+	char *buf;
 };
 
+struct usbg_snapshot
+{
+	int fd;
+	size_t size;
+	const struct usbg_snap_hdr *shm;
+};
+
+/*
+ * Gadget program, ordered list of configfs operations. Paths are
+ * relative to gadget directory, so program may be run under any name.
+ * File is made of usbg_program_hdr followed by usbg_program_op_hdr,
+ * path and data of each operation, all in native byte order.
+ */
+#define USBG_PROGRAM_MAGIC 0x52504755
+#define USBG_PROGRAM_VERSION 1
+
+enum usbg_program_op_type {
+	USBG_OP_MKDIR = 0,
+	USBG_OP_WRITE,
+	/* data is link target relative to gadget directory */
+	USBG_OP_SYMLINK,
+	/* data is name of UDC */
+	USBG_OP_BIND,
+	USBG_OP_MAX,
+};
+
+struct usbg_program_hdr
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t nops;
+};
+
+struct usbg_program_op_hdr
+{
+	uint8_t type;
+	uint8_t reserved;
+	uint16_t path_len;
+	uint32_t data_len;
+};
+
+struct usbg_program_op
+{
+	int type;
+	char *path;
+	char *data;
+	int len;
+};
+
+struct usbg_program
+{
+	struct usbg_program_op *ops;
+	int nops;
+	int size;
+};
+
+/*
+ * Binary image of gadgets. File is made of usbg_image_hdr, array of
+ * fixed size usbg_image_rec and string table. Records belong to the
+ * last preceding GADGET, FUNCTION or CONFIG record. Strings are
+ * referenced by offset in the string table, offset 0 is empty string.
+ * Everything is in native byte order, so image may be used directly
+ * after mmap().
+ */
+#define USBG_IMAGE_MAGIC 0x49504755
+#define USBG_IMAGE_VERSION 1
+
+enum usbg_image_rec_type {
+	USBG_IMG_GADGET = 0,		/* key: name */
+	USBG_IMG_GADGET_ATTR,		/* id: usbg_gadget_attr, val: value */
+	USBG_IMG_GADGET_STR,		/* id: lang, key: usbg_gadget_str, val: str */
+	USBG_IMG_GADGET_OS_DESC,	/* id: use, key: vendor code, val: qw_sign */
+	USBG_IMG_FUNCTION,		/* key: type name, val: instance */
+	USBG_IMG_FUNCTION_OP,		/* id: op type, key: path, val: data */
+	USBG_IMG_CONFIG,		/* id: id, key: label */
+	USBG_IMG_CONFIG_ATTR,		/* key: bmAttributes, val: bMaxPower */
+	USBG_IMG_CONFIG_STR,		/* id: lang, val: configuration */
+	USBG_IMG_BINDING,		/* key: name, val: index of FUNCTION record */
+	USBG_IMG_OS_DESC_CONFIG,	/* id: config id, key: label */
+	USBG_IMG_UDC,			/* key: name */
+	USBG_IMG_MAX,
+};
+
+struct usbg_image_hdr
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t nrecs;
+	uint32_t strtab_len;
+};
+
+struct usbg_image_rec
+{
+	uint16_t type;
+	uint16_t id;
+	uint32_t key;
+	uint32_t val;
+	uint32_t len;
+};
+
+struct usbg_image
+{
+	void *addr;
+	size_t size;
+	const struct usbg_image_rec *recs;
+	uint32_t nrecs;
+	const char *strtab;
+	uint32_t strtab_len;
+};
+
+/*
+ * RPC between daemon and clients. Each request and response is a single
+ * SOCK_SEQPACKET message made of usbg_rpc_hdr followed by arguments.
+ * Integers are sent in host order, strings as u16 length and characters.
+ */
+#define USBG_RPC_MAX_MSG 65536
+
+enum usbg_rpc_op {
+	USBG_RPC_LIST = 1,
+	USBG_RPC_GET,
+	USBG_RPC_CREATE,
+	USBG_RPC_ENABLE,
+	USBG_RPC_DISABLE,
+	USBG_RPC_SWITCH,
+};
+
+struct usbg_rpc_hdr
+{
+	uint16_t op;
+	uint16_t reserved;
+	int32_t status;
+};
+
+struct usbg_rpc_msg
+{
+	char *buf;
+	size_t size;
+	size_t len;
+	size_t pos;
+	/* Set when message is too long or too short */
+	bool error;
+};
+
+void usbg_rpc_init(struct usbg_rpc_msg *m, char *buf, size_t size,
+		   uint16_t op, int32_t status);
+int usbg_rpc_parse(struct usbg_rpc_msg *m, char *buf, size_t len,
+		   struct usbg_rpc_hdr *hdr);
+void usbg_rpc_put_u32(struct usbg_rpc_msg *m, uint32_t val);
+void usbg_rpc_put_str(struct usbg_rpc_msg *m, const char *str);
+uint32_t usbg_rpc_get_u32(struct usbg_rpc_msg *m);
+void usbg_rpc_get_str(struct usbg_rpc_msg *m, char *str, size_t size);
+
 #define ARRAY_SIZE(array) (sizeof(array)/sizeof(*array))
 
 #define ARRAY_SIZE_SENTINEL(array, size)				\
@@ -208,6 +562,7 @@ struct usbg_udc
 #define FUNCTIONS_DIR "functions"
 #define GADGETS_DIR "usb_gadget"
 #define OS_DESC_DIR "os_desc"
+#define UDC_CLASS_DIR "/sys/class/udc"
 
 static inline int file_select(const struct dirent *dent)
 {
@@ -223,55 +578,217 @@ char *usbg_ether_ntoa_r(const struct ether_addr *addr, char *buf);
 
 
 
-int usbg_read_buf(const char *path, const char *name,
+int usbg_read_buf(const struct usbg_io *io, const char *path, const char *name,
 		  const char *file, char *buf);
 
-int usbg_read_buf_limited(const char *path, const char *name,
-			  const char *file, char *buf, int len);
+int usbg_read_buf_limited(const struct usbg_io *io, const char *path,
+			  const char *name, const char *file, char *buf,
+			  int len);
 
-int usbg_read_int(const char *path, const char *name, const char *file,
-		  int base, int *dest);
+int usbg_read_int(const struct usbg_io *io, const char *path, const char *name,
+		  const char *file, int base, int *dest);
 
-#define usbg_read_dec(p, n, f, d)	usbg_read_int(p, n, f, 10, d)
-#define usbg_read_hex(p, n, f, d)	usbg_read_int(p, n, f, 16, d)
+#define usbg_read_dec(io, p, n, f, d)	usbg_read_int(io, p, n, f, 10, d)
+#define usbg_read_hex(io, p, n, f, d)	usbg_read_int(io, p, n, f, 16, d)
 
-int usbg_read_bool(const char *path, const char *name,
-		   const char *file, bool *dest);
+int usbg_read_bool(const struct usbg_io *io, const char *path,
+		   const char *name, const char *file, bool *dest);
 
-int usbg_read_string(const char *path, const char *name,
-		     const char *file, char *buf);
+int usbg_read_string(const struct usbg_io *io, const char *path,
+		     const char *name, const char *file, char *buf);
 
-int usbg_read_string_limited(const char *path, const char *name,
-			     const char *file, char *buf, int len);
+int usbg_read_string_limited(const struct usbg_io *io, const char *path,
+			     const char *name, const char *file, char *buf,
+			     int len);
 
-int usbg_read_string_alloc(const char *path, const char *name,
-			   const char *file, char **dest);
+int usbg_read_string_alloc(const struct usbg_io *io, const char *path,
+			   const char *name, const char *file, char **dest);
 
-int usbg_read_buf_alloc(const char *path, const char *name,
-			const char *file, char **dest, int len);
+int usbg_read_buf_alloc(const struct usbg_io *io, const char *path,
+			const char *name, const char *file, char **dest,
+			int len);
 
-int usbg_write_buf(const char *path, const char *name,
-		   const char *file, const char *buf, int len);
+int usbg_write_buf(const struct usbg_io *io, const char *path,
+		   const char *name, const char *file, const char *buf, int len);
 
-int usbg_write_int(const char *path, const char *name, const char *file,
-		   int value, const char *str);
+int usbg_write_int(const struct usbg_io *io, const char *path,
+		   const char *name, const char *file, int value,
+		   const char *str);
 
-#define usbg_write_dec(p, n, f, v)	usbg_write_int(p, n, f, v, "%d\n")
-#define usbg_write_hex(p, n, f, v)	usbg_write_int(p, n, f, v, "0x%x\n")
-#define usbg_write_hex16(p, n, f, v)	usbg_write_int(p, n, f, v, "0x%04x\n")
-#define usbg_write_hex8(p, n, f, v)	usbg_write_int(p, n, f, v, "0x%02x\n")
-#define usbg_write_bool(p, n, f, v)	usbg_write_dec(p, n, f, !!v)
+#define usbg_write_dec(io, p, n, f, v)	usbg_write_int(io, p, n, f, v, "%d\n")
+#define usbg_write_hex(io, p, n, f, v)	usbg_write_int(io, p, n, f, v, "0x%x\n")
+#define usbg_write_hex16(io, p, n, f, v)	usbg_write_int(io, p, n, f, v, "0x%04x\n")
+#define usbg_write_hex8(io, p, n, f, v)	usbg_write_int(io, p, n, f, v, "0x%02x\n")
+#define usbg_write_bool(io, p, n, f, v)	usbg_write_dec(io, p, n, f, !!v)
 
-int usbg_write_string(const char *path, const char *name,
-		      const char *file, const char *buf);
+int usbg_write_string(const struct usbg_io *io, const char *path,
+		      const char *name, const char *file, const char *buf);
 
-int usbg_rm_file(const char *path, const char *name);
+int usbg_rm_file(const struct usbg_io *io, const char *path, const char *name);
 
-int usbg_rm_dir(const char *path, const char *name);
+int usbg_rm_dir(const struct usbg_io *io, const char *path, const char *name);
 
-int usbg_rm_all_dirs(const char *path);
+int usbg_rm_all_dirs(const struct usbg_io *io, const char *path);
+
+int usbg_check_dir(const struct usbg_io *io, const char *path);
+
+/*
+ * Filesystem backend, see usbg_io.c
+ *
+ * read and write transfer whole attribute and return number of bytes
+ * or usbg_error. Other operations follow their libc counterparts:
+ * 0 on success, -1 and errno on failure.
+ */
+struct usbg_io_ops
+{
+	int (*read)(void *priv, const char *path, char *buf, int len);
+	int (*write)(void *priv, const char *path, const char *buf, int len);
+	int (*scandir)(void *priv, const char *path, struct dirent ***namelist,
+		       int (*filter)(const struct dirent *),
+		       int (*compar)(const struct dirent **,
+				     const struct dirent **));
+	int (*is_dir)(void *priv, const char *path);
+	int (*mkdir)(void *priv, const char *path, mode_t mode);
+	int (*rmdir)(void *priv, const char *path);
+	int (*unlink)(void *priv, const char *path);
+	int (*symlink)(void *priv, const char *target, const char *path);
+	ssize_t (*readlink)(void *priv, const char *path, char *buf,
+			    size_t len);
+	int (*lstat)(void *priv, const char *path, struct stat *st);
+	int (*stat)(void *priv, const char *path, struct stat *st);
+	/* Called for each state which starts to use this backend */
+	void (*get)(void *priv);
+	/* Called for each state using this backend when it is cleaned up */
+	void (*release)(void *priv);
+};
+
+/* libc backend, used unless state is given another one */
+extern const struct usbg_io_ops usbg_posix_ops;
+
+int usbg_io_read(const struct usbg_io *io, const char *path, char *buf,
+		 int len);
+int usbg_io_write(const struct usbg_io *io, const char *path,
+		  const char *buf, int len);
+int usbg_io_scandir(const struct usbg_io *io, const char *path,
+		    struct dirent ***namelist,
+		    int (*filter)(const struct dirent *),
+		    int (*compar)(const struct dirent **,
+				  const struct dirent **));
+int usbg_io_is_dir(const struct usbg_io *io, const char *path);
+int usbg_io_mkdir(const struct usbg_io *io, const char *path, mode_t mode);
+int usbg_io_rmdir(const struct usbg_io *io, const char *path);
+int usbg_io_unlink(const struct usbg_io *io, const char *path);
+int usbg_io_symlink(const struct usbg_io *io, const char *target,
+		    const char *path);
+ssize_t usbg_io_readlink(const struct usbg_io *io, const char *path,
+			 char *buf, size_t len);
+int usbg_io_lstat(const struct usbg_io *io, const char *path,
+		  struct stat *st);
+int usbg_io_stat(const struct usbg_io *io, const char *path, struct stat *st);
+
+/* NULL for NULL object, so they may be used before arguments are checked */
+static inline const struct usbg_io *usbg_gadget_io(usbg_gadget *g)
+{
+	return g ? &g->parent->io : NULL;
+}
+
+static inline const struct usbg_io *usbg_config_io(usbg_config *c)
+{
+	return c ? &c->parent->parent->io : NULL;
+}
+
+static inline const struct usbg_io *usbg_function_io(usbg_function *f)
+{
+	return f ? &f->parent->parent->io : NULL;
+}
+
+static inline const struct usbg_io *usbg_binding_io(usbg_binding *b)
+{
+	return b ? &b->parent->parent->parent->io : NULL;
+}
+
+static inline const struct usbg_io *usbg_udc_io(usbg_udc *u)
+{
+	return u ? &u->parent->io : NULL;
+}
+
+int usbg_init_io(const char *configfs_path, const char *udc_path,
+		 const struct usbg_io_ops *ops, void *priv, usbg_state **state);
+
+/*
+ * Counters, see usbg_stats.c
+ */
+static inline void usbg_stats_add(uint64_t *counter, uint64_t n)
+{
+	__atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+/* Public call which is traced but has no usbg_stat_op */
+#define USBG_STAT_OP_NONE -1
+
+/* Paths longer than that are truncated in probes */
+#define USBG_CALL_PATH_LENGTH 256
+
+/*
+ * Public call in progress. Path of the object it works on is formatted
+ * only when a tracer is attached to api probes.
+ */
+struct usbg_call
+{
+	const char *func;
+	int op;
+	bool outer;
+	uint64_t start;
+	char path[USBG_CALL_PATH_LENGTH];
+};
+
+void usbg_stats_begin(struct usbg_call *call, const char *func, int op,
+		      const char *dir, const char *name);
+void usbg_stats_begin_outer(struct usbg_call *call, const char *func,
+			    int op, const char *dir, const char *name);
+void usbg_stats_worker_begin(void);
+void usbg_stats_worker_end(void);
+void usbg_stats_end(struct usbg_call *call, usbg_state *s, int ret);
+
+/*
+ * Public call on object with path and name, which may be NULL when
+ * called with invalid arguments. Calls without op are only traced.
+ */
+#define USBG_CALL_BEGIN_OP(call, op, obj)				\
+	usbg_stats_begin(call, __func__, op,				\
+			 (obj) ? (obj)->path : NULL,			\
+			 (obj) ? (obj)->name : NULL)
+#define USBG_CALL_BEGIN(call, obj)					\
+	USBG_CALL_BEGIN_OP(call, USBG_STAT_OP_NONE, obj)
+#define USBG_CALL_END(call, ret) usbg_stats_end(call, NULL, ret)
+
+/*
+ * Static tracepoints of provider libusbgx, a nop unless built with
+ * sys/sdt.h. Probes are:
+ *   api__entry(func, path), api__return(func, path, op, ret, ns) -
+ *     public calls, nested ones included. Path is the object which is
+ *     worked on, op is usbg_stat_op or -1 for calls which aren't
+ *     accounted and ns is 0 unless the call was timed.
+ *   io__entry(op, path), io__return(op, path, ret) - each filesystem
+ *     operation, op is a string like "read" or "mkdir"
+ * e.g. bpftrace -e 'usdt:libusbgx.so:libusbgx:io__return
+ *	{ printf("%s %s %d\n", str(arg0), str(arg1), arg2); }'
+ * Semaphores are defined in usbg_stats.c, one for each probe.
+ */
+#ifdef HAVE_SYS_SDT_H
+#define USBG_PROBE(name, ...) STAP_PROBEV(libusbgx, name, __VA_ARGS__)
+#define USBG_PROBE_ENABLED(name) \
+	__builtin_expect(libusbgx_##name##_semaphore, 0)
+
+extern unsigned short libusbgx_api__entry_semaphore;
+extern unsigned short libusbgx_api__return_semaphore;
+extern unsigned short libusbgx_io__entry_semaphore;
+extern unsigned short libusbgx_io__return_semaphore;
+#else
+#define USBG_PROBE(name, ...) do { } while (0)
+#define USBG_PROBE_ENABLED(name) 0
+#endif
 
-int usbg_check_dir(const char *path);
 #define usbg_config_is_int(node) (config_setting_type(node) == CONFIG_TYPE_INT)
 #define usbg_config_is_string(node) \
 	(config_setting_type(node) == CONFIG_TYPE_STRING)
@@ -324,56 +841,154 @@ void usbg_cleanup_function(struct usbg_function *f);
 		free(ff);						\
 	}
 
-typedef int (*usbg_attr_get_func)(const char *, const char *, const char *, void *);
-typedef int (*usbg_attr_set_func)(const char *, const char *, const char *, void *);
+typedef int (*usbg_attr_get_func)(const struct usbg_io *, const char *,
+				  const char *, const char *, void *);
+typedef int (*usbg_attr_set_func)(const struct usbg_io *, const char *,
+				  const char *, const char *, void *);
 
-static inline int usbg_get_dec(const char *path, const char *name,
-			   const char *attr, void *val)
+static inline int usbg_get_dec(const struct usbg_io *io, const char *path,
+			       const char *name, const char *attr, void *val)
 {
-	return usbg_read_dec(path, name, attr, (int *)val);
+	return usbg_read_dec(io, path, name, attr, (int *)val);
 }
 
-static inline int usbg_set_dec(const char *path, const char *name,
-			   const char *attr, void *val)
+static inline int usbg_set_dec(const struct usbg_io *io, const char *path,
+			       const char *name, const char *attr, void *val)
 {
-	return usbg_write_dec(path, name, attr, *((int *)val));
+	return usbg_write_dec(io, path, name, attr, *((int *)val));
 }
 
-static inline int usbg_get_bool(const char *path, const char *name,
-			   const char *attr, void *val)
+static inline int usbg_get_bool(const struct usbg_io *io, const char *path,
+				const char *name, const char *attr, void *val)
 {
-	return usbg_read_bool(path, name, attr, (bool *)val);
+	return usbg_read_bool(io, path, name, attr, (bool *)val);
 }
 
-static inline int usbg_set_bool(const char *path, const char *name,
-			   const char *attr, void *val)
+static inline int usbg_set_bool(const struct usbg_io *io, const char *path,
+				const char *name, const char *attr, void *val)
 {
-	return usbg_write_bool(path, name, attr, *((bool *)val));
+	return usbg_write_bool(io, path, name, attr, *((bool *)val));
 }
 
-static inline int usbg_get_string(const char *path, const char *name,
-			      const char *attr, void *val)
+static inline int usbg_get_string(const struct usbg_io *io, const char *path,
+				  const char *name, const char *attr, void *val)
 {
-	return usbg_read_string_alloc(path, name, attr, (char **)val);
+	return usbg_read_string_alloc(io, path, name, attr, (char **)val);
 }
 
-static inline int usbg_set_string(const char *path, const char *name,
-			      const char *attr, void *val)
+static inline int usbg_set_string(const struct usbg_io *io, const char *path,
+				  const char *name, const char *attr, void *val)
+{
+	return usbg_write_string(io, path, name, attr, *(char **)val);
+}
+
+int usbg_get_ether_addr(const struct usbg_io *io, const char *path,
+			const char *name, const char *attr, void *val);
+
+int usbg_set_ether_addr(const struct usbg_io *io, const char *path,
+			const char *name, const char *attr, void *val);
+
+int usbg_get_dev(const struct usbg_io *io, const char *path, const char *name,
+		 const char *attr, void *val);
+
+int usbg_write_guid(const struct usbg_io *io, const char *path,
+		    const char *name, const char *file, const char *buf);
+
+extern struct usbg_function_type *function_types[];
+
+/*
+ * Describe validation failure in user buffer (if any)
+ * and return given error code
+ */
+int usbg_validation_fail(char *buf, int len, int ret, const char *fmt, ...)
+	__attribute__ ((format (printf, 4, 5)));
+
+/*
+ * Periodic bandwidth estimates in bytes per second,
+ * shared by live gadgets and scheme validation
+ */
+uint64_t usbg_speed_bandwidth(usbg_speed speed);
+uint64_t usbg_audio_bandwidth(usbg_speed speed, int chmask, int srate,
+			      int ssize, int hs_bint, bool feedback);
+uint64_t usbg_video_bandwidth(usbg_speed speed, int maxpacket, int maxburst,
+			      int interval);
+uint64_t usbg_hid_bandwidth(usbg_speed speed, unsigned int report_length);
+bool usbg_function_type_is_periodic(int type);
+
+/* Maximum speed of the fastest UDC in the system */
+usbg_speed usbg_fastest_udc_speed(usbg_state *s);
+
+/* Interfaces and endpoints which kernel creates for functions */
+void usbg_type_ep_budget(int type, struct usbg_ep_budget *b);
+void usbg_uac2_ep_budget(int c_chmask, int p_chmask, bool feedback,
+			 bool controls, struct usbg_ep_budget *b);
+
+/* The largest endpoint inventory of all UDCs or usbg_error if unknown */
+int usbg_max_udc_endpoints(usbg_state *s);
+
+/* Add gadget created in configfs behind library's back to the state */
+int usbg_load_gadget(usbg_state *s, const char *name, usbg_gadget **g);
+
+/* Parse gadget again after its directory has been changed */
+int usbg_reload_gadget(usbg_gadget *g);
+
+/* Drop gadget whose directory has already been removed from state */
+int usbg_forget_gadget(usbg_gadget *g);
+
+/* Remove directory with everything inside of it, links first */
+int usbg_rm_dir_tree(const struct usbg_io *io, const char *path);
+
+/* Create function in configfs without adding it to g->functions */
+int usbg_create_function_detached(usbg_gadget *g, usbg_function_type type,
+				  const char *instance, void *f_attrs,
+				  usbg_function **f);
+
+/*
+ * Mark object as modified, called by each mutating function. Counter
+ * is atomic, as objects of one state may be modified from many threads.
+ */
+static inline void usbg_touch_gadget(usbg_gadget *g)
 {
-	return usbg_write_string(path, name, attr, *(char **)val);
+	g->generation = __atomic_add_fetch(&g->parent->generation, 1,
+					  __ATOMIC_RELAXED);
 }
 
-int usbg_get_ether_addr(const char *path, const char *name, const char *attr,
-			void *val);
+static inline void usbg_touch_config(usbg_config *c)
+{
+	c->generation = __atomic_add_fetch(&c->parent->parent->generation,
+					  1, __ATOMIC_RELAXED);
+}
 
-int usbg_set_ether_addr(const char *path, const char *name, const char *attr,
-			void *val);
+static inline void usbg_touch_function(usbg_function *f)
+{
+	f->generation = __atomic_add_fetch(&f->parent->parent->generation,
+					  1, __ATOMIC_RELAXED);
+}
 
-int usbg_get_dev(const char *path, const char *name, const char *attr,
-		 void *val);
+/*
+ * Program of arbitrary directory and its replay, paths are relative to it.
+ * If rel is not empty only that subdirectory is compiled. Without children
+ * functions and configs of gadget are created empty.
+ */
+int usbg_compile_program_dir(const struct usbg_io *io, const char *path,
+			     const char *rel, bool children, usbg_program **p);
+int usbg_apply_program_ops(const struct usbg_io *io, const char *path,
+			   struct usbg_program_op *ops, int nops);
+/*
+ * Fingerprints taken from cache only, without reading configfs.
+ * USBG_ERROR_NOT_FOUND if object has changed since the last time its
+ * fingerprint was computed.
+ */
+int usbg_get_cached_gadget_fingerprint(usbg_gadget *g, uint64_t *fp);
+int usbg_get_cached_config_fingerprint(usbg_config *c, uint64_t *fp);
+int usbg_get_cached_function_fingerprint(usbg_function *f, uint64_t *fp);
 
-int usbg_write_guid(const char *path, const char *name,
-		    const char *file, const char *buf);
+/*
+ * Check operation which comes from untrusted file. Its path and target
+ * of link have to be relative and must not leave the directory.
+ */
+int usbg_check_program_op(int type, const char *path, const char *data,
+			  int len);
 
 /*
  * return:
@@ -44,6 +44,12 @@ static int p9fs_get_attrs(struct usbg_function *f, void *f_attrs)
 	return usbg_f_9pfs_get_dev_name(usbg_to_9pfs(f), f_attrs);
 }
 
+static int p9fs_clone(struct usbg_function *f, struct usbg_function *from)
+{
+	/* The only attribute, dev_name is just instance name */
+	return USBG_SUCCESS;
+}
+
 static void p9fs_cleanup_attrs(struct usbg_function *f, void *f_attrs)
 {
 	free(*(char **)f_attrs);
@@ -68,6 +74,7 @@ struct usbg_function_type usbg_f_type_9pfs = {
 	.set_attrs = p9fs_set_attrs,
 	.get_attrs = p9fs_get_attrs,
 	.cleanup_attrs = p9fs_cleanup_attrs,
+	.clone = p9fs_clone,
 	.import = p9fs_libconfig_import,
 	.export = p9fs_libconfig_export,
 };
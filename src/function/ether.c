@@ -102,6 +102,22 @@ static void ether_cleanup_attrs(struct usbg_function *f, void *f_attrs)
 	usbg_f_net_cleanup_attrs(f_attrs);
 }
 
+static int ether_clone(struct usbg_function *f, struct usbg_function *from)
+{
+	struct usbg_f_net_attrs attrs;
+	int ret;
+
+	ret = usbg_f_net_get_attrs(usbg_to_net_function(from), &attrs);
+	if (ret)
+		return ret;
+
+	/* ifname is skipped as it is assigned by kernel */
+	ret = usbg_f_net_set_attrs(usbg_to_net_function(f), &attrs);
+	usbg_f_net_cleanup_attrs(&attrs);
+
+	return ret;
+}
+
 #ifdef HAS_GADGET_SCHEMES
 
 static int ether_libconfig_import(struct usbg_function *f,
@@ -172,6 +188,7 @@ static int ether_libconfig_export(struct usbg_function *f,
 	.set_attrs = ether_set_attrs,		\
 	.get_attrs = ether_get_attrs,		\
 	.cleanup_attrs = ether_cleanup_attrs,	\
+	.clone = ether_clone,			\
 	ETHER_LIBCONFIG_DEP_OPS
 
 struct usbg_function_type usbg_f_type_ecm = {
@@ -272,38 +289,59 @@ int usbg_f_net_set_attrs(usbg_f_net *nf,
 int usbg_f_net_get_attr_val(usbg_f_net *nf, enum usbg_f_net_attr attr,
 			    union usbg_f_net_attr_val *val)
 {
-	return net_attr[attr].get(nf->func.path, nf->func.name,
-				    net_attr[attr].name, val);
+	const struct usbg_io *io = usbg_function_io(&nf->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &nf->func);
+	ret = net_attr[attr].get(io, nf->func.path, nf->func.name,
+				 net_attr[attr].name, val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_net_set_attr_val(usbg_f_net *nf, enum usbg_f_net_attr attr,
 			    union usbg_f_net_attr_val val)
 {
-	return net_attr[attr].ro ?
-		USBG_ERROR_INVALID_PARAM :
-		net_attr[attr].set(nf->func.path, nf->func.name,
-				   net_attr[attr].name, &val);
+	const struct usbg_io *io = usbg_function_io(&nf->func);
+	struct usbg_call call;
+	int ret;
+
+	if (net_attr[attr].ro)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, &nf->func);
+	usbg_touch_function(&nf->func);
+	ret = net_attr[attr].set(io, nf->func.path, nf->func.name,
+				 net_attr[attr].name, &val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_net_get_ifname_s(usbg_f_net *nf, char *buf, int len)
 {
+	const struct usbg_io *io = usbg_function_io(&nf->func);
 	struct usbg_function *f;
 	int ret;
+	struct usbg_call call;
 
 	if (!nf || !buf)
 		return USBG_ERROR_INVALID_PARAM;
 
+	USBG_CALL_BEGIN(&call, &nf->func);
 	f = &nf->func;
 	/*
 	 * TODO:
 	 * Rework usbg_common to make this function consistent with doc.
 	 * This below is only an ugly hack
 	 */
-	ret = usbg_read_string_limited(f->path, f->name, "ifname", buf, len);
+	ret = usbg_read_string_limited(io, f->path, f->name, "ifname", buf,
+				       len);
 	if (ret)
 		goto out;
 
 	ret = strlen(buf);
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
@@ -40,6 +40,12 @@ static int ffs_get_attrs(struct usbg_function *f, void *f_attrs)
 	return usbg_f_fs_get_dev_name(usbg_to_fs_function(f), f_attrs);
 }
 
+static int ffs_clone(struct usbg_function *f, struct usbg_function *from)
+{
+	/* The only attribute, dev_name is just instance name */
+	return USBG_SUCCESS;
+}
+
 static void ffs_cleanup_attrs(struct usbg_function *f, void *f_attrs)
 {
 	free(*(char **)f_attrs);
@@ -64,6 +70,7 @@ struct usbg_function_type usbg_f_type_ffs = {
 	.set_attrs = ffs_set_attrs,
 	.get_attrs = ffs_get_attrs,
 	.cleanup_attrs = ffs_cleanup_attrs,
+	.clone = ffs_clone,
 	.import = ffs_libconfig_import,
 	.export = ffs_libconfig_export,
 };
@@ -44,14 +44,14 @@ struct usbg_f_hid {
 		.export = usbg_set_config_node_dev,		        \
 	}
 
-static int hid_get_report(const char *path, const char *name, const char *attr,
-			  void *val)
+static int hid_get_report(const struct usbg_io *io, const char *path,
+			  const char *name, const char *attr, void *val)
 {
 	struct usbg_f_hid_report_desc *report_desc = val;
 	char buf[USBG_MAX_FILE_SIZE];
 	int ret;
 
-	ret = usbg_read_buf(path, name, attr, buf);
+	ret = usbg_read_buf(io, path, name, attr, buf);
 	if (ret < 0)
 		return ret;
 
@@ -68,8 +68,8 @@ static int hid_get_report(const char *path, const char *name, const char *attr,
 	return 0;
 }
 
-static int hid_set_report(const char *path, const char *name, const char *attr,
-			  void *val)
+static int hid_set_report(const struct usbg_io *io, const char *path,
+			  const char *name, const char *attr, void *val)
 {
 	struct usbg_f_hid_report_desc *report_desc = val;
 	char *buf = report_desc->desc;
@@ -81,7 +81,7 @@ static int hid_set_report(const char *path, const char *name, const char *attr,
 		len = 1;
 	}
 
-	ret = usbg_write_buf(path, name, attr, buf, len);
+	ret = usbg_write_buf(io, path, name, attr, buf, len);
 	if (ret > 0)
 		ret = USBG_SUCCESS;
 
@@ -152,7 +152,7 @@ static int hid_set_config_node_report(config_setting_t *root,
 		return USBG_ERROR_NO_MEM;
 
 	for (i = 0; i < report_desc->len; ++i) {
-		int tmp = report_desc->desc[i];
+		int tmp = (unsigned char)report_desc->desc[i];
 		ret = usbg_set_config_node_int_hex(node, NULL, &tmp);
 		if (ret)
 			return ret;
@@ -341,16 +341,32 @@ int usbg_f_hid_set_attrs(usbg_f_hid *hf,
 int usbg_f_hid_get_attr_val(usbg_f_hid *hf, enum usbg_f_hid_attr attr,
 			    union usbg_f_hid_attr_val *val)
 {
-	return hid_attr[attr].get(hf->func.path, hf->func.name,
-				  hid_attr[attr].name, val);
+	const struct usbg_io *io = usbg_function_io(&hf->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &hf->func);
+	ret = hid_attr[attr].get(io, hf->func.path, hf->func.name,
+				 hid_attr[attr].name, val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_hid_set_attr_val(usbg_f_hid *hf, enum usbg_f_hid_attr attr,
 			    union usbg_f_hid_attr_val val)
 {
-	return hid_attr[attr].ro ?
-		USBG_ERROR_INVALID_PARAM :
-		hid_attr[attr].set(hf->func.path, hf->func.name,
-				  hid_attr[attr].name, &val);
+	const struct usbg_io *io = usbg_function_io(&hf->func);
+	struct usbg_call call;
+	int ret;
+
+	if (hid_attr[attr].ro)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, &hf->func);
+	usbg_touch_function(&hf->func);
+	ret = hid_attr[attr].set(io, hf->func.path, hf->func.name,
+				 hid_attr[attr].name, &val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
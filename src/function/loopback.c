@@ -177,14 +177,29 @@ int usbg_f_loopback_set_attrs(usbg_f_loopback *lf,
 int usbg_f_loopback_get_attr_val(usbg_f_loopback *lf,
 				 enum usbg_f_loopback_attr attr, int *val)
 {
-	return usbg_read_dec(lf->func.path, lf->func.name,
-			     loopback_attr_names[attr], val);
+	const struct usbg_io *io = usbg_function_io(&lf->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &lf->func);
+	ret = usbg_read_dec(io, lf->func.path, lf->func.name,
+			    loopback_attr_names[attr], val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_loopback_set_attr_val(usbg_f_loopback *lf,
 				 enum usbg_f_loopback_attr attr, int val)
 {
-	return usbg_write_dec(lf->func.path, lf->func.name,
+	const struct usbg_io *io = usbg_function_io(&lf->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &lf->func);
+	usbg_touch_function(&lf->func);
+	ret = usbg_write_dec(io, lf->func.path, lf->func.name,
 			     loopback_attr_names[attr], val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
@@ -199,36 +199,55 @@ int usbg_f_midi_set_attrs(usbg_f_midi *mf,
 int usbg_f_midi_get_attr_val(usbg_f_midi *mf, enum usbg_f_midi_attr attr,
 			    union usbg_f_midi_attr_val *val)
 {
-	return midi_attr[attr].get(mf->func.path, mf->func.name,
-				    midi_attr[attr].name, val);
+	const struct usbg_io *io = usbg_function_io(&mf->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &mf->func);
+	ret = midi_attr[attr].get(io, mf->func.path, mf->func.name,
+				  midi_attr[attr].name, val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_midi_set_attr_val(usbg_f_midi *mf, enum usbg_f_midi_attr attr,
 			    union usbg_f_midi_attr_val val)
 {
-	return midi_attr[attr].set(mf->func.path, mf->func.name,
-				    midi_attr[attr].name, &val);
+	const struct usbg_io *io = usbg_function_io(&mf->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &mf->func);
+	usbg_touch_function(&mf->func);
+	ret = midi_attr[attr].set(io, mf->func.path, mf->func.name,
+				  midi_attr[attr].name, &val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_midi_get_id_s(usbg_f_midi *mf, char *buf, int len)
 {
+	const struct usbg_io *io = usbg_function_io(&mf->func);
 	struct usbg_function *f;
 	int ret;
+	struct usbg_call call;
 
 	if (!mf || !buf)
 		return USBG_ERROR_INVALID_PARAM;
 
+	USBG_CALL_BEGIN(&call, &mf->func);
 	f = &mf->func;
 	/*
 	 * TODO:
 	 * Rework usbg_common to make this function consistent with doc.
 	 * This below is only an ugly hack
 	 */
-	ret = usbg_read_string_limited(f->path, f->name, "id", buf, len);
+	ret = usbg_read_string_limited(io, f->path, f->name, "id", buf, len);
 	if (ret)
 		goto out;
 
 	ret = strlen(buf);
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
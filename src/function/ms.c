@@ -109,6 +109,7 @@ err:
 
 int init_luns(struct usbg_f_ms *ms)
 {
+	const struct usbg_io *io = usbg_function_io(&ms->func);
 	struct dirent **dent;
 	char lpath[USBG_MAX_PATH_LENGTH];
 	int nmb, i, id;
@@ -121,7 +122,7 @@ int init_luns(struct usbg_f_ms *ms)
 		return ret;
 	}
 
-	nmb = scandir(lpath, &dent, lun_select, lun_sort);
+	nmb = usbg_io_scandir(io, lpath, &dent, lun_select, lun_sort);
 	if (nmb < 0) {
 		ret = usbg_translate_error(errno);
 		return ret;
@@ -496,12 +497,28 @@ out:
 
 int usbg_f_ms_get_stall(usbg_f_ms *mf, bool *stall)
 {
-	return usbg_read_bool(mf->func.path, mf->func.name, "stall", stall);
+	const struct usbg_io *io = usbg_function_io(&mf->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &mf->func);
+	ret = usbg_read_bool(io, mf->func.path, mf->func.name, "stall", stall);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_ms_set_stall(usbg_f_ms *mf, bool stall)
 {
-	return usbg_write_bool(mf->func.path, mf->func.name, "stall", stall);
+	const struct usbg_io *io = usbg_function_io(&mf->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &mf->func);
+	usbg_touch_function(&mf->func);
+	ret = usbg_write_bool(io, mf->func.path, mf->func.name, "stall",
+			      stall);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_ms_get_nluns(usbg_f_ms *mf, int *nluns)
@@ -516,9 +533,10 @@ int usbg_f_ms_get_nluns(usbg_f_ms *mf, int *nluns)
 	return 0;
 }
 
-int usbg_f_ms_create_lun(usbg_f_ms *mf, int lun_id,
-			 struct usbg_f_ms_lun_attrs *lattrs)
+static int ms_do_create_lun(usbg_f_ms *mf, int lun_id,
+			    struct usbg_f_ms_lun_attrs *lattrs)
 {
+	const struct usbg_io *io = usbg_function_io(&mf->func);
 	int ret;
 	bool *luns;
 	char lpath[USBG_MAX_PATH_LENGTH];
@@ -535,7 +553,8 @@ int usbg_f_ms_create_lun(usbg_f_ms *mf, int lun_id,
 	if (ret >= sizeof(lpath))
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	ret = mkdir(lpath, S_IRWXU|S_IRWXG|S_IRWXO);
+	usbg_touch_function(&mf->func);
+	ret = usbg_io_mkdir(io, lpath, S_IRWXU|S_IRWXG|S_IRWXO);
 	if (ret)
 		return usbg_translate_error(errno);
 
@@ -549,12 +568,26 @@ int usbg_f_ms_create_lun(usbg_f_ms *mf, int lun_id,
 	return 0;
 
 remove_lun:
-	rmdir(lpath);
+	usbg_io_rmdir(io, lpath);
 	return ret;
 }
 
-int usbg_f_ms_rm_lun(usbg_f_ms *mf, int lun_id)
+int usbg_f_ms_create_lun(usbg_f_ms *mf, int lun_id,
+			 struct usbg_f_ms_lun_attrs *lattrs)
+{
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &mf->func);
+	ret = ms_do_create_lun(mf, lun_id, lattrs);
+	USBG_CALL_END(&call, ret);
+
+	return ret;
+}
+
+static int ms_do_rm_lun(usbg_f_ms *mf, int lun_id)
 {
+	const struct usbg_io *io = usbg_function_io(&mf->func);
 	int ret;
 	bool *luns;
 	char lpath[USBG_MAX_PATH_LENGTH];
@@ -571,7 +604,8 @@ int usbg_f_ms_rm_lun(usbg_f_ms *mf, int lun_id)
 	if (ret >= sizeof(lpath))
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	ret = rmdir(lpath);
+	usbg_touch_function(&mf->func);
+	ret = usbg_io_rmdir(io, lpath);
 	if (ret)
 		return usbg_translate_error(errno);
 
@@ -579,6 +613,18 @@ int usbg_f_ms_rm_lun(usbg_f_ms *mf, int lun_id)
 	return ret;
 }
 
+int usbg_f_ms_rm_lun(usbg_f_ms *mf, int lun_id)
+{
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &mf->func);
+	ret = ms_do_rm_lun(mf, lun_id);
+	USBG_CALL_END(&call, ret);
+
+	return ret;
+}
+
 int usbg_f_ms_get_lun_attrs(usbg_f_ms *mf, int lun_id,
 			struct usbg_f_ms_lun_attrs *lattrs)
 {
@@ -622,37 +668,55 @@ int usbg_f_ms_get_lun_attr_val(usbg_f_ms *mf, int lun_id,
 			       enum usbg_f_ms_lun_attr lattr,
 			       union usbg_f_ms_lun_attr_val *val)
 {
+	const struct usbg_io *io = usbg_function_io(&mf->func);
 	char lpath[USBG_MAX_PATH_LENGTH];
 	int ret;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, &mf->func);
 	ret = snprintf(lpath, sizeof(lpath), "%s/%s/lun.%d/",
 		       mf->func.path, mf->func.name, lun_id);
-	if (ret >= sizeof(lpath))
-		return USBG_ERROR_PATH_TOO_LONG;
+	if (ret >= sizeof(lpath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		USBG_CALL_END(&call, ret);
+		return ret;
+	}
 
-	return ms_lun_attr[lattr].get(lpath, "",
-				    ms_lun_attr[lattr].name, val);
+	ret = ms_lun_attr[lattr].get(io, lpath, "",
+				     ms_lun_attr[lattr].name, val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_ms_set_lun_attr_val(usbg_f_ms *mf, int lun_id,
 			       enum usbg_f_ms_lun_attr lattr,
 			       union usbg_f_ms_lun_attr_val val)
 {
+	const struct usbg_io *io = usbg_function_io(&mf->func);
 	char lpath[USBG_MAX_PATH_LENGTH];
 	int ret;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, &mf->func);
 	ret = snprintf(lpath, sizeof(lpath), "%s/%s/lun.%d/",
 		       mf->func.path, mf->func.name, lun_id);
-	if (ret >= sizeof(lpath))
-		return USBG_ERROR_PATH_TOO_LONG;
+	if (ret >= sizeof(lpath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		USBG_CALL_END(&call, ret);
+		return ret;
+	}
 
-	return 	ms_lun_attr[lattr].set(lpath, "",
-				       ms_lun_attr[lattr].name, &val);
+	usbg_touch_function(&mf->func);
+	ret = ms_lun_attr[lattr].set(io, lpath, "",
+				     ms_lun_attr[lattr].name, &val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
-int usbg_f_ms_get_lun_file_s(usbg_f_ms *mf, int lun_id,
-				 char *buf, int len)
+static int ms_do_get_lun_file_s(usbg_f_ms *mf, int lun_id,
+				    char *buf, int len)
 {
+	const struct usbg_io *io = usbg_function_io(&mf->func);
 	char lpath[USBG_MAX_PATH_LENGTH];
 	int ret;
 
@@ -668,7 +732,7 @@ int usbg_f_ms_get_lun_file_s(usbg_f_ms *mf, int lun_id,
 	 * Rework usbg_common to make this function consistent with doc.
 	 * This below is only an ugly hack
 	 */
-	ret = usbg_read_string_limited(lpath, "", "filename", buf, len);
+	ret = usbg_read_string_limited(io, lpath, "", "filename", buf, len);
 	if (ret)
 		goto out;
 
@@ -676,3 +740,16 @@ int usbg_f_ms_get_lun_file_s(usbg_f_ms *mf, int lun_id,
 out:
 	return ret;
 }
+
+int usbg_f_ms_get_lun_file_s(usbg_f_ms *mf, int lun_id,
+				 char *buf, int len)
+{
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &mf->func);
+	ret = ms_do_get_lun_file_s(mf, lun_id, buf, len);
+	USBG_CALL_END(&call, ret);
+
+	return ret;
+}
@@ -39,6 +39,12 @@ static int phonet_get_attrs(struct usbg_function *f, void *f_attrs)
 	return usbg_f_phonet_get_ifname(usbg_to_phonet_function(f), f_attrs);
 }
 
+static int phonet_clone(struct usbg_function *f, struct usbg_function *from)
+{
+	/* The only attribute, ifname is assigned by kernel */
+	return USBG_SUCCESS;
+}
+
 static void phonet_cleanup_attrs(struct usbg_function *f, void *f_attrs)
 {
 	free(*(char **)f_attrs);
@@ -63,6 +69,7 @@ struct usbg_function_type usbg_f_type_phonet = {
 	.set_attrs = phonet_set_attrs,
 	.get_attrs = phonet_get_attrs,
 	.cleanup_attrs = phonet_cleanup_attrs,
+	.clone = phonet_clone,
 	.import = phonet_libconfig_import,
 	.export = phonet_libconfig_export,
 };
@@ -82,32 +89,43 @@ usbg_function *usbg_from_phonet_function(usbg_f_phonet *pf)
 
 int usbg_f_phonet_get_ifname(usbg_f_phonet *pf, char **ifname)
 {
+	const struct usbg_io *io = usbg_function_io(&pf->func);
 	struct usbg_function *f = &pf->func;
+	struct usbg_call call;
+	int ret;
 
 	if (!pf || !ifname)
 		return USBG_ERROR_INVALID_PARAM;
 
-	return usbg_read_string_alloc(f->path, f->name, "ifname", ifname);
+	USBG_CALL_BEGIN(&call, &pf->func);
+	ret = usbg_read_string_alloc(io, f->path, f->name, "ifname", ifname);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_phonet_get_ifname_s(usbg_f_phonet *pf, char *buf, int len)
 {
+	const struct usbg_io *io = usbg_function_io(&pf->func);
 	struct usbg_function *f = &pf->func;
 	int ret;
+	struct usbg_call call;
 
 	if (!pf || !buf)
 		return USBG_ERROR_INVALID_PARAM;
 
+	USBG_CALL_BEGIN(&call, &pf->func);
 	/*
 	 * TODO:
 	 * Rework usbg_common to make this function consistent with doc.
 	 * This below is only an ugly hack
 	 */
-	ret = usbg_read_string_limited(f->path, f->name, "ifname", buf, len);
+	ret = usbg_read_string_limited(io, f->path, f->name, "ifname", buf,
+				       len);
 	if (ret)
 		goto out;
 
 	ret = strlen(buf);
 out:	
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
@@ -38,6 +38,12 @@ static int serial_get_attrs(struct usbg_function *f, void *f_attrs)
 	return usbg_f_serial_get_port_num(usbg_to_serial_function(f), f_attrs);
 }
 
+static int serial_clone(struct usbg_function *f, struct usbg_function *from)
+{
+	/* The only attribute, port_num is assigned by kernel */
+	return USBG_SUCCESS;
+}
+
 static int serial_libconfig_import(struct usbg_function *f,
 				  config_setting_t *root)
 {
@@ -56,6 +62,7 @@ static int serial_libconfig_export(struct usbg_function *f,
 	.free_inst = serial_free_inst,	        \
 	.set_attrs = serial_set_attrs,	        \
 	.get_attrs = serial_get_attrs,	        \
+	.clone = serial_clone,			\
 	.export = serial_libconfig_export,	\
 	.import = serial_libconfig_import
 
@@ -91,7 +98,14 @@ usbg_function *usbg_from_serial_function(usbg_f_serial *sf)
 
 int usbg_f_serial_get_port_num(usbg_f_serial *sf, int *port_num)
 {
-	return usbg_read_dec(sf->func.path, sf->func.name,
-			     "port_num", port_num);
+	const struct usbg_io *io = usbg_function_io(&sf->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &sf->func);
+	ret = usbg_read_dec(io, sf->func.path, sf->func.name,
+			    "port_num", port_num);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
@@ -224,13 +224,28 @@ int usbg_f_uac2_set_attrs(usbg_f_uac2 *af,
 int usbg_f_uac2_get_attr_val(usbg_f_uac2 *af, enum usbg_f_uac2_attr attr,
 			    union usbg_f_uac2_attr_val *val)
 {
-	return uac2_attr[attr].get(af->func.path, af->func.name,
-				    uac2_attr[attr].name, val);
+	const struct usbg_io *io = usbg_function_io(&af->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &af->func);
+	ret = uac2_attr[attr].get(io, af->func.path, af->func.name,
+				  uac2_attr[attr].name, val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_uac2_set_attr_val(usbg_f_uac2 *af, enum usbg_f_uac2_attr attr,
 			     union usbg_f_uac2_attr_val val)
 {
-	return uac2_attr[attr].set(af->func.path, af->func.name,
-				    uac2_attr[attr].name, &val);
+	const struct usbg_io *io = usbg_function_io(&af->func);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &af->func);
+	usbg_touch_function(&af->func);
+	ret = uac2_attr[attr].set(io, af->func.path, af->func.name,
+				  uac2_attr[attr].name, &val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
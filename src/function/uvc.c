@@ -18,7 +18,6 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <malloc.h>
-#include <ftw.h>
 #ifdef HAS_GADGET_SCHEMES
 #include <libconfig.h>
 #endif
@@ -139,16 +138,16 @@ struct {
 		.export = usbg_set_config_node_int,		        \
 	}
 
-static inline int usbg_get_guid(const char *path, const char *name,
-			      const char *attr, void *val)
+static inline int usbg_get_guid(const struct usbg_io *io, const char *path,
+				const char *name, const char *attr, void *val)
 {
-	return usbg_read_buf_alloc(path, name, attr, (char **)val, GUID_BIN_LENGTH);
+	return usbg_read_buf_alloc(io, path, name, attr, (char **)val, GUID_BIN_LENGTH);
 }
 
-static inline int usbg_set_guid(const char *path, const char *name,
-			      const char *attr, void *val)
+static inline int usbg_set_guid(const struct usbg_io *io, const char *path,
+				const char *name, const char *attr, void *val)
 {
-	return usbg_write_guid(path, name, attr, *(char **)val);
+	return usbg_write_guid(io, path, name, attr, *(char **)val);
 }
 
 #define UVC_GUID_ATTR(_name)					\
@@ -223,6 +222,7 @@ err:
 
 int init_frames(struct usbg_f_uvc *uvc, int j)
 {
+	const struct usbg_io *io = usbg_function_io(&uvc->func);
 	struct dirent **dent;
 	char fpath[USBG_MAX_PATH_LENGTH];
 	int nmb, i, id, ret = 0;
@@ -234,7 +234,7 @@ int init_frames(struct usbg_f_uvc *uvc, int j)
 		return ret;
 	}
 
-	nmb = scandir(fpath, &dent, frame_select, frame_sort);
+	nmb = usbg_io_scandir(io, fpath, &dent, frame_select, frame_sort);
 	if (nmb < 0) {
 		ret = usbg_translate_error(errno);
 		return ret;
@@ -315,32 +315,51 @@ static void uvc_cleanup_attrs(struct usbg_function *f, void *f_attrs)
 int usbg_f_uvc_get_config_attr_val(usbg_f_uvc *uvcf, enum usbg_f_uvc_config_attr iattr,
 			       union usbg_f_uvc_config_attr_val *val)
 {
+	const struct usbg_io *io = usbg_function_io(&uvcf->func);
 	char ipath[USBG_MAX_PATH_LENGTH];
 	int nmb;
+	struct usbg_call call;
+	int ret;
 
+	USBG_CALL_BEGIN(&call, &uvcf->func);
 	nmb = snprintf(ipath, sizeof(ipath), "%s/%s/",
 		       uvcf->func.path, uvcf->func.name);
-	if (nmb >= sizeof(ipath))
-		return USBG_ERROR_PATH_TOO_LONG;
+	if (nmb >= sizeof(ipath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		USBG_CALL_END(&call, ret);
+		return ret;
+	}
 
 
-	return uvc_config_attr[iattr].get(ipath, "",
-				    uvc_config_attr[iattr].name, val);
+	ret = uvc_config_attr[iattr].get(io, ipath, "",
+					 uvc_config_attr[iattr].name, val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_uvc_set_config_attr_val(usbg_f_uvc *uvcf, enum usbg_f_uvc_config_attr iattr,
 			       union usbg_f_uvc_config_attr_val val)
 {
+	const struct usbg_io *io = usbg_function_io(&uvcf->func);
 	char ipath[USBG_MAX_PATH_LENGTH];
 	int nmb;
+	struct usbg_call call;
+	int ret;
 
+	USBG_CALL_BEGIN(&call, &uvcf->func);
 	nmb = snprintf(ipath, sizeof(ipath), "%s/%s/",
 		       uvcf->func.path, uvcf->func.name);
-	if (nmb >= sizeof(ipath))
-		return USBG_ERROR_PATH_TOO_LONG;
+	if (nmb >= sizeof(ipath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		USBG_CALL_END(&call, ret);
+		return ret;
+	}
 
-	return uvc_config_attr[iattr].set(ipath, "",
-				       uvc_config_attr[iattr].name, &val);
+	usbg_touch_function(&uvcf->func);
+	ret = uvc_config_attr[iattr].set(io, ipath, "",
+					 uvc_config_attr[iattr].name, &val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_uvc_get_config_attrs(usbg_f_uvc *uvcf, struct usbg_f_uvc_config_attrs *iattrs)
@@ -381,32 +400,51 @@ int usbg_f_uvc_get_frame_attr_val(usbg_f_uvc *uvcf, const char* format, int fram
 			       enum usbg_f_uvc_frame_attr fattr,
 			       union usbg_f_uvc_frame_attr_val *val)
 {
+	const struct usbg_io *io = usbg_function_io(&uvcf->func);
 	char fpath[USBG_MAX_PATH_LENGTH];
 	int nmb;
+	struct usbg_call call;
+	int ret;
 
+	USBG_CALL_BEGIN(&call, &uvcf->func);
 	nmb = snprintf(fpath, sizeof(fpath), "%s/%s/" UVC_PATH_STREAMING "/%s/frame.%d/",
 		       uvcf->func.path, uvcf->func.name, format, frame_id);
-	if (nmb >= sizeof(fpath))
-		return USBG_ERROR_PATH_TOO_LONG;
+	if (nmb >= sizeof(fpath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		USBG_CALL_END(&call, ret);
+		return ret;
+	}
 
-	return uvc_frame_attr[fattr].get(fpath, "",
-				    uvc_frame_attr[fattr].name, val);
+	ret = uvc_frame_attr[fattr].get(io, fpath, "",
+					uvc_frame_attr[fattr].name, val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_uvc_set_frame_attr_val(usbg_f_uvc *uvcf, const char* format, int frame_id,
 			       enum usbg_f_uvc_frame_attr fattr,
 			       union usbg_f_uvc_frame_attr_val val)
 {
+	const struct usbg_io *io = usbg_function_io(&uvcf->func);
 	char fpath[USBG_MAX_PATH_LENGTH];
 	int nmb;
+	struct usbg_call call;
+	int ret;
 
+	USBG_CALL_BEGIN(&call, &uvcf->func);
 	nmb = snprintf(fpath, sizeof(fpath), "%s/%s/" UVC_PATH_STREAMING "/%s/frame.%d/",
 		       uvcf->func.path, uvcf->func.name, format, frame_id);
-	if (nmb >= sizeof(fpath))
-		return USBG_ERROR_PATH_TOO_LONG;
+	if (nmb >= sizeof(fpath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		USBG_CALL_END(&call, ret);
+		return ret;
+	}
 
-	return uvc_frame_attr[fattr].set(fpath, "",
-				       uvc_frame_attr[fattr].name, &val);
+	usbg_touch_function(&uvcf->func);
+	ret = uvc_frame_attr[fattr].set(io, fpath, "",
+					uvc_frame_attr[fattr].name, &val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_uvc_get_frame_attrs(usbg_f_uvc *uvcf, const char* format, int frame_id,
@@ -451,32 +489,51 @@ int usbg_f_uvc_get_format_attr_val(usbg_f_uvc *uvcf, const char* format,
 			       enum usbg_f_uvc_format_attr fattr,
 			       union usbg_f_uvc_format_attr_val *val)
 {
+	const struct usbg_io *io = usbg_function_io(&uvcf->func);
 	char fpath[USBG_MAX_PATH_LENGTH];
 	int nmb;
+	struct usbg_call call;
+	int ret;
 
+	USBG_CALL_BEGIN(&call, &uvcf->func);
 	nmb = snprintf(fpath, sizeof(fpath), "%s/%s/" UVC_PATH_STREAMING "/%s/",
 		       uvcf->func.path, uvcf->func.name, format);
-	if (nmb >= sizeof(fpath))
-		return USBG_ERROR_PATH_TOO_LONG;
+	if (nmb >= sizeof(fpath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		USBG_CALL_END(&call, ret);
+		return ret;
+	}
 
-	return uvc_format_attr[fattr].get(fpath, "",
-				    uvc_format_attr[fattr].name, val);
+	ret = uvc_format_attr[fattr].get(io, fpath, "",
+					 uvc_format_attr[fattr].name, val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_uvc_set_format_attr_val(usbg_f_uvc *uvcf, const char* format,
 			       enum usbg_f_uvc_format_attr fattr,
 			       union usbg_f_uvc_format_attr_val val)
 {
+	const struct usbg_io *io = usbg_function_io(&uvcf->func);
 	char fpath[USBG_MAX_PATH_LENGTH];
 	int nmb;
+	struct usbg_call call;
+	int ret;
 
+	USBG_CALL_BEGIN(&call, &uvcf->func);
 	nmb = snprintf(fpath, sizeof(fpath), "%s/%s/" UVC_PATH_STREAMING "/%s/",
 		       uvcf->func.path, uvcf->func.name, format);
-	if (nmb >= sizeof(fpath))
-		return USBG_ERROR_PATH_TOO_LONG;
+	if (nmb >= sizeof(fpath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		USBG_CALL_END(&call, ret);
+		return ret;
+	}
 
-	return uvc_format_attr[fattr].set(fpath, "",
-				       uvc_format_attr[fattr].name, &val);
+	usbg_touch_function(&uvcf->func);
+	ret = uvc_format_attr[fattr].set(io, fpath, "",
+					 uvc_format_attr[fattr].name, &val);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_f_uvc_get_format_attrs(usbg_f_uvc *uvcf, const char* format,
@@ -515,7 +572,7 @@ int usbg_f_uvc_set_format_attrs(usbg_f_uvc *uvcf, const char* format,
 	return ret;
 }
 
-static int uvc_create_dir(const char *path)
+static int uvc_create_dir(const struct usbg_io *io, const char *path)
 {
 	char tmp[USBG_MAX_PATH_LENGTH];
 	int nmb, ret = USBG_SUCCESS;
@@ -533,7 +590,7 @@ static int uvc_create_dir(const char *path)
 	for (p = tmp + 1; *p; p++) {
 		if(*p == '/') {
 			*p = 0;
-			if((mkdir(tmp, S_IRWXU | S_IRWXG | S_IRWXO) != 0) && errno != EEXIST) {
+			if((usbg_io_mkdir(io, tmp, S_IRWXU | S_IRWXG | S_IRWXO) != 0) && errno != EEXIST) {
 				ret = usbg_translate_error(errno);
 				break;
 			}
@@ -543,13 +600,13 @@ static int uvc_create_dir(const char *path)
 	if(ret != USBG_SUCCESS)
 		return ret;
 
-	if((mkdir(tmp, S_IRWXU | S_IRWXG | S_IRWXO) != 0) && errno != EEXIST)
+	if((usbg_io_mkdir(io, tmp, S_IRWXU | S_IRWXG | S_IRWXO) != 0) && errno != EEXIST)
 		return usbg_translate_error(errno);
 
 	return ret;
 }
 
-static int uvc_link(char *path, char *to, char *from)
+static int uvc_link(const struct usbg_io *io, char *path, char *to, char *from)
 {
 	char oldname[USBG_MAX_PATH_LENGTH];
 	char newname[USBG_MAX_PATH_LENGTH];
@@ -564,7 +621,7 @@ static int uvc_link(char *path, char *to, char *from)
 	if (nmb >= sizeof(newname))
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	if(symlink(oldname, newname))
+	if(usbg_io_symlink(io, oldname, newname))
 		return usbg_translate_error(errno);
 
 	return ret;
@@ -572,6 +629,7 @@ static int uvc_link(char *path, char *to, char *from)
 
 static int uvc_set_class(usbg_f_uvc *uvcf, char *cs)
 {
+	const struct usbg_io *io = usbg_function_io(&uvcf->func);
 	char path[USBG_MAX_PATH_LENGTH];
 	char header_path[USBG_MAX_PATH_LENGTH];
 	int nmb;
@@ -585,7 +643,7 @@ static int uvc_set_class(usbg_f_uvc *uvcf, char *cs)
 	if (nmb >= sizeof(header_path))
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	ret = uvc_create_dir(header_path);
+	ret = uvc_create_dir(io, header_path);
 	if (ret != USBG_SUCCESS)
 		return ret;
 
@@ -597,9 +655,9 @@ static int uvc_set_class(usbg_f_uvc *uvcf, char *cs)
 		if (nmb >= sizeof(check_path))
 			return USBG_ERROR_PATH_TOO_LONG;
 
-		ret = stat(check_path, &buffer);
+		ret = usbg_io_stat(io, check_path, &buffer);
 		if (!ret) {
-			ret = uvc_link(path, UVC_PATH_STREAMING_UNCOMPRESSED, "header/h/u");
+			ret = uvc_link(io, path, UVC_PATH_STREAMING_UNCOMPRESSED, "header/h/u");
 			if (ret != USBG_SUCCESS)
 				return ret;
 		}
@@ -608,23 +666,23 @@ static int uvc_set_class(usbg_f_uvc *uvcf, char *cs)
 		if (nmb >= sizeof(check_path))
 			return USBG_ERROR_PATH_TOO_LONG;
 
-		ret = stat(check_path, &buffer);
+		ret = usbg_io_stat(io, check_path, &buffer);
 		if (!ret) {
-			ret = uvc_link(path, UVC_PATH_STREAMING_MJPEG, "header/h/m");
+			ret = uvc_link(io, path, UVC_PATH_STREAMING_MJPEG, "header/h/m");
 			if (ret != USBG_SUCCESS)
 				return ret;
 		}
 
-		ret = uvc_link(path, UVC_PATH_HEADER, UVC_PATH_CLASS_HS);
+		ret = uvc_link(io, path, UVC_PATH_HEADER, UVC_PATH_CLASS_HS);
 		if (ret)
 			return ret;
 	}
 
-	ret = uvc_link(path, UVC_PATH_HEADER, UVC_PATH_CLASS_FS);
+	ret = uvc_link(io, path, UVC_PATH_HEADER, UVC_PATH_CLASS_FS);
 	if (ret)
 		return ret;
 
-	return uvc_link(path, UVC_PATH_HEADER, UVC_PATH_CLASS_SS);
+	return uvc_link(io, path, UVC_PATH_HEADER, UVC_PATH_CLASS_SS);
 }
 
 #ifdef HAS_GADGET_SCHEMES
@@ -643,9 +701,10 @@ int usbg_f_uvc_get_nframes(const bool *frames)
 	return nframes;
 }
 
-int usbg_f_uvc_create_frame(usbg_f_uvc *uvcf, const char* format, bool *frames,
-			 int frame_id, struct usbg_f_uvc_frame_attrs *fattrs)
+static int uvc_do_create_frame(usbg_f_uvc *uvcf, const char* format, bool *frames,
+			    int frame_id, struct usbg_f_uvc_frame_attrs *fattrs)
 {
+	const struct usbg_io *io = usbg_function_io(&uvcf->func);
 	char frame_path[USBG_MAX_PATH_LENGTH];
 	int nmb;
 	int ret;
@@ -661,7 +720,7 @@ int usbg_f_uvc_create_frame(usbg_f_uvc *uvcf, const char* format, bool *frames,
 	if (nmb >= sizeof(frame_path))
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	ret = uvc_create_dir(frame_path);
+	ret = uvc_create_dir(io, frame_path);
 	if (ret)
 		return usbg_translate_error(errno);
 
@@ -675,7 +734,21 @@ int usbg_f_uvc_create_frame(usbg_f_uvc *uvcf, const char* format, bool *frames,
 	return 0;
 
 remove_frame:
-	rmdir(frame_path);
+	usbg_io_rmdir(io, frame_path);
+	return ret;
+}
+
+int usbg_f_uvc_create_frame(usbg_f_uvc *uvcf, const char* format, bool *frames,
+			 int frame_id, struct usbg_f_uvc_frame_attrs *fattrs)
+{
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &uvcf->func);
+	usbg_touch_function(&uvcf->func);
+	ret = uvc_do_create_frame(uvcf, format, frames, frame_id, fattrs);
+	USBG_CALL_END(&call, ret);
+
 	return ret;
 }
 
@@ -687,6 +760,10 @@ static int uvc_import_frame_attrs(struct usbg_f_uvc *uvcf, const char* format,
 	int i;
 
 	for (i = USBG_F_UVC_FRAME_ATTR_MIN; i < USBG_F_UVC_FRAME_ATTR_MAX; ++i) {
+		/* Index is given by name of frame directory */
+		if (i == USBG_F_UVC_FRAME_INDEX)
+			continue;
+
 		ret = uvc_frame_attr[i].import(root, uvc_frame_attr[i].name, &val);
 		/* node not  found */
 		if (ret == 0)
@@ -733,7 +810,7 @@ static int uvc_import_format_attrs(struct usbg_f_uvc *uvcf, const char* format,
 static int uvc_import_format(struct usbg_f_uvc *uvcf, const char *format, bool *frames, config_setting_t *root)
 {
 	config_setting_t *frames_node, *node;
-	int i, nframes;
+	int i, nframes, frame_id;
 	int ret = 0;
 
 	frames_node = config_setting_get_member(root, "frames");
@@ -759,12 +836,26 @@ static int uvc_import_format(struct usbg_f_uvc *uvcf, const char *format, bool *
 			ret = USBG_ERROR_INVALID_TYPE;
 			goto out;
 		}
-		if (!frames[i]) {
-			ret = usbg_f_uvc_create_frame(uvcf, format, frames, i, NULL);
+
+		/* Frame is identified by its index, position in list
+		 * is used only if scheme doesn't provide it */
+		frame_id = i;
+		ret = usbg_get_config_node_int(node, "bFrameIndex", &frame_id);
+		if (ret < 0)
+			goto out;
+
+		if (frame_id < 0 || frame_id >= MAX_FRAMES) {
+			ret = USBG_ERROR_INVALID_VALUE;
+			goto out;
+		}
+
+		if (!frames[frame_id]) {
+			ret = usbg_f_uvc_create_frame(uvcf, format, frames,
+						      frame_id, NULL);
 			if (ret)
 				goto out;
 		}
-		ret = uvc_import_frame_attrs(uvcf, format, i, node);
+		ret = uvc_import_frame_attrs(uvcf, format, frame_id, node);
 		if (ret)
 			goto out;
 	}
@@ -812,7 +903,7 @@ static int uvc_libconfig_import(struct usbg_function *f, config_setting_t *root)
 {
 	struct usbg_f_uvc *uvcf = usbg_to_uvc_function(f);
 	config_setting_t *formats_node, *node;
-	int nmb, ret, i, nformats;
+	int nmb, ret, i, j, nformats;
 	char fp[USBG_MAX_PATH_LENGTH];
 	const char *format;
 	struct formats *formats;
@@ -848,7 +939,17 @@ static int uvc_libconfig_import(struct usbg_function *f, config_setting_t *root)
 		if (nmb >= sizeof(fp))
 			return USBG_ERROR_PATH_TOO_LONG;
 
-		ret = uvc_import_format(uvcf, fp, formats[i].frames, node);
+		/* Formats may be listed in any order */
+		for (j = 0; j < MAX_FORMATS; ++j)
+			if (!strcmp(fp, format_names[j]))
+				break;
+
+		if (j == MAX_FORMATS) {
+			ret = USBG_ERROR_NOT_SUPPORTED;
+			goto out;
+		}
+
+		ret = uvc_import_format(uvcf, fp, formats[j].frames, node);
 		if (ret)
 			goto out;
 
@@ -929,7 +1030,17 @@ static int uvc_export_frame_attrs(struct usbg_f_uvc *uvcf, const char *format,
 	int ret = 0;
 	int i;
 
+	/* Like usbg_f_uvc_get_frame_attrs(), report index given by name
+	 * of frame directory, kernel may number frames on its own */
+	ret = uvc_frame_attr[USBG_F_UVC_FRAME_INDEX].export(root,
+			uvc_frame_attr[USBG_F_UVC_FRAME_INDEX].name, &frame_id);
+	if (ret)
+		return ret;
+
 	for (i = USBG_F_UVC_FRAME_ATTR_MIN; i < USBG_F_UVC_FRAME_ATTR_MAX; ++i) {
+		if (i == USBG_F_UVC_FRAME_INDEX)
+			continue;
+
 		ret = usbg_f_uvc_get_frame_attr_val(uvcf, format, frame_id, i, &val);
 		if (ret)
 			break;
@@ -949,7 +1060,7 @@ static int uvc_export_frames(struct usbg_f_uvc *uvcf, const char *format,
 			     bool *frames, config_setting_t *root)
 {
 	config_setting_t *frames_node, *node;
-	int i, nframes;
+	int i;
 	int ret = 0;
 
 	frames_node = config_setting_add(root, "frames", CONFIG_TYPE_LIST);
@@ -958,10 +1069,11 @@ static int uvc_export_frames(struct usbg_f_uvc *uvcf, const char *format,
 		goto out;
 	}
 
-	nframes = usbg_f_uvc_get_nframes(frames);
-	if (nframes < 0)
-		return nframes;
-	for (i = 0; i < nframes; ++i) {
+	/* Frame ids don't have to be contiguous, export only existing ones */
+	for (i = 0; i < MAX_FRAMES; ++i) {
+		if (!frames[i])
+			continue;
+
 		node = config_setting_add(frames_node, "", CONFIG_TYPE_GROUP);
 		if (!node)
 			goto out;
@@ -1018,12 +1130,16 @@ out:
 
 #endif
 
-static int uvc_set_format(char *format_path, const char *format, const struct usbg_f_uvc_format_attrs *attrs)
+static int uvc_set_format(const struct usbg_io *io, char *format_path,
+			  const char *format,
+			  const struct usbg_f_uvc_format_attrs *attrs)
 {
-	return usbg_write_dec(format_path, format, "bDefaultFrameIndex", attrs->bDefaultFrameIndex);
+	return usbg_write_dec(io, format_path, format, "bDefaultFrameIndex", attrs->bDefaultFrameIndex);
 }
 
-static int uvc_set_frame(char *format_path, const char *format, const struct usbg_f_uvc_frame_attrs *attrs)
+static int uvc_set_frame(const struct usbg_io *io, char *format_path,
+			 const char *format,
+			 const struct usbg_f_uvc_frame_attrs *attrs)
 {
 	char frame_path[USBG_MAX_PATH_LENGTH];
 	char full_frame_path[USBG_MAX_PATH_LENGTH];
@@ -1042,38 +1158,42 @@ static int uvc_set_frame(char *format_path, const char *format, const struct usb
 	if (nmb >= sizeof(full_frame_path))
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	ret = uvc_create_dir(full_frame_path);
+	ret = uvc_create_dir(io, full_frame_path);
 	if (ret != USBG_SUCCESS)
 		return ret;
 
-	ret = usbg_write_dec(frame_path, frame_name, "dwFrameInterval", attrs->dwFrameInterval);
+	ret = usbg_write_dec(io, frame_path, frame_name, "dwFrameInterval", attrs->dwFrameInterval);
 	if (ret != USBG_SUCCESS)
 		return ret;
 
-	ret = usbg_write_dec(frame_path, frame_name, "dwDefaultFrameInterval", attrs->dwDefaultFrameInterval);
+	ret = usbg_write_dec(io, frame_path, frame_name, "dwDefaultFrameInterval", attrs->dwDefaultFrameInterval);
 	if (ret != USBG_SUCCESS)
 		return ret;
 
-	ret = usbg_write_dec(frame_path, frame_name, "dwMaxVideoFrameBufferSize", attrs->dwMaxVideoFrameBufferSize);
+	ret = usbg_write_dec(io, frame_path, frame_name, "dwMaxVideoFrameBufferSize", attrs->dwMaxVideoFrameBufferSize);
 	if (ret != USBG_SUCCESS)
 		return ret;
 
-	ret = usbg_write_dec(frame_path, frame_name, "dwMinBitRate", attrs->dwMinBitRate);
+	ret = usbg_write_dec(io, frame_path, frame_name, "dwMinBitRate", attrs->dwMinBitRate);
 	if (ret != USBG_SUCCESS)
 		return ret;
 
-	ret = usbg_write_dec(frame_path, frame_name, "dwMaxBitRate", attrs->dwMaxBitRate);
+	ret = usbg_write_dec(io, frame_path, frame_name, "dwMaxBitRate", attrs->dwMaxBitRate);
 	if (ret != USBG_SUCCESS)
 		return ret;
 
-	ret = usbg_write_dec(frame_path, frame_name, "wHeight", attrs->wHeight);
+	ret = usbg_write_dec(io, frame_path, frame_name, "wHeight",
+			     attrs->wHeight);
 	if (ret != USBG_SUCCESS)
 		return ret;
 
-	return usbg_write_dec(frame_path, frame_name, "wWidth", attrs->wWidth);
+	return usbg_write_dec(io, frame_path, frame_name, "wWidth",
+			      attrs->wWidth);
 }
 
-static int uvc_set_streaming(char *func_path, const char *format, const struct usbg_f_uvc_format_attrs *attrs)
+static int uvc_set_streaming(const struct usbg_io *io, char *func_path,
+			     const char *format,
+			     const struct usbg_f_uvc_format_attrs *attrs)
 {
 	struct usbg_f_uvc_frame_attrs **frame_attrs;
 	char streaming_path[USBG_MAX_PATH_LENGTH];
@@ -1085,73 +1205,81 @@ static int uvc_set_streaming(char *func_path, const char *format, const struct u
 
 	for(frame_attrs = attrs->frames, i = 0; frame_attrs[i]; ++i) {
 		if (frame_attrs[i]) {
-			ret = uvc_set_frame(streaming_path, format, frame_attrs[i]);
+			ret = uvc_set_frame(io, streaming_path, format, frame_attrs[i]);
 			if(ret != USBG_SUCCESS)
 				ERROR("Error: %d", ret);
 		}
 	}
 
-	ret = uvc_set_format(streaming_path, format, attrs);
+	ret = uvc_set_format(io, streaming_path, format, attrs);
 	if(ret != USBG_SUCCESS)
 		ERROR("Error: %d", ret);
 
 	return ret;
 }
 
-static int dir_nftw_cb(const char *pathname, const struct stat *sbuf, int type, struct FTW *ftwb)
+/*
+ * Depth first walk which doesn't follow links. Failures of single entries
+ * are ignored, default groups can't be removed and go away with parent.
+ */
+static int remove_tree(const struct usbg_io *io, const char *dirpath,
+		       bool self)
 {
-	(void) sbuf;
-	(void) type;
-	(void) ftwb;
-	int ret;
+	char path[USBG_MAX_PATH_LENGTH];
+	struct dirent **dent;
+	struct stat st;
+	int i, n, nmb;
+	int ret = 0;
 
-	ret = remove(pathname);
-	if (ret < -1)
-		ERROR("failed to remove %s - %s", pathname, strerror(ret));
+	n = usbg_io_scandir(io, dirpath, &dent, file_select, alphasort);
+	if (n < 0)
+		return -1;
 
-	return 0;
-}
+	for (i = 0; i < n; ++i) {
+		nmb = snprintf(path, sizeof(path), "%s/%s", dirpath,
+			       dent[i]->d_name);
+		free(dent[i]);
+		if (nmb >= sizeof(path)) {
+			ret = -1;
+			continue;
+		}
 
-int remove_dir(const char *dirpath)
-{
-	const int max_open_descs = 8;
-	int ret;
+		if (usbg_io_lstat(io, path, &st))
+			continue;
 
-	ret = nftw(dirpath, dir_nftw_cb, max_open_descs, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
-	if (ret < 0) {
-		ERROR("nftw failed");
-		return ret;
+		if (S_ISLNK(st.st_mode))
+			usbg_io_unlink(io, path);
+		else if (S_ISDIR(st.st_mode))
+			remove_tree(io, path, true);
 	}
+	free(dent);
 
-	return 0;
+	if (self)
+		usbg_io_rmdir(io, dirpath);
+
+	return ret;
 }
 
-static int content_nftw_cb(const char *pathname, const struct stat *sbuf, int type, struct FTW *ftwb)
+int remove_dir(const struct usbg_io *io, const char *dirpath)
 {
-	(void) sbuf;
-	(void) type;
-	(void) ftwb;
 	int ret;
 
-	if(ftwb->level == 0)
-		return 0;
-
-	ret = remove(pathname);
-	if(ret < -1)
-		ERROR("failed to remove %s - %s", pathname, strerror(ret));
+	ret = remove_tree(io, dirpath, true);
+	if (ret < 0) {
+		ERROR("failed to remove %s", dirpath);
+		return ret;
+	}
 
 	return 0;
 }
 
-int remove_dir_content(const char *dirpath)
+int remove_dir_content(const struct usbg_io *io, const char *dirpath)
 {
-	const int max_open_descs = 8;
 	int ret;
 
-	/* traverse in reverse order (handle directory after it's content), stay within the same file system and do not follow symbolic links */
-	ret = nftw(dirpath, content_nftw_cb, max_open_descs, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+	ret = remove_tree(io, dirpath, false);
 	if (ret < 0) {
-		ERROR("nftw failed");
+		ERROR("failed to remove content of %s", dirpath);
 		return ret;
 	}
 
@@ -1160,6 +1288,7 @@ int remove_dir_content(const char *dirpath)
 
 static int uvc_remove(struct usbg_function *f, int opts)
 {
+	const struct usbg_io *io = usbg_function_io(f);
 	usbg_f_uvc *uvcf = usbg_to_uvc_function(f);
 	char streaming_path[USBG_MAX_PATH_LENGTH];
 	char control_path[USBG_MAX_PATH_LENGTH];
@@ -1178,21 +1307,126 @@ static int uvc_remove(struct usbg_function *f, int opts)
 	if (nmb >= sizeof(control_path))
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	if(remove_dir_content(streaming_path) < 0)
+	if(remove_dir_content(io, streaming_path) < 0)
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	if(remove_dir_content(control_path) < 0)
+	if(remove_dir_content(io, control_path) < 0)
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	if(remove_dir(streaming_path) < 0)
+	if(remove_dir(io, streaming_path) < 0)
 		return USBG_ERROR_PATH_TOO_LONG;
 
-	if(remove_dir(control_path) < 0)
+	if(remove_dir(io, control_path) < 0)
 		return USBG_ERROR_PATH_TOO_LONG;
 
 	return ret;
 }
 
+static int uvc_clone_format(struct usbg_f_uvc *dst, struct usbg_f_uvc *src,
+			    const char *format, const bool *frames)
+{
+	const struct usbg_io *io = usbg_function_io(&dst->func);
+	struct usbg_f_uvc_frame_attrs fattrs;
+	union usbg_f_uvc_format_attr_val val;
+	char fpath[USBG_MAX_PATH_LENGTH];
+	bool empty = true;
+	int nmb, i, ret;
+
+	for (i = 0; i < MAX_FRAMES; ++i) {
+		if (!frames[i])
+			continue;
+
+		empty = false;
+
+		nmb = snprintf(fpath, sizeof(fpath), "%s/%s/" UVC_PATH_STREAMING "/%s/frame.%d/",
+			       dst->func.path, dst->func.name, format, i);
+		if (nmb >= sizeof(fpath))
+			return USBG_ERROR_PATH_TOO_LONG;
+
+		ret = usbg_f_uvc_get_frame_attrs(src, format, i, &fattrs);
+		if (ret)
+			return ret;
+
+		ret = uvc_create_dir(io, fpath);
+		if (ret)
+			return ret;
+
+		ret = usbg_f_uvc_set_frame_attrs(dst, format, i, &fattrs);
+		if (ret)
+			return ret;
+	}
+
+	/* Format directory doesn't exist without frames */
+	if (empty)
+		return USBG_SUCCESS;
+
+	nmb = snprintf(fpath, sizeof(fpath), "%s/%s/" UVC_PATH_STREAMING "/%s/",
+		       dst->func.path, dst->func.name, format);
+	if (nmb >= sizeof(fpath))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	for (i = USBG_F_UVC_FORMAT_ATTR_MIN; i < USBG_F_UVC_FORMAT_ATTR_MAX; ++i) {
+		if (uvc_format_attr[i].ro)
+			continue;
+
+		ret = usbg_f_uvc_get_format_attr_val(src, format, i, &val);
+		/* Not all formats have all attributes */
+		if (ret == USBG_ERROR_NOT_FOUND)
+			continue;
+		if (ret)
+			return ret;
+
+		/* GUID is copied in binary form, as read */
+		if (i == USBG_F_UVC_FORMAT_GUID_FORMAT) {
+			ret = usbg_write_buf(io, fpath, "",
+					     uvc_format_attr[i].name,
+					     val.guidFormat, GUID_BIN_LENGTH);
+			free((char *)val.guidFormat);
+		} else {
+			ret = usbg_f_uvc_set_format_attr_val(dst, format, i, val);
+		}
+		if (ret)
+			return ret;
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int uvc_clone(struct usbg_function *f, struct usbg_function *from)
+{
+	struct usbg_f_uvc *dst = usbg_to_uvc_function(f);
+	struct usbg_f_uvc *src = usbg_to_uvc_function(from);
+	union usbg_f_uvc_config_attr_val val;
+	struct formats *formats;
+	int i, ret;
+
+	formats = get_formats_mask(src);
+	for (i = 0; i < MAX_FORMATS; ++i) {
+		ret = uvc_clone_format(dst, src, format_names[i],
+				       formats[i].frames);
+		if (ret)
+			return ret;
+	}
+
+	for (i = USBG_F_UVC_CONFIG_ATTR_MIN; i < USBG_F_UVC_CONFIG_ATTR_MAX; ++i) {
+		ret = usbg_f_uvc_get_config_attr_val(src, i, &val);
+		if (ret)
+			return ret;
+
+		ret = usbg_f_uvc_set_config_attr_val(dst, i, val);
+		if (i == USBG_F_UVC_CONFIG_FUNCTION_NAME)
+			free((char *)val.function_name);
+		if (ret)
+			return ret;
+	}
+
+	ret = uvc_set_class(dst, UVC_PATH_CONTROL);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	return uvc_set_class(dst, UVC_PATH_STREAMING);
+}
+
 struct usbg_function_type usbg_f_type_uvc = {
 	.name = "uvc",
 	.alloc_inst = uvc_alloc_inst,
@@ -1200,6 +1434,7 @@ struct usbg_function_type usbg_f_type_uvc = {
 	.set_attrs = uvc_set_attrs,
 	.get_attrs = uvc_get_attrs,
 	.cleanup_attrs = uvc_cleanup_attrs,
+	.clone = uvc_clone,
 #ifdef HAS_GADGET_SCHEMES
 	.import = uvc_libconfig_import,
 	.export = uvc_libconfig_export,
@@ -1225,8 +1460,9 @@ int usbg_f_uvc_get_attrs(usbg_f_uvc *uvcf, struct usbg_f_uvc_attrs *attrs)
 	return USBG_SUCCESS;
 }
 
-int usbg_f_uvc_set_attrs(usbg_f_uvc *uvcf, const struct usbg_f_uvc_attrs *attrs)
+static int uvc_do_set_attrs(usbg_f_uvc *uvcf, const struct usbg_f_uvc_attrs *attrs)
 {
+	const struct usbg_io *io = usbg_function_io(&uvcf->func);
 	char path[USBG_MAX_PATH_LENGTH];
 	struct usbg_f_uvc_format_attrs **format_attrs;
 	int ret = USBG_SUCCESS;
@@ -1235,12 +1471,14 @@ int usbg_f_uvc_set_attrs(usbg_f_uvc *uvcf, const struct usbg_f_uvc_attrs *attrs)
 	if (!attrs)
 		return USBG_ERROR_INVALID_PARAM;
 
+	usbg_touch_function(&uvcf->func);
+
 	nmb = snprintf(path, sizeof(path), "%s/%s", uvcf->func.path, uvcf->func.name);
 	if (nmb >= sizeof(path))
 		return USBG_ERROR_PATH_TOO_LONG;
 
 	for(format_attrs = attrs->formats, i = 0; format_attrs[i]; ++i) {
-		ret = uvc_set_streaming(path, format_attrs[i]->format, format_attrs[i]);
+		ret = uvc_set_streaming(io, path, format_attrs[i]->format, format_attrs[i]);
 		if(ret != USBG_SUCCESS)
 			ERROR("Error: %d", ret);
 	}
@@ -1255,3 +1493,15 @@ int usbg_f_uvc_set_attrs(usbg_f_uvc *uvcf, const struct usbg_f_uvc_attrs *attrs)
 
 	return ret;
 }
+
+int usbg_f_uvc_set_attrs(usbg_f_uvc *uvcf, const struct usbg_f_uvc_attrs *attrs)
+{
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, &uvcf->func);
+	ret = uvc_do_set_attrs(uvcf, attrs);
+	USBG_CALL_END(&call, ret);
+
+	return ret;
+}
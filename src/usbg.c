@@ -325,11 +325,20 @@ static void usbg_free_udc(usbg_udc *u)
 	free(u);
 }
 
+static void usbg_free_tombstone(struct usbg_tombstone *t)
+{
+	free(t->gadget);
+	free(t->name);
+	free(t);
+}
+
 static void usbg_free_state(usbg_state *s)
 {
 	usbg_gadget *g;
 	usbg_udc *u;
 
+	usbg_drop_tombstones(s, UINT64_MAX);
+
 	while (!TAILQ_EMPTY(&s->gadgets)) {
 		g = TAILQ_FIRST(&s->gadgets);
 		TAILQ_REMOVE(&s->gadgets, g, gnode);
@@ -342,6 +351,7 @@ static void usbg_free_state(usbg_state *s)
 		TAILQ_REMOVE(&s->udcs, u, unode);
 		usbg_free_udc(u);
 	}
+	free(s->udc_index);
 
 	if (s->last_failed_import) {
 		config_destroy(s->last_failed_import);
@@ -350,6 +360,9 @@ static void usbg_free_state(usbg_state *s)
 
 	free(s->path);
 	free(s->configfs_path);
+	free(s->udc_path);
+	if (s->io.ops->release)
+		s->io.ops->release(s->io.priv);
 	free(s);
 }
 
@@ -370,10 +383,13 @@ static usbg_gadget *usbg_allocate_gadget(const char *path, const char *name,
 	g->parent = parent;
 	g->udc = NULL;
 	g->os_desc_binding = NULL;
+	g->generation = 0;
+	g->fp.valid = false;
 
 	if (!(g->name) || !(g->path))
 		goto cleanup;
 
+	usbg_stats_add(&parent->stats.allocs, 1);
 	return g;
 cleanup:
 	free(g->name);
@@ -403,10 +419,13 @@ static usbg_config *usbg_allocate_config(const char *path, const char *label,
 	c->label = strdup(label);
 	c->parent = parent;
 	c->id = id;
+	c->generation = 0;
+	c->fp.valid = false;
 
 	if (!(c->path) || !(c->label))
 		goto cleanup;
 
+	usbg_stats_add(&parent->parent->stats.allocs, 1);
 	return c;
 cleanup:
 	free(c->name);
@@ -427,7 +446,11 @@ usbg_allocate_function(const char *path, usbg_function_type type,
 
 	ret = function_types[type]->alloc_inst(function_types[type], type,
 					       instance, path, parent, &f);
-	return ret == 0 ? f : NULL;
+	if (ret != 0)
+		return NULL;
+
+	usbg_stats_add(&parent->parent->stats.allocs, 1);
+	return f;
 }
 
 static usbg_binding *usbg_allocate_binding(const char *path, const char *name,
@@ -446,6 +469,7 @@ static usbg_binding *usbg_allocate_binding(const char *path, const char *name,
 	if (!(b->name) || !(b->path))
 		goto cleanup;
 
+	usbg_stats_add(&parent->parent->parent->stats.allocs, 1);
 	return b;
 cleanup:
 	free(b->name);
@@ -465,10 +489,17 @@ static usbg_udc *usbg_allocate_udc(usbg_state *parent, const char *name)
 
 	u->gadget = NULL;
 	u->parent = parent;
+	u->connect_ts.tv_sec = 0;
+	u->connect_ts.tv_nsec = 0;
+	u->max_speed = USBG_SPEED_UNKNOWN;
+	u->max_speed_valid = false;
+	u->endpoints = USBG_ERROR_NOT_SUPPORTED;
+	u->endpoints_valid = false;
 	u->name = strdup(name);
 	if (!u->name)
 		goto cleanup;
 
+	usbg_stats_add(&parent->stats.allocs, 1);
 	return u;
 cleanup:
 	free(u);
@@ -478,6 +509,7 @@ out:
 
 static int usbg_parse_functions(const char *path, usbg_gadget *g)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	usbg_function *f;
 	int i, n;
 	int ret = USBG_SUCCESS;
@@ -492,7 +524,7 @@ static int usbg_parse_functions(const char *path, usbg_gadget *g)
 		goto out;
 	}
 
-	n = scandir(fpath, &dent, file_select, alphasort);
+	n = usbg_io_scandir(io, fpath, &dent, file_select, alphasort);
 	if (n < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -521,16 +553,17 @@ out:
 	return ret;
 }
 
-static int usbg_parse_config_attrs(const char *path, const char *name,
+static int usbg_parse_config_attrs(const struct usbg_io *io, const char *path,
+				   const char *name,
 				   struct usbg_config_attrs *c_attrs)
 {
 	int buf, ret;
 
-	ret = usbg_read_dec(path, name, "MaxPower", &buf);
+	ret = usbg_read_dec(io, path, name, "MaxPower", &buf);
 	if (ret == USBG_SUCCESS) {
 		c_attrs->bMaxPower = (uint8_t)buf;
 
-		ret = usbg_read_hex(path, name, "bmAttributes", &buf);
+		ret = usbg_read_hex(io, path, name, "bmAttributes", &buf);
 		if (ret == USBG_SUCCESS)
 			c_attrs->bmAttributes = (uint8_t)buf;
 	}
@@ -538,10 +571,10 @@ static int usbg_parse_config_attrs(const char *path, const char *name,
 	return ret;
 }
 
-static int usbg_parse_config_strs(const char *path, const char *name,
-				  int lang, struct usbg_config_strs *c_strs)
+static int usbg_parse_config_strs(const struct usbg_io *io, const char *path,
+				  const char *name, int lang,
+				  struct usbg_config_strs *c_strs)
 {
-	DIR *dir;
 	int ret;
 	int nmb;
 	char spath[USBG_MAX_PATH_LENGTH];
@@ -554,14 +587,12 @@ static int usbg_parse_config_strs(const char *path, const char *name,
 	}
 
 	/* Check if directory exist */
-	dir = opendir(spath);
-	if (!dir) {
+	if (usbg_io_is_dir(io, spath)) {
 		ret = usbg_translate_error(errno);
 		goto out;
 	}
 
-	closedir(dir);
-	ret = usbg_read_string_alloc(spath, "", "configuration",
+	ret = usbg_read_string_alloc(io, spath, "", "configuration",
 				     &c_strs->configuration);
 
 out:
@@ -570,6 +601,7 @@ out:
 
 static int usbg_parse_config_binding(usbg_config *c, char *bpath, int path_size)
 {
+	const struct usbg_io *io = usbg_config_io(c);
 	int nmb;
 	int ret;
 	char target[USBG_MAX_PATH_LENGTH];
@@ -579,7 +611,7 @@ static int usbg_parse_config_binding(usbg_config *c, char *bpath, int path_size)
 	usbg_function *f;
 	usbg_binding *b;
 
-	nmb = readlink(bpath, target, sizeof(target) - 1 );
+	nmb = usbg_io_readlink(io, bpath, target, sizeof(target) - 1 );
 	if (nmb < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -619,6 +651,7 @@ out:
 
 static int usbg_parse_config_bindings(usbg_config *c)
 {
+	const struct usbg_io *io = usbg_config_io(c);
 	int i, n, nmb;
 	int ret = USBG_SUCCESS;
 	struct dirent **dent;
@@ -631,7 +664,7 @@ static int usbg_parse_config_bindings(usbg_config *c)
 		goto out;
 	}
 
-	n = scandir(bpath, &dent, bindings_select, alphasort);
+	n = usbg_io_scandir(io, bpath, &dent, bindings_select, alphasort);
 	if (n < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -656,6 +689,7 @@ out:
 
 static int usbg_parse_gadget_os_desc_binding(usbg_gadget *g)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	int i, n, nmb, id;
 	int ret = USBG_SUCCESS;
 	struct dirent **dent;
@@ -673,7 +707,7 @@ static int usbg_parse_gadget_os_desc_binding(usbg_gadget *g)
 		goto out;
 	}
 
-	n = scandir(bpath, &dent, bindings_select, alphasort);
+	n = usbg_io_scandir(io, bpath, &dent, bindings_select, alphasort);
 	if (n < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -702,7 +736,7 @@ static int usbg_parse_gadget_os_desc_binding(usbg_gadget *g)
 		goto out;
 	}
 
-	nmb = readlink(bpath, target, sizeof(target) - 1 );
+	nmb = usbg_io_readlink(io, bpath, target, sizeof(target) - 1 );
 	if (nmb < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -764,6 +798,7 @@ out:
 
 static int usbg_parse_configs(const char *path, usbg_gadget *g)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	int i, n;
 	int ret = USBG_SUCCESS;
 	struct dirent **dent;
@@ -776,7 +811,7 @@ static int usbg_parse_configs(const char *path, usbg_gadget *g)
 		goto out;
 	}
 
-	n = scandir(cpath, &dent, file_select, alphasort);
+	n = usbg_io_scandir(io, cpath, &dent, file_select, alphasort);
 	if (n < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -794,56 +829,57 @@ out:
 	return ret;
 }
 
-static int usbg_parse_gadget_attrs(const char *path, const char *name,
+static int usbg_parse_gadget_attrs(const struct usbg_io *io, const char *path,
+				   const char *name,
 				   struct usbg_gadget_attrs *g_attrs)
 {
 	int buf, ret;
 
 	/* Actual attributes */
 
-	ret = usbg_read_hex(path, name, "bcdUSB", &buf);
+	ret = usbg_read_hex(io, path, name, "bcdUSB", &buf);
 	if (ret == USBG_SUCCESS)
 		g_attrs->bcdUSB = (uint16_t) buf;
 	else
 		goto out;
 
-	ret = usbg_read_hex(path, name, "bDeviceClass", &buf);
+	ret = usbg_read_hex(io, path, name, "bDeviceClass", &buf);
 	if (ret == USBG_SUCCESS)
 		g_attrs->bDeviceClass = (uint8_t)buf;
 	else
 		goto out;
 
-	ret = usbg_read_hex(path, name, "bDeviceSubClass", &buf);
+	ret = usbg_read_hex(io, path, name, "bDeviceSubClass", &buf);
 	if (ret == USBG_SUCCESS)
 		g_attrs->bDeviceSubClass = (uint8_t)buf;
 	else
 		goto out;
 
-	ret = usbg_read_hex(path, name, "bDeviceProtocol", &buf);
+	ret = usbg_read_hex(io, path, name, "bDeviceProtocol", &buf);
 	if (ret == USBG_SUCCESS)
 		g_attrs->bDeviceProtocol = (uint8_t) buf;
 	else
 		goto out;
 
-	ret = usbg_read_hex(path, name, "bMaxPacketSize0", &buf);
+	ret = usbg_read_hex(io, path, name, "bMaxPacketSize0", &buf);
 	if (ret == USBG_SUCCESS)
 		g_attrs->bMaxPacketSize0 = (uint8_t) buf;
 	else
 		goto out;
 
-	ret = usbg_read_hex(path, name, "idVendor", &buf);
+	ret = usbg_read_hex(io, path, name, "idVendor", &buf);
 	if (ret == USBG_SUCCESS)
 		g_attrs->idVendor = (uint16_t) buf;
 	else
 		goto out;
 
-	ret = usbg_read_hex(path, name, "idProduct", &buf);
+	ret = usbg_read_hex(io, path, name, "idProduct", &buf);
 	if (ret == USBG_SUCCESS)
 		g_attrs->idProduct = (uint16_t) buf;
 	else
 		goto out;
 
-	ret = usbg_read_hex(path, name, "bcdDevice", &buf);
+	ret = usbg_read_hex(io, path, name, "bcdDevice", &buf);
 	if (ret == USBG_SUCCESS)
 		g_attrs->bcdDevice = (uint16_t) buf;
 	else
@@ -853,12 +889,12 @@ out:
 	return ret;
 }
 
-static int usbg_parse_gadget_strs(const char *path, const char *name, int lang,
+static int usbg_parse_gadget_strs(const struct usbg_io *io, const char *path,
+				  const char *name, int lang,
 				  struct usbg_gadget_strs *g_strs)
 {
 	int ret;
 	int nmb;
-	DIR *dir;
 	char spath[USBG_MAX_PATH_LENGTH];
 
 	nmb = snprintf(spath, sizeof(spath), "%s/%s/%s/0x%x", path, name,
@@ -869,26 +905,25 @@ static int usbg_parse_gadget_strs(const char *path, const char *name, int lang,
 	}
 
 	/* Check if directory exist */
-	dir = opendir(spath);
-	if (!dir) {
+	if (usbg_io_is_dir(io, spath)) {
 		ret = usbg_translate_error(errno);
 		goto out;
 	}
 
-	closedir(dir);
 
 	g_strs->manufacturer = g_strs->product = g_strs->serial = NULL;
 
-	ret = usbg_read_string_alloc(spath, "", "manufacturer",
+	ret = usbg_read_string_alloc(io, spath, "", "manufacturer",
 				     &g_strs->manufacturer);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
-	ret = usbg_read_string_alloc(spath, "", "product", &g_strs->product);
+	ret = usbg_read_string_alloc(io, spath, "", "product",
+				     &g_strs->product);
 	if (ret != USBG_SUCCESS)
 		goto free_mnf;
 
-	ret = usbg_read_string_alloc(spath, "", "serialnumber",
+	ret = usbg_read_string_alloc(io, spath, "", "serialnumber",
 				     &g_strs->serial);
 	if (ret != USBG_SUCCESS)
 		goto free_product;
@@ -903,8 +938,9 @@ out:
 	return ret;
 }
 
-static int usbg_parse_gadget_os_descs(const char *path, const char *name,
-		struct usbg_gadget_os_descs *g_os_descs)
+static int usbg_parse_gadget_os_descs(const struct usbg_io *io,
+				      const char *path, const char *name,
+				      struct usbg_gadget_os_descs *g_os_descs)
 {
 	int ret;
 	int nmb;
@@ -918,17 +954,17 @@ static int usbg_parse_gadget_os_descs(const char *path, const char *name,
 		goto out;
 	}
 
-	ret = usbg_read_string_alloc(spath, "", "qw_sign", &g_os_descs->qw_sign);
+	ret = usbg_read_string_alloc(io, spath, "", "qw_sign", &g_os_descs->qw_sign);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
-	ret = usbg_read_hex(spath, "", "b_vendor_code", &val);
+	ret = usbg_read_hex(io, spath, "", "b_vendor_code", &val);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
 	g_os_descs->b_vendor_code = (unsigned char)val;
 
-	ret = usbg_read_int(spath, "", "use", 10, &val);
+	ret = usbg_read_int(io, spath, "", "use", 10, &val);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
@@ -939,11 +975,12 @@ out:
 
 static inline int usbg_parse_gadget(usbg_gadget *g)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	int ret;
 	char buf[USBG_MAX_STR_LENGTH];
 
 	/* UDC bound to, if any */
-	ret = usbg_read_string(g->path, g->name, "UDC", buf);
+	ret = usbg_read_string(io, g->path, g->name, "UDC", buf);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
@@ -966,12 +1003,13 @@ out:
 
 static int usbg_parse_gadgets(const char *path, usbg_state *s)
 {
+	const struct usbg_io *io = &s->io;
 	usbg_gadget *g;
 	int i, n;
 	int ret = USBG_SUCCESS;
 	struct dirent **dent;
 
-	n = scandir(path, &dent, file_select, alphasort);
+	n = usbg_io_scandir(io, path, &dent, file_select, alphasort);
 	if (n < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -1001,14 +1039,51 @@ out:
 	return ret;
 }
 
+static int udc_index_cmp(const void *a, const void *b)
+{
+	return strcmp((*(usbg_udc **)a)->name, (*(usbg_udc **)b)->name);
+}
+
+static int udc_name_cmp(const void *name, const void *u)
+{
+	return strcmp(name, (*(usbg_udc **)u)->name);
+}
+
+static int usbg_index_udcs(usbg_state *s)
+{
+	usbg_udc **index;
+	usbg_udc *u;
+	int n = 0;
+
+	TAILQ_FOREACH(u, &s->udcs, unode)
+		++n;
+
+	index = calloc(n ? n : 1, sizeof(*index));
+	if (!index)
+		return USBG_ERROR_NO_MEM;
+
+	n = 0;
+	TAILQ_FOREACH(u, &s->udcs, unode)
+		index[n++] = u;
+
+	qsort(index, n, sizeof(*index), udc_index_cmp);
+
+	free(s->udc_index);
+	s->udc_index = index;
+	s->udc_count = n;
+
+	return USBG_SUCCESS;
+}
+
 static int usbg_parse_udcs(usbg_state *s)
 {
+	const struct usbg_io *io = &s->io;
 	usbg_udc *u;
 	int n, i;
 	int ret = USBG_SUCCESS;
 	struct dirent **dent;
 
-	n = scandir("/sys/class/udc", &dent, file_select, alphasort);
+	n = usbg_io_scandir(io, s->udc_path, &dent, file_select, alphasort);
 	if (n < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -1027,11 +1102,16 @@ static int usbg_parse_udcs(usbg_state *s)
 	}
 	free(dent);
 
+	if (ret == USBG_SUCCESS)
+		ret = usbg_index_udcs(s);
+
 out:
 	return ret;
 }
 
-static usbg_state *usbg_allocate_state(const char *configfs_path, char *path)
+static usbg_state *usbg_allocate_state(const char *configfs_path, char *path,
+					const char *udc_path,
+					const struct usbg_io *io)
 {
 	usbg_state *s;
 
@@ -1043,14 +1123,31 @@ static usbg_state *usbg_allocate_state(const char *configfs_path, char *path)
 	if (!s->configfs_path)
 		goto cpath_failed;
 
+	s->udc_path = strdup(udc_path);
+	if (!s->udc_path)
+		goto upath_failed;
+
 	/* State takes the ownership of path and should free it */
 	s->path = path;
 	s->last_failed_import = NULL;
 	TAILQ_INIT(&s->gadgets);
 	TAILQ_INIT(&s->udcs);
+	s->udc_index = NULL;
+	s->udc_count = 0;
+	s->func_probed = false;
+	s->generation = 0;
+	TAILQ_INIT(&s->tombstones);
+	memset(&s->stats, 0, sizeof(s->stats));
+	s->io = *io;
+	s->io.stats = &s->stats;
+	/* From now on state holds the backend */
+	if (io->ops->get)
+		io->ops->get(io->priv);
 
 	return s;
 
+upath_failed:
+	free(s->configfs_path);
 cpath_failed:
 	free(s);
 err:
@@ -1088,29 +1185,34 @@ out:
  * User API
  */
 
-int usbg_init(const char *configfs_path, usbg_state **state)
+int usbg_init_io(const char *configfs_path, const char *udc_path,
+		 const struct usbg_io_ops *ops, void *priv, usbg_state **state)
 {
 	int ret;
-	DIR *dir;
 	char *path;
 	usbg_state *s;
-
+	struct usbg_io io = {
+		.ops = ops ? ops : &usbg_posix_ops,
+		.priv = priv,
+	};
+	struct usbg_call call;
+
+	usbg_stats_begin_outer(&call, __func__, USBG_STAT_OP_INIT,
+			       configfs_path, NULL);
 	ret = asprintf(&path, "%s/" GADGETS_DIR, configfs_path);
-	if (ret < 0)
-		return USBG_ERROR_NO_MEM;
-	else
-		ret = USBG_SUCCESS;
+	if (ret < 0) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
 
 	/* Check if directory exist */
-	dir = opendir(path);
-	if (!dir) {
+	if (usbg_io_is_dir(&io, path)) {
 		ERRORNO("couldn't init gadget state\n");
 		ret = usbg_translate_error(errno);
 		goto err;
 	}
 
-	closedir(dir);
-	s = usbg_allocate_state(configfs_path, path);
+	s = usbg_allocate_state(configfs_path, path, udc_path, &io);
 	if (!s) {
 		ret = USBG_ERROR_NO_MEM;
 		goto err;
@@ -1124,15 +1226,23 @@ int usbg_init(const char *configfs_path, usbg_state **state)
 	}
 
 	*state = s;
+	usbg_stats_end(&call, s, ret);
 
 	return ret;
 
 err:
 	free(path);
 out:
+	/* Nothing to account to, just close the operation */
+	usbg_stats_end(&call, NULL, ret);
 	return ret;
 }
 
+int usbg_init(const char *configfs_path, usbg_state **state)
+{
+	return usbg_init_io(configfs_path, UDC_CLASS_DIR, NULL, NULL, state);
+}
+
 void usbg_cleanup(usbg_state *s)
 {
 	usbg_free_state(s);
@@ -1187,13 +1297,15 @@ usbg_config *usbg_get_config(usbg_gadget *g, int id, const char *label)
 
 usbg_udc *usbg_get_udc(usbg_state *s, const char *name)
 {
-	usbg_udc *u;
+	usbg_udc **u;
 
-	TAILQ_FOREACH(u, &s->udcs, unode)
-		if (!strcmp(u->name, name))
-			return u;
+	if (!s->udc_index)
+		return NULL;
 
-	return NULL;
+	u = bsearch(name, s->udc_index, s->udc_count,
+		    sizeof(*s->udc_index), udc_name_cmp);
+
+	return u ? *u : NULL;
 }
 
 usbg_binding *usbg_get_binding(usbg_config *c, const char *name)
@@ -1218,8 +1330,81 @@ usbg_binding *usbg_get_link_binding(usbg_config *c, usbg_function *f)
 	return NULL;
 }
 
-int usbg_rm_binding(usbg_binding *b)
+static struct usbg_tombstone *usbg_allocate_tombstone(int type,
+						     const char *gadget,
+						     const char *name)
+{
+	struct usbg_tombstone *t;
+
+	t = malloc(sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->type = type;
+	t->generation = 0;
+	t->gadget = strdup(gadget);
+	t->name = name ? strdup(name) : NULL;
+	if (!t->gadget || (name && !t->name)) {
+		usbg_free_tombstone(t);
+		return NULL;
+	}
+
+	return t;
+}
+
+/* Newer tombstone makes older ones for the same object redundant */
+static bool usbg_tombstone_covers(struct usbg_tombstone *t,
+				  struct usbg_tombstone *old)
+{
+	if (strcmp(t->gadget, old->gadget))
+		return false;
+
+	if (t->type == USBG_TOMBSTONE_GADGET)
+		return true;
+
+	return t->type == old->type && !strcmp(t->name, old->name);
+}
+
+static void usbg_bury(usbg_state *s, struct usbg_tombstone *t)
+{
+	struct usbg_tombstone *i, *next;
+
+	for (i = TAILQ_FIRST(&s->tombstones); i; i = next) {
+		next = TAILQ_NEXT(i, tnode);
+		if (usbg_tombstone_covers(t, i)) {
+			TAILQ_REMOVE(&s->tombstones, i, tnode);
+			usbg_free_tombstone(i);
+		}
+	}
+
+	t->generation = __atomic_add_fetch(&s->generation, 1, __ATOMIC_RELAXED);
+	TAILQ_INSERT_TAIL(&s->tombstones, t, tnode);
+}
+
+uint64_t usbg_get_generation(usbg_state *s)
+{
+	return s ? __atomic_load_n(&s->generation, __ATOMIC_RELAXED) : 0;
+}
+
+void usbg_drop_tombstones(usbg_state *s, uint64_t gen)
+{
+	struct usbg_tombstone *t, *next;
+
+	if (!s)
+		return;
+
+	for (t = TAILQ_FIRST(&s->tombstones); t; t = next) {
+		next = TAILQ_NEXT(t, tnode);
+		if (t->generation <= gen) {
+			TAILQ_REMOVE(&s->tombstones, t, tnode);
+			usbg_free_tombstone(t);
+		}
+	}
+}
+
+static int usbg_do_rm_binding(usbg_binding *b)
 {
+	const struct usbg_io *io = usbg_binding_io(b);
 	int ret = USBG_SUCCESS;
 	usbg_config *c;
 
@@ -1227,8 +1412,9 @@ int usbg_rm_binding(usbg_binding *b)
 		return USBG_ERROR_INVALID_PARAM;
 
 	c = b->parent;
+	usbg_touch_config(c);
 
-	ret = usbg_rm_file(b->path, b->name);
+	ret = usbg_rm_file(io, b->path, b->name);
 	if (ret)
 		goto out;
 
@@ -1239,14 +1425,29 @@ out:
 	return ret;
 }
 
+int usbg_rm_binding(usbg_binding *b)
+{
+	usbg_state *st = b ? b->parent->parent->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_REMOVE, b);
+	ret = usbg_do_rm_binding(b);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
 usbg_config *usbg_get_os_desc_binding(usbg_gadget *g)
 {
 	return g->os_desc_binding;
 }
 
-int usbg_rm_config(usbg_config *c, int opts)
+static int usbg_do_rm_config(usbg_config *c, int opts)
 {
+	const struct usbg_io *io = usbg_config_io(c);
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_tombstone *t;
 	usbg_gadget *g;
 
 	if (!c)
@@ -1254,6 +1455,10 @@ int usbg_rm_config(usbg_config *c, int opts)
 
 	g = c->parent;
 
+	t = usbg_allocate_tombstone(USBG_TOMBSTONE_CONFIG, g->name, c->name);
+	if (!t)
+		return USBG_ERROR_NO_MEM;
+
 	if (opts & USBG_RM_RECURSE) {
 		/* 
 		 * Recursive flag was given
@@ -1283,24 +1488,43 @@ int usbg_rm_config(usbg_config *c, int opts)
 			goto out;
 		}
 
-		ret = usbg_rm_all_dirs(spath);
+		ret = usbg_rm_all_dirs(io, spath);
 		if (ret != USBG_SUCCESS)
 			goto out;
 	}
 
-	ret = usbg_rm_dir(c->path, c->name);
+	ret = usbg_rm_dir(io, c->path, c->name);
 	if (ret == USBG_SUCCESS) {
 		TAILQ_REMOVE(&(g->configs), c, cnode);
 		usbg_free_config(c);
+		usbg_bury(g->parent, t);
+		t = NULL;
 	}
 
 out:
+	if (t)
+		usbg_free_tombstone(t);
 	return ret;
 }
 
-int usbg_rm_function(usbg_function *f, int opts)
+int usbg_rm_config(usbg_config *c, int opts)
+{
+	usbg_state *st = c ? c->parent->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_REMOVE, c);
+	ret = usbg_do_rm_config(c, opts);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
+static int usbg_do_rm_function(usbg_function *f, int opts)
 {
+	const struct usbg_io *io = usbg_function_io(f);
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_tombstone *t;
 	usbg_gadget *g;
 
 	if (!f)
@@ -1308,6 +1532,10 @@ int usbg_rm_function(usbg_function *f, int opts)
 
 	g = f->parent;
 
+	t = usbg_allocate_tombstone(USBG_TOMBSTONE_FUNCTION, g->name, f->name);
+	if (!t)
+		return USBG_ERROR_NO_MEM;
+
 	if (opts & USBG_RM_RECURSE) {
 		/* Recursive flag was given
 		 * so remove all bindings to this function */
@@ -1321,7 +1549,7 @@ int usbg_rm_function(usbg_function *f, int opts)
 					usbg_binding *b_next = TAILQ_NEXT(b, bnode);
 					ret = usbg_rm_binding(b);
 					if (ret != USBG_SUCCESS)
-						return ret;
+						goto out;
 
 					b = b_next;
 				} else {
@@ -1337,25 +1565,53 @@ int usbg_rm_function(usbg_function *f, int opts)
 			goto out;
 	}
 
-	ret = usbg_rm_dir(f->path, f->name);
+	ret = usbg_rm_dir(io, f->path, f->name);
 	if (ret == USBG_SUCCESS) {
 		TAILQ_REMOVE(&(g->functions), f, fnode);
 		usbg_free_function(f);
+		usbg_bury(g->parent, t);
+		t = NULL;
 	}
 
 out:
+	if (t)
+		usbg_free_tombstone(t);
 	return ret;
 }
 
-int usbg_rm_gadget(usbg_gadget *g, int opts)
+int usbg_rm_function(usbg_function *f, int opts)
+{
+	usbg_state *st = f ? f->parent->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_REMOVE, f);
+	ret = usbg_do_rm_function(f, opts);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
+static int usbg_do_rm_gadget(usbg_gadget *g, int opts)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_tombstone *t = NULL;
 	usbg_state *s;
 	if (!g)
 		goto out;
 
 	s = g->parent;
 
+	if (opts & (USBG_RM_PARALLEL | USBG_RM_BEST_EFFORT))
+		return usbg_teardown_gadget(g, opts, NULL, NULL);
+
+	t = usbg_allocate_tombstone(USBG_TOMBSTONE_GADGET, g->name, NULL);
+	if (!t) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
 	if (opts & USBG_RM_RECURSE) {
 		/* Recursive flag was given
 		 * so remove all configs and functions
@@ -1386,56 +1642,86 @@ int usbg_rm_gadget(usbg_gadget *g, int opts)
 			goto out;
 		}
 
-		ret = usbg_rm_all_dirs(spath);
+		ret = usbg_rm_all_dirs(io, spath);
 		if (ret != USBG_SUCCESS)
 			goto out;
 	}
 
-	ret = usbg_rm_dir(g->path, g->name);
+	ret = usbg_rm_dir(io, g->path, g->name);
 	if (ret == USBG_SUCCESS) {
+		/* Removed gadget no longer occupies its UDC */
+		if (g->udc)
+			g->udc->gadget = NULL;
 		TAILQ_REMOVE(&(s->gadgets), g, gnode);
 		usbg_free_gadget(g);
+		usbg_bury(s, t);
+		t = NULL;
 	}
 
 out:
+	if (t)
+		usbg_free_tombstone(t);
+	return ret;
+}
+
+int usbg_rm_gadget(usbg_gadget *g, int opts)
+{
+	usbg_state *st = g ? g->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_REMOVE, g);
+	ret = usbg_do_rm_gadget(g, opts);
+	usbg_stats_end(&call, st, ret);
+
 	return ret;
 }
 
 int usbg_rm_config_strs(usbg_config *c, int lang)
 {
+	const struct usbg_io *io = usbg_config_io(c);
 	int ret = USBG_SUCCESS;
 	int nmb;
 	char path[USBG_MAX_PATH_LENGTH];
+	struct usbg_call call;
 
 	if (!c)
 		return USBG_ERROR_INVALID_PARAM;
 
+	USBG_CALL_BEGIN(&call, c);
+	usbg_touch_config(c);
 	nmb = snprintf(path, sizeof(path), "%s/%s/%s/0x%x", c->path, c->name,
 			STRINGS_DIR, lang);
 	if (nmb < sizeof(path))
-		ret = usbg_rm_dir(path, "");
+		ret = usbg_rm_dir(io, path, "");
 	else
 		ret = USBG_ERROR_PATH_TOO_LONG;
 
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
 int usbg_rm_gadget_strs(usbg_gadget *g, int lang)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	int ret = USBG_SUCCESS;
 	int nmb;
 	char path[USBG_MAX_PATH_LENGTH];
+	struct usbg_call call;
 
 	if (!g)
 		return USBG_ERROR_INVALID_PARAM;
 
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
 	nmb = snprintf(path, sizeof(path), "%s/%s/%s/0x%x", g->path, g->name,
 			STRINGS_DIR, lang);
 	if (nmb < sizeof(path))
-		ret = usbg_rm_dir(path, "");
+		ret = usbg_rm_dir(io, path, "");
 	else
 		ret = USBG_ERROR_PATH_TOO_LONG;
 
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
@@ -1443,6 +1729,7 @@ int usbg_rm_gadget_strs(usbg_gadget *g, int lang)
 static int usbg_create_empty_gadget(usbg_state *s, const char *name,
 				    usbg_gadget **g)
 {
+	const struct usbg_io *io = &s->io;
 	char gpath[USBG_MAX_PATH_LENGTH];
 	char buf[USBG_MAX_STR_LENGTH];
 	int nmb;
@@ -1463,7 +1750,7 @@ static int usbg_create_empty_gadget(usbg_state *s, const char *name,
 
 	gad = *g; /* alias only */
 
-	ret = mkdir(gpath, S_IRWXU|S_IRWXG|S_IRWXO);
+	ret = usbg_io_mkdir(io, gpath, S_IRWXU|S_IRWXG|S_IRWXO);
 	if (ret != 0) {
 		ret = usbg_translate_error(errno);
 		goto free_gadget;
@@ -1471,7 +1758,7 @@ static int usbg_create_empty_gadget(usbg_state *s, const char *name,
 
 
 	/* Should be empty but read the default */
-	ret = usbg_read_string(gad->path, gad->name,
+	ret = usbg_read_string(io, gad->path, gad->name,
 			       "UDC", buf);
 	if (ret != USBG_SUCCESS)
 		goto rm_gdir;
@@ -1482,7 +1769,7 @@ static int usbg_create_empty_gadget(usbg_state *s, const char *name,
 
 	return 0;
 rm_gdir:
-	rmdir(gpath);
+	usbg_io_rmdir(io, gpath);
 free_gadget:
 	usbg_free_gadget(*g);
 	*g = NULL;
@@ -1490,8 +1777,9 @@ out:
 	return ret;
 }
 
-int usbg_create_gadget_vid_pid(usbg_state *s, const char *name,
-		uint16_t idVendor, uint16_t idProduct, usbg_gadget **g)
+static int usbg_do_create_gadget_vid_pid(usbg_state *s, const char *name,
+					 uint16_t idVendor, uint16_t idProduct,
+					 usbg_gadget **g)
 {
 	int ret;
 	usbg_gadget *gad;
@@ -1510,28 +1798,43 @@ int usbg_create_gadget_vid_pid(usbg_state *s, const char *name,
 	if (ret != USBG_SUCCESS)
 		goto out;
 
-	ret = usbg_write_hex16(s->path, name, "idVendor", idVendor);
+	ret = usbg_write_hex16(&s->io, s->path, name, "idVendor", idVendor);
 	if (ret != USBG_SUCCESS)
 		goto rm_gadget;
 
-	ret = usbg_write_hex16(s->path, name, "idProduct", idProduct);
+	ret = usbg_write_hex16(&s->io, s->path, name, "idProduct", idProduct);
 	if (ret != USBG_SUCCESS)
 		goto rm_gadget;
 
+	usbg_touch_gadget(gad);
 	INSERT_TAILQ_STRING_ORDER(&s->gadgets, ghead, name, gad, gnode);
 
 	return 0;
 
 rm_gadget:
-	usbg_rm_dir(gad->path, gad->name);
+	usbg_rm_dir(&s->io, gad->path, gad->name);
 	usbg_free_gadget(gad);
 out:
 	return ret;
 }
 
-int usbg_create_gadget(usbg_state *s, const char *name,
-		       const struct usbg_gadget_attrs *g_attrs,
-		       const struct usbg_gadget_strs *g_strs, usbg_gadget **g)
+int usbg_create_gadget_vid_pid(usbg_state *s, const char *name,
+		uint16_t idVendor, uint16_t idProduct, usbg_gadget **g)
+{
+	struct usbg_call call;
+	int ret;
+
+	usbg_stats_begin(&call, __func__, USBG_STAT_OP_NONE,
+			 s ? s->path : NULL, name);
+	ret = usbg_do_create_gadget_vid_pid(s, name, idVendor, idProduct, g);
+	USBG_CALL_END(&call, ret);
+
+	return ret;
+}
+
+static int usbg_do_create_gadget(usbg_state *s, const char *name,
+				 const struct usbg_gadget_attrs *g_attrs,
+				 const struct usbg_gadget_strs *g_strs, usbg_gadget **g)
 {
 	usbg_gadget *gad;
 	int ret;
@@ -1565,21 +1868,120 @@ int usbg_create_gadget(usbg_state *s, const char *name,
 			goto rm_gadget;
 	}
 
+	usbg_touch_gadget(gad);
 	INSERT_TAILQ_STRING_ORDER(&s->gadgets, ghead, name, gad, gnode);
 
 	return 0;
 rm_gadget:
-	usbg_rm_dir(gad->path, gad->name);
+	usbg_rm_dir(&s->io, gad->path, gad->name);
 	usbg_free_gadget(gad);
 out:
 	return ret;
 }
 
+int usbg_create_gadget(usbg_state *s, const char *name,
+		       const struct usbg_gadget_attrs *g_attrs,
+		       const struct usbg_gadget_strs *g_strs, usbg_gadget **g)
+{
+	struct usbg_call call;
+	int ret;
+
+	usbg_stats_begin(&call, __func__, USBG_STAT_OP_CREATE,
+			 s ? s->path : NULL, name);
+	ret = usbg_do_create_gadget(s, name, g_attrs, g_strs, g);
+	usbg_stats_end(&call, s, ret);
+
+	return ret;
+}
+
+int usbg_load_gadget(usbg_state *s, const char *name, usbg_gadget **g)
+{
+	usbg_gadget *gad;
+	int ret;
+
+	gad = usbg_allocate_gadget(s->path, name, s);
+	if (!gad)
+		return USBG_ERROR_NO_MEM;
+
+	ret = usbg_parse_gadget(gad);
+	if (ret != USBG_SUCCESS) {
+		usbg_free_gadget(gad);
+		return ret;
+	}
+
+	usbg_touch_gadget(gad);
+	INSERT_TAILQ_STRING_ORDER(&s->gadgets, ghead, name, gad, gnode);
+	*g = gad;
+
+	return USBG_SUCCESS;
+}
+
+int usbg_reload_gadget(usbg_gadget *g)
+{
+	usbg_config *c;
+	usbg_function *f;
+
+	while (!TAILQ_EMPTY(&g->configs)) {
+		c = TAILQ_FIRST(&g->configs);
+		TAILQ_REMOVE(&g->configs, c, cnode);
+		usbg_free_config(c);
+	}
+	while (!TAILQ_EMPTY(&g->functions)) {
+		f = TAILQ_FIRST(&g->functions);
+		TAILQ_REMOVE(&g->functions, f, fnode);
+		usbg_free_function(f);
+	}
+
+	g->os_desc_binding = NULL;
+	if (g->udc)
+		g->udc->gadget = NULL;
+	g->udc = NULL;
+
+	usbg_touch_gadget(g);
+
+	return usbg_parse_gadget(g);
+}
+
+int usbg_forget_gadget(usbg_gadget *g)
+{
+	usbg_state *s = g->parent;
+	struct usbg_tombstone *t;
+
+	t = usbg_allocate_tombstone(USBG_TOMBSTONE_GADGET, g->name, NULL);
+
+	if (g->udc)
+		g->udc->gadget = NULL;
+	TAILQ_REMOVE(&s->gadgets, g, gnode);
+	usbg_free_gadget(g);
+
+	if (!t)
+		return USBG_ERROR_NO_MEM;
+
+	usbg_bury(s, t);
+	return USBG_SUCCESS;
+}
+
+static int usbg_do_get_gadget_attrs(usbg_gadget *g,
+				    struct usbg_gadget_attrs *g_attrs)
+{
+	const struct usbg_io *io = usbg_gadget_io(g);
+	return g && g_attrs ? usbg_parse_gadget_attrs(io, g->path, g->name,
+						      g_attrs)
+			: USBG_ERROR_INVALID_PARAM;
+}
+
 int usbg_get_gadget_attrs(usbg_gadget *g,
 			  struct usbg_gadget_attrs *g_attrs)
 {
-	return g && g_attrs ? usbg_parse_gadget_attrs(g->path, g->name, g_attrs)
-			: USBG_ERROR_INVALID_PARAM;
+	usbg_state *st = g ? g->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_GET_ATTRS, g);
+	ret = usbg_do_get_gadget_attrs(g, g_attrs);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
 }
 
 const char *usbg_get_gadget_name(usbg_gadget *g)
@@ -1611,9 +2013,12 @@ int usbg_get_udc_name_s(usbg_udc *u, char *buf, int len)
 
 int usbg_set_gadget_attr(usbg_gadget *g, usbg_gadget_attr attr, int val)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	const char *attr_name;
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, g);
 	if (!g)
 		goto out;
 
@@ -1621,17 +2026,22 @@ int usbg_set_gadget_attr(usbg_gadget *g, usbg_gadget_attr attr, int val)
 	if (!attr_name)
 		goto out;
 
-	ret = usbg_write_hex(g->path, g->name, attr_name, val);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex(io, g->path, g->name, attr_name, val);
 
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
 int usbg_get_gadget_attr(usbg_gadget *g, usbg_gadget_attr attr)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	const char *attr_name;
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, g);
 	if (!g)
 		goto out;
 
@@ -1639,14 +2049,16 @@ int usbg_get_gadget_attr(usbg_gadget *g, usbg_gadget_attr attr)
 	if (!attr_name)
 		goto out;
 
-	usbg_read_hex(g->path, g->name, attr_name, &ret);
+	usbg_read_hex(io, g->path, g->name, attr_name, &ret);
 
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
 usbg_udc *usbg_get_gadget_udc(usbg_gadget *g)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	usbg_udc *u = NULL;
 	char buf[USBG_MAX_STR_LENGTH];
 	int ret;
@@ -1659,7 +2071,7 @@ usbg_udc *usbg_get_gadget_udc(usbg_gadget *g)
 	 * For example some FFS daemon could just get
 	 * a segmentation fault or sth
 	 */
-	ret = usbg_read_string(g->path, g->name, "UDC", buf);
+	ret = usbg_read_string(io, g->path, g->name, "UDC", buf);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
@@ -1700,110 +2112,217 @@ out:
 	return g;
 }
 
-int usbg_set_gadget_attrs(usbg_gadget *g,
-			  const struct usbg_gadget_attrs *g_attrs)
+static int usbg_do_set_gadget_attrs(usbg_gadget *g,
+				    const struct usbg_gadget_attrs *g_attrs)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	int ret;
 	if (!g || !g_attrs)
 		return USBG_ERROR_INVALID_PARAM;
 
-	ret = usbg_write_hex16(g->path, g->name, "bcdUSB", g_attrs->bcdUSB);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex16(io, g->path, g->name, "bcdUSB", g_attrs->bcdUSB);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
-	ret = usbg_write_hex8(g->path, g->name, "bDeviceClass",
+	ret = usbg_write_hex8(io, g->path, g->name, "bDeviceClass",
 		g_attrs->bDeviceClass);
 	if (ret != USBG_SUCCESS)
 			goto out;
 
-	ret = usbg_write_hex8(g->path, g->name, "bDeviceSubClass",
+	ret = usbg_write_hex8(io, g->path, g->name, "bDeviceSubClass",
 		g_attrs->bDeviceSubClass);
 	if (ret != USBG_SUCCESS)
 			goto out;
 
-	ret = usbg_write_hex8(g->path, g->name, "bDeviceProtocol",
+	ret = usbg_write_hex8(io, g->path, g->name, "bDeviceProtocol",
 		g_attrs->bDeviceProtocol);
 	if (ret != USBG_SUCCESS)
 			goto out;
 
-	ret = usbg_write_hex8(g->path, g->name, "bMaxPacketSize0",
+	ret = usbg_write_hex8(io, g->path, g->name, "bMaxPacketSize0",
 		g_attrs->bMaxPacketSize0);
 	if (ret != USBG_SUCCESS)
 			goto out;
 
-	ret = usbg_write_hex16(g->path, g->name, "idVendor",
+	ret = usbg_write_hex16(io, g->path, g->name, "idVendor",
 		g_attrs->idVendor);
 	if (ret != USBG_SUCCESS)
 			goto out;
 
-	ret = usbg_write_hex16(g->path, g->name, "idProduct",
+	ret = usbg_write_hex16(io, g->path, g->name, "idProduct",
 		 g_attrs->idProduct);
 	if (ret != USBG_SUCCESS)
 			goto out;
 
-	ret = usbg_write_hex16(g->path, g->name, "bcdDevice",
+	ret = usbg_write_hex16(io, g->path, g->name, "bcdDevice",
 		g_attrs->bcdDevice);
 
 out:
 	return ret;
 }
 
+int usbg_set_gadget_attrs(usbg_gadget *g,
+			  const struct usbg_gadget_attrs *g_attrs)
+{
+	usbg_state *st = g ? g->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_SET_ATTRS, g);
+	ret = usbg_do_set_gadget_attrs(g, g_attrs);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
 int usbg_set_gadget_vendor_id(usbg_gadget *g, uint16_t idVendor)
 {
-	return g ? usbg_write_hex16(g->path, g->name, "idVendor", idVendor)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex16(io, g->path, g->name, "idVendor", idVendor);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_gadget_product_id(usbg_gadget *g, uint16_t idProduct)
 {
-	return g ? usbg_write_hex16(g->path, g->name, "idProduct", idProduct)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex16(io, g->path, g->name, "idProduct", idProduct);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_gadget_device_class(usbg_gadget *g, uint8_t bDeviceClass)
 {
-	return g ? usbg_write_hex8(g->path, g->name, "bDeviceClass", bDeviceClass)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex8(io, g->path, g->name, "bDeviceClass",
+			      bDeviceClass);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_gadget_device_protocol(usbg_gadget *g, uint8_t bDeviceProtocol)
 {
-	return g ? usbg_write_hex8(g->path, g->name, "bDeviceProtocol", bDeviceProtocol)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex8(io, g->path, g->name, "bDeviceProtocol", bDeviceProtocol);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_gadget_device_subclass(usbg_gadget *g, uint8_t bDeviceSubClass)
 {
-	return g ? usbg_write_hex8(g->path, g->name, "bDeviceSubClass", bDeviceSubClass)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex8(io, g->path, g->name, "bDeviceSubClass", bDeviceSubClass);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_gadget_device_max_packet(usbg_gadget *g, uint8_t bMaxPacketSize0)
 {
-	return g ? usbg_write_hex8(g->path, g->name, "bMaxPacketSize0", bMaxPacketSize0)
-			: USBG_ERROR_INVALID_PARAM;
-}
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
 
-int usbg_set_gadget_device_bcd_device(usbg_gadget *g, uint16_t bcdDevice)
-{
-	return g ? usbg_write_hex16(g->path, g->name, "bcdDevice", bcdDevice)
-			: USBG_ERROR_INVALID_PARAM;
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex8(io, g->path, g->name, "bMaxPacketSize0", bMaxPacketSize0);
+	USBG_CALL_END(&call, ret);
+	return ret;
+}
+
+int usbg_set_gadget_device_bcd_device(usbg_gadget *g, uint16_t bcdDevice)
+{
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex16(io, g->path, g->name, "bcdDevice", bcdDevice);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_gadget_device_bcd_usb(usbg_gadget *g, uint16_t bcdUSB)
 {
-	return g ? usbg_write_hex16(g->path, g->name, "bcdUSB", bcdUSB)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
+	ret = usbg_write_hex16(io, g->path, g->name, "bcdUSB", bcdUSB);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_get_gadget_strs(usbg_gadget *g, int lang,
 			 struct usbg_gadget_strs *g_strs)
 {
-	return g && g_strs ? usbg_parse_gadget_strs(g->path, g->name, lang,
-			g_strs)	: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	if (!g || !g_strs)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	ret = usbg_parse_gadget_strs(io, g->path, g->name, lang, g_strs);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
-static int usbg_get_strs_langs_by_path(const char *epath, const char *name,
+static int usbg_get_strs_langs_by_path(const struct usbg_io *io,
+				       const char *epath, const char *name,
 				       int **langs)
 {
 	int i, n;
@@ -1819,7 +2338,7 @@ static int usbg_get_strs_langs_by_path(const char *epath, const char *name,
 		goto out;
 	}
 
-	n = scandir(spath, &dent, file_select, alphasort);
+	n = usbg_io_scandir(io, spath, &dent, file_select, alphasort);
 	if (n < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -1857,22 +2376,39 @@ out:
 
 int usbg_get_gadget_strs_langs(usbg_gadget *g, int **langs)
 {
-	return usbg_get_strs_langs_by_path(g->path, g->name, langs);
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, g);
+	ret = usbg_get_strs_langs_by_path(io, g->path, g->name, langs);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_get_config_strs_langs(usbg_config *c, int **langs)
 {
-	return usbg_get_strs_langs_by_path(c->path, c->name, langs);
+	const struct usbg_io *io = usbg_config_io(c);
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, c);
+	ret = usbg_get_strs_langs_by_path(io, c->path, c->name, langs);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_gadget_str(usbg_gadget *g, usbg_gadget_str str, int lang,
 		const char *val)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	const char *str_name;
 	int ret = USBG_ERROR_INVALID_PARAM;
 	char path[USBG_MAX_PATH_LENGTH];
 	int nmb;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, g);
 	if (!g)
 		goto out;
 
@@ -1880,6 +2416,7 @@ int usbg_set_gadget_str(usbg_gadget *g, usbg_gadget_str str, int lang,
 	if (!str_name)
 		goto out;
 
+	usbg_touch_gadget(g);
 	nmb = snprintf(path, sizeof(path), "%s/%s/%s/0x%x", g->path, g->name,
 			STRINGS_DIR, lang);
 	if (nmb >= sizeof(path)) {
@@ -1887,26 +2424,31 @@ int usbg_set_gadget_str(usbg_gadget *g, usbg_gadget_str str, int lang,
 		goto out;
 	}
 
-	ret = usbg_check_dir(path);
+	ret = usbg_check_dir(io, path);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
-	ret = usbg_write_string(path, "", str_name, val);
+	ret = usbg_write_string(io, path, "", str_name, val);
 
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
 int usbg_set_gadget_strs(usbg_gadget *g, int lang,
 			 const struct usbg_gadget_strs *g_strs)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	char path[USBG_MAX_PATH_LENGTH];
 	int nmb;
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, g);
 	if (!g || !g_strs)
 		goto out;
 
+	usbg_touch_gadget(g);
 	nmb = snprintf(path, sizeof(path), "%s/%s/%s/0x%x", g->path, g->name,
 			STRINGS_DIR, lang);
 	if (nmb >= sizeof(path)) {
@@ -1914,13 +2456,13 @@ int usbg_set_gadget_strs(usbg_gadget *g, int lang,
 		goto out;
 	}
 
-	ret = usbg_check_dir(path);
+	ret = usbg_check_dir(io, path);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
 #define SET_GADGET_STR(file, field)				\
 	if (g_strs->field) {					\
-		ret = usbg_write_string(path, "", #file,	\
+		ret = usbg_write_string(io, path, "", #file,	\
 					g_strs->field);		\
 		if (ret != USBG_SUCCESS)			\
 			goto out;				\
@@ -1931,18 +2473,23 @@ int usbg_set_gadget_strs(usbg_gadget *g, int lang,
 	SET_GADGET_STR(serialnumber, serial);
 #undef SET_GADGET_STR
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
 int usbg_set_gadget_serial_number(usbg_gadget *g, int lang, const char *serno)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	char path[USBG_MAX_PATH_LENGTH];
 	int nmb;
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, g);
 	if (!g || !serno)
 		goto out;
 
+	usbg_touch_gadget(g);
 	nmb = snprintf(path, sizeof(path), "%s/%s/%s/0x%x", g->path,
 		       g->name, STRINGS_DIR, lang);
 	if (nmb >= sizeof(path)) {
@@ -1950,23 +2497,28 @@ int usbg_set_gadget_serial_number(usbg_gadget *g, int lang, const char *serno)
 		goto out;
 	}
 
-	ret = usbg_check_dir(path);
+	ret = usbg_check_dir(io, path);
 	if (ret == USBG_SUCCESS)
-		ret = usbg_write_string(path, "", "serialnumber", serno);
+		ret = usbg_write_string(io, path, "", "serialnumber", serno);
 
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
 int usbg_set_gadget_manufacturer(usbg_gadget *g, int lang, const char *mnf)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	char path[USBG_MAX_PATH_LENGTH];
 	int nmb;
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, g);
 	if (!g || !mnf)
 		goto out;
 
+	usbg_touch_gadget(g);
 	nmb = snprintf(path, sizeof(path), "%s/%s/%s/0x%x", g->path,
 		       g->name, STRINGS_DIR, lang);
 	if (nmb >= sizeof(path)) {
@@ -1974,23 +2526,28 @@ int usbg_set_gadget_manufacturer(usbg_gadget *g, int lang, const char *mnf)
 		goto out;
 	}
 
-	ret = usbg_check_dir(path);
+	ret = usbg_check_dir(io, path);
 	if (ret == USBG_SUCCESS)
-		ret = usbg_write_string(path, "", "manufacturer", mnf);
+		ret = usbg_write_string(io, path, "", "manufacturer", mnf);
 
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
 int usbg_set_gadget_product(usbg_gadget *g, int lang, const char *prd)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	char path[USBG_MAX_PATH_LENGTH];
 	int nmb;
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, g);
 	if (!g || !prd)
 		goto out;
 
+	usbg_touch_gadget(g);
 	nmb = snprintf(path, sizeof(path), "%s/%s/%s/0x%x", g->path,
 		       g->name, STRINGS_DIR, lang);
 	if (nmb >= sizeof(path)) {
@@ -1998,28 +2555,44 @@ int usbg_set_gadget_product(usbg_gadget *g, int lang, const char *prd)
 		goto out;
 	}
 
-	ret = usbg_check_dir(path);
+	ret = usbg_check_dir(io, path);
 	if (ret == USBG_SUCCESS)
-		ret = usbg_write_string(path, "", "product", prd);
+		ret = usbg_write_string(io, path, "", "product", prd);
 
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
 int usbg_get_gadget_os_descs(usbg_gadget *g, struct usbg_gadget_os_descs *g_os_descs)
 {
-	return g && g_os_descs ?
-			usbg_parse_gadget_os_descs(g->path, g->name, g_os_descs)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_gadget_io(g);
+	struct usbg_call call;
+	int ret;
+
+	if (!g || !g_os_descs)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	ret = usbg_parse_gadget_os_descs(io, g->path, g->name, g_os_descs);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_gadget_os_descs(usbg_gadget *g,
 			     const struct usbg_gadget_os_descs *g_os_descs)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	int ret;
 	int nmb;
 	char spath[USBG_MAX_PATH_LENGTH];
+	struct usbg_call call;
 
+	if (!g || !g_os_descs)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, g);
+	usbg_touch_gadget(g);
 	nmb = snprintf(spath, sizeof(spath), "%s/%s/%s", g->path, g->name,
 			OS_DESC_DIR);
 	if (nmb >= sizeof(spath)) {
@@ -2027,42 +2600,43 @@ int usbg_set_gadget_os_descs(usbg_gadget *g,
 		goto out;
 	}
 
-	ret = usbg_check_dir(spath);
+	ret = usbg_check_dir(io, spath);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
-	ret = usbg_write_string(spath, "", "qw_sign", g_os_descs->qw_sign);
+	ret = usbg_write_string(io, spath, "", "qw_sign", g_os_descs->qw_sign);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
-	ret = usbg_write_hex8(spath, "", "b_vendor_code",
+	ret = usbg_write_hex8(io, spath, "", "b_vendor_code",
 				g_os_descs->b_vendor_code);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
-	ret = usbg_write_dec(spath, "", "use", g_os_descs->use);
+	ret = usbg_write_dec(io, spath, "", "use", g_os_descs->use);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
-int usbg_create_function(usbg_gadget *g, usbg_function_type type,
-			 const char *instance, void *f_attrs, usbg_function **f)
+int usbg_create_function_detached(usbg_gadget *g, usbg_function_type type,
+				  const char *instance, void *f_attrs,
+				  usbg_function **f)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	char fpath[USBG_MAX_PATH_LENGTH];
 	usbg_function *func;
 	int ret = USBG_ERROR_INVALID_PARAM;
 	int n, free_space;
 
-	if (!g || !f || !instance || *instance == '\0')
-		return ret;
-
-	func = usbg_get_function(g, type, instance);
-	if (func) {
-		ERROR("duplicate function name\n");
-		ret = USBG_ERROR_EXIST;
+	/* Don't wait for module autoloading if we know that it will fail */
+	if (g->parent->func_probed && type >= USBG_FUNCTION_TYPE_MIN &&
+	    type < USBG_FUNCTION_TYPE_MAX &&
+	    g->parent->func_avail[type] == USBG_FUNC_AVAIL_MISSING) {
+		ret = USBG_ERROR_NOT_SUPPORTED;
 		goto out;
 	}
 
@@ -2088,7 +2662,7 @@ int usbg_create_function(usbg_gadget *g, usbg_function_type type,
 		goto free_func;
 	}
 
-	ret = mkdir(fpath, S_IRWXU | S_IRWXG | S_IRWXO);
+	ret = usbg_io_mkdir(io, fpath, S_IRWXU | S_IRWXG | S_IRWXO);
 	if (ret) {
 		ret = usbg_translate_error(errno);
 		goto free_func;
@@ -2100,21 +2674,59 @@ int usbg_create_function(usbg_gadget *g, usbg_function_type type,
 			goto remove_dir;
 	}
 
-	INSERT_TAILQ_STRING_ORDER(&g->functions, fhead, name, func, fnode);
+	usbg_touch_function(func);
 
 	return USBG_SUCCESS;
 
 remove_dir:
-	usbg_rm_dir(fpath, "");
+	usbg_rm_dir(io, fpath, "");
 free_func:
 	usbg_free_function(func);
 out:
 	return ret;
 }
 
-int usbg_get_interf_os_desc(usbg_function *f, const char *iname,
-			struct usbg_function_os_desc *f_os_desc)
+static int usbg_do_create_function(usbg_gadget *g, usbg_function_type type,
+				   const char *instance, void *f_attrs, usbg_function **f)
+{
+	usbg_function *func;
+	int ret;
+
+	if (!g || !f || !instance || *instance == '\0')
+		return USBG_ERROR_INVALID_PARAM;
+
+	func = usbg_get_function(g, type, instance);
+	if (func) {
+		ERROR("duplicate function name\n");
+		return USBG_ERROR_EXIST;
+	}
+
+	ret = usbg_create_function_detached(g, type, instance, f_attrs, f);
+	if (ret == USBG_SUCCESS)
+		INSERT_TAILQ_STRING_ORDER(&g->functions, fhead, name, *f,
+					  fnode);
+
+	return ret;
+}
+
+int usbg_create_function(usbg_gadget *g, usbg_function_type type,
+			 const char *instance, void *f_attrs, usbg_function **f)
 {
+	usbg_state *st = g ? g->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_CREATE, g);
+	ret = usbg_do_create_function(g, type, instance, f_attrs, f);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
+static int usbg_do_get_interf_os_desc(usbg_function *f, const char *iname,
+				      struct usbg_function_os_desc *f_os_desc)
+{
+	const struct usbg_io *io = usbg_function_io(f);
 	int ret = USBG_ERROR_NOT_SUPPORTED;
 	int nmb;
 	char spath[USBG_MAX_PATH_LENGTH];
@@ -2129,12 +2741,12 @@ int usbg_get_interf_os_desc(usbg_function *f, const char *iname,
 		goto out;
 	}
 
-	ret = usbg_read_string_alloc(spath, "", "compatible_id",
+	ret = usbg_read_string_alloc(io, spath, "", "compatible_id",
 				&f_os_desc->compatible_id);
 	if (ret < 0)
 		goto out;
 
-	ret = usbg_read_string_alloc(spath, "", "sub_compatible_id",
+	ret = usbg_read_string_alloc(io, spath, "", "sub_compatible_id",
 				&f_os_desc->sub_compatible_id);
 	if (ret < 0)
 		goto free_compatible;
@@ -2147,9 +2759,23 @@ out:
 	return ret;
 }
 
-int usbg_set_interf_os_desc(usbg_function *f, const char *iname,
+int usbg_get_interf_os_desc(usbg_function *f, const char *iname,
+			struct usbg_function_os_desc *f_os_desc)
+{
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, f);
+	ret = usbg_do_get_interf_os_desc(f, iname, f_os_desc);
+	USBG_CALL_END(&call, ret);
+
+	return ret;
+}
+
+static int usbg_do_set_interf_os_desc(usbg_function *f, const char *iname,
 			const struct usbg_function_os_desc *f_os_desc)
 {
+	const struct usbg_io *io = usbg_function_io(f);
 	int ret = USBG_ERROR_NOT_SUPPORTED;
 	int nmb;
 	char spath[USBG_MAX_PATH_LENGTH];
@@ -2157,6 +2783,7 @@ int usbg_set_interf_os_desc(usbg_function *f, const char *iname,
 	if (!iname)
 		return ret;
 
+	usbg_touch_function(f);
 	nmb = snprintf(spath, sizeof(spath), "%s/%s/%s/interface.%s", f->path,
 			f->name, OS_DESC_DIR, iname);
 	if (nmb >= sizeof(spath)) {
@@ -2164,23 +2791,37 @@ int usbg_set_interf_os_desc(usbg_function *f, const char *iname,
 		goto out;
 	}
 
-	ret = usbg_write_string(spath, "", "compatible_id",
+	ret = usbg_write_string(io, spath, "", "compatible_id",
 			f_os_desc->compatible_id);
 	if (ret < 0)
 		return ret;
 
-	ret = usbg_write_string(spath, "", "sub_compatible_id",
+	ret = usbg_write_string(io, spath, "", "sub_compatible_id",
 			f_os_desc->sub_compatible_id);
 
 out:
 	return ret;
 }
 
-int usbg_create_config(usbg_gadget *g, int id, const char *label,
-		       const struct usbg_config_attrs *c_attrs,
-		       const struct usbg_config_strs *c_strs,
-		       usbg_config **c)
+int usbg_set_interf_os_desc(usbg_function *f, const char *iname,
+			const struct usbg_function_os_desc *f_os_desc)
+{
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, f);
+	ret = usbg_do_set_interf_os_desc(f, iname, f_os_desc);
+	USBG_CALL_END(&call, ret);
+
+	return ret;
+}
+
+static int usbg_do_create_config(usbg_gadget *g, int id, const char *label,
+				 const struct usbg_config_attrs *c_attrs,
+				 const struct usbg_config_strs *c_strs,
+				 usbg_config **c)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	char cpath[USBG_MAX_PATH_LENGTH];
 	usbg_config *conf = NULL;
 	int ret = USBG_ERROR_INVALID_PARAM;
@@ -2223,7 +2864,7 @@ int usbg_create_config(usbg_gadget *g, int id, const char *label,
 		goto out;
 	}
 
-	ret = mkdir(cpath, S_IRWXU | S_IRWXG | S_IRWXO);
+	ret = usbg_io_mkdir(io, cpath, S_IRWXU | S_IRWXG | S_IRWXO);
 	if (ret) {
 		ret = usbg_translate_error(errno);
 		goto free_config;
@@ -2242,18 +2883,35 @@ int usbg_create_config(usbg_gadget *g, int id, const char *label,
 			goto rm_config;
 	}
 
+	usbg_touch_config(conf);
 	INSERT_TAILQ_STRING_ORDER(&g->configs, chead, name,
 				  conf, cnode);
 
 	return 0;
 rm_config:
-	rmdir(cpath);
+	usbg_io_rmdir(io, cpath);
 free_config:
 	usbg_free_config(conf);
 out:
 	return ret;
 }
 
+int usbg_create_config(usbg_gadget *g, int id, const char *label,
+		       const struct usbg_config_attrs *c_attrs,
+		       const struct usbg_config_strs *c_strs,
+		       usbg_config **c)
+{
+	usbg_state *st = g ? g->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_CREATE, g);
+	ret = usbg_do_create_config(g, id, label, c_attrs, c_strs, c);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
 const char *usbg_get_config_label(usbg_config *c)
 {
 	return c ? c->label : NULL;
@@ -2289,48 +2947,93 @@ int usbg_get_function_instance_s(usbg_function *f, char *buf, int len)
 int usbg_set_config_attrs(usbg_config *c,
 			  const struct usbg_config_attrs *c_attrs)
 {
+	const struct usbg_io *io = usbg_config_io(c);
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, c);
 	if (!c || !c_attrs)
 		goto out;
 
-	ret = usbg_write_dec(c->path, c->name, "MaxPower", c_attrs->bMaxPower);
+	usbg_touch_config(c);
+	ret = usbg_write_dec(io, c->path, c->name, "MaxPower",
+			     c_attrs->bMaxPower);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
-	ret = usbg_write_hex8(c->path, c->name, "bmAttributes",
+	ret = usbg_write_hex8(io, c->path, c->name, "bmAttributes",
 			      c_attrs->bmAttributes);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
 int usbg_get_config_attrs(usbg_config *c,
 			  struct usbg_config_attrs *c_attrs)
 {
-	return c && c_attrs ? usbg_parse_config_attrs(c->path, c->name, c_attrs)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_config_io(c);
+	struct usbg_call call;
+	int ret;
+
+	if (!c || !c_attrs)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, c);
+	ret = usbg_parse_config_attrs(io, c->path, c->name, c_attrs);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_config_max_power(usbg_config *c, int bMaxPower)
 {
-	return c ? usbg_write_dec(c->path, c->name, "MaxPower", bMaxPower)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_config_io(c);
+	struct usbg_call call;
+	int ret;
+
+	if (!c)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, c);
+	usbg_touch_config(c);
+	ret = usbg_write_dec(io, c->path, c->name, "MaxPower", bMaxPower);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_config_bm_attrs(usbg_config *c, int bmAttributes)
 {
-	return c ? usbg_write_hex8(c->path, c->name, "bmAttributes", bmAttributes)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_config_io(c);
+	struct usbg_call call;
+	int ret;
+
+	if (!c)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, c);
+	usbg_touch_config(c);
+	ret = usbg_write_hex8(io, c->path, c->name, "bmAttributes",
+			      bmAttributes);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_get_config_strs(usbg_config *c, int lang,
 			 struct usbg_config_strs *c_strs)
 {
-	return c && c_strs ? usbg_parse_config_strs(c->path, c->name, lang, c_strs)
-			: USBG_ERROR_INVALID_PARAM;
+	const struct usbg_io *io = usbg_config_io(c);
+	struct usbg_call call;
+	int ret;
+
+	if (!c || !c_strs)
+		return USBG_ERROR_INVALID_PARAM;
+
+	USBG_CALL_BEGIN(&call, c);
+	ret = usbg_parse_config_strs(io, c->path, c->name, lang, c_strs);
+	USBG_CALL_END(&call, ret);
+	return ret;
 }
 
 int usbg_set_config_strs(usbg_config *c, int lang,
@@ -2341,32 +3044,38 @@ int usbg_set_config_strs(usbg_config *c, int lang,
 
 int usbg_set_config_string(usbg_config *c, int lang, const char *str)
 {
+	const struct usbg_io *io = usbg_config_io(c);
 	char path[USBG_MAX_PATH_LENGTH];
 	int nmb;
 	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_call call;
 
+	USBG_CALL_BEGIN(&call, c);
 	if (!c || !str)
 		goto out;
 
+	usbg_touch_config(c);
 	nmb = snprintf(path, sizeof(path), "%s/%s/%s/0x%x", c->path,
 		       c->name, STRINGS_DIR, lang);
 	if (nmb >= sizeof(path)) {
 		ret = USBG_ERROR_PATH_TOO_LONG;
 		goto out;
 	}
-	ret = usbg_check_dir(path);
+	ret = usbg_check_dir(io, path);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
 
-	ret = usbg_write_string(path, "", "configuration", str);
+	ret = usbg_write_string(io, path, "", "configuration", str);
 
 out:
+	USBG_CALL_END(&call, ret);
 	return ret;
 }
 
-int usbg_add_config_function(usbg_config *c, const char *name, usbg_function *f)
+static int usbg_do_add_config_function(usbg_config *c, const char *name, usbg_function *f)
 {
+	const struct usbg_io *io = usbg_config_io(c);
 	char bpath[USBG_MAX_PATH_LENGTH];
 	char fpath[USBG_MAX_PATH_LENGTH];
 	usbg_binding *b;
@@ -2378,6 +3087,7 @@ int usbg_add_config_function(usbg_config *c, const char *name, usbg_function *f)
 		goto out;
 	}
 
+	usbg_touch_config(c);
 	if (!name)
 		name = f->name;
 
@@ -2421,7 +3131,7 @@ int usbg_add_config_function(usbg_config *c, const char *name, usbg_function *f)
 		goto free_binding;
 	}
 
-	ret = symlink(fpath, bpath);
+	ret = usbg_io_symlink(io, fpath, bpath);
 	if (ret != 0) {
 		ret = usbg_translate_error(errno);
 		goto free_binding;
@@ -2438,6 +3148,19 @@ out:
 	return ret;
 }
 
+int usbg_add_config_function(usbg_config *c, const char *name, usbg_function *f)
+{
+	usbg_state *st = c ? c->parent->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_LINK, c);
+	ret = usbg_do_add_config_function(c, name, f);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
 usbg_function *usbg_get_binding_target(usbg_binding *b)
 {
 	return b ? b->target : NULL;
@@ -2458,6 +3181,7 @@ int usbg_get_binding_name_s(usbg_binding *b, char *buf, int len)
 
 static int usbg_create_os_desc_link(usbg_gadget *g, usbg_config *c)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	char bpath[USBG_MAX_PATH_LENGTH];
 	char cpath[USBG_MAX_PATH_LENGTH];
 	int nmb;
@@ -2476,7 +3200,7 @@ static int usbg_create_os_desc_link(usbg_gadget *g, usbg_config *c)
 		goto out;
 	}
 
-	ret = symlink(cpath, bpath);
+	ret = usbg_io_symlink(io, cpath, bpath);
 	if (ret != 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -2491,6 +3215,7 @@ out:
 
 static int usbg_rm_os_desc_link(usbg_gadget *g)
 {
+	const struct usbg_io *io = usbg_gadget_io(g);
 	char bpath[USBG_MAX_PATH_LENGTH];
 	struct dirent **dent;
 	int end, n, i;
@@ -2503,7 +3228,7 @@ static int usbg_rm_os_desc_link(usbg_gadget *g)
 		goto out;
 	}
 
-	n = scandir(bpath, &dent, bindings_select, alphasort);
+	n = usbg_io_scandir(io, bpath, &dent, bindings_select, alphasort);
 	if (n < 0) {
 		ret = usbg_translate_error(errno);
 		goto out;
@@ -2514,7 +3239,7 @@ static int usbg_rm_os_desc_link(usbg_gadget *g)
 		goto free_dent;
 	}
 
-	ret = usbg_rm_file(bpath, dent[0]->d_name);
+	ret = usbg_rm_file(io, bpath, dent[0]->d_name);
 
 	for (i = 0; i < n; i++)
 		free(dent[i]);
@@ -2524,13 +3249,14 @@ out:
 	return ret;
 }
 
-int usbg_set_os_desc_config(usbg_gadget *g, usbg_config *c)
+static int usbg_do_set_os_desc_config(usbg_gadget *g, usbg_config *c)
 {
 	int ret;
 
 	if (!g)
 		return USBG_ERROR_INVALID_PARAM;
 
+	usbg_touch_gadget(g);
 	if (c) {
 		if (g->os_desc_binding) {
 			ERROR("os desc binding exist\n");
@@ -2545,8 +3271,21 @@ int usbg_set_os_desc_config(usbg_gadget *g, usbg_config *c)
 	return ret;
 }
 
-int usbg_enable_gadget(usbg_gadget *g, usbg_udc *udc)
+int usbg_set_os_desc_config(usbg_gadget *g, usbg_config *c)
 {
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN(&call, g);
+	ret = usbg_do_set_os_desc_config(g, c);
+	USBG_CALL_END(&call, ret);
+
+	return ret;
+}
+
+static int usbg_do_enable_gadget(usbg_gadget *g, usbg_udc *udc)
+{
+	const struct usbg_io *io = usbg_gadget_io(g);
 	int ret = USBG_ERROR_INVALID_PARAM;
 
 	if (!g)
@@ -2558,7 +3297,7 @@ int usbg_enable_gadget(usbg_gadget *g, usbg_udc *udc)
 			return ret;
 	}
 
-	ret = usbg_write_string(g->path, g->name, "UDC", udc->name);
+	ret = usbg_write_string(io, g->path, g->name, "UDC", udc->name);
 	if (ret != USBG_SUCCESS)
 		goto out;
 	/* If gadget has been detached and we didn't noticed
@@ -2573,14 +3312,28 @@ out:
 	return ret;
 }
 
-int usbg_disable_gadget(usbg_gadget *g)
+int usbg_enable_gadget(usbg_gadget *g, usbg_udc *udc)
 {
+	usbg_state *st = g ? g->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_ENABLE, g);
+	ret = usbg_do_enable_gadget(g, udc);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
+static int usbg_do_disable_gadget(usbg_gadget *g)
+{
+	const struct usbg_io *io = usbg_gadget_io(g);
 	int ret = USBG_ERROR_INVALID_PARAM;
 
 	if (!g)
 		return ret;
 
-	ret = usbg_write_string(g->path, g->name, "UDC", "\n");
+	ret = usbg_write_string(io, g->path, g->name, "UDC", "\n");
 	if (ret != USBG_SUCCESS)
 		goto out;
 
@@ -2591,6 +3344,188 @@ out:
 	return ret;
 }
 
+int usbg_disable_gadget(usbg_gadget *g)
+{
+	usbg_state *st = g ? g->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_DISABLE, g);
+	ret = usbg_do_disable_gadget(g);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
+usbg_speed usbg_get_udc_max_speed(usbg_udc *u)
+{
+	const struct usbg_io *io = usbg_udc_io(u);
+	static const char * const speed_names[] = {
+		[USBG_SPEED_UNKNOWN] = "UNKNOWN",
+		[USBG_SPEED_LOW] = "low-speed",
+		[USBG_SPEED_FULL] = "full-speed",
+		[USBG_SPEED_HIGH] = "high-speed",
+		[USBG_SPEED_WIRELESS] = "wireless",
+		[USBG_SPEED_SUPER] = "super-speed",
+		[USBG_SPEED_SUPER_PLUS] = "super-speed-plus",
+	};
+	char buf[USBG_MAX_STR_LENGTH];
+	int i;
+
+	if (!u)
+		return USBG_SPEED_UNKNOWN;
+
+	if (u->max_speed_valid)
+		goto out;
+
+	u->max_speed = USBG_SPEED_UNKNOWN;
+	if (usbg_read_string(io, u->parent->udc_path, u->name, "maximum_speed",
+			     buf)
+	    == USBG_SUCCESS) {
+		for (i = 0; i < ARRAY_SIZE(speed_names); ++i)
+			if (!strcmp(buf, speed_names[i]))
+				u->max_speed = i;
+	}
+	u->max_speed_valid = true;
+
+out:
+	return u->max_speed;
+}
+
+usbg_udc *usbg_find_free_udc(usbg_state *s, usbg_udc_policy policy,
+			     const char *pinned)
+{
+	usbg_udc *u, *best = NULL;
+	int i;
+
+	if (!s)
+		return NULL;
+
+	switch (policy) {
+	case USBG_UDC_POLICY_PINNED:
+		if (!pinned)
+			break;
+		u = usbg_get_udc(s, pinned);
+		if (u && !u->gadget)
+			best = u;
+		break;
+	case USBG_UDC_POLICY_FIRST_FREE:
+		for (i = 0; i < s->udc_count && !best; ++i)
+			if (!s->udc_index[i]->gadget)
+				best = s->udc_index[i];
+		break;
+	case USBG_UDC_POLICY_FASTEST:
+		for (i = 0; i < s->udc_count; ++i) {
+			u = s->udc_index[i];
+			if (u->gadget)
+				continue;
+			if (!best || usbg_get_udc_max_speed(u) >
+			    usbg_get_udc_max_speed(best))
+				best = u;
+		}
+		break;
+	}
+
+	return best;
+}
+
+int usbg_enable_gadget_policy(usbg_gadget *g, usbg_udc_policy policy,
+			      const char *pinned, usbg_udc **udc)
+{
+	usbg_udc *u;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!g || (policy == USBG_UDC_POLICY_PINNED && !pinned))
+		goto out;
+
+	u = usbg_find_free_udc(g->parent, policy, pinned);
+	if (!u) {
+		if (policy == USBG_UDC_POLICY_PINNED &&
+		    !usbg_get_udc(g->parent, pinned))
+			ret = USBG_ERROR_NOT_FOUND;
+		else
+			ret = USBG_ERROR_BUSY;
+		goto out;
+	}
+
+	ret = usbg_enable_gadget(g, u);
+	if (ret == USBG_SUCCESS && udc)
+		*udc = u;
+
+out:
+	return ret;
+}
+
+int usbg_enable_gadget_staged(usbg_gadget *g, usbg_udc *udc)
+{
+	int ret;
+
+	ret = usbg_enable_gadget(g, udc);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = usbg_udc_disconnect(g->udc);
+	if (ret != USBG_SUCCESS)
+		/* Don't leave gadget connected if we were asked not to */
+		usbg_disable_gadget(g);
+
+out:
+	return ret;
+}
+
+int usbg_udc_connect(usbg_udc *u)
+{
+	const struct usbg_io *io = usbg_udc_io(u);
+	struct timespec ts;
+	int ret = USBG_ERROR_INVALID_PARAM;
+	struct usbg_call call;
+
+	if (!u)
+		return ret;
+
+	usbg_stats_begin(&call, __func__, USBG_STAT_OP_NONE,
+			 u->parent->udc_path, u->name);
+	/* Host may start enumeration as soon as the pull-up is on */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	ret = usbg_write_string(io, u->parent->udc_path, u->name,
+				"soft_connect", "connect");
+	if (ret == USBG_SUCCESS)
+		u->connect_ts = ts;
+
+	USBG_CALL_END(&call, ret);
+	return ret;
+}
+
+int usbg_udc_disconnect(usbg_udc *u)
+{
+	const struct usbg_io *io = usbg_udc_io(u);
+	struct usbg_call call;
+	int ret;
+
+	if (!u)
+		return USBG_ERROR_INVALID_PARAM;
+
+	usbg_stats_begin(&call, __func__, USBG_STAT_OP_NONE,
+			 u->parent->udc_path, u->name);
+	ret = usbg_write_string(io, u->parent->udc_path, u->name,
+				"soft_connect", "disconnect");
+	USBG_CALL_END(&call, ret);
+	return ret;
+}
+
+int usbg_get_udc_connect_time(usbg_udc *u, struct timespec *ts)
+{
+	if (!u || !ts)
+		return USBG_ERROR_INVALID_PARAM;
+
+	if (!u->connect_ts.tv_sec && !u->connect_ts.tv_nsec)
+		return USBG_ERROR_NOT_FOUND;
+
+	*ts = u->connect_ts;
+	return USBG_SUCCESS;
+}
+
 /*
  * USB function
  */
@@ -2600,28 +3535,55 @@ usbg_function_type usbg_get_function_type(usbg_function *f)
 	return f ? f->type : USBG_ERROR_INVALID_PARAM;
 }
 
-int usbg_get_function_attrs(usbg_function *f, void *f_attrs)
+static int usbg_do_get_function_attrs(usbg_function *f, void *f_attrs)
 {
 	return f && f_attrs ? f->ops->get_attrs(f, f_attrs)
 			: USBG_ERROR_INVALID_PARAM;
 }
 
+int usbg_get_function_attrs(usbg_function *f, void *f_attrs)
+{
+	usbg_state *st = f ? f->parent->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_GET_ATTRS, f);
+	ret = usbg_do_get_function_attrs(f, f_attrs);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
 void usbg_cleanup_function_attrs(usbg_function *f, void *f_attrs)
 {
 	if (f->ops->cleanup_attrs)
 		f->ops->cleanup_attrs(f, f_attrs);
 }
 
-int usbg_set_function_attrs(usbg_function *f, void *f_attrs)
+static int usbg_do_set_function_attrs(usbg_function *f, void *f_attrs)
 {
 	int ret = USBG_ERROR_INVALID_PARAM;
 
 	if (!f || !f_attrs)
 		return ret;
 
+	usbg_touch_function(f);
 	return f->ops->set_attrs(f, f_attrs);
 }
 
+int usbg_set_function_attrs(usbg_function *f, void *f_attrs)
+{
+	usbg_state *st = f ? f->parent->parent : NULL;
+	struct usbg_call call;
+	int ret;
+
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_SET_ATTRS, f);
+	ret = usbg_do_set_function_attrs(f, f_attrs);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
 usbg_gadget *usbg_get_first_gadget(usbg_state *s)
 {
 	return s ? TAILQ_FIRST(&s->gadgets) : NULL;
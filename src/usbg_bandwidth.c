@@ -0,0 +1,260 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+#include "usbg/function/hid.h"
+#include "usbg/function/uac2.h"
+#include "usbg/function/uvc.h"
+
+/**
+ * @file usbg_bandwidth.c
+ * @brief Estimation of bus time reserved by periodic endpoints.
+ * @details Only isochronous and interrupt endpoints which may carry
+ * significant amount of data are taken into account. Values follow
+ * endpoint descriptors which kernel creates for given attributes,
+ * protocol overhead is ignored.
+ */
+
+#define UAC2_DEF_HS_BINT 1
+#define UAC2_FEEDBACK_SIZE 4
+#define UVC_DEF_INTERVAL 1
+#define HID_FS_INTERVAL_MS 10
+
+/* (Micro)frames per second */
+static uint64_t usbg_speed_frames(usbg_speed speed)
+{
+	return speed >= USBG_SPEED_HIGH ? 8000 : 1000;
+}
+
+uint64_t usbg_speed_bandwidth(usbg_speed speed)
+{
+	/*
+	 * USB 2.0 allows 90% of frame (80% of microframe)
+	 * and USB 3.x 90% of bus time for periodic transfers.
+	 */
+	switch (speed) {
+	case USBG_SPEED_LOW:
+		return 1500000ULL / 8 * 9 / 10;
+	case USBG_SPEED_FULL:
+		return 12000000ULL / 8 * 9 / 10;
+	case USBG_SPEED_HIGH:
+	case USBG_SPEED_WIRELESS:
+		return 480000000ULL / 8 * 8 / 10;
+	case USBG_SPEED_SUPER:
+		/* 8b/10b encoding */
+		return 5000000000ULL / 10 * 9 / 10;
+	case USBG_SPEED_SUPER_PLUS:
+		/* 128b/132b encoding */
+		return 10000000000ULL / 132 * 128 / 8 * 9 / 10;
+	default:
+		return 0;
+	}
+}
+
+uint64_t usbg_audio_bandwidth(usbg_speed speed, int chmask, int srate,
+			      int ssize, int hs_bint, bool feedback)
+{
+	uint64_t intervals, samples, bytes;
+
+	if (!chmask || srate <= 0 || ssize <= 0)
+		return 0;
+
+	/* Full speed endpoints are always serviced every frame */
+	if (speed < USBG_SPEED_HIGH || hs_bint < 1 || hs_bint > 4)
+		hs_bint = speed < USBG_SPEED_HIGH ? 1 : UAC2_DEF_HS_BINT;
+
+	intervals = usbg_speed_frames(speed) >> (hs_bint - 1);
+	samples = (srate + intervals - 1) / intervals;
+	bytes = samples * __builtin_popcount(chmask) * ssize;
+	if (feedback)
+		bytes += UAC2_FEEDBACK_SIZE;
+
+	return bytes * intervals;
+}
+
+uint64_t usbg_video_bandwidth(usbg_speed speed, int maxpacket, int maxburst,
+			      int interval)
+{
+	uint64_t bytes;
+
+	if (maxpacket <= 0)
+		return 0;
+
+	if (interval < 1 || interval > 16)
+		interval = UVC_DEF_INTERVAL;
+
+	/* Same limits as kernel applies to streaming endpoint */
+	if (speed < USBG_SPEED_HIGH) {
+		bytes = maxpacket > 1023 ? 1023 : maxpacket;
+	} else {
+		bytes = maxpacket > 3072 ? 3072 : maxpacket;
+		if (speed >= USBG_SPEED_SUPER && maxburst > 0)
+			bytes *= (maxburst > 15 ? 15 : maxburst) + 1;
+	}
+
+	return bytes * (usbg_speed_frames(speed) >> (interval - 1));
+}
+
+uint64_t usbg_hid_bandwidth(usbg_speed speed, unsigned int report_length)
+{
+	uint64_t per_second;
+
+	/* bInterval is 10 frames for full speed and 1 ms otherwise */
+	per_second = speed < USBG_SPEED_HIGH ? 1000 / HID_FS_INTERVAL_MS : 1000;
+
+	/* Both IN and OUT interrupt endpoints */
+	return 2ULL * report_length * per_second;
+}
+
+static int usbg_get_uac2_bandwidth(usbg_function *f, usbg_speed speed,
+				   uint64_t *bw)
+{
+	static const enum usbg_f_uac2_attr attrs[] = {
+		USBG_F_UAC2_C_CHMASK, USBG_F_UAC2_C_SRATE, USBG_F_UAC2_C_SSIZE,
+		USBG_F_UAC2_P_CHMASK, USBG_F_UAC2_P_SRATE, USBG_F_UAC2_P_SSIZE,
+	};
+	usbg_f_uac2 *af = usbg_to_uac2_function(f);
+	union usbg_f_uac2_attr_val val;
+	int v[ARRAY_SIZE(attrs)];
+	int c_bint = 0, p_bint = 0;
+	bool feedback = false;
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(attrs); ++i) {
+		ret = usbg_f_uac2_get_attr_val(af, attrs[i], &val);
+		if (ret != USBG_SUCCESS)
+			return ret;
+		v[i] = val.c_chmask;
+	}
+
+	/* Not all kernels provide these */
+	if (usbg_f_uac2_get_attr_val(af, USBG_F_UAC2_C_HS_BINT, &val) == 0)
+		c_bint = val.c_hs_bint;
+	if (usbg_f_uac2_get_attr_val(af, USBG_F_UAC2_P_HS_BINT, &val) == 0)
+		p_bint = val.p_hs_bint;
+	if (usbg_f_uac2_get_attr_val(af, USBG_F_UAC2_C_SYNC, &val) == 0) {
+		feedback = val.c_sync && !strcmp(val.c_sync, "async");
+		free((char *)val.c_sync);
+	}
+
+	*bw = usbg_audio_bandwidth(speed, v[0], v[1], v[2], c_bint, feedback) +
+		usbg_audio_bandwidth(speed, v[3], v[4], v[5], p_bint, false);
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_get_uvc_bandwidth(usbg_function *f, usbg_speed speed,
+				  uint64_t *bw)
+{
+	usbg_f_uvc *uvcf = usbg_to_uvc_function(f);
+	union usbg_f_uvc_config_attr_val maxburst, maxpacket, interval;
+	int ret;
+
+	ret = usbg_f_uvc_get_config_attr_val(uvcf, USBG_F_UVC_CONFIG_MAXBURST,
+					     &maxburst);
+	if (ret == USBG_SUCCESS)
+		ret = usbg_f_uvc_get_config_attr_val(uvcf,
+						     USBG_F_UVC_CONFIG_MAXPACKET,
+						     &maxpacket);
+	if (ret == USBG_SUCCESS)
+		ret = usbg_f_uvc_get_config_attr_val(uvcf,
+						     USBG_F_UVC_CONFIG_INTERVAL,
+						     &interval);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	*bw = usbg_video_bandwidth(speed, maxpacket.streaming_maxpacket,
+				   maxburst.streaming_maxburst,
+				   interval.streaming_interval);
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_get_hid_bandwidth(usbg_function *f, usbg_speed speed,
+				  uint64_t *bw)
+{
+	union usbg_f_hid_attr_val val;
+	int ret;
+
+	ret = usbg_f_hid_get_attr_val(usbg_to_hid_function(f),
+				      USBG_F_HID_REPORT_LENGTH, &val);
+	if (ret == USBG_SUCCESS)
+		*bw = usbg_hid_bandwidth(speed, val.report_length);
+
+	return ret;
+}
+
+bool usbg_function_type_is_periodic(int type)
+{
+	return type == USBG_F_UAC2 || type == USBG_F_UVC || type == USBG_F_HID;
+}
+
+int usbg_get_function_bandwidth(usbg_function *f, usbg_speed speed,
+				uint64_t *bw)
+{
+	if (!f || !bw || speed <= USBG_SPEED_UNKNOWN ||
+	    speed > USBG_SPEED_SUPER_PLUS)
+		return USBG_ERROR_INVALID_PARAM;
+
+	switch (f->type) {
+	case USBG_F_UAC2:
+		return usbg_get_uac2_bandwidth(f, speed, bw);
+	case USBG_F_UVC:
+		return usbg_get_uvc_bandwidth(f, speed, bw);
+	case USBG_F_HID:
+		return usbg_get_hid_bandwidth(f, speed, bw);
+	default:
+		*bw = 0;
+		return USBG_SUCCESS;
+	}
+}
+
+int usbg_get_config_bandwidth(usbg_config *c, usbg_speed speed,
+			      struct usbg_bandwidth *bw)
+{
+	usbg_binding *b;
+	uint64_t used;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!c || !bw || speed <= USBG_SPEED_UNKNOWN ||
+	    speed > USBG_SPEED_SUPER_PLUS)
+		goto out;
+
+	bw->available = usbg_speed_bandwidth(speed);
+	bw->used = 0;
+
+	TAILQ_FOREACH(b, &c->bindings, bnode) {
+		ret = usbg_get_function_bandwidth(b->target, speed, &used);
+		if (ret != USBG_SUCCESS)
+			goto out;
+		bw->used += used;
+	}
+
+	bw->headroom = (int64_t)bw->available - (int64_t)bw->used;
+	ret = USBG_SUCCESS;
+
+out:
+	return ret;
+}
+
+usbg_speed usbg_fastest_udc_speed(usbg_state *s)
+{
+	usbg_speed speed = USBG_SPEED_UNKNOWN;
+	usbg_udc *u;
+
+	TAILQ_FOREACH(u, &s->udcs, unode)
+		if (usbg_get_udc_max_speed(u) > speed)
+			speed = usbg_get_udc_max_speed(u);
+
+	return speed;
+}
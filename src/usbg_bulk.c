@@ -0,0 +1,464 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @file usbg_bulk.c
+ * @brief Operations on many objects of one gadget at once.
+ * @details Workers only touch configfs and objects which are not yet
+ * linked to the gadget, so lists of gadget are modified by calling
+ * thread only.
+ */
+
+/* Most of the time is spent in kernel, waiting for modules and files */
+#define USBG_BULK_MAX_WORKERS 8
+
+struct usbg_bulk_pool
+{
+	usbg_gadget *g;
+	struct usbg_function_spec *specs;
+	int *rets;
+	int n;
+	/* Index of the next spec to be taken by a worker */
+	int next;
+	/* Set on first failure, remaining specs are not started */
+	bool failed;
+};
+
+static void *usbg_bulk_create_worker(void *data)
+{
+	struct usbg_bulk_pool *pool = data;
+	struct usbg_function_spec *spec;
+	int i;
+
+	while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED))
+	       < pool->n) {
+		if (__atomic_load_n(&pool->failed, __ATOMIC_RELAXED))
+			break;
+
+		spec = &pool->specs[i];
+		pool->rets[i] = usbg_create_function_detached(pool->g,
+							      spec->type,
+							      spec->instance,
+							      spec->f_attrs,
+							      &spec->f);
+		if (pool->rets[i] != USBG_SUCCESS) {
+			spec->f = NULL;
+			__atomic_store_n(&pool->failed, true,
+					 __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
+
+static int usbg_bulk_check_specs(usbg_gadget *g,
+				 struct usbg_function_spec *specs, int n)
+{
+	int i, j;
+
+	for (i = 0; i < n; ++i) {
+		if (!specs[i].instance || *specs[i].instance == '\0')
+			return USBG_ERROR_INVALID_PARAM;
+
+		if (usbg_get_function(g, specs[i].type, specs[i].instance))
+			return USBG_ERROR_EXIST;
+
+		for (j = 0; j < i; ++j)
+			if (specs[j].type == specs[i].type &&
+			    !strcmp(specs[j].instance, specs[i].instance))
+				return USBG_ERROR_EXIST;
+
+		specs[i].f = NULL;
+	}
+
+	return USBG_SUCCESS;
+}
+
+int usbg_create_functions(usbg_gadget *g, struct usbg_function_spec *specs,
+			  int n, int flags)
+{
+	struct usbg_bulk_pool pool = { 0 };
+	pthread_t threads[USBG_BULK_MAX_WORKERS];
+	int nthreads = 0;
+	long ncpus;
+	int i;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!g || (!specs && n) || n < 0)
+		goto out;
+
+	ret = usbg_bulk_check_specs(g, specs, n);
+	if (ret != USBG_SUCCESS || !n)
+		goto out;
+
+	pool.g = g;
+	pool.specs = specs;
+	pool.n = n;
+	pool.rets = calloc(n, sizeof(*pool.rets));
+	if (!pool.rets) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	if (flags & USBG_CREATE_PARALLEL) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = n < USBG_BULK_MAX_WORKERS ? n : USBG_BULK_MAX_WORKERS;
+		if (ncpus > 0 && ncpus < nthreads)
+			nthreads = ncpus;
+		/* Calling thread is one of workers */
+		--nthreads;
+	}
+
+	for (i = 0; i < nthreads; ++i)
+		if (pthread_create(&threads[i], NULL, usbg_bulk_create_worker,
+				   &pool))
+			break;
+	nthreads = i;
+
+	usbg_bulk_create_worker(&pool);
+
+	for (i = 0; i < nthreads; ++i)
+		pthread_join(threads[i], NULL);
+
+	/* Report failure of the first spec, regardless of timing */
+	for (i = 0; i < n; ++i) {
+		if (pool.rets[i] != USBG_SUCCESS) {
+			ret = pool.rets[i];
+			break;
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (!specs[i].f)
+			continue;
+
+		INSERT_TAILQ_STRING_ORDER(&g->functions, fhead, name,
+					  specs[i].f, fnode);
+	}
+
+	/* All or nothing */
+	if (ret != USBG_SUCCESS) {
+		for (i = 0; i < n; ++i) {
+			if (specs[i].f)
+				usbg_rm_function(specs[i].f, USBG_RM_RECURSE);
+			specs[i].f = NULL;
+		}
+	}
+
+	free(pool.rets);
+out:
+	return ret;
+}
+
+/* Depth of links, they are removed before any directory */
+#define USBG_RM_LINK -1
+
+struct usbg_rm_entry
+{
+	char *path;
+	int depth;
+};
+
+struct usbg_teardown
+{
+	const struct usbg_io *io;
+	struct usbg_rm_entry *entries;
+	int n;
+	int size;
+	int opts;
+	usbg_rm_error_func cb;
+	void *data;
+	/* Serializes reporting of failures */
+	pthread_mutex_t lock;
+	int ret;
+	bool stop;
+	/* Gadget directory itself is gone */
+	bool removed;
+	/* Anything has been removed, cached objects are stale */
+	bool changed;
+	/* Batch of entries currently being removed */
+	int next;
+	int end;
+};
+
+static int usbg_teardown_add(struct usbg_teardown *td, const char *path,
+			     int depth)
+{
+	struct usbg_rm_entry *entries;
+
+	if (td->n == td->size) {
+		int size = td->size ? 2 * td->size : 64;
+
+		entries = realloc(td->entries, size * sizeof(*entries));
+		if (!entries)
+			return USBG_ERROR_NO_MEM;
+
+		td->entries = entries;
+		td->size = size;
+	}
+
+	td->entries[td->n].path = strdup(path);
+	if (!td->entries[td->n].path)
+		return USBG_ERROR_NO_MEM;
+
+	td->entries[td->n].depth = depth;
+	td->n++;
+
+	return USBG_SUCCESS;
+}
+
+/* Attributes are left alone, they disappear with their directory */
+static int usbg_teardown_scan(struct usbg_teardown *td, const char *path,
+			      int depth)
+{
+	const struct usbg_io *io = td->io;
+	char sub[USBG_MAX_PATH_LENGTH];
+	struct dirent **dent;
+	struct stat st;
+	int i, n, nmb;
+	int ret = USBG_SUCCESS;
+
+	n = usbg_io_scandir(io, path, &dent, file_select, alphasort);
+	if (n < 0)
+		return usbg_translate_error(errno);
+
+	for (i = 0; i < n && ret == USBG_SUCCESS; ++i) {
+		nmb = snprintf(sub, sizeof(sub), "%s/%s", path,
+			       dent[i]->d_name);
+		if (nmb >= sizeof(sub)) {
+			ret = USBG_ERROR_PATH_TOO_LONG;
+			break;
+		}
+
+		if (usbg_io_lstat(io, sub, &st)) {
+			ret = usbg_translate_error(errno);
+			break;
+		}
+
+		if (S_ISLNK(st.st_mode))
+			ret = usbg_teardown_add(td, sub, USBG_RM_LINK);
+		else if (S_ISDIR(st.st_mode))
+			ret = usbg_teardown_scan(td, sub, depth + 1);
+	}
+
+	for (i = 0; i < n; ++i)
+		free(dent[i]);
+	free(dent);
+
+	if (ret == USBG_SUCCESS)
+		ret = usbg_teardown_add(td, path, depth);
+
+	return ret;
+}
+
+/* Links first, then directories from the deepest ones */
+static int usbg_rm_entry_cmp(const void *a, const void *b)
+{
+	const struct usbg_rm_entry *ea = a, *eb = b;
+
+	if (ea->depth == USBG_RM_LINK || eb->depth == USBG_RM_LINK)
+		return (eb->depth == USBG_RM_LINK) - (ea->depth == USBG_RM_LINK);
+
+	return eb->depth - ea->depth;
+}
+
+static void usbg_teardown_fail(struct usbg_teardown *td, const char *path,
+			       int err)
+{
+	pthread_mutex_lock(&td->lock);
+
+	if (td->ret == USBG_SUCCESS)
+		td->ret = err;
+	if (!(td->opts & USBG_RM_BEST_EFFORT))
+		__atomic_store_n(&td->stop, true, __ATOMIC_RELAXED);
+	if (td->cb)
+		td->cb(path, err, td->data);
+
+	pthread_mutex_unlock(&td->lock);
+}
+
+static void *usbg_teardown_worker(void *data)
+{
+	struct usbg_teardown *td = data;
+	const struct usbg_io *io = td->io;
+	struct usbg_rm_entry *e;
+	int i, ret;
+
+	while ((i = __atomic_fetch_add(&td->next, 1, __ATOMIC_RELAXED))
+	       < td->end) {
+		if (__atomic_load_n(&td->stop, __ATOMIC_RELAXED))
+			break;
+
+		e = &td->entries[i];
+		if (e->depth == USBG_RM_LINK) {
+			ret = usbg_io_unlink(io, e->path);
+		} else {
+			ret = usbg_io_rmdir(io, e->path);
+			/* Default group, goes away with its parent */
+			if (ret && errno == EPERM && e->depth > 0)
+				continue;
+			if (!ret && e->depth == 0)
+				__atomic_store_n(&td->removed, true,
+						 __ATOMIC_RELAXED);
+		}
+
+		if (ret)
+			usbg_teardown_fail(td, e->path,
+					   usbg_translate_error(errno));
+		else
+			__atomic_store_n(&td->changed, true, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static void usbg_teardown_batch(struct usbg_teardown *td, int start, int end)
+{
+	pthread_t threads[USBG_BULK_MAX_WORKERS];
+	int nthreads = 0;
+	int i;
+
+	td->next = start;
+	td->end = end;
+
+	if (td->opts & USBG_RM_PARALLEL) {
+		nthreads = end - start;
+		if (nthreads > USBG_BULK_MAX_WORKERS)
+			nthreads = USBG_BULK_MAX_WORKERS;
+		/* Calling thread is one of workers */
+		--nthreads;
+	}
+
+	for (i = 0; i < nthreads; ++i)
+		if (pthread_create(&threads[i], NULL, usbg_teardown_worker,
+				   td))
+			break;
+	nthreads = i;
+
+	usbg_teardown_worker(td);
+
+	for (i = 0; i < nthreads; ++i)
+		pthread_join(threads[i], NULL);
+}
+
+static void usbg_teardown_init(struct usbg_teardown *td,
+			       const struct usbg_io *io, int opts,
+			       usbg_rm_error_func cb, void *data)
+{
+	memset(td, 0, sizeof(*td));
+	td->io = io;
+	td->opts = opts;
+	td->cb = cb;
+	td->data = data;
+	pthread_mutex_init(&td->lock, NULL);
+}
+
+static void usbg_teardown_cleanup(struct usbg_teardown *td)
+{
+	int i;
+
+	for (i = 0; i < td->n; ++i)
+		free(td->entries[i].path);
+	free(td->entries);
+	pthread_mutex_destroy(&td->lock);
+}
+
+/* Failures are reported through td */
+static void usbg_teardown_dir(struct usbg_teardown *td, const char *path)
+{
+	int i, start;
+	int ret;
+
+	ret = usbg_teardown_scan(td, path, 0);
+	if (ret != USBG_SUCCESS) {
+		usbg_teardown_fail(td, path, ret);
+		return;
+	}
+
+	qsort(td->entries, td->n, sizeof(*td->entries), usbg_rm_entry_cmp);
+
+	/* Entries of the same depth don't depend on each other */
+	for (start = 0; start < td->n && !td->stop; start = i) {
+		for (i = start; i < td->n &&
+			     td->entries[i].depth == td->entries[start].depth;
+		     ++i)
+			;
+
+		usbg_teardown_batch(td, start, i);
+	}
+}
+
+int usbg_rm_dir_tree(const struct usbg_io *io, const char *path)
+{
+	struct usbg_teardown td;
+
+	usbg_teardown_init(&td, io, USBG_RM_BEST_EFFORT, NULL, NULL);
+	usbg_teardown_dir(&td, path);
+	usbg_teardown_cleanup(&td);
+
+	return td.ret;
+}
+
+int usbg_teardown_gadget(usbg_gadget *g, int opts, usbg_rm_error_func cb,
+			 void *data)
+{
+	struct usbg_teardown td;
+	char gpath[USBG_MAX_PATH_LENGTH];
+	int nmb;
+	int ret;
+
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	nmb = snprintf(gpath, sizeof(gpath), "%s/%s", g->path, g->name);
+	if (nmb >= sizeof(gpath))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	usbg_teardown_init(&td, usbg_gadget_io(g), opts, cb, data);
+
+	if (g->udc) {
+		ret = usbg_disable_gadget(g);
+		if (ret != USBG_SUCCESS) {
+			usbg_teardown_fail(&td, gpath, ret);
+			if (td.stop)
+				goto out;
+		}
+	}
+
+	usbg_teardown_dir(&td, gpath);
+
+out:
+	if (td.removed)
+		ret = usbg_forget_gadget(g);
+	else if (td.changed)
+		ret = usbg_reload_gadget(g);
+	else
+		ret = USBG_SUCCESS;
+
+	if (td.ret != USBG_SUCCESS)
+		ret = td.ret;
+
+	usbg_teardown_cleanup(&td);
+
+	return ret;
+}
@@ -0,0 +1,267 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+#include "usbg/function/hid.h"
+#include "usbg/function/loopback.h"
+#include "usbg/function/midi.h"
+#include "usbg/function/ms.h"
+#include "usbg/function/printer.h"
+#include "usbg/function/uac2.h"
+
+#include <stdlib.h>
+
+/**
+ * @file usbg_clone.c
+ * @brief Copying of gadgets directly from one configfs tree to another.
+ * @details Each object is copied using the same get/set functions which
+ * are used by application, so no intermediate text representation is
+ * needed.
+ */
+
+/* Large enough for attributes of each function without clone() op */
+union usbg_clone_function_attrs {
+	struct usbg_f_hid_attrs hid;
+	struct usbg_f_loopback_attrs loopback;
+	struct usbg_f_midi_attrs midi;
+	struct usbg_f_ms_attrs ms;
+	struct usbg_f_printer_attrs printer;
+	struct usbg_f_uac2_attrs uac2;
+};
+
+static int usbg_clone_gadget_strs(usbg_gadget *g, usbg_gadget *src)
+{
+	struct usbg_gadget_strs strs;
+	int *langs;
+	int i, ret;
+
+	ret = usbg_get_gadget_strs_langs(src, &langs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	for (i = 0; langs[i]; ++i) {
+		ret = usbg_get_gadget_strs(src, langs[i], &strs);
+		if (ret != USBG_SUCCESS)
+			break;
+
+		ret = usbg_set_gadget_strs(g, langs[i], &strs);
+		usbg_free_gadget_strs(&strs);
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	free(langs);
+out:
+	return ret;
+}
+
+static int usbg_clone_gadget_os_descs(usbg_gadget *g, usbg_gadget *src)
+{
+	struct usbg_gadget_os_descs os_descs = {0};
+	int ret;
+
+	ret = usbg_get_gadget_os_descs(src, &os_descs);
+	/* OS Descriptors are optional */
+	if (ret == USBG_ERROR_NOT_FOUND)
+		return USBG_SUCCESS;
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = usbg_set_gadget_os_descs(g, &os_descs);
+out:
+	usbg_free_gadget_os_desc(&os_descs);
+	return ret;
+}
+
+static int usbg_clone_function_attrs(usbg_function *f, usbg_function *src)
+{
+	union usbg_clone_function_attrs attrs;
+	int ret;
+
+	if (f->ops->clone)
+		return f->ops->clone(f, src);
+
+	memset(&attrs, 0, sizeof(attrs));
+	ret = usbg_get_function_attrs(src, &attrs);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	ret = usbg_set_function_attrs(f, &attrs);
+	usbg_cleanup_function_attrs(src, &attrs);
+
+	return ret;
+}
+
+static int usbg_clone_function_os_descs(usbg_function *f, usbg_function *src)
+{
+	struct usbg_function_os_desc f_os_desc;
+	char **iname;
+	int ret = USBG_SUCCESS;
+
+	for (iname = f->ops->os_desc_iname; iname && *iname; ++iname) {
+		memset(&f_os_desc, 0, sizeof(f_os_desc));
+
+		ret = usbg_get_interf_os_desc(src, *iname, &f_os_desc);
+		if (ret == USBG_ERROR_NOT_FOUND) {
+			ret = USBG_SUCCESS;
+			continue;
+		}
+		if (ret != USBG_SUCCESS)
+			break;
+
+		ret = usbg_set_interf_os_desc(f, *iname, &f_os_desc);
+		usbg_free_interf_os_desc(&f_os_desc);
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	return ret;
+}
+
+static int usbg_clone_functions(usbg_gadget *g, usbg_gadget *src)
+{
+	usbg_function *f, *new_f;
+	int ret = USBG_SUCCESS;
+
+	TAILQ_FOREACH(f, &src->functions, fnode) {
+		ret = usbg_create_function(g, f->type, f->instance, NULL,
+					   &new_f);
+		if (ret != USBG_SUCCESS)
+			break;
+
+		ret = usbg_clone_function_attrs(new_f, f);
+		if (ret != USBG_SUCCESS)
+			break;
+
+		ret = usbg_clone_function_os_descs(new_f, f);
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	return ret;
+}
+
+static int usbg_clone_config(usbg_gadget *g, usbg_config *src)
+{
+	struct usbg_config_attrs attrs;
+	struct usbg_config_strs strs;
+	usbg_config *c;
+	usbg_binding *b;
+	usbg_function *f;
+	int *langs;
+	int i, ret;
+
+	ret = usbg_get_config_attrs(src, &attrs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = usbg_create_config(g, src->id, src->label, &attrs, NULL, &c);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = usbg_get_config_strs_langs(src, &langs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	for (i = 0; langs[i]; ++i) {
+		ret = usbg_get_config_strs(src, langs[i], &strs);
+		if (ret != USBG_SUCCESS)
+			break;
+
+		ret = usbg_set_config_strs(c, langs[i], &strs);
+		usbg_free_config_strs(&strs);
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	free(langs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	TAILQ_FOREACH(b, &src->bindings, bnode) {
+		f = usbg_get_function(g, b->target->type, b->target->instance);
+		if (!f) {
+			ret = USBG_ERROR_NOT_FOUND;
+			break;
+		}
+
+		ret = usbg_add_config_function(c, b->name, f);
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+out:
+	return ret;
+}
+
+static int usbg_clone_configs(usbg_gadget *g, usbg_gadget *src)
+{
+	usbg_config *c;
+	int ret = USBG_SUCCESS;
+
+	TAILQ_FOREACH(c, &src->configs, cnode) {
+		ret = usbg_clone_config(g, c);
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	if (ret == USBG_SUCCESS && src->os_desc_binding) {
+		c = usbg_get_config(g, src->os_desc_binding->id,
+				    src->os_desc_binding->label);
+		ret = c ? usbg_set_os_desc_config(g, c) : USBG_ERROR_NOT_FOUND;
+	}
+
+	return ret;
+}
+
+int usbg_clone_gadget(usbg_gadget *src, const char *name, usbg_gadget **dst)
+{
+	struct usbg_gadget_attrs attrs;
+	usbg_gadget *g;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!src || !name || !dst)
+		goto out;
+
+	ret = usbg_get_gadget_attrs(src, &attrs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = usbg_create_gadget(src->parent, name, &attrs, NULL, &g);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = usbg_clone_gadget_strs(g, src);
+	if (ret != USBG_SUCCESS)
+		goto rm_gadget;
+
+	ret = usbg_clone_gadget_os_descs(g, src);
+	if (ret != USBG_SUCCESS)
+		goto rm_gadget;
+
+	ret = usbg_clone_functions(g, src);
+	if (ret != USBG_SUCCESS)
+		goto rm_gadget;
+
+	ret = usbg_clone_configs(g, src);
+	if (ret != USBG_SUCCESS)
+		goto rm_gadget;
+
+	*dst = g;
+	return USBG_SUCCESS;
+
+rm_gadget:
+	usbg_rm_gadget(g, USBG_RM_RECURSE);
+out:
+	return ret;
+}
@@ -18,13 +18,14 @@
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <malloc.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/sysmacros.h>
 
-int usbg_write_guid(const char *path, const char *name,
-		      const char *file, const char *buf)
+int usbg_write_guid(const struct usbg_io *io, const char *path,
+		    const char *name, const char *file, const char *buf)
 {
 	char guidbin[GUID_BIN_LENGTH];
 	int ret;
@@ -41,58 +42,41 @@ int usbg_write_guid(const char *path, const char *name,
 	if (ret != GUID_BIN_LENGTH)
 		return USBG_ERROR_INVALID_PARAM;
 
-	ret = usbg_write_buf(path, name, file, guidbin, GUID_BIN_LENGTH);
+	ret = usbg_write_buf(io, path, name, file, guidbin, GUID_BIN_LENGTH);
 	if (ret > 0)
 		ret = 0;
 
 	return ret;
 }
 
-int usbg_read_buf_limited(const char *path, const char *name,
-			  const char *file, char *buf, int len)
+int usbg_read_buf_limited(const struct usbg_io *io, const char *path,
+			  const char *name, const char *file, char *buf,
+			  int len)
 {
 	char p[USBG_MAX_PATH_LENGTH];
-	FILE *fp;
 	int nmb;
-	int ret = USBG_SUCCESS;
 
 	nmb = snprintf(p, sizeof(p), "%s/%s/%s", path, name, file);
-	if (nmb >= sizeof(p)) {
-		ret = USBG_ERROR_PATH_TOO_LONG;
-		goto out;
-	}
-
-	fp = fopen(p, "r");
-	if (!fp) {
-		/* Set error correctly */
-		ret = usbg_translate_error(errno);
-		goto out;
-	}
-
-	ret= (int)fread(buf, sizeof(char), len, fp);
-	if (ret < len && ferror(fp))
-		ret = USBG_ERROR_IO;
+	if (nmb >= sizeof(p))
+		return USBG_ERROR_PATH_TOO_LONG;
 
-	fclose(fp);
-
-out:
-	return ret;
+	return usbg_io_read(io, p, buf, len);
 }
 
-int usbg_read_buf(const char *path, const char *name,
+int usbg_read_buf(const struct usbg_io *io, const char *path, const char *name,
 		  const char *file, char *buf)
 {
-	return usbg_read_buf_limited(path, name, file, buf, USBG_MAX_STR_LENGTH);
+	return usbg_read_buf_limited(io, path, name, file, buf, USBG_MAX_STR_LENGTH);
 }
 
-int usbg_read_int(const char *path, const char *name, const char *file,
-			 int base, int *dest)
+int usbg_read_int(const struct usbg_io *io, const char *path, const char *name,
+		  const char *file, int base, int *dest)
 {
 	char buf[USBG_MAX_STR_LENGTH];
 	char *pos;
 	int ret;
 
-	ret = usbg_read_buf(path, name, file, buf);
+	ret = usbg_read_buf(io, path, name, file, buf);
 	if (ret >= 0) {
 		ret = 0;
 		*dest = strtol(buf, &pos, base);
@@ -103,13 +87,13 @@ int usbg_read_int(const char *path, const char *name, const char *file,
 	return ret;
 }
 
-int usbg_read_bool(const char *path, const char *name,
-		   const char *file,  bool *dest)
+int usbg_read_bool(const struct usbg_io *io, const char *path,
+		   const char *name, const char *file, bool *dest)
 {
 	int buf;
 	int ret;
 
-	ret = usbg_read_dec(path, name, file, &buf);
+	ret = usbg_read_dec(io, path, name, file, &buf);
 	if (ret != USBG_SUCCESS)
 		goto out;
 
@@ -118,20 +102,21 @@ out:
 	return ret;
 }
 
-int usbg_read_string(const char *path, const char *name,
-		     const char *file, char *buf)
+int usbg_read_string(const struct usbg_io *io, const char *path,
+		     const char *name, const char *file, char *buf)
 {
-	return usbg_read_string_limited(path, name, file, buf,
+	return usbg_read_string_limited(io, path, name, file, buf,
 					USBG_MAX_STR_LENGTH);
 }
 
-int usbg_read_string_limited(const char *path, const char *name,
-			     const char *file, char *buf, int len)
+int usbg_read_string_limited(const struct usbg_io *io, const char *path,
+			     const char *name, const char *file, char *buf,
+			     int len)
 {
 	char *p = NULL;
 	int ret;
 
-	ret = usbg_read_buf_limited(path, name, file, buf, len);
+	ret = usbg_read_buf_limited(io, path, name, file, buf, len);
 	/* Check whether read was successful */
 	if (ret >= 0) {
 		/* Truncate bufer if needed */
@@ -148,14 +133,14 @@ int usbg_read_string_limited(const char *path, const char *name,
 
 }
 
-int usbg_read_string_alloc(const char *path, const char *name,
-			   const char *file, char **dest)
+int usbg_read_string_alloc(const struct usbg_io *io, const char *path,
+			   const char *name, const char *file, char **dest)
 {
 	char buf[USBG_MAX_FILE_SIZE];
 	char *new_buf = NULL;
 	int ret;
 
-	ret = usbg_read_string_limited(path, name, file, buf, sizeof(buf));
+	ret = usbg_read_string_limited(io, path, name, file, buf, sizeof(buf));
 	if (ret != USBG_SUCCESS)
 		goto out;
 
@@ -170,14 +155,15 @@ out:
 	return ret;
 }
 
-int usbg_read_buf_alloc(const char *path, const char *name,
-			   const char *file, char **dest, int len)
+int usbg_read_buf_alloc(const struct usbg_io *io, const char *path,
+			const char *name, const char *file, char **dest,
+			int len)
 {
 	char buf[USBG_MAX_FILE_SIZE];
 	char *new_buf = NULL;
 	int ret;
 
-	ret = usbg_read_buf_limited(path, name, file, buf, len);
+	ret = usbg_read_buf_limited(io, path, name, file, buf, len);
 	if (ret != len)
 		goto out;
 
@@ -196,46 +182,23 @@ out:
 	return ret;
 }
 
-int usbg_write_buf(const char *path, const char *name,
-		   const char *file, const char *buf, int len)
+int usbg_write_buf(const struct usbg_io *io, const char *path,
+		   const char *name, const char *file, const char *buf,
+		   int len)
 {
 	char p[USBG_MAX_PATH_LENGTH];
-	FILE *fp;
 	int nmb;
-	int ret = USBG_SUCCESS;
 
 	nmb = snprintf(p, sizeof(p), "%s/%s/%s", path, name, file);
-	if (nmb >= sizeof(p)) {
-		ret = USBG_ERROR_PATH_TOO_LONG;
-		goto out;
-	}
+	if (nmb >= sizeof(p))
+		return USBG_ERROR_PATH_TOO_LONG;
 
-	fp = fopen(p, "w");
-	if (!fp) {
-		/* Set error correctly */
-		ret = usbg_translate_error(errno);
-		goto out;
-	}
-
-	nmb = fwrite(buf, sizeof(char), len, fp);
-	if (nmb < len) {
-		if (ferror(fp))
-			nmb = usbg_translate_error(errno);
-		else
-			nmb = USBG_ERROR_IO;
-	}
-
-	ret = fclose(fp);
-	if (ret < 0)
-		ret = usbg_translate_error(errno);
-	else
-		ret = nmb;
-out:
-	return ret;
+	return usbg_io_write(io, p, buf, len);
 }
 
-int usbg_write_int(const char *path, const char *name, const char *file,
-		   int value, const char *str)
+int usbg_write_int(const struct usbg_io *io, const char *path,
+		   const char *name, const char *file, int value,
+		   const char *str)
 {
 	char buf[USBG_MAX_STR_LENGTH];
 	int nmb;
@@ -245,29 +208,29 @@ int usbg_write_int(const char *path, const char *name, const char *file,
 	if (nmb >= USBG_MAX_STR_LENGTH)
 		return USBG_ERROR_INVALID_PARAM;
 
-	ret = usbg_write_buf(path, name, file, buf, nmb);
+	ret = usbg_write_buf(io, path, name, file, buf, nmb);
 	if (ret > 0)
 		ret = 0;
 
 	return ret;
 }
 
-int usbg_write_string(const char *path, const char *name,
-		      const char *file, const char *buf)
+int usbg_write_string(const struct usbg_io *io, const char *path,
+		      const char *name, const char *file, const char *buf)
 {
 	int ret;
 
 	if (!buf)
 		return USBG_ERROR_INVALID_PARAM;
 
-	ret = usbg_write_buf(path, name, file, buf, strlen(buf));
+	ret = usbg_write_buf(io, path, name, file, buf, strlen(buf));
 	if (ret > 0)
 		ret = 0;
 
 	return ret;
 }
 
-int usbg_rm_file(const char *path, const char *name)
+int usbg_rm_file(const struct usbg_io *io, const char *path, const char *name)
 {
 	int ret = USBG_SUCCESS;
 	int nmb;
@@ -275,7 +238,7 @@ int usbg_rm_file(const char *path, const char *name)
 
 	nmb = snprintf(buf, sizeof(buf), "%s/%s", path, name);
 	if (nmb < sizeof(buf)) {
-		nmb = unlink(buf);
+		nmb = usbg_io_unlink(io, buf);
 		if (nmb != 0)
 			ret = usbg_translate_error(errno);
 	} else {
@@ -285,7 +248,7 @@ int usbg_rm_file(const char *path, const char *name)
 	return ret;
 }
 
-int usbg_rm_dir(const char *path, const char *name)
+int usbg_rm_dir(const struct usbg_io *io, const char *path, const char *name)
 {
 	int ret = USBG_SUCCESS;
 	int nmb;
@@ -293,7 +256,7 @@ int usbg_rm_dir(const char *path, const char *name)
 
 	nmb = snprintf(buf, sizeof(buf), "%s/%s", path, name);
 	if (nmb < sizeof(buf)) {
-		nmb = rmdir(buf);
+		nmb = usbg_io_rmdir(io, buf);
 		if (nmb != 0)
 			ret = usbg_translate_error(errno);
 	} else {
@@ -303,17 +266,17 @@ int usbg_rm_dir(const char *path, const char *name)
 	return ret;
 }
 
-int usbg_rm_all_dirs(const char *path)
+int usbg_rm_all_dirs(const struct usbg_io *io, const char *path)
 {
 	int ret = USBG_SUCCESS;
 	int n, i;
 	struct dirent **dent;
 
-	n = scandir(path, &dent, file_select, alphasort);
+	n = usbg_io_scandir(io, path, &dent, file_select, alphasort);
 	if (n >= 0) {
 		for (i = 0; i < n; ++i) {
 			if (ret == USBG_SUCCESS)
-				ret = usbg_rm_dir(path, dent[i]->d_name);
+				ret = usbg_rm_dir(io, path, dent[i]->d_name);
 
 			free(dent[i]);
 		}
@@ -325,16 +288,14 @@ int usbg_rm_all_dirs(const char *path)
 	return ret;
 }
 
-int usbg_check_dir(const char *path)
+int usbg_check_dir(const struct usbg_io *io, const char *path)
 {
 	int ret = USBG_SUCCESS;
-	DIR *dir;
 
 	/* Assume that user will always have read access to this directory */
-	dir = opendir(path);
-	if (dir)
-		closedir(dir);
-	else if (errno != ENOENT || mkdir(path, S_IRWXU|S_IRWXG|S_IRWXO) != 0)
+	if (usbg_io_is_dir(io, path) &&
+	    (errno != ENOENT ||
+	     usbg_io_mkdir(io, path, S_IRWXU|S_IRWXG|S_IRWXO) != 0))
 		ret = usbg_translate_error(errno);
 
 	return ret;
@@ -369,19 +330,21 @@ int usbg_init_function(struct usbg_function *f,
 	f->type = type;
 	f->ops = ops;
 	f->label = NULL;
+	f->generation = 0;
+	f->fp.valid = false;
 	memset(&f->fnode, 0, sizeof(f->fnode));
 
 	return 0;
 }
 
-int usbg_get_ether_addr(const char *path, const char *name,
-			      const char *attr, void *val)
+int usbg_get_ether_addr(const struct usbg_io *io, const char *path,
+			const char *name, const char *attr, void *val)
 {
 	struct ether_addr *addr;
 	char str_addr[USBG_MAX_STR_LENGTH];
 	int ret;
 
-	ret = usbg_read_string_limited(path, name, attr,
+	ret = usbg_read_string_limited(io, path, name, attr,
 				       str_addr, sizeof(str_addr));
 	if (ret)
 		return ret;
@@ -390,23 +353,23 @@ int usbg_get_ether_addr(const char *path, const char *name,
 	return addr ? 0 : USBG_ERROR_IO;
 }
 
-int usbg_set_ether_addr(const char *path, const char *name,
-			      const char *attr, void *val)
+int usbg_set_ether_addr(const struct usbg_io *io, const char *path,
+			const char *name, const char *attr, void *val)
 {
 	char str_addr[USBG_MAX_STR_LENGTH];
 
 	usbg_ether_ntoa_r(val, str_addr);
-	return usbg_write_string(path, name, attr, str_addr);
+	return usbg_write_string(io, path, name, attr, str_addr);
 }
 
-int usbg_get_dev(const char *path, const char *name, const char *attr,
-		 void *val)
+int usbg_get_dev(const struct usbg_io *io, const char *path, const char *name,
+		 const char *attr, void *val)
 {
 	int major, minor;
 	char str_dev[USBG_MAX_STR_LENGTH];
 	int ret;
 
-	ret = usbg_read_string_limited(path, name, attr,
+	ret = usbg_read_string_limited(io, path, name, attr,
 				       str_dev, sizeof(str_dev));
 	if (ret < 0)
 		return ret;
@@ -425,3 +388,16 @@ void usbg_cleanup_function(struct usbg_function *f)
 	free(f->name);
 	free(f->label);
 }
+
+int usbg_validation_fail(char *buf, int len, int ret, const char *fmt, ...)
+{
+	va_list args;
+
+	if (buf && len > 0) {
+		va_start(args, fmt);
+		vsnprintf(buf, len, fmt, args);
+		va_end(args);
+	}
+
+	return ret;
+}
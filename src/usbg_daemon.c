@@ -0,0 +1,463 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <errno.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @file usbg_daemon.c
+ * @brief Serves requests of many clients using single usbg_state.
+ * @details Requests are handled one by one from dispatch, so changes
+ * made by different clients are serialized. Only the user running
+ * daemon, root and optionally members of one group may connect.
+ */
+
+#define MAX_EVENTS 8
+#define MAX_PEER_GROUPS 64
+
+static void usbg_daemon_close_client(usbg_daemon *d,
+				     struct usbg_daemon_client *c)
+{
+	TAILQ_REMOVE(&d->clients, c, cnode);
+	epoll_ctl(d->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c);
+}
+
+static bool usbg_daemon_peer_in_group(uid_t uid, gid_t gid, gid_t group)
+{
+	gid_t groups[MAX_PEER_GROUPS];
+	int ngroups = MAX_PEER_GROUPS;
+	struct passwd pw, *pwp;
+	char buf[USBG_MAX_PATH_LENGTH];
+	int i;
+
+	if (gid == group)
+		return true;
+
+	/* Credentials carry only primary group of peer */
+	if (getpwuid_r(uid, &pw, buf, sizeof(buf), &pwp) || !pwp)
+		return false;
+
+	if (getgrouplist(pw.pw_name, gid, groups, &ngroups) < 0)
+		return false;
+
+	for (i = 0; i < ngroups; ++i)
+		if (groups[i] == group)
+			return true;
+
+	return false;
+}
+
+/* Socket permissions are checked once more, after connection is made */
+static bool usbg_daemon_peer_allowed(usbg_daemon *d, int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+		return false;
+
+	if (cred.uid == 0 || cred.uid == geteuid())
+		return true;
+
+	return d->group != (gid_t)-1 &&
+		usbg_daemon_peer_in_group(cred.uid, cred.gid, d->group);
+}
+
+static void usbg_daemon_accept(usbg_daemon *d)
+{
+	struct usbg_daemon_client *c;
+	struct epoll_event ev;
+	int fd;
+
+	fd = accept4(d->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	if (!usbg_daemon_peer_allowed(d, fd)) {
+		close(fd);
+		return;
+	}
+
+	c = malloc(sizeof(*c));
+	if (!c) {
+		close(fd);
+		return;
+	}
+
+	c->fd = fd;
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		close(fd);
+		free(c);
+		return;
+	}
+
+	TAILQ_INSERT_TAIL(&d->clients, c, cnode);
+}
+
+static void usbg_daemon_list(usbg_daemon *d, struct usbg_rpc_msg *resp)
+{
+	usbg_gadget *g;
+	uint32_t count = 0;
+
+	TAILQ_FOREACH(g, &d->parent->gadgets, gnode)
+		count++;
+
+	usbg_rpc_put_u32(resp, count);
+	TAILQ_FOREACH(g, &d->parent->gadgets, gnode) {
+		usbg_rpc_put_str(resp, g->name);
+		usbg_rpc_put_str(resp, g->udc ? g->udc->name : NULL);
+	}
+}
+
+static int usbg_daemon_get(usbg_gadget *g, struct usbg_rpc_msg *resp)
+{
+	int vid, pid;
+
+	vid = usbg_get_gadget_attr(g, USBG_ID_VENDOR);
+	if (vid < 0)
+		return vid;
+
+	pid = usbg_get_gadget_attr(g, USBG_ID_PRODUCT);
+	if (pid < 0)
+		return pid;
+
+	usbg_rpc_put_str(resp, g->name);
+	usbg_rpc_put_str(resp, g->udc ? g->udc->name : NULL);
+	usbg_rpc_put_u32(resp, vid);
+	usbg_rpc_put_u32(resp, pid);
+
+	return USBG_SUCCESS;
+}
+
+/*
+ * Take UDC from any gadget which uses it. If gadget cannot be bound,
+ * both gadgets are bound back where they were.
+ */
+static int usbg_daemon_switch(usbg_gadget *g, usbg_udc *u)
+{
+	usbg_gadget *prev = u->gadget;
+	usbg_udc *prev_udc = g->udc;
+	int ret;
+
+	if (prev == g)
+		return USBG_SUCCESS;
+
+	if (prev) {
+		ret = usbg_disable_gadget(prev);
+		if (ret != USBG_SUCCESS)
+			return ret;
+	}
+
+	if (prev_udc) {
+		ret = usbg_disable_gadget(g);
+		if (ret != USBG_SUCCESS)
+			goto restore_prev;
+	}
+
+	ret = usbg_enable_gadget(g, u);
+	if (ret == USBG_SUCCESS)
+		return ret;
+
+	if (prev_udc)
+		usbg_enable_gadget(g, prev_udc);
+restore_prev:
+	if (prev)
+		usbg_enable_gadget(prev, u);
+	return ret;
+}
+
+static int usbg_daemon_handle(usbg_daemon *d, struct usbg_rpc_msg *req,
+			      uint16_t op, struct usbg_rpc_msg *resp)
+{
+	char name[USBG_MAX_STR_LENGTH];
+	char udc_name[USBG_MAX_STR_LENGTH];
+	usbg_gadget *g = NULL;
+	usbg_udc *u = NULL;
+	uint32_t vid, pid;
+
+	if (op == USBG_RPC_LIST) {
+		usbg_daemon_list(d, resp);
+		return USBG_SUCCESS;
+	}
+
+	usbg_rpc_get_str(req, name, sizeof(name));
+
+	if (op == USBG_RPC_CREATE) {
+		vid = usbg_rpc_get_u32(req);
+		pid = usbg_rpc_get_u32(req);
+		if (req->error)
+			return USBG_ERROR_INVALID_FORMAT;
+
+		if (vid > UINT16_MAX || pid > UINT16_MAX)
+			return USBG_ERROR_INVALID_VALUE;
+
+		return usbg_create_gadget_vid_pid(d->parent, name, vid, pid, &g);
+	}
+
+	if (op != USBG_RPC_GET)
+		usbg_rpc_get_str(req, udc_name, sizeof(udc_name));
+	if (req->error)
+		return USBG_ERROR_INVALID_FORMAT;
+
+	g = usbg_get_gadget(d->parent, name);
+	if (!g)
+		return USBG_ERROR_NOT_FOUND;
+
+	if (op != USBG_RPC_GET && udc_name[0]) {
+		u = usbg_get_udc(d->parent, udc_name);
+		if (!u)
+			return USBG_ERROR_NOT_FOUND;
+	}
+
+	switch (op) {
+	case USBG_RPC_GET:
+		return usbg_daemon_get(g, resp);
+	case USBG_RPC_ENABLE:
+		if (!u)
+			return usbg_enable_gadget_policy(g,
+						USBG_UDC_POLICY_FIRST_FREE,
+						NULL, NULL);
+		return usbg_enable_gadget(g, u);
+	case USBG_RPC_DISABLE:
+		return usbg_disable_gadget(g);
+	case USBG_RPC_SWITCH:
+		if (!u)
+			return USBG_ERROR_INVALID_PARAM;
+		return usbg_daemon_switch(g, u);
+	default:
+		return USBG_ERROR_NOT_SUPPORTED;
+	}
+}
+
+/* Returns 1 if request has been served, 0 otherwise */
+static int usbg_daemon_serve(usbg_daemon *d, struct usbg_daemon_client *c)
+{
+	struct usbg_rpc_msg req, resp;
+	struct usbg_rpc_hdr hdr;
+	char *resp_buf;
+	ssize_t n;
+	int ret;
+
+	n = recv(c->fd, d->buf, USBG_RPC_MAX_MSG, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+
+	if (n <= 0 || usbg_rpc_parse(&req, d->buf, n, &hdr) != USBG_SUCCESS) {
+		usbg_daemon_close_client(d, c);
+		return 0;
+	}
+
+	/* Response is built just after request in the same buffer */
+	resp_buf = d->buf + USBG_RPC_MAX_MSG;
+	usbg_rpc_init(&resp, resp_buf, USBG_RPC_MAX_MSG, hdr.op, 0);
+
+	ret = usbg_daemon_handle(d, &req, hdr.op, &resp);
+	if (ret == USBG_SUCCESS && resp.error)
+		ret = USBG_ERROR_NO_MEM;
+	if (ret != USBG_SUCCESS)
+		usbg_rpc_init(&resp, resp_buf, USBG_RPC_MAX_MSG, hdr.op, ret);
+
+	/* Client which doesn't read responses must not stall the others */
+	if (send(c->fd, resp.buf, resp.len, MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+		usbg_daemon_close_client(d, c);
+
+	return 1;
+}
+
+/* Remove socket left by previous instance, but nothing else */
+static int usbg_daemon_remove_stale(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd, ret;
+
+	if (lstat(addr->sun_path, &st))
+		return errno == ENOENT ? USBG_SUCCESS
+			: usbg_translate_error(errno);
+
+	if (!S_ISSOCK(st.st_mode))
+		return USBG_ERROR_EXIST;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return usbg_translate_error(errno);
+
+	/* Other daemon still serves this socket */
+	ret = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+	close(fd);
+	if (!ret)
+		return USBG_ERROR_BUSY;
+
+	if (unlink(addr->sun_path) && errno != ENOENT)
+		return usbg_translate_error(errno);
+
+	return USBG_SUCCESS;
+}
+
+int usbg_daemon_create(usbg_state *s, const char *path, usbg_daemon **d)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct epoll_event ev;
+	usbg_daemon *new_d;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!s || !d)
+		goto out;
+
+	if (!path)
+		path = USBG_DAEMON_SOCKET;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		goto out;
+	}
+	strcpy(addr.sun_path, path);
+
+	new_d = calloc(1, sizeof(*new_d));
+	if (!new_d) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	new_d->parent = s;
+	new_d->listen_fd = -1;
+	new_d->epoll_fd = -1;
+	new_d->group = (gid_t)-1;
+	TAILQ_INIT(&new_d->clients);
+
+	new_d->path = strdup(path);
+	/* Request and response */
+	new_d->buf = malloc(2 * USBG_RPC_MAX_MSG);
+	if (!new_d->path || !new_d->buf) {
+		ret = USBG_ERROR_NO_MEM;
+		goto err;
+	}
+
+	new_d->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	new_d->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC |
+				  SOCK_NONBLOCK, 0);
+	if (new_d->epoll_fd < 0 || new_d->listen_fd < 0) {
+		ret = usbg_translate_error(errno);
+		goto err;
+	}
+
+	ret = usbg_daemon_remove_stale(&addr);
+	if (ret != USBG_SUCCESS)
+		goto err;
+
+	if (bind(new_d->listen_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		ret = usbg_translate_error(errno);
+		goto err;
+	}
+
+	/* Nobody can connect before listen(), so mode is set in time */
+	if (chmod(path, S_IRUSR | S_IWUSR) ||
+	    listen(new_d->listen_fd, SOMAXCONN)) {
+		ret = usbg_translate_error(errno);
+		unlink(path);
+		goto err;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(new_d->epoll_fd, EPOLL_CTL_ADD, new_d->listen_fd, &ev)) {
+		ret = usbg_translate_error(errno);
+		unlink(path);
+		goto err;
+	}
+
+	*d = new_d;
+	return USBG_SUCCESS;
+
+err:
+	if (new_d->listen_fd >= 0)
+		close(new_d->listen_fd);
+	if (new_d->epoll_fd >= 0)
+		close(new_d->epoll_fd);
+	free(new_d->buf);
+	free(new_d->path);
+	free(new_d);
+out:
+	return ret;
+}
+
+int usbg_daemon_allow_group(usbg_daemon *d, gid_t gid)
+{
+	if (!d || gid == (gid_t)-1)
+		return USBG_ERROR_INVALID_PARAM;
+
+	if (chown(d->path, -1, gid) ||
+	    chmod(d->path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP))
+		return usbg_translate_error(errno);
+
+	d->group = gid;
+
+	return USBG_SUCCESS;
+}
+
+void usbg_daemon_destroy(usbg_daemon *d)
+{
+	if (!d)
+		return;
+
+	while (!TAILQ_EMPTY(&d->clients))
+		usbg_daemon_close_client(d, TAILQ_FIRST(&d->clients));
+
+	close(d->listen_fd);
+	close(d->epoll_fd);
+	unlink(d->path);
+	free(d->buf);
+	free(d->path);
+	free(d);
+}
+
+int usbg_daemon_get_fd(usbg_daemon *d)
+{
+	return d ? d->epoll_fd : USBG_ERROR_INVALID_PARAM;
+}
+
+int usbg_daemon_dispatch(usbg_daemon *d, int timeout_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int i, n;
+	int ret = 0;
+
+	if (!d)
+		return USBG_ERROR_INVALID_PARAM;
+
+	n = epoll_wait(d->epoll_fd, events, MAX_EVENTS, timeout_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : usbg_translate_error(errno);
+
+	for (i = 0; i < n; ++i) {
+		if (!events[i].data.ptr)
+			usbg_daemon_accept(d);
+		else
+			ret += usbg_daemon_serve(d, events[i].data.ptr);
+	}
+
+	return ret;
+}
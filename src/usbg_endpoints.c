@@ -0,0 +1,228 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+#include "usbg/function/uac2.h"
+
+#include <ctype.h>
+#include <glob.h>
+#include <stdio.h>
+
+/**
+ * @file usbg_endpoints.c
+ * @brief Estimation of interfaces and endpoints needed by functions.
+ * @details Kernel releases all endpoints of UDC after binding each
+ * configuration, so the budget is checked for each config separately.
+ */
+
+#define DEBUGFS_DIR "/sys/kernel/debug"
+
+/*
+ * Interfaces and non control endpoints of descriptors which kernel
+ * creates for each function type. Mass storage uses the same pair of
+ * bulk endpoints for all LUNs. FunctionFS descriptors are written
+ * by user space daemon so only its interface is counted.
+ */
+static const struct usbg_ep_budget type_budget[USBG_FUNCTION_TYPE_MAX] = {
+	[USBG_F_SERIAL] = { 1, 2 },
+	[USBG_F_ACM] = { 2, 3 },
+	[USBG_F_OBEX] = { 2, 2 },
+	[USBG_F_ECM] = { 2, 3 },
+	[USBG_F_SUBSET] = { 1, 2 },
+	[USBG_F_NCM] = { 2, 3 },
+	[USBG_F_EEM] = { 1, 2 },
+	[USBG_F_RNDIS] = { 2, 3 },
+	[USBG_F_PHONET] = { 2, 2 },
+	[USBG_F_FFS] = { 1, 0 },
+	[USBG_F_MASS_STORAGE] = { 1, 2 },
+	[USBG_F_MIDI] = { 2, 2 },
+	[USBG_F_LOOPBACK] = { 1, 2 },
+	[USBG_F_HID] = { 1, 2 },
+	[USBG_F_UAC2] = { 1, 0 },
+	[USBG_F_UVC] = { 2, 2 },
+	[USBG_F_PRINTER] = { 1, 2 },
+	[USBG_F_9PFS] = { 1, 2 },
+};
+
+void usbg_type_ep_budget(int type, struct usbg_ep_budget *b)
+{
+	*b = type_budget[type];
+}
+
+void usbg_uac2_ep_budget(int c_chmask, int p_chmask, bool feedback,
+			 bool controls, struct usbg_ep_budget *b)
+{
+	/* Audio control interface, optionally with interrupt endpoint */
+	b->interfaces = 1;
+	b->endpoints = controls ? 1 : 0;
+
+	if (c_chmask) {
+		b->interfaces++;
+		b->endpoints += feedback ? 2 : 1;
+	}
+
+	if (p_chmask) {
+		b->interfaces++;
+		b->endpoints++;
+	}
+}
+
+static bool usbg_uac2_get_bool(usbg_f_uac2 *af, enum usbg_f_uac2_attr attr)
+{
+	union usbg_f_uac2_attr_val val;
+
+	/* Older kernels don't provide controls at all */
+	return usbg_f_uac2_get_attr_val(af, attr, &val) == USBG_SUCCESS &&
+		val.p_mute_present;
+}
+
+static int usbg_get_uac2_ep_budget(usbg_function *f, struct usbg_ep_budget *b)
+{
+	usbg_f_uac2 *af = usbg_to_uac2_function(f);
+	union usbg_f_uac2_attr_val c_chmask, p_chmask, sync;
+	bool feedback, controls;
+	int ret;
+
+	ret = usbg_f_uac2_get_attr_val(af, USBG_F_UAC2_C_CHMASK, &c_chmask);
+	if (ret == USBG_SUCCESS)
+		ret = usbg_f_uac2_get_attr_val(af, USBG_F_UAC2_P_CHMASK,
+					       &p_chmask);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	feedback = true;
+	if (usbg_f_uac2_get_attr_val(af, USBG_F_UAC2_C_SYNC, &sync) == 0) {
+		feedback = !sync.c_sync || !strcmp(sync.c_sync, "async");
+		free((char *)sync.c_sync);
+	}
+
+	controls = usbg_uac2_get_bool(af, USBG_F_UAC2_P_MUTE_PRESENT) ||
+		usbg_uac2_get_bool(af, USBG_F_UAC2_P_VOLUME_PRESENT) ||
+		usbg_uac2_get_bool(af, USBG_F_UAC2_C_MUTE_PRESENT) ||
+		usbg_uac2_get_bool(af, USBG_F_UAC2_C_VOLUME_PRESENT);
+
+	usbg_uac2_ep_budget(c_chmask.c_chmask, p_chmask.p_chmask, feedback,
+			    controls, b);
+
+	return USBG_SUCCESS;
+}
+
+int usbg_get_function_ep_budget(usbg_function *f, struct usbg_ep_budget *b)
+{
+	if (!f || !b)
+		return USBG_ERROR_INVALID_PARAM;
+
+	if (f->type == USBG_F_UAC2)
+		return usbg_get_uac2_ep_budget(f, b);
+
+	usbg_type_ep_budget(f->type, b);
+
+	return USBG_SUCCESS;
+}
+
+int usbg_get_config_ep_budget(usbg_config *c, struct usbg_ep_budget *b)
+{
+	struct usbg_ep_budget fb;
+	usbg_binding *bd;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!c || !b)
+		goto out;
+
+	b->interfaces = 0;
+	b->endpoints = 0;
+
+	TAILQ_FOREACH(bd, &c->bindings, bnode) {
+		ret = usbg_get_function_ep_budget(bd->target, &fb);
+		if (ret != USBG_SUCCESS)
+			goto out;
+
+		b->interfaces += fb.interfaces;
+		b->endpoints += fb.endpoints;
+	}
+
+	ret = USBG_SUCCESS;
+
+out:
+	return ret;
+}
+
+int usbg_get_udc_endpoints(usbg_udc *u)
+{
+	char pattern[USBG_MAX_PATH_LENGTH];
+	glob_t gl;
+	size_t i;
+	int nmb;
+
+	if (!u)
+		return USBG_ERROR_INVALID_PARAM;
+
+	if (u->endpoints_valid)
+		goto out;
+
+	u->endpoints = USBG_ERROR_NOT_SUPPORTED;
+	u->endpoints_valid = true;
+
+	/*
+	 * UDC drivers like dwc2 and dwc3 create debugfs entry
+	 * for each endpoint direction, named ep<N>in, ep<N>out
+	 * or ep<N> for bidirectional ones.
+	 */
+	nmb = snprintf(pattern, sizeof(pattern), "%s/%s/ep[0-9]*",
+		       DEBUGFS_DIR, u->name);
+	if (nmb >= sizeof(pattern))
+		goto out;
+
+	if (glob(pattern, 0, NULL, &gl))
+		goto out;
+
+	u->endpoints = 0;
+	for (i = 0; i < gl.gl_pathc; ++i) {
+		const char *ep = strrchr(gl.gl_pathv[i], '/') + 3;
+
+		/* ep0 is the control endpoint */
+		if (ep[0] != '0' || isdigit(ep[1]))
+			u->endpoints++;
+	}
+
+	globfree(&gl);
+
+out:
+	return u->endpoints;
+}
+
+int usbg_set_udc_endpoints(usbg_udc *u, int endpoints)
+{
+	if (!u || endpoints < 0)
+		return USBG_ERROR_INVALID_PARAM;
+
+	u->endpoints = endpoints;
+	u->endpoints_valid = true;
+
+	return USBG_SUCCESS;
+}
+
+int usbg_max_udc_endpoints(usbg_state *s)
+{
+	int endpoints = USBG_ERROR_NOT_SUPPORTED;
+	int n;
+	usbg_udc *u;
+
+	TAILQ_FOREACH(u, &s->udcs, unode) {
+		n = usbg_get_udc_endpoints(u);
+		if (n > endpoints)
+			endpoints = n;
+	}
+
+	return endpoints;
+}
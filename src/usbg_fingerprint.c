@@ -0,0 +1,307 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <stdio.h>
+
+/**
+ * @file usbg_fingerprint.c
+ * @brief Content hashes of gadgets, configs and functions.
+ * @details Fingerprint is computed from compiled program of given
+ * directory. Each operation is hashed separately and hashes are summed,
+ * so result doesn't depend on order of directory entries. Paths and
+ * targets of links are relative to hashed directory, so gadgets and
+ * functions with the same content have the same fingerprint regardless
+ * of their names. Fingerprint of gadget is made of its own directories
+ * and fingerprints of its functions and configs. Each part is cached
+ * until library changes it, so only modified parts are read again.
+ */
+
+#define USBG_FNV_OFFSET 0xcbf29ce484222325ULL
+#define USBG_FNV_PRIME 0x100000001b3ULL
+
+static uint64_t usbg_fnv(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *c = data;
+
+	while (len--) {
+		h ^= *c++;
+		h *= USBG_FNV_PRIME;
+	}
+
+	return h;
+}
+
+/* Avalanche, so that sum of hashes doesn't cancel out similar ops */
+static uint64_t usbg_fp_mix(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+
+	return h;
+}
+
+static bool usbg_fp_is_under(const char *path, const char *dir, size_t len)
+{
+	return !strncmp(path, dir, len) && path[len] == '/';
+}
+
+static void usbg_fp_add(struct usbg_fp_cache *fp, uint64_t h)
+{
+	fp->sum += h;
+	fp->n++;
+}
+
+static uint64_t usbg_fp_final(const struct usbg_fp_cache *fp)
+{
+	return usbg_fp_mix(fp->sum ^ fp->n);
+}
+
+/* Function or config is identified by its directory within gadget */
+static uint64_t usbg_fp_child(const char *path, uint64_t fp)
+{
+	return usbg_fp_mix(usbg_fnv(fp, path, strlen(path) + 1));
+}
+
+/* Sum ops placed under rel, paths and link targets made relative to it */
+static void usbg_fp_sum_ops(struct usbg_fp_cache *fp,
+			    struct usbg_program_op *ops, int nops,
+			    const char *rel)
+{
+	size_t rel_len = strlen(rel);
+	const char *path, *data;
+	unsigned char type;
+	uint64_t h;
+	int i, len;
+
+	for (i = 0; i < nops; ++i) {
+		/* UDC says where gadget is, not what it is */
+		if (ops[i].type == USBG_OP_BIND)
+			continue;
+
+		path = ops[i].path;
+		data = ops[i].data;
+		len = ops[i].len;
+		if (rel_len) {
+			if (!usbg_fp_is_under(path, rel, rel_len))
+				continue;
+			path += rel_len + 1;
+
+			/* Like UVC header pointing to its format */
+			if (ops[i].type == USBG_OP_SYMLINK &&
+			    usbg_fp_is_under(data, rel, rel_len)) {
+				data += rel_len + 1;
+				len -= rel_len + 1;
+			}
+		}
+
+		type = ops[i].type;
+		h = usbg_fnv(USBG_FNV_OFFSET, &type, sizeof(type));
+		h = usbg_fnv(h, path, strlen(path) + 1);
+		h = usbg_fnv(h, data, len);
+		usbg_fp_add(fp, usbg_fp_mix(h));
+	}
+}
+
+/* Name of function or config if path lays within one */
+static const char *usbg_fp_child_name(const char *path)
+{
+	if (usbg_fp_is_under(path, FUNCTIONS_DIR, strlen(FUNCTIONS_DIR)))
+		return path + strlen(FUNCTIONS_DIR) + 1;
+	if (usbg_fp_is_under(path, CONFIGS_DIR, strlen(CONFIGS_DIR)))
+		return path + strlen(CONFIGS_DIR) + 1;
+
+	return NULL;
+}
+
+static int usbg_fp_update(usbg_gadget *g, const char *rel, bool children,
+			  uint64_t generation, bool cached,
+			  struct usbg_fp_cache *fp)
+{
+	char gpath[USBG_MAX_PATH_LENGTH];
+	usbg_program *p;
+	int nmb;
+	int ret;
+
+	if (fp->valid && fp->generation == generation)
+		return USBG_SUCCESS;
+
+	if (cached)
+		return USBG_ERROR_NOT_FOUND;
+
+	nmb = snprintf(gpath, sizeof(gpath), "%s/%s", g->path, g->name);
+	if (nmb >= sizeof(gpath))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	ret = usbg_compile_program_dir(usbg_gadget_io(g), gpath, rel,
+				       children, &p);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	fp->sum = 0;
+	fp->n = 0;
+	usbg_fp_sum_ops(fp, p->ops, p->nops, rel);
+	fp->generation = generation;
+	fp->valid = true;
+	usbg_destroy_program(p);
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_fp_function(usbg_function *f, bool cached, uint64_t *fp)
+{
+	char rel[USBG_MAX_PATH_LENGTH];
+	int nmb;
+	int ret;
+
+	if (!f || !fp)
+		return USBG_ERROR_INVALID_PARAM;
+
+	nmb = snprintf(rel, sizeof(rel), "%s/%s", FUNCTIONS_DIR, f->name);
+	if (nmb >= sizeof(rel))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	ret = usbg_fp_update(f->parent, rel, true, f->generation, cached,
+			     &f->fp);
+	if (ret == USBG_SUCCESS)
+		*fp = usbg_fp_final(&f->fp);
+
+	return ret;
+}
+
+static int usbg_fp_config(usbg_config *c, bool cached, uint64_t *fp)
+{
+	char rel[USBG_MAX_PATH_LENGTH];
+	int nmb;
+	int ret;
+
+	if (!c || !fp)
+		return USBG_ERROR_INVALID_PARAM;
+
+	nmb = snprintf(rel, sizeof(rel), "%s/%s", CONFIGS_DIR, c->name);
+	if (nmb >= sizeof(rel))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	ret = usbg_fp_update(c->parent, rel, true, c->generation, cached,
+			     &c->fp);
+	if (ret == USBG_SUCCESS)
+		*fp = usbg_fp_final(&c->fp);
+
+	return ret;
+}
+
+static int usbg_fp_gadget(usbg_gadget *g, bool cached, uint64_t *fp)
+{
+	char path[USBG_MAX_PATH_LENGTH];
+	struct usbg_fp_cache sum;
+	usbg_function *f;
+	usbg_config *c;
+	uint64_t h;
+	int ret;
+
+	if (!g || !fp)
+		return USBG_ERROR_INVALID_PARAM;
+
+	ret = usbg_fp_update(g, "", false, g->generation, cached, &g->fp);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	sum = g->fp;
+	TAILQ_FOREACH(f, &g->functions, fnode) {
+		ret = usbg_fp_function(f, cached, &h);
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		snprintf(path, sizeof(path), "%s/%s", FUNCTIONS_DIR, f->name);
+		usbg_fp_add(&sum, usbg_fp_child(path, h));
+	}
+
+	TAILQ_FOREACH(c, &g->configs, cnode) {
+		ret = usbg_fp_config(c, cached, &h);
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		snprintf(path, sizeof(path), "%s/%s", CONFIGS_DIR, c->name);
+		usbg_fp_add(&sum, usbg_fp_child(path, h));
+	}
+
+	*fp = usbg_fp_final(&sum);
+
+	return USBG_SUCCESS;
+}
+
+int usbg_get_gadget_fingerprint(usbg_gadget *g, uint64_t *fp)
+{
+	return usbg_fp_gadget(g, false, fp);
+}
+
+int usbg_get_function_fingerprint(usbg_function *f, uint64_t *fp)
+{
+	return usbg_fp_function(f, false, fp);
+}
+
+int usbg_get_config_fingerprint(usbg_config *c, uint64_t *fp)
+{
+	return usbg_fp_config(c, false, fp);
+}
+
+int usbg_get_cached_gadget_fingerprint(usbg_gadget *g, uint64_t *fp)
+{
+	return usbg_fp_gadget(g, true, fp);
+}
+
+int usbg_get_cached_function_fingerprint(usbg_function *f, uint64_t *fp)
+{
+	return usbg_fp_function(f, true, fp);
+}
+
+int usbg_get_cached_config_fingerprint(usbg_config *c, uint64_t *fp)
+{
+	return usbg_fp_config(c, true, fp);
+}
+
+int usbg_get_program_fingerprint(usbg_program *p, uint64_t *fp)
+{
+	struct usbg_fp_cache sum = { 0 }, child;
+	const char *name;
+	int i;
+
+	if (!p || !fp)
+		return USBG_ERROR_INVALID_PARAM;
+
+	/* Split program the same way as gadget is split above */
+	for (i = 0; i < p->nops; ++i) {
+		name = usbg_fp_child_name(p->ops[i].path);
+		if (!name) {
+			usbg_fp_sum_ops(&sum, &p->ops[i], 1, "");
+			continue;
+		}
+
+		/* Content of function or config is summed with its dir */
+		if (p->ops[i].type != USBG_OP_MKDIR || strchr(name, '/'))
+			continue;
+
+		memset(&child, 0, sizeof(child));
+		usbg_fp_sum_ops(&child, p->ops, p->nops, p->ops[i].path);
+		usbg_fp_add(&sum, usbg_fp_child(p->ops[i].path,
+						usbg_fp_final(&child)));
+	}
+
+	*fp = usbg_fp_final(&sum);
+
+	return USBG_SUCCESS;
+}
@@ -0,0 +1,788 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @file usbg_image.c
+ * @brief Binary images of gadgets.
+ * @details Gadget, config and string attributes are stored in the same
+ * form as they are passed to usbg_set_*() functions. Attributes of
+ * functions are stored as compiled program of function directory, so
+ * there is no per function type code here.
+ */
+
+struct usbg_image_builder
+{
+	struct usbg_image_rec *recs;
+	uint32_t nrecs;
+	uint32_t recs_size;
+	char *strtab;
+	uint32_t strtab_len;
+	uint32_t strtab_size;
+};
+
+#define IMG_STR_KEY 0x01
+#define IMG_STR_VAL 0x02
+/* Record has to be preceded by record of given type */
+#define IMG_IN_GADGET 0x04
+#define IMG_IN_FUNCTION 0x08
+#define IMG_IN_CONFIG 0x10
+
+static const int usbg_image_rec_flags[USBG_IMG_MAX] = {
+	[USBG_IMG_GADGET] = IMG_STR_KEY,
+	[USBG_IMG_GADGET_ATTR] = IMG_IN_GADGET,
+	[USBG_IMG_GADGET_STR] = IMG_IN_GADGET | IMG_STR_VAL,
+	[USBG_IMG_GADGET_OS_DESC] = IMG_IN_GADGET | IMG_STR_VAL,
+	[USBG_IMG_FUNCTION] = IMG_IN_GADGET | IMG_STR_KEY | IMG_STR_VAL,
+	[USBG_IMG_FUNCTION_OP] = IMG_IN_FUNCTION | IMG_STR_KEY | IMG_STR_VAL,
+	[USBG_IMG_CONFIG] = IMG_IN_GADGET | IMG_STR_KEY,
+	[USBG_IMG_CONFIG_ATTR] = IMG_IN_CONFIG,
+	[USBG_IMG_CONFIG_STR] = IMG_IN_CONFIG | IMG_STR_VAL,
+	[USBG_IMG_BINDING] = IMG_IN_CONFIG | IMG_STR_KEY,
+	[USBG_IMG_OS_DESC_CONFIG] = IMG_IN_GADGET | IMG_STR_KEY,
+	[USBG_IMG_UDC] = IMG_IN_GADGET | IMG_STR_KEY,
+};
+
+static uint32_t usbg_image_str(struct usbg_image_builder *b, const char *str,
+			       size_t len)
+{
+	uint32_t off;
+	char *strtab;
+
+	/* Empty string is always at offset 0 */
+	if (!str || !len)
+		return 0;
+
+	if (b->strtab_len + len + 1 > b->strtab_size) {
+		size_t size = b->strtab_size;
+
+		while (b->strtab_len + len + 1 > size)
+			size *= 2;
+		if (size > UINT32_MAX)
+			return 0;
+
+		strtab = realloc(b->strtab, size);
+		if (!strtab)
+			return 0;
+
+		b->strtab = strtab;
+		b->strtab_size = size;
+	}
+
+	off = b->strtab_len;
+	memcpy(b->strtab + off, str, len);
+	b->strtab[off + len] = '\0';
+	b->strtab_len += len + 1;
+
+	return off;
+}
+
+static int usbg_image_add(struct usbg_image_builder *b, int type, int id,
+			  uint32_t key, uint32_t val, uint32_t len)
+{
+	struct usbg_image_rec *rec;
+
+	if (b->nrecs == b->recs_size) {
+		uint32_t size = b->recs_size ? 2 * b->recs_size : 64;
+
+		rec = realloc(b->recs, size * sizeof(*rec));
+		if (!rec)
+			return USBG_ERROR_NO_MEM;
+
+		b->recs = rec;
+		b->recs_size = size;
+	}
+
+	rec = &b->recs[b->nrecs++];
+	rec->type = type;
+	rec->id = id;
+	rec->key = key;
+	rec->val = val;
+	rec->len = len;
+
+	return USBG_SUCCESS;
+}
+
+/* Adds record with string key and/or value, fails if any string failed */
+static int usbg_image_add_str(struct usbg_image_builder *b, int type, int id,
+			      const char *key, const char *val, size_t len)
+{
+	uint32_t key_off = 0, val_off = 0;
+
+	if (key && *key) {
+		key_off = usbg_image_str(b, key, strlen(key));
+		if (!key_off)
+			return USBG_ERROR_NO_MEM;
+	}
+
+	if (val && len) {
+		val_off = usbg_image_str(b, val, len);
+		if (!val_off)
+			return USBG_ERROR_NO_MEM;
+	}
+
+	return usbg_image_add(b, type, id, key_off, val_off, len);
+}
+
+static int usbg_image_add_gadget_strs(struct usbg_image_builder *b,
+				      usbg_gadget *g)
+{
+	struct usbg_gadget_strs strs;
+	const char *str[USBG_GADGET_STR_MAX];
+	int *langs;
+	int i, j, ret;
+
+	ret = usbg_get_gadget_strs_langs(g, &langs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	for (i = 0; langs[i] && ret == USBG_SUCCESS; ++i) {
+		ret = usbg_get_gadget_strs(g, langs[i], &strs);
+		if (ret != USBG_SUCCESS)
+			break;
+
+		str[USBG_STR_MANUFACTURER] = strs.manufacturer;
+		str[USBG_STR_PRODUCT] = strs.product;
+		str[USBG_STR_SERIAL_NUMBER] = strs.serial;
+
+		for (j = USBG_GADGET_STR_MIN;
+		     j < USBG_GADGET_STR_MAX && ret == USBG_SUCCESS; ++j) {
+			ret = usbg_image_add_str(b, USBG_IMG_GADGET_STR,
+						 langs[i], NULL, str[j],
+						 str[j] ? strlen(str[j]) : 0);
+			/* Code of string is not a string */
+			if (ret == USBG_SUCCESS)
+				b->recs[b->nrecs - 1].key = j;
+		}
+
+		usbg_free_gadget_strs(&strs);
+	}
+
+	free(langs);
+out:
+	return ret;
+}
+
+static int usbg_image_add_function(struct usbg_image_builder *b,
+				   usbg_function *f)
+{
+	char fpath[USBG_MAX_PATH_LENGTH];
+	usbg_program *p;
+	struct usbg_program_op *op;
+	int i, nmb, ret;
+
+	ret = usbg_image_add_str(b, USBG_IMG_FUNCTION, 0,
+				 usbg_get_function_type_str(f->type),
+				 f->instance, strlen(f->instance));
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	nmb = snprintf(fpath, sizeof(fpath), "%s/%s", f->path, f->name);
+	if (nmb >= sizeof(fpath))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	ret = usbg_compile_program_dir(usbg_function_io(f), fpath, "", true,
+				       &p);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	for (i = 0; i < p->nops && ret == USBG_SUCCESS; ++i) {
+		op = &p->ops[i];
+		ret = usbg_image_add_str(b, USBG_IMG_FUNCTION_OP, op->type,
+					 op->path, op->data, op->len);
+	}
+
+	usbg_destroy_program(p);
+	return ret;
+}
+
+static int usbg_image_add_config(struct usbg_image_builder *b,
+				 usbg_config *c, uint32_t *func_rec)
+{
+	struct usbg_config_attrs attrs;
+	struct usbg_config_strs strs;
+	usbg_binding *bd;
+	usbg_function *f, *i;
+	int *langs;
+	int l, idx, ret;
+
+	ret = usbg_image_add_str(b, USBG_IMG_CONFIG, c->id, c->label, NULL, 0);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = usbg_get_config_attrs(c, &attrs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = usbg_image_add(b, USBG_IMG_CONFIG_ATTR, 0, attrs.bmAttributes,
+			     attrs.bMaxPower, 0);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	ret = usbg_get_config_strs_langs(c, &langs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	for (l = 0; langs[l] && ret == USBG_SUCCESS; ++l) {
+		ret = usbg_get_config_strs(c, langs[l], &strs);
+		if (ret != USBG_SUCCESS)
+			break;
+
+		ret = usbg_image_add_str(b, USBG_IMG_CONFIG_STR, langs[l],
+					 NULL, strs.configuration,
+					 strlen(strs.configuration));
+		usbg_free_config_strs(&strs);
+	}
+
+	free(langs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	TAILQ_FOREACH(bd, &c->bindings, bnode) {
+		f = usbg_get_binding_target(bd);
+		idx = 0;
+		TAILQ_FOREACH(i, &c->parent->functions, fnode) {
+			if (i == f)
+				break;
+			idx++;
+		}
+
+		ret = usbg_image_add_str(b, USBG_IMG_BINDING, 0, bd->name,
+					 NULL, 0);
+		if (ret != USBG_SUCCESS)
+			break;
+		b->recs[b->nrecs - 1].val = func_rec[idx];
+	}
+
+out:
+	return ret;
+}
+
+static int usbg_image_add_gadget(struct usbg_image_builder *b, usbg_gadget *g)
+{
+	struct usbg_gadget_os_descs os_descs = {0};
+	usbg_function *f;
+	usbg_config *c;
+	uint32_t *func_rec;
+	int i, val, nfuncs = 0;
+	int ret;
+
+	ret = usbg_image_add_str(b, USBG_IMG_GADGET, 0, g->name, NULL, 0);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	for (i = USBG_GADGET_ATTR_MIN; i < USBG_GADGET_ATTR_MAX; ++i) {
+		val = usbg_get_gadget_attr(g, i);
+		if (val < 0)
+			return val;
+
+		ret = usbg_image_add(b, USBG_IMG_GADGET_ATTR, i, 0, val, 0);
+		if (ret != USBG_SUCCESS)
+			return ret;
+	}
+
+	ret = usbg_image_add_gadget_strs(b, g);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	ret = usbg_get_gadget_os_descs(g, &os_descs);
+	if (ret == USBG_SUCCESS) {
+		ret = usbg_image_add_str(b, USBG_IMG_GADGET_OS_DESC,
+					 os_descs.use, NULL, os_descs.qw_sign,
+					 strlen(os_descs.qw_sign));
+		if (ret == USBG_SUCCESS)
+			b->recs[b->nrecs - 1].key = os_descs.b_vendor_code;
+		usbg_free_gadget_os_desc(&os_descs);
+	} else if (ret == USBG_ERROR_NOT_FOUND) {
+		/* OS Descriptors are optional */
+		ret = USBG_SUCCESS;
+	}
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	TAILQ_FOREACH(f, &g->functions, fnode)
+		nfuncs++;
+
+	func_rec = calloc(nfuncs + 1, sizeof(*func_rec));
+	if (!func_rec)
+		return USBG_ERROR_NO_MEM;
+
+	i = 0;
+	TAILQ_FOREACH(f, &g->functions, fnode) {
+		func_rec[i++] = b->nrecs;
+		ret = usbg_image_add_function(b, f);
+		if (ret != USBG_SUCCESS)
+			goto out;
+	}
+
+	TAILQ_FOREACH(c, &g->configs, cnode) {
+		ret = usbg_image_add_config(b, c, func_rec);
+		if (ret != USBG_SUCCESS)
+			goto out;
+	}
+
+	if (g->os_desc_binding) {
+		ret = usbg_image_add_str(b, USBG_IMG_OS_DESC_CONFIG,
+					 g->os_desc_binding->id,
+					 g->os_desc_binding->label, NULL, 0);
+		if (ret != USBG_SUCCESS)
+			goto out;
+	}
+
+	if (g->udc)
+		ret = usbg_image_add_str(b, USBG_IMG_UDC, 0, g->udc->name,
+					 NULL, 0);
+out:
+	free(func_rec);
+	return ret;
+}
+
+static int usbg_image_write(int fd, const void *buf, size_t len)
+{
+	const char *pos = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, pos, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return usbg_translate_error(errno);
+		}
+
+		pos += n;
+		len -= n;
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_image_save(usbg_state *s, usbg_gadget *only, int fd)
+{
+	struct usbg_image_builder b = { 0 };
+	struct usbg_image_hdr hdr = {
+		.magic = USBG_IMAGE_MAGIC,
+		.version = USBG_IMAGE_VERSION,
+	};
+	usbg_gadget *g;
+	int ret = USBG_SUCCESS;
+
+	b.strtab_size = 4096;
+	b.strtab = malloc(b.strtab_size);
+	if (!b.strtab)
+		return USBG_ERROR_NO_MEM;
+
+	b.strtab[0] = '\0';
+	b.strtab_len = 1;
+
+	if (only) {
+		ret = usbg_image_add_gadget(&b, only);
+	} else {
+		TAILQ_FOREACH(g, &s->gadgets, gnode) {
+			ret = usbg_image_add_gadget(&b, g);
+			if (ret != USBG_SUCCESS)
+				break;
+		}
+	}
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	hdr.nrecs = b.nrecs;
+	hdr.strtab_len = b.strtab_len;
+
+	ret = usbg_image_write(fd, &hdr, sizeof(hdr));
+	if (ret == USBG_SUCCESS)
+		ret = usbg_image_write(fd, b.recs, b.nrecs * sizeof(*b.recs));
+	if (ret == USBG_SUCCESS)
+		ret = usbg_image_write(fd, b.strtab, b.strtab_len);
+
+out:
+	free(b.recs);
+	free(b.strtab);
+	return ret;
+}
+
+int usbg_save_image(usbg_state *s, int fd)
+{
+	if (!s || fd < 0)
+		return USBG_ERROR_INVALID_PARAM;
+
+	return usbg_image_save(s, NULL, fd);
+}
+
+int usbg_save_gadget_image(usbg_gadget *g, int fd)
+{
+	if (!g || fd < 0)
+		return USBG_ERROR_INVALID_PARAM;
+
+	return usbg_image_save(g->parent, g, fd);
+}
+
+#define IMG_STR(img, off) ((img)->strtab + (off))
+
+/* Each name becomes single directory in configfs */
+static bool usbg_image_name_is_valid(const usbg_image *img, uint32_t off)
+{
+	const char *name = IMG_STR(img, off);
+
+	return *name && !strchr(name, '/') && strcmp(name, ".") &&
+		strcmp(name, "..");
+}
+
+/*
+ * All offsets are checked once, when image is opened, so restore may
+ * use records without any further checks.
+ */
+static int usbg_image_check(usbg_image *img)
+{
+	const struct usbg_image_rec *rec;
+	uint32_t i, gadget = UINT32_MAX;
+	int scope = 0;
+	int flags;
+
+	if (!img->strtab_len || img->strtab[0] ||
+	    img->strtab[img->strtab_len - 1])
+		return USBG_ERROR_INVALID_FORMAT;
+
+	for (i = 0; i < img->nrecs; ++i) {
+		rec = &img->recs[i];
+		if (rec->type >= USBG_IMG_MAX)
+			return USBG_ERROR_INVALID_FORMAT;
+
+		flags = usbg_image_rec_flags[rec->type];
+		if ((flags & ~(IMG_STR_KEY | IMG_STR_VAL)) & ~scope)
+			return USBG_ERROR_INVALID_FORMAT;
+
+		if ((flags & IMG_STR_KEY) && rec->key >= img->strtab_len)
+			return USBG_ERROR_INVALID_FORMAT;
+
+		if ((flags & IMG_STR_VAL) &&
+		    ((uint64_t)rec->val + rec->len >= img->strtab_len ||
+		     img->strtab[rec->val + rec->len]))
+			return USBG_ERROR_INVALID_FORMAT;
+
+		switch (rec->type) {
+		case USBG_IMG_GADGET:
+			if (!usbg_image_name_is_valid(img, rec->key))
+				return USBG_ERROR_INVALID_FORMAT;
+			gadget = i;
+			scope = IMG_IN_GADGET;
+			break;
+		case USBG_IMG_FUNCTION:
+			if (!usbg_image_name_is_valid(img, rec->val))
+				return USBG_ERROR_INVALID_FORMAT;
+			scope = IMG_IN_GADGET | IMG_IN_FUNCTION;
+			break;
+		case USBG_IMG_FUNCTION_OP:
+			/* Operations stay inside of function directory */
+			if (rec->id == USBG_OP_BIND ||
+			    usbg_check_program_op(rec->id,
+						  IMG_STR(img, rec->key),
+						  IMG_STR(img, rec->val),
+						  rec->len) != USBG_SUCCESS)
+				return USBG_ERROR_INVALID_FORMAT;
+			break;
+		case USBG_IMG_CONFIG:
+			if (!usbg_image_name_is_valid(img, rec->key))
+				return USBG_ERROR_INVALID_FORMAT;
+			scope = IMG_IN_GADGET | IMG_IN_CONFIG;
+			break;
+		case USBG_IMG_BINDING:
+			/* Only functions of the same gadget may be bound */
+			if (!usbg_image_name_is_valid(img, rec->key) ||
+			    rec->val <= gadget || rec->val >= i ||
+			    img->recs[rec->val].type != USBG_IMG_FUNCTION)
+				return USBG_ERROR_INVALID_FORMAT;
+			break;
+		default:
+			if (rec->type != USBG_IMG_FUNCTION_OP)
+				scope &= ~IMG_IN_FUNCTION;
+			break;
+		}
+	}
+
+	return USBG_SUCCESS;
+}
+
+int usbg_open_image_fd(int fd, usbg_image **img)
+{
+	const struct usbg_image_hdr *hdr;
+	usbg_image *new_img;
+	struct stat st;
+	uint64_t size;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (fd < 0 || !img)
+		goto out;
+
+	if (fstat(fd, &st)) {
+		ret = usbg_translate_error(errno);
+		goto out;
+	}
+
+	if (st.st_size < sizeof(*hdr)) {
+		ret = USBG_ERROR_INVALID_FORMAT;
+		goto out;
+	}
+
+	new_img = malloc(sizeof(*new_img));
+	if (!new_img) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	new_img->size = st.st_size;
+	new_img->addr = mmap(NULL, new_img->size, PROT_READ, MAP_PRIVATE,
+			     fd, 0);
+	if (new_img->addr == MAP_FAILED) {
+		ret = usbg_translate_error(errno);
+		goto free_img;
+	}
+
+	hdr = new_img->addr;
+	size = sizeof(*hdr) + (uint64_t)hdr->nrecs * sizeof(struct usbg_image_rec)
+		+ hdr->strtab_len;
+	if (hdr->magic != USBG_IMAGE_MAGIC ||
+	    hdr->version != USBG_IMAGE_VERSION || size != new_img->size) {
+		ret = USBG_ERROR_INVALID_FORMAT;
+		goto unmap;
+	}
+
+	new_img->recs = (const struct usbg_image_rec *)(hdr + 1);
+	new_img->nrecs = hdr->nrecs;
+	new_img->strtab = (const char *)(new_img->recs + hdr->nrecs);
+	new_img->strtab_len = hdr->strtab_len;
+
+	ret = usbg_image_check(new_img);
+	if (ret != USBG_SUCCESS)
+		goto unmap;
+
+	*img = new_img;
+	return USBG_SUCCESS;
+
+unmap:
+	munmap(new_img->addr, new_img->size);
+free_img:
+	free(new_img);
+out:
+	return ret;
+}
+
+int usbg_open_image(const char *file, usbg_image **img)
+{
+	int fd;
+	int ret;
+
+	if (!file || !img)
+		return USBG_ERROR_INVALID_PARAM;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return usbg_translate_error(errno);
+
+	ret = usbg_open_image_fd(fd, img);
+	close(fd);
+
+	return ret;
+}
+
+void usbg_close_image(usbg_image *img)
+{
+	if (!img)
+		return;
+
+	munmap(img->addr, img->size);
+	free(img);
+}
+
+int usbg_get_image_gadget_count(usbg_image *img)
+{
+	uint32_t i;
+	int n = 0;
+
+	if (!img)
+		return USBG_ERROR_INVALID_PARAM;
+
+	for (i = 0; i < img->nrecs; ++i)
+		if (img->recs[i].type == USBG_IMG_GADGET)
+			n++;
+
+	return n;
+}
+
+/* Consecutive FUNCTION_OP records are applied at once */
+static int usbg_image_restore_function(usbg_image *img, uint32_t *i,
+				       usbg_function *f)
+{
+	char fpath[USBG_MAX_PATH_LENGTH];
+	struct usbg_program_op *ops;
+	const struct usbg_image_rec *rec;
+	int n, nmb, ret;
+
+	for (n = 0; *i + n + 1 < img->nrecs; ++n)
+		if (img->recs[*i + n + 1].type != USBG_IMG_FUNCTION_OP)
+			break;
+
+	if (!n)
+		return USBG_SUCCESS;
+
+	nmb = snprintf(fpath, sizeof(fpath), "%s/%s", f->path, f->name);
+	if (nmb >= sizeof(fpath))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	ops = malloc(n * sizeof(*ops));
+	if (!ops)
+		return USBG_ERROR_NO_MEM;
+
+	for (nmb = 0; nmb < n; ++nmb) {
+		rec = &img->recs[*i + nmb + 1];
+		ops[nmb].type = rec->id;
+		/* Ops are only read, so they may point into the image */
+		ops[nmb].path = (char *)IMG_STR(img, rec->key);
+		ops[nmb].data = (char *)IMG_STR(img, rec->val);
+		ops[nmb].len = rec->len;
+	}
+
+	ret = usbg_apply_program_ops(usbg_function_io(f), fpath, ops, n);
+	free(ops);
+	*i += n;
+
+	return ret;
+}
+
+static int usbg_image_restore_rec(usbg_state *s, usbg_image *img,
+				  uint32_t *i, int flags, usbg_gadget *g,
+				  usbg_config **c)
+{
+	const struct usbg_image_rec *rec = &img->recs[*i];
+	const struct usbg_image_rec *frec;
+	struct usbg_gadget_os_descs os_descs;
+	struct usbg_config_attrs c_attrs;
+	usbg_function *f;
+	usbg_config *os_c;
+	usbg_udc *u;
+	int type;
+	int ret = USBG_SUCCESS;
+
+	switch (rec->type) {
+	case USBG_IMG_GADGET_ATTR:
+		ret = usbg_set_gadget_attr(g, rec->id, rec->val);
+		break;
+	case USBG_IMG_GADGET_STR:
+		ret = usbg_set_gadget_str(g, rec->key, rec->id,
+					  IMG_STR(img, rec->val));
+		break;
+	case USBG_IMG_GADGET_OS_DESC:
+		os_descs.use = rec->id;
+		os_descs.b_vendor_code = rec->key;
+		os_descs.qw_sign = (char *)IMG_STR(img, rec->val);
+		ret = usbg_set_gadget_os_descs(g, &os_descs);
+		break;
+	case USBG_IMG_FUNCTION:
+		type = usbg_lookup_function_type(IMG_STR(img, rec->key));
+		if (type < 0) {
+			ret = USBG_ERROR_NOT_SUPPORTED;
+			break;
+		}
+
+		ret = usbg_create_function(g, type, IMG_STR(img, rec->val),
+					   NULL, &f);
+		if (ret == USBG_SUCCESS)
+			ret = usbg_image_restore_function(img, i, f);
+		break;
+	case USBG_IMG_CONFIG:
+		ret = usbg_create_config(g, rec->id, IMG_STR(img, rec->key),
+					 NULL, NULL, c);
+		break;
+	case USBG_IMG_CONFIG_ATTR:
+		c_attrs.bmAttributes = rec->key;
+		c_attrs.bMaxPower = rec->val;
+		ret = usbg_set_config_attrs(*c, &c_attrs);
+		break;
+	case USBG_IMG_CONFIG_STR:
+		ret = usbg_set_config_string(*c, rec->id,
+					     IMG_STR(img, rec->val));
+		break;
+	case USBG_IMG_BINDING:
+		frec = &img->recs[rec->val];
+		type = usbg_lookup_function_type(IMG_STR(img, frec->key));
+		f = usbg_get_function(g, type, IMG_STR(img, frec->val));
+		ret = f ? usbg_add_config_function(*c, IMG_STR(img, rec->key), f)
+			: USBG_ERROR_NOT_FOUND;
+		break;
+	case USBG_IMG_OS_DESC_CONFIG:
+		os_c = usbg_get_config(g, rec->id, IMG_STR(img, rec->key));
+		ret = os_c ? usbg_set_os_desc_config(g, os_c)
+			: USBG_ERROR_NOT_FOUND;
+		break;
+	case USBG_IMG_UDC:
+		if (!(flags & USBG_IMAGE_BIND))
+			break;
+
+		u = usbg_get_udc(s, IMG_STR(img, rec->key));
+		ret = u ? usbg_enable_gadget(g, u) : USBG_ERROR_NO_DEV;
+		break;
+	default:
+		ret = USBG_ERROR_INVALID_FORMAT;
+		break;
+	}
+
+	return ret;
+}
+
+int usbg_restore_image(usbg_state *s, usbg_image *img, int flags)
+{
+	usbg_gadget **restored;
+	usbg_gadget *g = NULL;
+	usbg_config *c = NULL;
+	const struct usbg_image_rec *rec;
+	int n = 0, ngadgets;
+	uint32_t i;
+	int ret = USBG_SUCCESS;
+
+	if (!s || !img)
+		return USBG_ERROR_INVALID_PARAM;
+
+	ngadgets = usbg_get_image_gadget_count(img);
+	restored = calloc(ngadgets + 1, sizeof(*restored));
+	if (!restored)
+		return USBG_ERROR_NO_MEM;
+
+	for (i = 0; i < img->nrecs && ret == USBG_SUCCESS; ++i) {
+		rec = &img->recs[i];
+		if (rec->type == USBG_IMG_GADGET) {
+			ret = usbg_create_gadget(s, IMG_STR(img, rec->key),
+						 NULL, NULL, &g);
+			if (ret == USBG_SUCCESS)
+				restored[n++] = g;
+		} else {
+			ret = usbg_image_restore_rec(s, img, &i, flags, g, &c);
+		}
+	}
+
+	/* Image is restored completely or not at all */
+	if (ret != USBG_SUCCESS)
+		while (n--)
+			usbg_rm_gadget(restored[n], USBG_RM_RECURSE);
+
+	free(restored);
+	return ret;
+}
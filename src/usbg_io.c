@@ -0,0 +1,301 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * @file usbg_io.c
+ * @brief Dispatch of filesystem operations to backends.
+ * @details Each state carries its backend and counters, and passes
+ * them down with the paths it touches, so states on the same directory
+ * or on different backends don't know about each other and there is
+ * nothing to lock here.
+ */
+
+static int posix_read(void *priv, const char *path, char *buf, int len)
+{
+	FILE *fp;
+	int ret;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return usbg_translate_error(errno);
+
+	ret = (int)fread(buf, sizeof(char), len, fp);
+	if (ret < len && ferror(fp))
+		ret = USBG_ERROR_IO;
+
+	fclose(fp);
+
+	return ret;
+}
+
+static int posix_write(void *priv, const char *path, const char *buf, int len)
+{
+	FILE *fp;
+	int nmb;
+	int ret;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return usbg_translate_error(errno);
+
+	nmb = fwrite(buf, sizeof(char), len, fp);
+	if (nmb < len) {
+		if (ferror(fp))
+			nmb = usbg_translate_error(errno);
+		else
+			nmb = USBG_ERROR_IO;
+	}
+
+	ret = fclose(fp);
+	if (ret < 0)
+		ret = usbg_translate_error(errno);
+	else
+		ret = nmb;
+
+	return ret;
+}
+
+static int posix_scandir(void *priv, const char *path,
+			 struct dirent ***namelist,
+			 int (*filter)(const struct dirent *),
+			 int (*compar)(const struct dirent **,
+				       const struct dirent **))
+{
+	return scandir(path, namelist, filter, compar);
+}
+
+static int posix_is_dir(void *priv, const char *path)
+{
+	DIR *dir;
+
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	closedir(dir);
+	return 0;
+}
+
+static int posix_mkdir(void *priv, const char *path, mode_t mode)
+{
+	return mkdir(path, mode);
+}
+
+static int posix_rmdir(void *priv, const char *path)
+{
+	return rmdir(path);
+}
+
+static int posix_unlink(void *priv, const char *path)
+{
+	return unlink(path);
+}
+
+static int posix_symlink(void *priv, const char *target, const char *path)
+{
+	return symlink(target, path);
+}
+
+static ssize_t posix_readlink(void *priv, const char *path, char *buf,
+			      size_t len)
+{
+	return readlink(path, buf, len);
+}
+
+static int posix_lstat(void *priv, const char *path, struct stat *st)
+{
+	return lstat(path, st);
+}
+
+static int posix_stat(void *priv, const char *path, struct stat *st)
+{
+	return stat(path, st);
+}
+
+const struct usbg_io_ops usbg_posix_ops = {
+	.read = posix_read,
+	.write = posix_write,
+	.scandir = posix_scandir,
+	.is_dir = posix_is_dir,
+	.mkdir = posix_mkdir,
+	.rmdir = posix_rmdir,
+	.unlink = posix_unlink,
+	.symlink = posix_symlink,
+	.readlink = posix_readlink,
+	.lstat = posix_lstat,
+	.stat = posix_stat,
+};
+
+static void usbg_io_account(const struct usbg_io *io, usbg_stat_syscall sc,
+			    uint64_t bytes_read, uint64_t bytes_written)
+{
+	struct usbg_stats *stats = io->stats;
+
+	if (!stats)
+		return;
+
+	usbg_stats_add(&stats->syscalls[sc], 1);
+	if (sc == USBG_STAT_READ || sc == USBG_STAT_WRITE)
+		usbg_stats_add(&stats->syscalls[USBG_STAT_OPEN], 1);
+	if (bytes_read)
+		usbg_stats_add(&stats->bytes_read, bytes_read);
+	if (bytes_written)
+		usbg_stats_add(&stats->bytes_written, bytes_written);
+}
+
+int usbg_io_read(const struct usbg_io *io, const char *path, char *buf,
+		 int len)
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "read", path);
+	ret = io->ops->read(io->priv, path, buf, len);
+	USBG_PROBE(io__return, "read", path, ret);
+	usbg_io_account(io, USBG_STAT_READ, ret > 0 ? ret : 0, 0);
+
+	return ret;
+}
+
+int usbg_io_write(const struct usbg_io *io, const char *path,
+		  const char *buf, int len)
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "write", path);
+	ret = io->ops->write(io->priv, path, buf, len);
+	USBG_PROBE(io__return, "write", path, ret);
+	usbg_io_account(io, USBG_STAT_WRITE, 0, ret > 0 ? ret : 0);
+
+	return ret;
+}
+
+int usbg_io_scandir(const struct usbg_io *io, const char *path,
+		    struct dirent ***namelist,
+		    int (*filter)(const struct dirent *),
+		    int (*compar)(const struct dirent **,
+				  const struct dirent **))
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "scandir", path);
+	ret = io->ops->scandir(io->priv, path, namelist, filter, compar);
+	USBG_PROBE(io__return, "scandir", path, ret);
+	usbg_io_account(io, USBG_STAT_SCANDIR, 0, 0);
+
+	return ret;
+}
+
+int usbg_io_is_dir(const struct usbg_io *io, const char *path)
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "is_dir", path);
+	ret = io->ops->is_dir(io->priv, path);
+	USBG_PROBE(io__return, "is_dir", path, ret);
+	usbg_io_account(io, USBG_STAT_OPEN, 0, 0);
+
+	return ret;
+}
+
+int usbg_io_mkdir(const struct usbg_io *io, const char *path, mode_t mode)
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "mkdir", path);
+	ret = io->ops->mkdir(io->priv, path, mode);
+	USBG_PROBE(io__return, "mkdir", path, ret);
+	usbg_io_account(io, USBG_STAT_MKDIR, 0, 0);
+
+	return ret;
+}
+
+int usbg_io_rmdir(const struct usbg_io *io, const char *path)
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "rmdir", path);
+	ret = io->ops->rmdir(io->priv, path);
+	USBG_PROBE(io__return, "rmdir", path, ret);
+	usbg_io_account(io, USBG_STAT_RMDIR, 0, 0);
+
+	return ret;
+}
+
+int usbg_io_unlink(const struct usbg_io *io, const char *path)
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "unlink", path);
+	ret = io->ops->unlink(io->priv, path);
+	USBG_PROBE(io__return, "unlink", path, ret);
+	usbg_io_account(io, USBG_STAT_UNLINK, 0, 0);
+
+	return ret;
+}
+
+int usbg_io_symlink(const struct usbg_io *io, const char *target,
+		    const char *path)
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "symlink", path);
+	ret = io->ops->symlink(io->priv, target, path);
+	USBG_PROBE(io__return, "symlink", path, ret);
+	usbg_io_account(io, USBG_STAT_SYMLINK, 0, 0);
+
+	return ret;
+}
+
+ssize_t usbg_io_readlink(const struct usbg_io *io, const char *path,
+			 char *buf, size_t len)
+{
+	ssize_t ret;
+
+	USBG_PROBE(io__entry, "readlink", path);
+	ret = io->ops->readlink(io->priv, path, buf, len);
+	USBG_PROBE(io__return, "readlink", path, ret);
+	usbg_io_account(io, USBG_STAT_READLINK, 0, 0);
+
+	return ret;
+}
+
+int usbg_io_lstat(const struct usbg_io *io, const char *path, struct stat *st)
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "lstat", path);
+	ret = io->ops->lstat(io->priv, path, st);
+	USBG_PROBE(io__return, "lstat", path, ret);
+	usbg_io_account(io, USBG_STAT_STAT, 0, 0);
+
+	return ret;
+}
+
+int usbg_io_stat(const struct usbg_io *io, const char *path, struct stat *st)
+{
+	int ret;
+
+	USBG_PROBE(io__entry, "stat", path);
+	ret = io->ops->stat(io->priv, path, st);
+	USBG_PROBE(io__return, "stat", path, ret);
+	usbg_io_account(io, USBG_STAT_STAT, 0, 0);
+
+	return ret;
+}
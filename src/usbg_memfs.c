@@ -0,0 +1,1487 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @file usbg_memfs.c
+ * @brief In-memory emulation of gadget configfs and UDC class in sysfs.
+ * @details Only the rules which libusbgx relies on are emulated:
+ * mkdir creates attributes and default groups of the new item, default
+ * groups cannot be removed, items with children, links or bound UDC
+ * cannot be removed, and links are allowed only from configs to
+ * functions and from os_desc to configs of the same gadget. Names of
+ * network interfaces are checked on write like kernel does and they
+ * are assigned when gadget is bound for the first time. UVC
+ * streaming and control trees are not validated, anything can be
+ * created inside of them.
+ */
+
+/* Below /dev/null, so it is never a path on real filesystem */
+#define MEMFS_ROOT "/dev/null/usbg-memfs"
+#define MEMFS_CONFIGFS "config"
+#define MEMFS_UDC_CLASS "sys/class/udc"
+#define MEMFS_MAX_LINKS 8
+/* IFNAMSIZ, including terminating null byte */
+#define MEMFS_IFNAMSIZ 16
+/* Read from ifname until network interface is registered */
+#define MEMFS_UNNAMED_NETDEV "(unnamed net_device)\n"
+
+enum memfs_type {
+	MEMFS_DIR,
+	MEMFS_FILE,
+	MEMFS_LINK,
+};
+
+/* Decides what mkdir and symlink may create in given directory */
+enum memfs_kind {
+	MEMFS_PLAIN,
+	MEMFS_GADGETS,
+	MEMFS_GADGET,
+	MEMFS_GADGET_STRINGS,
+	MEMFS_CONFIGS,
+	MEMFS_CONFIG,
+	MEMFS_CONFIG_STRINGS,
+	MEMFS_FUNCTIONS,
+	MEMFS_FUNCTION,
+	MEMFS_OS_DESC,
+	MEMFS_FREEFORM,
+};
+
+struct memfs_node
+{
+	char *name;
+	enum memfs_type type;
+	enum memfs_kind kind;
+	/* Created by kernel, cannot be removed by user */
+	bool builtin;
+	mode_t mode;
+	/* Content of file or target of link */
+	char *data;
+	int len;
+	/* Resolved target of link */
+	struct memfs_node *target;
+	/* Number of links pointing to this node */
+	int nlinks;
+	ino_t ino;
+
+	struct memfs_node *parent;
+	TAILQ_ENTRY(memfs_node) node;
+	TAILQ_HEAD(memfs_head, memfs_node) children;
+};
+
+struct usbg_memfs
+{
+	/* Operations may come from many threads, eg. usbg_create_functions */
+	pthread_mutex_t lock;
+	char *root;
+	size_t root_len;
+	struct memfs_node *top;
+	struct memfs_node *udcs;
+	ino_t next_ino;
+	/* Number given to the next registered network interface */
+	int next_netdev;
+	/* States using this filesystem and its creator */
+	int refs;
+};
+
+struct memfs_attr
+{
+	const char *name;
+	const char *val;
+	mode_t mode;
+};
+
+#define RW (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+#define RO (S_IRUSR | S_IRGRP | S_IROTH)
+#define WO (S_IWUSR)
+
+static const struct memfs_attr gadget_attrs[] = {
+	{ "bcdUSB", "0x0200\n", RW },
+	{ "bDeviceClass", "0x00\n", RW },
+	{ "bDeviceSubClass", "0x00\n", RW },
+	{ "bDeviceProtocol", "0x00\n", RW },
+	{ "bMaxPacketSize0", "0x40\n", RW },
+	{ "idVendor", "0x0000\n", RW },
+	{ "idProduct", "0x0000\n", RW },
+	{ "bcdDevice", "0x0000\n", RW },
+	{ "max_speed", "super-speed-plus\n", RW },
+	{ "UDC", "\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr gadget_strs_attrs[] = {
+	{ "manufacturer", "\n", RW },
+	{ "product", "\n", RW },
+	{ "serialnumber", "\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr os_desc_attrs[] = {
+	{ "use", "0\n", RW },
+	{ "b_vendor_code", "0x00\n", RW },
+	{ "qw_sign", "MSFT100\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr config_attrs[] = {
+	{ "MaxPower", "2\n", RW },
+	{ "bmAttributes", "0x80\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr config_strs_attrs[] = {
+	{ "configuration", "\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr interf_os_desc_attrs[] = {
+	{ "compatible_id", "", RW },
+	{ "sub_compatible_id", "", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr udc_attrs[] = {
+	{ "maximum_speed", "super-speed\n", RO },
+	{ "current_speed", "UNKNOWN\n", RO },
+	{ "state", "not attached\n", RO },
+	{ "function", "", RO },
+	{ "soft_connect", "", WO },
+	{ NULL }
+};
+
+static const struct memfs_attr serial_attrs[] = {
+	{ "port_num", "0\n", RO },
+	{ NULL }
+};
+
+static const struct memfs_attr net_attrs[] = {
+	{ "dev_addr", "02:00:00:00:00:01\n", RW },
+	{ "host_addr", "02:00:00:00:00:02\n", RW },
+	{ "ifname", MEMFS_UNNAMED_NETDEV, RW },
+	{ "qmult", "5\n", RW },
+	{ "class_", "2\n", RW },
+	{ "subclass", "6\n", RW },
+	{ "protocol", "0\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr phonet_attrs[] = {
+	{ "ifname", "upnlink0\n", RO },
+	{ NULL }
+};
+
+static const struct memfs_attr midi_attrs[] = {
+	{ "index", "-1\n", RW },
+	{ "id", "\n", RW },
+	{ "in_ports", "1\n", RW },
+	{ "out_ports", "1\n", RW },
+	{ "buflen", "512\n", RW },
+	{ "qlen", "32\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr ms_attrs[] = {
+	{ "stall", "1\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr ms_lun_attrs[] = {
+	{ "cdrom", "0\n", RW },
+	{ "ro", "0\n", RW },
+	{ "nofua", "0\n", RW },
+	{ "removable", "0\n", RW },
+	{ "file", "\n", RW },
+	{ "inquiry_string", "\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr loopback_attrs[] = {
+	{ "buflen", "4096\n", RW },
+	{ "qlen", "32\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr hid_attrs[] = {
+	{ "dev", "0:0\n", RO },
+	{ "protocol", "0\n", RW },
+	{ "report_desc", "", RW },
+	{ "report_length", "0\n", RW },
+	{ "subclass", "0\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr uac2_attrs[] = {
+	{ "c_chmask", "3\n", RW },
+	{ "c_srate", "64000\n", RW },
+	{ "c_ssize", "2\n", RW },
+	{ "p_chmask", "3\n", RW },
+	{ "p_srate", "48000\n", RW },
+	{ "p_ssize", "2\n", RW },
+	{ "p_hs_bint", "1\n", RW },
+	{ "c_hs_bint", "1\n", RW },
+	{ "c_sync", "asynchronous\n", RW },
+	{ "req_number", "2\n", RW },
+	{ "fb_max", "5\n", RW },
+	{ "p_mute_present", "1\n", RW },
+	{ "p_volume_present", "1\n", RW },
+	{ "p_volume_min", "-25600\n", RW },
+	{ "p_volume_max", "0\n", RW },
+	{ "p_volume_res", "128\n", RW },
+	{ "c_mute_present", "1\n", RW },
+	{ "c_volume_present", "1\n", RW },
+	{ "c_volume_min", "-25600\n", RW },
+	{ "c_volume_max", "0\n", RW },
+	{ "c_volume_res", "128\n", RW },
+	{ "function_name", "Source/Sink\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr uvc_attrs[] = {
+	{ "streaming_maxburst", "0\n", RW },
+	{ "streaming_maxpacket", "1024\n", RW },
+	{ "streaming_interval", "1\n", RW },
+	{ "function_name", "UVC Camera\n", RW },
+	{ NULL }
+};
+
+/* Defaults of frame created by mkdir in format group */
+static const struct memfs_attr uvc_frame_attrs[] = {
+	{ "bFrameIndex", "1\n", RW },
+	{ "bmCapabilities", "0\n", RW },
+	{ "dwMinBitRate", "18432000\n", RW },
+	{ "dwMaxBitRate", "55296000\n", RW },
+	{ "dwMaxVideoFrameBufferSize", "460800\n", RW },
+	{ "dwDefaultFrameInterval", "666666\n", RW },
+	{ "dwFrameInterval", "666666\n", RW },
+	{ "wWidth", "640\n", RW },
+	{ "wHeight", "360\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr printer_attrs[] = {
+	{ "pnp_string", "\n", RW },
+	{ "q_len", "10\n", RW },
+	{ NULL }
+};
+
+static const struct memfs_attr no_attrs[] = {
+	{ NULL }
+};
+
+static const char *uvc_groups[] = {
+	"control/header",
+	"control/class/fs",
+	"control/class/ss",
+	"control/terminal/camera/default",
+	"control/terminal/output/default",
+	"control/processing/default",
+	"streaming/header",
+	"streaming/uncompressed",
+	"streaming/mjpeg",
+	"streaming/class/fs",
+	"streaming/class/hs",
+	"streaming/class/ss",
+	"streaming/color_matching/default",
+	NULL
+};
+
+static const struct {
+	const char *name;
+	const struct memfs_attr *attrs;
+} memfs_ftypes[] = {
+	{ "gser", serial_attrs },
+	{ "acm", serial_attrs },
+	{ "obex", serial_attrs },
+	{ "ecm", net_attrs },
+	{ "geth", net_attrs },
+	{ "ncm", net_attrs },
+	{ "eem", net_attrs },
+	{ "rndis", net_attrs },
+	{ "phonet", phonet_attrs },
+	{ "ffs", no_attrs },
+	{ "mass_storage", ms_attrs },
+	{ "midi", midi_attrs },
+	{ "Loopback", loopback_attrs },
+	{ "hid", hid_attrs },
+	{ "uac2", uac2_attrs },
+	{ "uvc", uvc_attrs },
+	{ "printer", printer_attrs },
+	{ "usb9pfs", no_attrs },
+};
+
+static struct memfs_node *memfs_add(struct usbg_memfs *fs,
+				    struct memfs_node *parent,
+				    const char *name, size_t len,
+				    enum memfs_type type, enum memfs_kind kind)
+{
+	struct memfs_node *n;
+
+	n = calloc(1, sizeof(*n));
+	if (!n)
+		return NULL;
+
+	n->name = strndup(name, len);
+	if (!n->name) {
+		free(n);
+		return NULL;
+	}
+
+	n->type = type;
+	n->kind = kind;
+	n->mode = type == MEMFS_FILE ? RW : S_IRWXU | S_IRGRP | S_IXGRP |
+		S_IROTH | S_IXOTH;
+	n->ino = ++fs->next_ino;
+	n->parent = parent;
+	TAILQ_INIT(&n->children);
+	if (parent)
+		TAILQ_INSERT_TAIL(&parent->children, n, node);
+
+	return n;
+}
+
+static void memfs_free(struct memfs_node *n)
+{
+	struct memfs_node *c;
+
+	while (!TAILQ_EMPTY(&n->children)) {
+		c = TAILQ_FIRST(&n->children);
+		TAILQ_REMOVE(&n->children, c, node);
+		memfs_free(c);
+	}
+
+	if (n->target)
+		n->target->nlinks--;
+	free(n->data);
+	free(n->name);
+	free(n);
+}
+
+static int memfs_set_data(struct memfs_node *n, const char *data, int len)
+{
+	char *buf;
+
+	buf = malloc(len + 1);
+	if (!buf)
+		return -ENOMEM;
+
+	memcpy(buf, data, len);
+	buf[len] = '\0';
+	free(n->data);
+	n->data = buf;
+	n->len = len;
+
+	return 0;
+}
+
+static int memfs_add_attrs(struct usbg_memfs *fs, struct memfs_node *dir,
+			   const struct memfs_attr *attrs)
+{
+	struct memfs_node *n;
+
+	for (; attrs->name; ++attrs) {
+		n = memfs_add(fs, dir, attrs->name, strlen(attrs->name),
+			      MEMFS_FILE, MEMFS_PLAIN);
+		if (!n || memfs_set_data(n, attrs->val, strlen(attrs->val)))
+			return -ENOMEM;
+
+		n->builtin = true;
+		n->mode = attrs->mode;
+	}
+
+	return 0;
+}
+
+/* Default group, with all missing parents */
+static struct memfs_node *memfs_add_group(struct usbg_memfs *fs,
+					  struct memfs_node *dir,
+					  const char *path,
+					  enum memfs_kind kind)
+{
+	struct memfs_node *n, *c;
+	const char *end;
+	size_t len;
+
+	for (n = dir; *path; path = *end ? end + 1 : end, n = c) {
+		end = strchrnul(path, '/');
+		len = end - path;
+
+		TAILQ_FOREACH(c, &n->children, node)
+			if (strlen(c->name) == len && !strncmp(c->name, path, len))
+				break;
+		if (c)
+			continue;
+
+		c = memfs_add(fs, n, path, len, MEMFS_DIR, kind);
+		if (!c)
+			return NULL;
+		c->builtin = true;
+	}
+
+	return n;
+}
+
+static struct memfs_node *memfs_child(struct memfs_node *dir,
+				      const char *name, size_t len)
+{
+	struct memfs_node *c;
+
+	TAILQ_FOREACH(c, &dir->children, node)
+		if (!strncmp(c->name, name, len) && c->name[len] == '\0')
+			return c;
+
+	return NULL;
+}
+
+static struct memfs_node *memfs_lookup(struct usbg_memfs *fs,
+				       const char *path, bool follow,
+				       int depth)
+{
+	struct memfs_node *n, *c;
+	const char *p, *end;
+	size_t len;
+
+	if (strncmp(path, fs->root, fs->root_len) ||
+	    (path[fs->root_len] != '/' && path[fs->root_len] != '\0')) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	n = fs->top;
+	for (p = path + fs->root_len; *p; p = end) {
+		while (*p == '/')
+			++p;
+		if (!*p)
+			break;
+
+		if (n->type != MEMFS_DIR) {
+			errno = ENOTDIR;
+			return NULL;
+		}
+
+		end = strchrnul(p, '/');
+		len = end - p;
+		if (len == 1 && *p == '.') {
+			continue;
+		} else if (len == 2 && !strncmp(p, "..", 2)) {
+			if (n->parent)
+				n = n->parent;
+			continue;
+		}
+
+		c = memfs_child(n, p, len);
+		if (!c) {
+			errno = ENOENT;
+			return NULL;
+		}
+		n = c;
+
+		/* Links in the middle of path are always followed */
+		if (n->type == MEMFS_LINK && (follow || end[strspn(end, "/")])) {
+			if (depth >= MEMFS_MAX_LINKS) {
+				errno = ELOOP;
+				return NULL;
+			}
+
+			n = memfs_lookup(fs, n->data, true, depth + 1);
+			if (!n)
+				return NULL;
+		}
+	}
+
+	return n;
+}
+
+/* Directory in which path is to be created and name of the new entry */
+static struct memfs_node *memfs_lookup_parent(struct usbg_memfs *fs,
+					      const char *path,
+					      const char **name, size_t *len)
+{
+	char buf[USBG_MAX_PATH_LENGTH];
+	struct memfs_node *dir;
+	char *slash;
+	size_t plen;
+
+	plen = strlen(path);
+	while (plen > 1 && path[plen - 1] == '/')
+		--plen;
+	if (plen >= sizeof(buf)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	memcpy(buf, path, plen);
+	buf[plen] = '\0';
+
+	slash = strrchr(buf, '/');
+	if (!slash || slash[1] == '\0' || !strcmp(slash + 1, ".") ||
+	    !strcmp(slash + 1, "..") || plen <= fs->root_len) {
+		/* Root of emulated filesystem and its parents */
+		errno = EEXIST;
+		return NULL;
+	}
+
+	*slash = '\0';
+	dir = memfs_lookup(fs, buf, true, 0);
+	if (!dir)
+		return NULL;
+
+	if (dir->type != MEMFS_DIR) {
+		errno = ENOTDIR;
+		return NULL;
+	}
+
+	*name = path + (slash + 1 - buf);
+	*len = plen - (slash + 1 - buf);
+
+	return dir;
+}
+
+static struct memfs_node *memfs_ancestor(struct memfs_node *n,
+					 enum memfs_kind kind)
+{
+	while (n && n->kind != kind)
+		n = n->parent;
+
+	return n;
+}
+
+static int memfs_mkdir_gadget(struct usbg_memfs *fs, struct memfs_node *g)
+{
+	struct memfs_node *n;
+
+	if (memfs_add_attrs(fs, g, gadget_attrs) ||
+	    !memfs_add_group(fs, g, CONFIGS_DIR, MEMFS_CONFIGS) ||
+	    !memfs_add_group(fs, g, FUNCTIONS_DIR, MEMFS_FUNCTIONS) ||
+	    !memfs_add_group(fs, g, STRINGS_DIR, MEMFS_GADGET_STRINGS))
+		return -ENOMEM;
+
+	n = memfs_add_group(fs, g, OS_DESC_DIR, MEMFS_OS_DESC);
+	if (!n || memfs_add_attrs(fs, n, os_desc_attrs))
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int memfs_mkdir_lang(struct usbg_memfs *fs, struct memfs_node *dir,
+			    const char *name,
+			    const struct memfs_attr *attrs)
+{
+	unsigned long lang;
+	char *end;
+
+	lang = strtoul(name, &end, 0);
+	if (*end || end == name || !lang || lang > 0xffff)
+		return -EINVAL;
+
+	return memfs_add_attrs(fs, dir, attrs);
+}
+
+static int memfs_mkdir_config(struct usbg_memfs *fs, struct memfs_node *c,
+			      const char *name)
+{
+	const char *dot;
+	unsigned long id;
+	char *end;
+
+	/* label.number, number is bConfigurationValue */
+	dot = strrchr(name, '.');
+	if (!dot || dot == name)
+		return -EINVAL;
+
+	id = strtoul(dot + 1, &end, 10);
+	if (*end || end == dot + 1 || !id || id > 255)
+		return -EINVAL;
+
+	if (memfs_add_attrs(fs, c, config_attrs) ||
+	    !memfs_add_group(fs, c, STRINGS_DIR, MEMFS_CONFIG_STRINGS))
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int memfs_mkdir_function(struct usbg_memfs *fs, struct memfs_node *f,
+				const char *name)
+{
+	struct memfs_node *n;
+	const char *dot;
+	size_t len;
+	int i;
+	int ret;
+
+	/* type.instance */
+	dot = strchr(name, '.');
+	if (!dot || dot == name || !dot[1])
+		return -EINVAL;
+
+	len = dot - name;
+	for (i = 0; i < ARRAY_SIZE(memfs_ftypes); ++i)
+		if (strlen(memfs_ftypes[i].name) == len &&
+		    !strncmp(memfs_ftypes[i].name, name, len))
+			break;
+
+	/* Kernel has no module providing such function */
+	if (i == ARRAY_SIZE(memfs_ftypes))
+		return -ENOENT;
+
+	ret = memfs_add_attrs(fs, f, memfs_ftypes[i].attrs);
+	if (ret)
+		return ret;
+
+	if (!strcmp(memfs_ftypes[i].name, "mass_storage")) {
+		n = memfs_add_group(fs, f, "lun.0", MEMFS_PLAIN);
+		if (!n || memfs_add_attrs(fs, n, ms_lun_attrs))
+			return -ENOMEM;
+	} else if (!strcmp(memfs_ftypes[i].name, "uvc")) {
+		for (i = 0; uvc_groups[i]; ++i)
+			if (!memfs_add_group(fs, f, uvc_groups[i],
+					     MEMFS_FREEFORM))
+				return -ENOMEM;
+	} else if (!strcmp(memfs_ftypes[i].name, "ncm") ||
+		   !strcmp(memfs_ftypes[i].name, "rndis")) {
+		char iname[USBG_MAX_NAME_LENGTH];
+
+		snprintf(iname, sizeof(iname), OS_DESC_DIR "/interface.%s",
+			 memfs_ftypes[i].name);
+		n = memfs_add_group(fs, f, iname, MEMFS_PLAIN);
+		if (!n || memfs_add_attrs(fs, n, interf_os_desc_attrs))
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int memfs_mkdir_lun(struct usbg_memfs *fs, struct memfs_node *dir,
+			   const char *name)
+{
+	unsigned long id;
+	char *end;
+
+	if (strncmp(name, "lun.", 4))
+		return -EINVAL;
+
+	id = strtoul(name + 4, &end, 10);
+	if (*end || end == name + 4 || id >= 16)
+		return -EINVAL;
+
+	return memfs_add_attrs(fs, dir, ms_lun_attrs);
+}
+
+static int memfs_mkdir(void *priv, const char *path, mode_t mode)
+{
+	struct usbg_memfs *fs = priv;
+	struct memfs_node *dir, *n;
+	enum memfs_kind kind;
+	const char *name;
+	size_t len;
+	int ret = 0;
+
+	pthread_mutex_lock(&fs->lock);
+
+	dir = memfs_lookup_parent(fs, path, &name, &len);
+	if (!dir) {
+		ret = -errno;
+		goto out;
+	}
+
+	if (memfs_child(dir, name, len)) {
+		ret = -EEXIST;
+		goto out;
+	}
+
+	switch (dir->kind) {
+	case MEMFS_GADGETS:
+		kind = MEMFS_GADGET;
+		break;
+	case MEMFS_CONFIGS:
+		kind = MEMFS_CONFIG;
+		break;
+	case MEMFS_FUNCTIONS:
+		kind = MEMFS_FUNCTION;
+		break;
+	case MEMFS_FREEFORM:
+		kind = MEMFS_FREEFORM;
+		break;
+	case MEMFS_GADGET_STRINGS:
+	case MEMFS_CONFIG_STRINGS:
+		kind = MEMFS_PLAIN;
+		break;
+	case MEMFS_FUNCTION:
+		/* Only mass storage has user created groups */
+		if (!strncmp(dir->name, "mass_storage.", 13)) {
+			kind = MEMFS_PLAIN;
+			break;
+		}
+		/* fallthrough */
+	default:
+		ret = -EPERM;
+		goto out;
+	}
+
+	n = memfs_add(fs, dir, name, len, MEMFS_DIR, kind);
+	if (!n) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	switch (dir->kind) {
+	case MEMFS_GADGETS:
+		ret = memfs_mkdir_gadget(fs, n);
+		break;
+	case MEMFS_GADGET_STRINGS:
+		ret = memfs_mkdir_lang(fs, n, n->name, gadget_strs_attrs);
+		break;
+	case MEMFS_CONFIG_STRINGS:
+		ret = memfs_mkdir_lang(fs, n, n->name, config_strs_attrs);
+		break;
+	case MEMFS_CONFIGS:
+		ret = memfs_mkdir_config(fs, n, n->name);
+		break;
+	case MEMFS_FUNCTIONS:
+		ret = memfs_mkdir_function(fs, n, n->name);
+		break;
+	case MEMFS_FUNCTION:
+		ret = memfs_mkdir_lun(fs, n, n->name);
+		break;
+	case MEMFS_FREEFORM:
+		if (!strncmp(n->name, "frame.", 6))
+			ret = memfs_add_attrs(fs, n, uvc_frame_attrs);
+		break;
+	default:
+		break;
+	}
+
+	if (ret) {
+		TAILQ_REMOVE(&dir->children, n, node);
+		memfs_free(n);
+	}
+
+out:
+	pthread_mutex_unlock(&fs->lock);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Anything created by user, kernel doesn't remove it on its own */
+static bool memfs_has_user_items(struct memfs_node *dir)
+{
+	struct memfs_node *c;
+
+	TAILQ_FOREACH(c, &dir->children, node) {
+		if (c->type == MEMFS_LINK ||
+		    (c->type == MEMFS_DIR && !c->builtin))
+			return true;
+		if (c->type == MEMFS_DIR && memfs_has_user_items(c))
+			return true;
+	}
+
+	return false;
+}
+
+/* Files of UDC bound to gadget, if any */
+static struct memfs_node *memfs_gadget_udc(struct usbg_memfs *fs,
+					   struct memfs_node *g)
+{
+	struct memfs_node *attr, *u;
+
+	attr = memfs_child(g, "UDC", 3);
+	if (!attr || attr->len <= 1)
+		return NULL;
+
+	u = memfs_child(fs->udcs, attr->data, strcspn(attr->data, "\n"));
+	return u ? memfs_child(u, "function", 8) : NULL;
+}
+
+static int memfs_rmdir(void *priv, const char *path)
+{
+	struct usbg_memfs *fs = priv;
+	struct memfs_node *n, *func;
+	int ret = 0;
+
+	pthread_mutex_lock(&fs->lock);
+
+	n = memfs_lookup(fs, path, false, 0);
+	if (!n) {
+		ret = -errno;
+		goto out;
+	}
+
+	if (n->type != MEMFS_DIR) {
+		ret = -ENOTDIR;
+		goto out;
+	}
+
+	if (n->builtin || !n->parent) {
+		ret = -EPERM;
+		goto out;
+	}
+
+	if (memfs_has_user_items(n)) {
+		ret = -ENOTEMPTY;
+		goto out;
+	}
+
+	if (n->nlinks) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	/* Removal of gadget unbinds it */
+	if (n->kind == MEMFS_GADGET) {
+		func = memfs_gadget_udc(fs, n);
+		if (func)
+			memfs_set_data(func, "", 0);
+	}
+
+	TAILQ_REMOVE(&n->parent->children, n, node);
+	memfs_free(n);
+
+out:
+	pthread_mutex_unlock(&fs->lock);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int memfs_unlink(void *priv, const char *path)
+{
+	struct usbg_memfs *fs = priv;
+	struct memfs_node *n;
+	int ret = 0;
+
+	pthread_mutex_lock(&fs->lock);
+
+	n = memfs_lookup(fs, path, false, 0);
+	if (!n) {
+		ret = -errno;
+		goto out;
+	}
+
+	if (n->type == MEMFS_DIR)
+		ret = -EISDIR;
+	else if (n->type != MEMFS_LINK)
+		ret = -EPERM;
+	if (ret)
+		goto out;
+
+	TAILQ_REMOVE(&n->parent->children, n, node);
+	memfs_free(n);
+
+out:
+	pthread_mutex_unlock(&fs->lock);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int memfs_check_link(struct memfs_node *dir, struct memfs_node *t)
+{
+	struct memfs_node *c;
+
+	switch (dir->kind) {
+	case MEMFS_CONFIG:
+		if (t->kind != MEMFS_FUNCTION ||
+		    memfs_ancestor(t, MEMFS_GADGET) !=
+		    memfs_ancestor(dir, MEMFS_GADGET))
+			return -EINVAL;
+		/* Each function may be added only once to config */
+		TAILQ_FOREACH(c, &dir->children, node)
+			if (c->target == t)
+				return -EEXIST;
+		return 0;
+	case MEMFS_OS_DESC:
+		if (t->kind != MEMFS_CONFIG ||
+		    memfs_ancestor(t, MEMFS_GADGET) !=
+		    memfs_ancestor(dir, MEMFS_GADGET))
+			return -EINVAL;
+		TAILQ_FOREACH(c, &dir->children, node)
+			if (c->type == MEMFS_LINK)
+				return -EBUSY;
+		return 0;
+	case MEMFS_FREEFORM:
+		return 0;
+	default:
+		return -EPERM;
+	}
+}
+
+static int memfs_symlink(void *priv, const char *target, const char *path)
+{
+	struct usbg_memfs *fs = priv;
+	struct memfs_node *dir, *t, *n;
+	const char *name;
+	size_t len;
+	int ret = 0;
+
+	pthread_mutex_lock(&fs->lock);
+
+	dir = memfs_lookup_parent(fs, path, &name, &len);
+	if (!dir) {
+		ret = -errno;
+		goto out;
+	}
+
+	if (memfs_child(dir, name, len)) {
+		ret = -EEXIST;
+		goto out;
+	}
+
+	/* Configfs links always point to an existing item */
+	t = memfs_lookup(fs, target, true, 0);
+	if (!t) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	if (t->type != MEMFS_DIR) {
+		ret = -EPERM;
+		goto out;
+	}
+
+	ret = memfs_check_link(dir, t);
+	if (ret)
+		goto out;
+
+	n = memfs_add(fs, dir, name, len, MEMFS_LINK, MEMFS_PLAIN);
+	if (!n || memfs_set_data(n, target, strlen(target))) {
+		if (n) {
+			TAILQ_REMOVE(&dir->children, n, node);
+			memfs_free(n);
+		}
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	n->mode = S_IRWXU | S_IRWXG | S_IRWXO;
+	n->target = t;
+	t->nlinks++;
+
+out:
+	pthread_mutex_unlock(&fs->lock);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+static ssize_t memfs_readlink(void *priv, const char *path, char *buf,
+			      size_t len)
+{
+	struct usbg_memfs *fs = priv;
+	struct memfs_node *n;
+	ssize_t ret;
+
+	pthread_mutex_lock(&fs->lock);
+
+	n = memfs_lookup(fs, path, false, 0);
+	if (!n) {
+		ret = -errno;
+	} else if (n->type != MEMFS_LINK) {
+		ret = -EINVAL;
+	} else {
+		/* Like readlink(), no terminating null byte */
+		ret = (size_t)n->len < len ? n->len : len;
+		memcpy(buf, n->data, ret);
+	}
+
+	pthread_mutex_unlock(&fs->lock);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
+
+static int memfs_read(void *priv, const char *path, char *buf, int len)
+{
+	struct usbg_memfs *fs = priv;
+	struct memfs_node *n;
+	int ret;
+
+	pthread_mutex_lock(&fs->lock);
+
+	n = memfs_lookup(fs, path, true, 0);
+	if (!n) {
+		ret = usbg_translate_error(errno);
+	} else if (n->type != MEMFS_FILE) {
+		ret = usbg_translate_error(EISDIR);
+	} else if (!(n->mode & S_IRUSR)) {
+		ret = usbg_translate_error(EACCES);
+	} else {
+		ret = n->len < len ? n->len : len;
+		memcpy(buf, n->data, ret);
+	}
+
+	pthread_mutex_unlock(&fs->lock);
+
+	return ret;
+}
+
+/* Pattern of interface name, exactly one %d is required */
+static int memfs_set_ifname(struct memfs_node *attr, const char *buf,
+			    int len)
+{
+	char name[MEMFS_IFNAMSIZ];
+	const char *p;
+	int i;
+
+	/* Function is in use by config */
+	if (attr->parent->nlinks)
+		return -EBUSY;
+
+	len = strnlen(buf, len);
+	if (len && buf[len - 1] == '\n')
+		--len;
+
+	if (len >= MEMFS_IFNAMSIZ)
+		return -E2BIG;
+
+	for (i = 0; i < len; ++i)
+		if (buf[i] == '/' || buf[i] == ':' ||
+		    isspace((unsigned char)buf[i]))
+			return -EINVAL;
+
+	p = memchr(buf, '%', len);
+	if (!len || !p || p + 1 == buf + len || p[1] != 'd' ||
+	    memchr(p + 2, '%', buf + len - p - 2))
+		return -EINVAL;
+
+	memcpy(name, buf, len);
+	name[len] = '\n';
+
+	return memfs_set_data(attr, name, len + 1);
+}
+
+/* Network interfaces of bound functions get their names */
+static void memfs_register_netdevs(struct usbg_memfs *fs,
+				   struct memfs_node *configs)
+{
+	struct memfs_node *c, *l, *attr;
+	char name[MEMFS_IFNAMSIZ + 1];
+	const char *pattern = "usb%d\n";
+	char *p;
+	int len;
+
+	TAILQ_FOREACH(c, &configs->children, node) {
+		TAILQ_FOREACH(l, &c->children, node) {
+			if (l->type != MEMFS_LINK)
+				continue;
+
+			attr = memfs_child(l->target, "ifname", 6);
+			if (!attr || !(attr->mode & S_IWUSR))
+				continue;
+
+			if (strcmp(attr->data, MEMFS_UNNAMED_NETDEV)) {
+				p = strchr(attr->data, '%');
+				/* Already registered */
+				if (!p)
+					continue;
+				pattern = attr->data;
+			}
+
+			p = strchr(pattern, '%');
+			len = snprintf(name, sizeof(name), "%.*s%d%s",
+				       (int)(p - pattern), pattern,
+				       fs->next_netdev++, p + 2);
+			if (len < sizeof(name))
+				memfs_set_data(attr, name, len);
+			pattern = "usb%d\n";
+		}
+	}
+}
+
+/* Write to UDC attribute of gadget, binds or unbinds it */
+static int memfs_bind(struct usbg_memfs *fs, struct memfs_node *attr,
+		      const char *buf, int len)
+{
+	struct memfs_node *g = attr->parent;
+	struct memfs_node *func, *u, *configs, *c;
+	char name[USBG_MAX_NAME_LENGTH];
+
+	len = strnlen(buf, len);
+	if (len && buf[len - 1] == '\n')
+		--len;
+
+	func = memfs_gadget_udc(fs, g);
+	if (!len) {
+		if (func)
+			memfs_set_data(func, "", 0);
+		return memfs_set_data(attr, "\n", 1);
+	}
+
+	if (func)
+		return -EBUSY;
+
+	u = memfs_child(fs->udcs, buf, len);
+	if (!u)
+		return -ENODEV;
+
+	func = memfs_child(u, "function", 8);
+	if (func->len)
+		return -EBUSY;
+
+	/* Composite driver needs at least one function in each config */
+	configs = memfs_child(g, CONFIGS_DIR, strlen(CONFIGS_DIR));
+	if (TAILQ_EMPTY(&configs->children))
+		return -EINVAL;
+
+	TAILQ_FOREACH(c, &configs->children, node) {
+		struct memfs_node *l;
+
+		TAILQ_FOREACH(l, &c->children, node)
+			if (l->type == MEMFS_LINK)
+				break;
+		if (!l)
+			return -EINVAL;
+	}
+
+	snprintf(name, sizeof(name), "%s\n", u->name);
+	if (memfs_set_data(func, g->name, strlen(g->name)) ||
+	    memfs_set_data(attr, name, strlen(name)))
+		return -ENOMEM;
+
+	memfs_register_netdevs(fs, configs);
+
+	return 0;
+}
+
+static int memfs_write(void *priv, const char *path, const char *buf, int len)
+{
+	struct usbg_memfs *fs = priv;
+	struct memfs_node *n, *dir;
+	const char *name;
+	size_t nlen;
+	int ret;
+
+	pthread_mutex_lock(&fs->lock);
+
+	n = memfs_lookup(fs, path, true, 0);
+	ret = n ? 0 : -errno;
+	if (ret == -ENOENT) {
+		/* Attributes of UVC items other than frames are not emulated */
+		dir = memfs_lookup_parent(fs, path, &name, &nlen);
+		if (dir && dir->kind == MEMFS_FREEFORM) {
+			n = memfs_add(fs, dir, name, nlen, MEMFS_FILE,
+				      MEMFS_PLAIN);
+			ret = n ? 0 : -ENOMEM;
+		}
+	}
+
+	if (ret)
+		goto out;
+
+	if (n->type != MEMFS_FILE)
+		ret = -EISDIR;
+	else if (!(n->mode & S_IWUSR))
+		ret = -EACCES;
+	else if (n->parent->kind == MEMFS_GADGET && !strcmp(n->name, "UDC"))
+		ret = memfs_bind(fs, n, buf, len);
+	else if (n->parent->kind == MEMFS_FUNCTION &&
+		 !strcmp(n->name, "ifname"))
+		ret = memfs_set_ifname(n, buf, len);
+	else
+		ret = memfs_set_data(n, buf, len);
+
+out:
+	pthread_mutex_unlock(&fs->lock);
+
+	return ret ? usbg_translate_error(-ret) : len;
+}
+
+static int memfs_dirent_cmp(const void *a, const void *b, void *arg)
+{
+	int (*compar)(const struct dirent **, const struct dirent **) = arg;
+
+	return compar((const struct dirent **)a, (const struct dirent **)b);
+}
+
+static int memfs_scandir(void *priv, const char *path,
+			 struct dirent ***namelist,
+			 int (*filter)(const struct dirent *),
+			 int (*compar)(const struct dirent **,
+				       const struct dirent **))
+{
+	struct usbg_memfs *fs = priv;
+	struct memfs_node *dir, *c;
+	struct dirent **list = NULL, *d;
+	int i, n = 0, size = 0;
+	int ret = 0;
+
+	pthread_mutex_lock(&fs->lock);
+
+	dir = memfs_lookup(fs, path, true, 0);
+	if (!dir) {
+		ret = -errno;
+		goto out;
+	}
+
+	if (dir->type != MEMFS_DIR) {
+		ret = -ENOTDIR;
+		goto out;
+	}
+
+	/* . and .. first, as from real readdir() */
+	for (i = -2, c = NULL; i < 0 || c; ++i) {
+		const char *name = i == -2 ? "." : "..";
+		unsigned char type = DT_DIR;
+
+		if (i >= 0) {
+			name = c->name;
+			type = c->type == MEMFS_DIR ? DT_DIR :
+				c->type == MEMFS_LINK ? DT_LNK : DT_REG;
+		}
+
+		d = calloc(1, sizeof(*d));
+		if (!d) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		snprintf(d->d_name, sizeof(d->d_name), "%s", name);
+		d->d_type = type;
+		d->d_ino = i >= 0 ? c->ino : dir->ino;
+		c = i >= 0 ? TAILQ_NEXT(c, node) : TAILQ_FIRST(&dir->children);
+
+		if (filter && !filter(d)) {
+			free(d);
+			continue;
+		}
+
+		if (n == size) {
+			struct dirent **l;
+
+			size = size ? 2 * size : 16;
+			l = realloc(list, size * sizeof(*l));
+			if (!l) {
+				free(d);
+				ret = -ENOMEM;
+				goto out;
+			}
+			list = l;
+		}
+		list[n++] = d;
+	}
+
+	if (compar)
+		qsort_r(list, n, sizeof(*list), memfs_dirent_cmp, compar);
+
+out:
+	pthread_mutex_unlock(&fs->lock);
+	if (ret) {
+		while (n > 0)
+			free(list[--n]);
+		free(list);
+		errno = -ret;
+		return -1;
+	}
+
+	*namelist = list;
+	return n;
+}
+
+static int memfs_is_dir(void *priv, const char *path)
+{
+	struct usbg_memfs *fs = priv;
+	struct memfs_node *n;
+	int ret = 0;
+
+	pthread_mutex_lock(&fs->lock);
+
+	n = memfs_lookup(fs, path, true, 0);
+	if (!n)
+		ret = -errno;
+	else if (n->type != MEMFS_DIR)
+		ret = -ENOTDIR;
+
+	pthread_mutex_unlock(&fs->lock);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int memfs_do_stat(struct usbg_memfs *fs, const char *path,
+			 struct stat *st, bool follow)
+{
+	struct memfs_node *n;
+	int ret = 0;
+
+	pthread_mutex_lock(&fs->lock);
+
+	n = memfs_lookup(fs, path, follow, 0);
+	if (n) {
+		memset(st, 0, sizeof(*st));
+		st->st_ino = n->ino;
+		st->st_nlink = 1;
+		st->st_size = n->len;
+		st->st_mode = n->mode | (n->type == MEMFS_DIR ? S_IFDIR :
+					 n->type == MEMFS_LINK ? S_IFLNK :
+					 S_IFREG);
+	} else {
+		ret = -errno;
+	}
+
+	pthread_mutex_unlock(&fs->lock);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int memfs_lstat(void *priv, const char *path, struct stat *st)
+{
+	return memfs_do_stat(priv, path, st, false);
+}
+
+static int memfs_stat(void *priv, const char *path, struct stat *st)
+{
+	return memfs_do_stat(priv, path, st, true);
+}
+
+static void memfs_get(void *priv)
+{
+	struct usbg_memfs *fs = priv;
+
+	__atomic_add_fetch(&fs->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void memfs_release(void *priv)
+{
+	struct usbg_memfs *fs = priv;
+
+	if (__atomic_sub_fetch(&fs->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	if (fs->top)
+		memfs_free(fs->top);
+	pthread_mutex_destroy(&fs->lock);
+	free(fs->root);
+	free(fs);
+}
+
+static const struct usbg_io_ops usbg_memfs_ops = {
+	.read = memfs_read,
+	.write = memfs_write,
+	.scandir = memfs_scandir,
+	.is_dir = memfs_is_dir,
+	.mkdir = memfs_mkdir,
+	.rmdir = memfs_rmdir,
+	.unlink = memfs_unlink,
+	.symlink = memfs_symlink,
+	.readlink = memfs_readlink,
+	.lstat = memfs_lstat,
+	.stat = memfs_stat,
+	.get = memfs_get,
+	.release = memfs_release,
+};
+
+static int memfs_create(const char *root, int nudcs, struct usbg_memfs **fsp)
+{
+	char name[USBG_MAX_NAME_LENGTH];
+	struct usbg_memfs *fs;
+	struct memfs_node *u;
+	int i;
+
+	fs = calloc(1, sizeof(*fs));
+	if (!fs)
+		return USBG_ERROR_NO_MEM;
+
+	pthread_mutex_init(&fs->lock, NULL);
+	fs->refs = 1;
+	fs->root = strdup(root);
+	if (!fs->root)
+		goto err;
+	fs->root_len = strlen(root);
+
+	fs->top = memfs_add(fs, NULL, "", 0, MEMFS_DIR, MEMFS_PLAIN);
+	if (!fs->top)
+		goto err;
+	fs->top->builtin = true;
+
+	if (!memfs_add_group(fs, fs->top, MEMFS_CONFIGFS "/" GADGETS_DIR,
+			     MEMFS_PLAIN))
+		goto err;
+	memfs_child(memfs_child(fs->top, MEMFS_CONFIGFS,
+				strlen(MEMFS_CONFIGFS)),
+		    GADGETS_DIR, strlen(GADGETS_DIR))->kind = MEMFS_GADGETS;
+
+	fs->udcs = memfs_add_group(fs, fs->top, MEMFS_UDC_CLASS, MEMFS_PLAIN);
+	if (!fs->udcs)
+		goto err;
+
+	for (i = 0; i < nudcs; ++i) {
+		snprintf(name, sizeof(name), "dummy_udc.%d", i);
+		u = memfs_add_group(fs, fs->udcs, name, MEMFS_PLAIN);
+		if (!u || memfs_add_attrs(fs, u, udc_attrs))
+			goto err;
+	}
+
+	*fsp = fs;
+	return USBG_SUCCESS;
+
+err:
+	memfs_release(fs);
+	return USBG_ERROR_NO_MEM;
+}
+
+int usbg_init_memfs(int nudcs, usbg_state **state)
+{
+	static int seq;
+	char root[64];
+	char configfs[USBG_MAX_PATH_LENGTH];
+	char udcs[USBG_MAX_PATH_LENGTH];
+	struct usbg_memfs *fs;
+	int ret;
+
+	if (nudcs < 0 || !state)
+		return USBG_ERROR_INVALID_PARAM;
+
+	/* Each state gets its own filesystem */
+	snprintf(root, sizeof(root), MEMFS_ROOT ".%d",
+		 __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED));
+	snprintf(configfs, sizeof(configfs), "%s/" MEMFS_CONFIGFS, root);
+	snprintf(udcs, sizeof(udcs), "%s/" MEMFS_UDC_CLASS, root);
+
+	ret = memfs_create(root, nudcs, &fs);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	/* State takes its own reference, the filesystem goes with it */
+	ret = usbg_init_io(configfs, udcs, &usbg_memfs_ops, fs, state);
+	memfs_release(fs);
+
+	return ret;
+}
@@ -0,0 +1,290 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+/**
+ * @file usbg_probe.c
+ * @brief Detection of function types provided by running kernel.
+ */
+
+#define MODULES_DIR "/lib/modules"
+#define SYS_MODULE_DIR "/sys/module"
+#define USBFUNC_ALIAS "usbfunc:"
+#define PROBE_INSTANCE "usbg_probe"
+
+struct usbg_probe_db {
+	bool builtin[USBG_FUNCTION_TYPE_MAX];
+	char *module[USBG_FUNCTION_TYPE_MAX];
+};
+
+struct usbg_probe_job {
+	const struct usbg_io *io;
+	pthread_t thread;
+	/* Scratch gadget of this job only, empty if shared */
+	char gpath[USBG_MAX_PATH_LENGTH];
+	char path[USBG_MAX_PATH_LENGTH];
+	usbg_function_availability result;
+	/* errno of scratch gadget mkdir */
+	int gadget_err;
+	bool started;
+};
+
+/*
+ * Collect usbfunc:<name> aliases from module database file.
+ * Entries in modules.alias are separated by new lines and
+ * look like "alias usbfunc:acm usb_f_acm", entries in
+ * modules.builtin.modinfo are separated by '\0' and
+ * look like "usb_f_acm.alias=usbfunc:acm".
+ */
+static int usbg_read_probe_db(const char *release, const char *file,
+			      int delim, struct usbg_probe_db *db)
+{
+	char path[USBG_MAX_PATH_LENGTH];
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t n;
+	FILE *fp;
+	int nmb, type;
+
+	nmb = snprintf(path, sizeof(path), "%s/%s/%s", MODULES_DIR,
+		       release, file);
+	if (nmb >= sizeof(path))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return usbg_translate_error(errno);
+
+	while ((n = getdelim(&line, &size, delim, fp)) > 0) {
+		char *alias, *end;
+
+		if (line[n - 1] == delim)
+			line[n - 1] = '\0';
+
+		alias = strstr(line, USBFUNC_ALIAS);
+		if (!alias)
+			continue;
+
+		alias += sizeof(USBFUNC_ALIAS) - 1;
+		end = strchr(alias, ' ');
+		if (end)
+			*end = '\0';
+
+		type = usbg_lookup_function_type(alias);
+		if (type < 0)
+			continue;
+
+		if (delim == '\0') {
+			db->builtin[type] = true;
+		} else if (end && !db->module[type]) {
+			db->module[type] = strdup(end + 1);
+			if (!db->module[type])
+				break;
+		}
+	}
+
+	free(line);
+	fclose(fp);
+
+	return USBG_SUCCESS;
+}
+
+static void usbg_probe_modules(usbg_state *s)
+{
+	char path[USBG_MAX_PATH_LENGTH];
+	struct usbg_probe_db db = { .builtin = { false } };
+	struct utsname uts;
+	bool builtin_read, alias_read;
+	int i, nmb;
+
+	/* Module database describes the running kernel, not emulated one */
+	if (s->io.ops != &usbg_posix_ops || uname(&uts))
+		return;
+
+	builtin_read = usbg_read_probe_db(uts.release, "modules.builtin.modinfo",
+					  '\0', &db) == USBG_SUCCESS;
+	alias_read = usbg_read_probe_db(uts.release, "modules.alias",
+					'\n', &db) == USBG_SUCCESS;
+	if (!builtin_read && !alias_read)
+		return;
+
+	for (i = USBG_FUNCTION_TYPE_MIN; i < USBG_FUNCTION_TYPE_MAX; ++i) {
+		if (db.builtin[i]) {
+			s->func_avail[i] = USBG_FUNC_AVAIL_LOADED;
+		} else if (db.module[i]) {
+			nmb = snprintf(path, sizeof(path), "%s/%s",
+				       SYS_MODULE_DIR, db.module[i]);
+			s->func_avail[i] = nmb < sizeof(path) && !access(path, F_OK)
+				? USBG_FUNC_AVAIL_LOADED : USBG_FUNC_AVAIL_LOADABLE;
+		} else if (builtin_read && alias_read) {
+			s->func_avail[i] = USBG_FUNC_AVAIL_MISSING;
+		}
+		free(db.module[i]);
+	}
+}
+
+/* mkdir of function directory loads the module if needed */
+static void *usbg_probe_mkdir(void *data)
+{
+	struct usbg_probe_job *job = data;
+	const struct usbg_io *io = job->io;
+
+	if (job->gpath[0] &&
+	    usbg_io_mkdir(io, job->gpath, S_IRWXU | S_IRWXG | S_IRWXO)) {
+		job->gadget_err = errno;
+		return NULL;
+	}
+
+	if (!usbg_io_mkdir(io, job->path, S_IRWXU | S_IRWXG | S_IRWXO)) {
+		job->result = USBG_FUNC_AVAIL_LOADED;
+		usbg_io_rmdir(io, job->path);
+	} else if (errno == ENOENT || errno == ENODEV) {
+		job->result = USBG_FUNC_AVAIL_MISSING;
+	}
+
+	if (job->gpath[0])
+		usbg_io_rmdir(io, job->gpath);
+
+	return NULL;
+}
+
+static int usbg_probe_trial_mkdir(usbg_state *s, int flags)
+{
+	const struct usbg_io *io = &s->io;
+	struct usbg_probe_job *jobs;
+	char gpath[USBG_MAX_PATH_LENGTH];
+	int i, nmb;
+	int ret = USBG_SUCCESS;
+
+	jobs = calloc(USBG_FUNCTION_TYPE_MAX, sizeof(*jobs));
+	if (!jobs)
+		return USBG_ERROR_NO_MEM;
+
+	/* Scratch gadget is never visible to library users */
+	nmb = snprintf(gpath, sizeof(gpath), "%s/%s.%d", s->path,
+		       PROBE_INSTANCE, getpid());
+	if (nmb >= sizeof(gpath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		goto out;
+	}
+
+	if (!(flags & USBG_PROBE_PARALLEL) &&
+	    usbg_io_mkdir(io, gpath, S_IRWXU | S_IRWXG | S_IRWXO)) {
+		ret = usbg_translate_error(errno);
+		goto out;
+	}
+
+	for (i = USBG_FUNCTION_TYPE_MIN; i < USBG_FUNCTION_TYPE_MAX; ++i) {
+		struct usbg_probe_job *job = &jobs[i];
+		const char *name = function_types[i]->name;
+
+		job->io = io;
+		job->result = s->func_avail[i];
+
+		/*
+		 * Kernel serializes mkdir in one functions directory,
+		 * including module autoload, so each thread needs
+		 * a scratch gadget of its own.
+		 */
+		if (flags & USBG_PROBE_PARALLEL) {
+			nmb = snprintf(job->gpath, sizeof(job->gpath),
+				       "%s.%s", gpath, name);
+			if (nmb >= sizeof(job->gpath))
+				continue;
+		}
+
+		nmb = snprintf(job->path, sizeof(job->path), "%s/%s/%s.%s",
+			       job->gpath[0] ? job->gpath : gpath,
+			       FUNCTIONS_DIR, name, PROBE_INSTANCE);
+		if (nmb >= sizeof(job->path))
+			continue;
+
+		if (flags & USBG_PROBE_PARALLEL)
+			job->started = !pthread_create(&job->thread, NULL,
+						       usbg_probe_mkdir, job);
+		if (!job->started)
+			usbg_probe_mkdir(job);
+	}
+
+	for (i = USBG_FUNCTION_TYPE_MIN; i < USBG_FUNCTION_TYPE_MAX; ++i) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+		s->func_avail[i] = jobs[i].result;
+		if (jobs[i].gadget_err && ret == USBG_SUCCESS)
+			ret = usbg_translate_error(jobs[i].gadget_err);
+	}
+
+	if (!(flags & USBG_PROBE_PARALLEL))
+		usbg_io_rmdir(io, gpath);
+out:
+	free(jobs);
+	return ret;
+}
+
+int usbg_probe_function_types(usbg_state *s, int flags)
+{
+	int i;
+	int ret = USBG_SUCCESS;
+
+	if (!s)
+		return USBG_ERROR_INVALID_PARAM;
+
+	for (i = USBG_FUNCTION_TYPE_MIN; i < USBG_FUNCTION_TYPE_MAX; ++i)
+		s->func_avail[i] = USBG_FUNC_AVAIL_UNKNOWN;
+
+	usbg_probe_modules(s);
+
+	if (flags & USBG_PROBE_MKDIR)
+		ret = usbg_probe_trial_mkdir(s, flags);
+
+	s->func_probed = true;
+
+	return ret;
+}
+
+usbg_function_availability usbg_get_function_type_availability(usbg_state *s,
+						usbg_function_type type)
+{
+	if (!s || type < USBG_FUNCTION_TYPE_MIN || type >= USBG_FUNCTION_TYPE_MAX)
+		return USBG_FUNC_AVAIL_UNKNOWN;
+
+	if (!s->func_probed)
+		usbg_probe_function_types(s, 0);
+
+	return s->func_avail[type];
+}
+
+int usbg_function_type_available(usbg_state *s, usbg_function_type type)
+{
+	if (!s || !usbg_get_function_type_str(type))
+		return USBG_ERROR_INVALID_PARAM;
+
+	switch (usbg_get_function_type_availability(s, type)) {
+	case USBG_FUNC_AVAIL_LOADED:
+	case USBG_FUNC_AVAIL_LOADABLE:
+		return USBG_SUCCESS;
+	case USBG_FUNC_AVAIL_MISSING:
+		return USBG_ERROR_NOT_SUPPORTED;
+	default:
+		return USBG_ERROR_NOT_FOUND;
+	}
+}
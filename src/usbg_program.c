@@ -0,0 +1,717 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @file usbg_program.c
+ * @brief Gadget compiled to flat list of configfs operations.
+ * @details Program is compiled by walking gadget directory, so it
+ * covers also attributes which library doesn't know about. Running
+ * it doesn't read anything from configfs until the whole gadget has
+ * been created.
+ */
+
+/* Large enough for any configfs attribute */
+#define USBG_PROGRAM_MAX_ATTR 4096
+
+struct usbg_program_link
+{
+	char *path;
+	char *target;
+};
+
+struct usbg_program_builder
+{
+	const struct usbg_io *io;
+	usbg_program *p;
+	char root[USBG_MAX_PATH_LENGTH];
+	size_t root_len;
+	struct usbg_program_link *links;
+	int nlinks;
+	/* Walk also into functions and configs of gadget */
+	bool children;
+};
+
+/*
+ * Attributes which are writable but set by kernel, they can't be written
+ * back with value read from them. Name of network interface reads as
+ * "(unnamed net_device)" or as the name assigned on bind, while only
+ * a pattern with "%d" is accepted.
+ */
+static const struct {
+	usbg_function_type type;
+	const char *name;
+} usbg_program_kernel_attrs[] = {
+	{ USBG_F_ECM, "ifname" },
+	{ USBG_F_SUBSET, "ifname" },
+	{ USBG_F_NCM, "ifname" },
+	{ USBG_F_EEM, "ifname" },
+	{ USBG_F_RNDIS, "ifname" },
+};
+
+static int usbg_program_add(usbg_program *p, int type, const char *path,
+			    const char *data, int len)
+{
+	struct usbg_program_op *op;
+
+	if (p->nops == p->size) {
+		int size = p->size ? 2 * p->size : 64;
+
+		op = realloc(p->ops, size * sizeof(*op));
+		if (!op)
+			return USBG_ERROR_NO_MEM;
+
+		p->ops = op;
+		p->size = size;
+	}
+
+	op = &p->ops[p->nops];
+	op->type = type;
+	op->len = len;
+	op->path = strdup(path);
+	op->data = malloc(len + 1);
+	if (!op->path || !op->data) {
+		free(op->path);
+		free(op->data);
+		return USBG_ERROR_NO_MEM;
+	}
+
+	memcpy(op->data, data, len);
+	op->data[len] = '\0';
+	p->nops++;
+
+	return USBG_SUCCESS;
+}
+
+/*
+ * Resolve . and .. in absolute path. Configfs has no links between
+ * directories, only the final component may be one, so this gives
+ * the same result as realpath() without asking the backend.
+ */
+static void usbg_program_normalize(char *path)
+{
+	char *src = path, *dst = path;
+
+	while (*src) {
+		while (*src == '/')
+			src++;
+		if (!*src)
+			break;
+
+		if (src[0] == '.' && (src[1] == '/' || !src[1])) {
+			src++;
+		} else if (src[0] == '.' && src[1] == '.' &&
+			   (src[2] == '/' || !src[2])) {
+			src += 2;
+			while (dst > path && *--dst != '/');
+		} else {
+			*dst++ = '/';
+			while (*src && *src != '/')
+				*dst++ = *src++;
+		}
+	}
+
+	if (dst == path)
+		*dst++ = '/';
+	*dst = '\0';
+}
+
+static int usbg_program_add_link(struct usbg_program_builder *b,
+				 const char *path, const char *abs)
+{
+	struct usbg_program_link *links;
+	char target[USBG_MAX_PATH_LENGTH];
+	char real[2 * USBG_MAX_PATH_LENGTH];
+	ssize_t len;
+
+	len = usbg_io_readlink(b->io, abs, target, sizeof(target) - 1);
+	if (len < 0)
+		return usbg_translate_error(errno);
+	target[len] = '\0';
+
+	if (target[0] == '/')
+		strcpy(real, target);
+	else
+		snprintf(real, sizeof(real), "%.*s/%s",
+			 (int)(strrchr(abs, '/') - abs), abs, target);
+	usbg_program_normalize(real);
+
+	/* Only links within gadget can be created again */
+	if (strncmp(real, b->root, b->root_len) || real[b->root_len] != '/')
+		return USBG_ERROR_NOT_SUPPORTED;
+
+	links = realloc(b->links, (b->nlinks + 1) * sizeof(*links));
+	if (!links)
+		return USBG_ERROR_NO_MEM;
+	b->links = links;
+
+	links[b->nlinks].path = strdup(path);
+	links[b->nlinks].target = strdup(real + b->root_len + 1);
+	b->nlinks++;
+
+	return links[b->nlinks - 1].path && links[b->nlinks - 1].target ?
+		USBG_SUCCESS : USBG_ERROR_NO_MEM;
+}
+
+/* Check if attribute in top directory of function is set by kernel */
+static bool usbg_program_is_kernel_attr(const char *abs)
+{
+	char type[USBG_MAX_NAME_LENGTH];
+	const char *name, *func, *dir, *dot;
+	int i, f_type;
+
+	name = strrchr(abs, '/');
+	for (func = name; func > abs && func[-1] != '/'; --func)
+		;
+	if (func == abs)
+		return false;
+
+	for (dir = func - 1; dir > abs && dir[-1] != '/'; --dir)
+		;
+	if (func - 1 - dir != strlen(FUNCTIONS_DIR) ||
+	    strncmp(dir, FUNCTIONS_DIR, func - 1 - dir))
+		return false;
+
+	dot = memchr(func, '.', name - func);
+	if (!dot || dot - func >= sizeof(type))
+		return false;
+
+	memcpy(type, func, dot - func);
+	type[dot - func] = '\0';
+	f_type = usbg_lookup_function_type(type);
+
+	for (i = 0; i < ARRAY_SIZE(usbg_program_kernel_attrs); ++i)
+		if (usbg_program_kernel_attrs[i].type == f_type &&
+		    !strcmp(usbg_program_kernel_attrs[i].name, name + 1))
+			return true;
+
+	return false;
+}
+
+static int usbg_program_add_attr(struct usbg_program_builder *b,
+				 const char *path, const char *abs)
+{
+	char buf[USBG_PROGRAM_MAX_ATTR];
+	int len;
+
+	len = usbg_io_read(b->io, abs, buf, sizeof(buf));
+	if (len < 0)
+		return len;
+
+	/* Nothing to write, attribute keeps its default */
+	if (len == 0)
+		return USBG_SUCCESS;
+
+	return usbg_program_add(b->p, USBG_OP_WRITE, path, buf, len);
+}
+
+static int usbg_program_walk(struct usbg_program_builder *b, const char *rel)
+{
+	char abs[USBG_MAX_PATH_LENGTH];
+	char path[USBG_MAX_PATH_LENGTH];
+	struct dirent **dent;
+	struct stat st;
+	int i, n, nmb, pass;
+	int ret = USBG_SUCCESS;
+
+	nmb = snprintf(abs, sizeof(abs), "%s%s%s", b->root, *rel ? "/" : "",
+		       rel);
+	if (nmb >= sizeof(abs))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	n = usbg_io_scandir(b->io, abs, &dent, file_select, alphasort);
+	if (n < 0)
+		return usbg_translate_error(errno);
+
+	/*
+	 * Subdirectories go first, as some attributes (like default UVC
+	 * frame) refer to them. Backing file of LUN is written after all
+	 * other attributes, because they cannot be changed once it is open.
+	 */
+	for (pass = 0; pass < 3; ++pass) {
+		for (i = 0; i < n && ret == USBG_SUCCESS; ++i) {
+			const char *fname = dent[i]->d_name;
+
+			nmb = snprintf(path, sizeof(path), "%s%s%s", rel,
+				       *rel ? "/" : "", fname);
+			if (nmb >= sizeof(path) ||
+			    snprintf(abs, sizeof(abs), "%s/%s", b->root,
+				     path) >= sizeof(abs)) {
+				ret = USBG_ERROR_PATH_TOO_LONG;
+				break;
+			}
+
+			if (usbg_io_lstat(b->io, abs, &st)) {
+				ret = usbg_translate_error(errno);
+				break;
+			}
+
+			if (pass == 0 && S_ISLNK(st.st_mode)) {
+				ret = usbg_program_add_link(b, path, abs);
+			} else if (pass == 0 && S_ISDIR(st.st_mode)) {
+				ret = usbg_program_add(b->p, USBG_OP_MKDIR,
+						       path, "", 0);
+				if (ret != USBG_SUCCESS)
+					break;
+				if (!b->children && !*rel &&
+				    (!strcmp(fname, FUNCTIONS_DIR) ||
+				     !strcmp(fname, CONFIGS_DIR)))
+					continue;
+
+				ret = usbg_program_walk(b, path);
+			} else if (pass > 0 && S_ISREG(st.st_mode)) {
+				/* UDC is handled separately, on request */
+				if (!*rel && !strcmp(fname, "UDC"))
+					continue;
+				/* Read only and write only attributes */
+				if (!(st.st_mode & S_IWUSR) ||
+				    !(st.st_mode & S_IRUSR))
+					continue;
+				if (usbg_program_is_kernel_attr(abs))
+					continue;
+				if ((pass == 2) != !strcmp(fname, "file"))
+					continue;
+
+				ret = usbg_program_add_attr(b, path, abs);
+			}
+		}
+	}
+
+	for (i = 0; i < n; ++i)
+		free(dent[i]);
+	free(dent);
+
+	return ret;
+}
+
+static bool usbg_program_is_under(const char *path, const char *dir)
+{
+	size_t len = strlen(dir);
+
+	return !strncmp(path, dir, len) && path[len] == '/';
+}
+
+/*
+ * Configfs doesn't allow to add links into item which is already
+ * linked (like UVC header or function bound to config), so each link
+ * is created after all links placed inside of its target.
+ */
+static int usbg_program_add_links(struct usbg_program_builder *b)
+{
+	bool *done;
+	bool progress = true;
+	int emitted = 0;
+	int i, j;
+	int ret = USBG_SUCCESS;
+
+	done = calloc(b->nlinks, sizeof(*done));
+	if (b->nlinks && !done)
+		return USBG_ERROR_NO_MEM;
+
+	while (emitted < b->nlinks && ret == USBG_SUCCESS) {
+		bool forced = !progress;
+
+		progress = false;
+		for (i = 0; i < b->nlinks && ret == USBG_SUCCESS; ++i) {
+			if (done[i])
+				continue;
+
+			for (j = 0; j < b->nlinks && !forced; ++j)
+				if (!done[j] && j != i &&
+				    usbg_program_is_under(b->links[j].path,
+							  b->links[i].target))
+					break;
+			/* Wait for links inside target */
+			if (j < b->nlinks && !forced)
+				continue;
+
+			ret = usbg_program_add(b->p, USBG_OP_SYMLINK,
+					       b->links[i].path,
+					       b->links[i].target,
+					       strlen(b->links[i].target));
+			done[i] = true;
+			emitted++;
+			progress = true;
+			/* Circular dependency, keep order of directory walk */
+			if (forced)
+				break;
+		}
+	}
+
+	free(done);
+	return ret;
+}
+
+int usbg_compile_program_dir(const struct usbg_io *io, const char *path,
+			     const char *rel, bool children, usbg_program **p)
+{
+	struct usbg_program_builder b = { .io = io, .children = children };
+	int i;
+	int ret;
+
+	b.root_len = strlen(path);
+	if (b.root_len >= sizeof(b.root)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		goto out;
+	}
+	strcpy(b.root, path);
+	usbg_program_normalize(b.root);
+	b.root_len = strlen(b.root);
+
+	b.p = calloc(1, sizeof(*b.p));
+	if (!b.p) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	ret = usbg_program_walk(&b, rel);
+	if (ret == USBG_SUCCESS)
+		ret = usbg_program_add_links(&b);
+
+	if (ret == USBG_SUCCESS) {
+		*p = b.p;
+		b.p = NULL;
+	}
+
+	usbg_destroy_program(b.p);
+	for (i = 0; i < b.nlinks; ++i) {
+		free(b.links[i].path);
+		free(b.links[i].target);
+	}
+	free(b.links);
+out:
+	return ret;
+}
+
+int usbg_compile_program(usbg_gadget *g, int flags, usbg_program **p)
+{
+	char gpath[USBG_MAX_PATH_LENGTH];
+	usbg_program *newp;
+	int nmb;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!g || !p)
+		goto out;
+
+	nmb = snprintf(gpath, sizeof(gpath), "%s/%s", g->path, g->name);
+	if (nmb >= sizeof(gpath)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		goto out;
+	}
+
+	ret = usbg_compile_program_dir(usbg_gadget_io(g), gpath, "", true,
+				       &newp);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	if ((flags & USBG_PROGRAM_BIND) && g->udc) {
+		ret = usbg_program_add(newp, USBG_OP_BIND, "UDC", g->udc->name,
+				       strlen(g->udc->name));
+		if (ret != USBG_SUCCESS) {
+			usbg_destroy_program(newp);
+			goto out;
+		}
+	}
+
+	*p = newp;
+out:
+	return ret;
+}
+
+int usbg_compile_program_scheme(usbg_state *s, FILE *stream,
+				usbg_program **p)
+{
+	char name[USBG_MAX_NAME_LENGTH];
+	usbg_gadget *g;
+	int ret;
+
+	if (!s || !stream || !p)
+		return USBG_ERROR_INVALID_PARAM;
+
+	/* Paths in program don't depend on gadget name */
+	snprintf(name, sizeof(name), "usbg_compile.%d", getpid());
+
+	ret = usbg_import_gadget(s, stream, name, &g);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	ret = usbg_compile_program(g, 0, p);
+	usbg_rm_gadget(g, USBG_RM_RECURSE);
+
+	return ret;
+}
+
+int usbg_apply_program_ops(const struct usbg_io *io, const char *path,
+			   struct usbg_program_op *ops, int nops)
+{
+	char opath[USBG_MAX_PATH_LENGTH];
+	char target[USBG_MAX_PATH_LENGTH];
+	struct usbg_program_op *op, *end;
+	int nmb;
+	int ret = USBG_SUCCESS;
+
+	for (op = ops, end = op + nops; op < end; ++op) {
+		nmb = snprintf(opath, sizeof(opath), "%s/%s", path, op->path);
+		if (nmb >= sizeof(opath)) {
+			ret = USBG_ERROR_PATH_TOO_LONG;
+			break;
+		}
+
+		switch (op->type) {
+		case USBG_OP_MKDIR:
+			/* Default groups are created by kernel */
+			if (usbg_io_mkdir(io, opath,
+					  S_IRWXU | S_IRWXG | S_IRWXO) &&
+			    errno != EEXIST)
+				ret = usbg_translate_error(errno);
+			break;
+		case USBG_OP_WRITE:
+		case USBG_OP_BIND:
+			nmb = usbg_io_write(io, opath, op->data, op->len);
+			if (nmb < 0)
+				ret = nmb;
+			break;
+		case USBG_OP_SYMLINK:
+			/* Configfs resolves target from cwd, not from link */
+			nmb = snprintf(target, sizeof(target), "%s/%s", path,
+				       op->data);
+			if (nmb >= sizeof(target))
+				ret = USBG_ERROR_PATH_TOO_LONG;
+			else if (usbg_io_symlink(io, target, opath))
+				ret = usbg_translate_error(errno);
+			break;
+		}
+
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	return ret;
+}
+
+int usbg_run_program(usbg_state *s, usbg_program *p, const char *name,
+		     usbg_gadget **g)
+{
+	char gpath[USBG_MAX_PATH_LENGTH];
+	usbg_gadget *newg;
+	int nmb;
+	int ret, load_ret;
+
+	if (!s || !p || !name)
+		return USBG_ERROR_INVALID_PARAM;
+
+	if (usbg_get_gadget(s, name))
+		return USBG_ERROR_EXIST;
+
+	nmb = snprintf(gpath, sizeof(gpath), "%s/%s", s->path, name);
+	if (nmb >= sizeof(gpath))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	if (usbg_io_mkdir(&s->io, gpath, S_IRWXU | S_IRWXG | S_IRWXO))
+		return usbg_translate_error(errno);
+
+	ret = usbg_apply_program_ops(&s->io, gpath, p->ops, p->nops);
+
+	/*
+	 * Partially created gadget is removed in the usual way. If it
+	 * can't be even parsed, its directory is removed behind state.
+	 */
+	load_ret = usbg_load_gadget(s, name, &newg);
+	if (ret != USBG_SUCCESS) {
+		if (load_ret == USBG_SUCCESS)
+			usbg_rm_gadget(newg, USBG_RM_RECURSE);
+		else
+			usbg_rm_dir_tree(&s->io, gpath);
+		return ret;
+	}
+
+	if (load_ret == USBG_SUCCESS && g)
+		*g = newg;
+
+	return load_ret;
+}
+
+int usbg_get_program_length(usbg_program *p)
+{
+	return p ? p->nops : USBG_ERROR_INVALID_PARAM;
+}
+
+int usbg_save_program(usbg_program *p, FILE *stream)
+{
+	struct usbg_program_hdr hdr = {
+		.magic = USBG_PROGRAM_MAGIC,
+		.version = USBG_PROGRAM_VERSION,
+	};
+	struct usbg_program_op_hdr ohdr = { 0 };
+	struct usbg_program_op *op;
+	size_t path_len;
+	int i;
+
+	if (!p || !stream)
+		return USBG_ERROR_INVALID_PARAM;
+
+	hdr.nops = p->nops;
+	if (fwrite(&hdr, sizeof(hdr), 1, stream) != 1)
+		return USBG_ERROR_IO;
+
+	for (i = 0; i < p->nops; ++i) {
+		op = &p->ops[i];
+		path_len = strlen(op->path);
+		if (path_len > UINT16_MAX)
+			return USBG_ERROR_PATH_TOO_LONG;
+
+		ohdr.type = op->type;
+		ohdr.path_len = path_len;
+		ohdr.data_len = op->len;
+
+		if (fwrite(&ohdr, sizeof(ohdr), 1, stream) != 1 ||
+		    fwrite(op->path, 1, path_len, stream) != path_len ||
+		    fwrite(op->data, 1, op->len, stream) != op->len)
+			return USBG_ERROR_IO;
+	}
+
+	return fflush(stream) ? USBG_ERROR_IO : USBG_SUCCESS;
+}
+
+/* Relative path which doesn't leave directory it is resolved in */
+static bool usbg_program_path_is_safe(const char *path)
+{
+	const char *p = path;
+
+	if (!*path || *path == '/')
+		return false;
+
+	while (p) {
+		if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || !p[2]))
+			return false;
+
+		p = strchr(p, '/');
+		if (p)
+			p++;
+	}
+
+	return true;
+}
+
+int usbg_check_program_op(int type, const char *path, const char *data,
+			  int len)
+{
+	if (type < 0 || type >= USBG_OP_MAX || !usbg_program_path_is_safe(path))
+		return USBG_ERROR_INVALID_FORMAT;
+
+	/* Target of link is resolved relative to directory as well */
+	if (type == USBG_OP_SYMLINK &&
+	    (strlen(data) != len || !usbg_program_path_is_safe(data)))
+		return USBG_ERROR_INVALID_FORMAT;
+
+	return USBG_SUCCESS;
+}
+
+int usbg_load_program(FILE *stream, usbg_program **p)
+{
+	struct usbg_program_hdr hdr;
+	struct usbg_program_op_hdr ohdr;
+	usbg_program *newp;
+	char *path = NULL, *data = NULL;
+	uint32_t i;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!stream || !p)
+		goto out;
+
+	if (fread(&hdr, sizeof(hdr), 1, stream) != 1 ||
+	    hdr.magic != USBG_PROGRAM_MAGIC ||
+	    hdr.version != USBG_PROGRAM_VERSION) {
+		ret = USBG_ERROR_INVALID_FORMAT;
+		goto out;
+	}
+
+	newp = calloc(1, sizeof(*newp));
+	if (!newp) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	for (i = 0; i < hdr.nops; ++i) {
+		ret = USBG_ERROR_INVALID_FORMAT;
+		if (fread(&ohdr, sizeof(ohdr), 1, stream) != 1 ||
+		    ohdr.type >= USBG_OP_MAX ||
+		    ohdr.data_len > USBG_PROGRAM_MAX_ATTR)
+			break;
+
+		path = malloc(ohdr.path_len + 1);
+		data = malloc(ohdr.data_len + 1);
+		if (!path || !data) {
+			ret = USBG_ERROR_NO_MEM;
+			break;
+		}
+
+		if (fread(path, 1, ohdr.path_len, stream) != ohdr.path_len ||
+		    fread(data, 1, ohdr.data_len, stream) != ohdr.data_len)
+			break;
+		path[ohdr.path_len] = '\0';
+		data[ohdr.data_len] = '\0';
+
+		/* Absolute or escaping paths would leave gadget directory */
+		if (strlen(path) != ohdr.path_len ||
+		    usbg_check_program_op(ohdr.type, path, data,
+					  ohdr.data_len) != USBG_SUCCESS)
+			break;
+
+		ret = usbg_program_add(newp, ohdr.type, path, data,
+				       ohdr.data_len);
+		if (ret != USBG_SUCCESS)
+			break;
+
+		free(path);
+		free(data);
+		path = data = NULL;
+	}
+
+	free(path);
+	free(data);
+
+	if (i < hdr.nops) {
+		usbg_destroy_program(newp);
+		goto out;
+	}
+
+	*p = newp;
+	ret = USBG_SUCCESS;
+out:
+	return ret;
+}
+
+void usbg_destroy_program(usbg_program *p)
+{
+	int i;
+
+	if (!p)
+		return;
+
+	for (i = 0; i < p->nops; ++i) {
+		free(p->ops[i].path);
+		free(p->ops[i].data);
+	}
+
+	free(p->ops);
+	free(p);
+}
@@ -0,0 +1,341 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @file usbg_rpc.c
+ * @brief Messages exchanged with usbg daemon and its client side.
+ */
+
+struct usbg_client
+{
+	int fd;
+	char *buf;
+};
+
+void usbg_rpc_init(struct usbg_rpc_msg *m, char *buf, size_t size,
+		   uint16_t op, int32_t status)
+{
+	struct usbg_rpc_hdr hdr = {
+		.op = op,
+		.status = status,
+	};
+
+	m->buf = buf;
+	m->size = size;
+	m->pos = 0;
+	m->error = false;
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	m->len = sizeof(hdr);
+}
+
+int usbg_rpc_parse(struct usbg_rpc_msg *m, char *buf, size_t len,
+		   struct usbg_rpc_hdr *hdr)
+{
+	if (len < sizeof(*hdr))
+		return USBG_ERROR_INVALID_FORMAT;
+
+	memcpy(hdr, buf, sizeof(*hdr));
+
+	m->buf = buf;
+	m->size = len;
+	m->len = len;
+	m->pos = sizeof(*hdr);
+	m->error = false;
+
+	return USBG_SUCCESS;
+}
+
+static void usbg_rpc_put(struct usbg_rpc_msg *m, const void *data, size_t len)
+{
+	if (m->error || m->len + len > m->size) {
+		m->error = true;
+		return;
+	}
+
+	memcpy(m->buf + m->len, data, len);
+	m->len += len;
+}
+
+static void usbg_rpc_get(struct usbg_rpc_msg *m, void *data, size_t len)
+{
+	if (m->error || m->pos + len > m->len) {
+		m->error = true;
+		memset(data, 0, len);
+		return;
+	}
+
+	memcpy(data, m->buf + m->pos, len);
+	m->pos += len;
+}
+
+void usbg_rpc_put_u32(struct usbg_rpc_msg *m, uint32_t val)
+{
+	usbg_rpc_put(m, &val, sizeof(val));
+}
+
+void usbg_rpc_put_str(struct usbg_rpc_msg *m, const char *str)
+{
+	size_t len = str ? strlen(str) : 0;
+	uint16_t len16 = len;
+
+	if (len > UINT16_MAX) {
+		m->error = true;
+		return;
+	}
+
+	usbg_rpc_put(m, &len16, sizeof(len16));
+	usbg_rpc_put(m, str, len);
+}
+
+uint32_t usbg_rpc_get_u32(struct usbg_rpc_msg *m)
+{
+	uint32_t val;
+
+	usbg_rpc_get(m, &val, sizeof(val));
+	return val;
+}
+
+void usbg_rpc_get_str(struct usbg_rpc_msg *m, char *str, size_t size)
+{
+	uint16_t len;
+
+	usbg_rpc_get(m, &len, sizeof(len));
+	if (len >= size) {
+		m->error = true;
+		len = 0;
+	}
+
+	usbg_rpc_get(m, str, len);
+	str[m->error ? 0 : len] = '\0';
+}
+
+int usbg_client_connect(const char *path, usbg_client **c)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	usbg_client *new_c;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!c)
+		goto out;
+
+	if (!path)
+		path = USBG_DAEMON_SOCKET;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		ret = USBG_ERROR_PATH_TOO_LONG;
+		goto out;
+	}
+	strcpy(addr.sun_path, path);
+
+	new_c = malloc(sizeof(*new_c));
+	if (!new_c) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	new_c->buf = malloc(USBG_RPC_MAX_MSG);
+	if (!new_c->buf) {
+		ret = USBG_ERROR_NO_MEM;
+		goto free_c;
+	}
+
+	new_c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (new_c->fd < 0) {
+		ret = usbg_translate_error(errno);
+		goto free_buf;
+	}
+
+	if (connect(new_c->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		ret = usbg_translate_error(errno);
+		goto close_fd;
+	}
+
+	*c = new_c;
+	return USBG_SUCCESS;
+
+close_fd:
+	close(new_c->fd);
+free_buf:
+	free(new_c->buf);
+free_c:
+	free(new_c);
+out:
+	return ret;
+}
+
+void usbg_client_close(usbg_client *c)
+{
+	if (!c)
+		return;
+
+	close(c->fd);
+	free(c->buf);
+	free(c);
+}
+
+/* Sends request prepared in client buffer and parses response into m */
+static int usbg_client_call(usbg_client *c, struct usbg_rpc_msg *m)
+{
+	struct usbg_rpc_hdr hdr;
+	uint16_t op;
+	ssize_t n;
+	int ret;
+
+	if (m->error)
+		return USBG_ERROR_INVALID_PARAM;
+
+	memcpy(&op, m->buf, sizeof(op));
+
+	if (send(c->fd, m->buf, m->len, MSG_NOSIGNAL) < 0)
+		return usbg_translate_error(errno);
+
+	do {
+		n = recv(c->fd, c->buf, USBG_RPC_MAX_MSG, 0);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		return usbg_translate_error(errno);
+	if (n == 0)
+		return USBG_ERROR_NO_DEV;
+
+	ret = usbg_rpc_parse(m, c->buf, n, &hdr);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	if (hdr.op != op)
+		return USBG_ERROR_INVALID_FORMAT;
+
+	return hdr.status;
+}
+
+static void usbg_client_get_gadget_msg(struct usbg_rpc_msg *m,
+				       struct usbg_client_gadget *g)
+{
+	usbg_rpc_get_str(m, g->name, sizeof(g->name));
+	usbg_rpc_get_str(m, g->udc, sizeof(g->udc));
+	g->idVendor = 0;
+	g->idProduct = 0;
+}
+
+int usbg_client_list_gadgets(usbg_client *c, usbg_client_gadget_func func,
+			     void *data)
+{
+	struct usbg_client_gadget g;
+	struct usbg_rpc_msg m;
+	uint32_t i, count;
+	int ret;
+
+	if (!c || !func)
+		return USBG_ERROR_INVALID_PARAM;
+
+	usbg_rpc_init(&m, c->buf, USBG_RPC_MAX_MSG, USBG_RPC_LIST, 0);
+	ret = usbg_client_call(c, &m);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	count = usbg_rpc_get_u32(&m);
+	for (i = 0; i < count && !m.error; ++i) {
+		usbg_client_get_gadget_msg(&m, &g);
+		if (m.error)
+			break;
+
+		ret = func(&g, data);
+		if (ret)
+			return ret;
+	}
+
+	return m.error ? USBG_ERROR_INVALID_FORMAT : USBG_SUCCESS;
+}
+
+int usbg_client_get_gadget(usbg_client *c, const char *name,
+			   struct usbg_client_gadget *g)
+{
+	struct usbg_rpc_msg m;
+	int ret;
+
+	if (!c || !name || !g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	usbg_rpc_init(&m, c->buf, USBG_RPC_MAX_MSG, USBG_RPC_GET, 0);
+	usbg_rpc_put_str(&m, name);
+	ret = usbg_client_call(c, &m);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	usbg_client_get_gadget_msg(&m, g);
+	g->idVendor = usbg_rpc_get_u32(&m);
+	g->idProduct = usbg_rpc_get_u32(&m);
+
+	return m.error ? USBG_ERROR_INVALID_FORMAT : USBG_SUCCESS;
+}
+
+int usbg_client_create_gadget(usbg_client *c, const char *name,
+			      uint16_t idVendor, uint16_t idProduct)
+{
+	struct usbg_rpc_msg m;
+
+	if (!c || !name)
+		return USBG_ERROR_INVALID_PARAM;
+
+	usbg_rpc_init(&m, c->buf, USBG_RPC_MAX_MSG, USBG_RPC_CREATE, 0);
+	usbg_rpc_put_str(&m, name);
+	usbg_rpc_put_u32(&m, idVendor);
+	usbg_rpc_put_u32(&m, idProduct);
+
+	return usbg_client_call(c, &m);
+}
+
+static int usbg_client_gadget_op(usbg_client *c, uint16_t op,
+				 const char *name, const char *udc)
+{
+	struct usbg_rpc_msg m;
+
+	if (!c || !name)
+		return USBG_ERROR_INVALID_PARAM;
+
+	usbg_rpc_init(&m, c->buf, USBG_RPC_MAX_MSG, op, 0);
+	usbg_rpc_put_str(&m, name);
+	usbg_rpc_put_str(&m, udc);
+
+	return usbg_client_call(c, &m);
+}
+
+int usbg_client_enable_gadget(usbg_client *c, const char *name,
+			      const char *udc)
+{
+	return usbg_client_gadget_op(c, USBG_RPC_ENABLE, name, udc);
+}
+
+int usbg_client_disable_gadget(usbg_client *c, const char *name)
+{
+	return usbg_client_gadget_op(c, USBG_RPC_DISABLE, name, NULL);
+}
+
+int usbg_client_switch_gadget(usbg_client *c, const char *name,
+			      const char *udc)
+{
+	if (!udc)
+		return USBG_ERROR_INVALID_PARAM;
+
+	return usbg_client_gadget_op(c, USBG_RPC_SWITCH, name, udc);
+}
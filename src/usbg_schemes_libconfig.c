@@ -10,7 +10,9 @@
  * Lesser General Public License for more details.
  */
 
+#include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <libconfig.h>
@@ -30,6 +32,12 @@
 #define USBG_FUNCTION_TAG "function"
 #define USBG_INTERFACE_TAG "interface"
 #define USBG_CONFIG_ID_TAG "config_id"
+#define USBG_GADGETS_TAG "gadgets"
+#define USBG_UDC_TAG "udc"
+#define USBG_REMOVED_TAG "removed"
+#define USBG_CHANGED_TAG "changed"
+#define USBG_GADGET_TAG "gadget"
+#define USBG_CONFIG_TAG "config"
 #define USBG_TAB_WIDTH 4
 
 static inline int generate_function_label(usbg_function *f, char *buf, int size)
@@ -773,7 +781,7 @@ out:
 	return ret;
 }
 
-int usbg_export_gadget(usbg_gadget *g, FILE *stream)
+static int usbg_do_export_gadget(usbg_gadget *g, FILE *stream)
 {
 	config_t cfg;
 	config_setting_t *root;
@@ -800,598 +808,808 @@ out:
 	return ret;
 }
 
-static int split_function_label(const char *label, usbg_function_type *type,
-				const char **instance)
+int usbg_export_gadget(usbg_gadget *g, FILE *stream)
 {
-	const char *floor;
-	char buf[USBG_MAX_NAME_LENGTH];
-	int len;
-	int function_type;
-	int ret = USBG_ERROR_NOT_FOUND;
-
-	/* We assume that function type string doesn't contain '_' */
-	floor = strchr(label, '_');
-	/* if phrase before _ is longer than max name length we may
-	 * stop looking */
-	len = floor - label;
-	if (len >= USBG_MAX_NAME_LENGTH || floor == label)
-		goto out;
-
-	strncpy(buf, label, len);
-	buf[len] = '\0';
-
-	function_type = usbg_lookup_function_type(buf);
-	if (function_type < 0)
-		goto out;
+	usbg_state *st = g ? g->parent : NULL;
+	struct usbg_call call;
+	int ret;
 
-	*type = (usbg_function_type)function_type;
-	*instance = floor + 1;
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_EXPORT, g);
+	ret = usbg_do_export_gadget(g, stream);
+	usbg_stats_end(&call, st, ret);
 
-	ret = USBG_SUCCESS;
-out:
 	return ret;
 }
 
-static void usbg_set_failed_import(config_t **to_set, config_t *failed)
+/*
+ * Streaming export. Output is written while gadget is being walked,
+ * in exactly the same form as config_write() produces for the tree
+ * built by usbg_export_*_prep() (tab width USBG_TAB_WIDTH, colon for
+ * groups, opening brace in separate line). Only attributes of a single
+ * function are built as libconfig tree, as they are provided by
+ * function's export() op.
+ */
+#define USBG_STREAM_MAX_DEPTH 32
+
+struct usbg_stream
 {
-	if (*to_set != NULL) {
-		config_destroy(*to_set);
-		free(*to_set);
-	}
+	FILE *stream;
+	/* Depth of the next setting, root group is at 0 */
+	int depth;
+	/* Bit d set if container at depth d is a list or an array */
+	uint32_t list;
+	/* Bit d set if container at depth d already has an element */
+	uint32_t nonempty;
+	int ret;
+};
 
-	*to_set = failed;
-}
+#define STREAM_BIT(d) ((uint32_t)1 << (d))
 
-static int usbg_import_function_attrs(config_setting_t *root, usbg_function *f)
+/* Same rules as libconfig uses for names of settings */
+static bool usbg_stream_valid_name(const char *name)
 {
-	int ret = USBG_ERROR_NOT_SUPPORTED;
+	const char *p = name;
 
-	if (!f->ops->import)
-		goto out;
+	if (!isalpha((unsigned char)*p) && *p != '*')
+		return false;
 
-	ret = f->ops->import(f, root);
-out:
-	return ret;
+	for (++p; *p; ++p)
+		if (!isalnum((unsigned char)*p) && !strchr("*_-", *p))
+			return false;
+
+	return true;
 }
 
-static int usbg_get_config_node_os_desc(config_setting_t *node,
-					struct usbg_function_os_desc *f_os_desc)
+static void usbg_stream_indent(struct usbg_stream *w, int depth)
 {
-	int ret;
-
-	ret = usbg_get_config_node_string(node, "compatible_id",
-					  &f_os_desc->compatible_id);
-	/* if error */
-	if (ret < 0)
-		return ret;
-
-	ret = usbg_get_config_node_string(node, "sub_compatible_id",
-					  &f_os_desc->sub_compatible_id);
-	/* if error */
-	if (ret < 0)
-		return ret;
-
-	return USBG_SUCCESS;
+	fprintf(w->stream, "%*s", (depth - 1) * USBG_TAB_WIDTH, " ");
 }
 
-static int find_string(const char *str, char **array)
+static bool usbg_stream_begin(struct usbg_stream *w, const char *name,
+			      bool group)
 {
-	int i;
+	int d = w->depth;
 
-	if (!array)
-		return -ENOENT;
+	if (w->ret != USBG_SUCCESS)
+		return false;
 
-	for (i = 0; array[i]; ++i)
-		if (strcmp(str, array[i]) == 0)
-			return i;
+	if (w->list & STREAM_BIT(d - 1)) {
+		/* Elements of list have no names */
+		if (w->nonempty & STREAM_BIT(d - 1))
+			fputs(", ", w->stream);
+	} else {
+		if (!name || !usbg_stream_valid_name(name)) {
+			w->ret = USBG_ERROR_INVALID_PARAM;
+			return false;
+		}
 
-	return -ENOENT;
+		if (d > 1)
+			usbg_stream_indent(w, d);
+		fprintf(w->stream, "%s %c ", name, group ? ':' : '=');
+	}
+
+	w->nonempty |= STREAM_BIT(d - 1);
+	return true;
 }
 
-static int usbg_import_function_os_descs(config_setting_t *root,
-					 usbg_function *f)
+static void usbg_stream_end(struct usbg_stream *w)
 {
-	config_setting_t *node;
-	int ret = USBG_SUCCESS;
-	struct usbg_function_os_desc f_os_desc;
-	char **allowed_names = f->ops->os_desc_iname;
-	int count, i;
-
-	count = config_setting_length(root);
+	if (!(w->list & STREAM_BIT(w->depth - 1)))
+		fputs(";\n", w->stream);
+}
 
-	for (i = 0; i < count; ++i) {
-		config_setting_t *interf_node;
-		const char *interface;
+static void usbg_stream_int(struct usbg_stream *w, const char *name, int val,
+			    bool hex)
+{
+	if (!usbg_stream_begin(w, name, false))
+		return;
 
-		memset(&f_os_desc, 0, sizeof(f_os_desc));
+	fprintf(w->stream, hex ? "0x%X" : "%d", val);
+	usbg_stream_end(w);
+}
 
-		node = config_setting_get_elem(root, i);
-		if (!node) {
-			ret = USBG_ERROR_OTHER_ERROR;
+static void usbg_stream_string(struct usbg_stream *w, const char *name,
+			       const char *val)
+{
+	const char *p;
+	int c;
+
+	if (!usbg_stream_begin(w, name, false))
+		return;
+
+	fputc('"', w->stream);
+	for (p = val; p && *p; ++p) {
+		c = *p & 0xFF;
+		switch (c) {
+		case '"':
+		case '\\':
+			fputc('\\', w->stream);
+			fputc(c, w->stream);
 			break;
-		}
-
-		if (!config_setting_is_group(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
+		case '\n':
+			fputs("\\n", w->stream);
 			break;
-		}
-
-		/* Look for interface name */
-		interf_node = config_setting_get_member(node, USBG_INTERFACE_TAG);
-		if (!interf_node) {
-			ret = USBG_ERROR_MISSING_TAG;
+		case '\r':
+			fputs("\\r", w->stream);
 			break;
-		}
-
-		interface = config_setting_get_string(interf_node);
-		if (!interface) {
-			ret = USBG_ERROR_OTHER_ERROR;
+		case '\f':
+			fputs("\\f", w->stream);
 			break;
-		}
-
-		ret = find_string(interface, allowed_names);
-		if (ret < 0) {
-			ret = USBG_ERROR_NOT_SUPPORTED;
+		case '\t':
+			fputs("\\t", w->stream);
 			break;
+		default:
+			if (c >= ' ')
+				fputc(c, w->stream);
+			else
+				fprintf(w->stream, "\\x%02X", c);
 		}
-
-		ret = usbg_get_config_node_os_desc(node, &f_os_desc);
-		if (ret)
-			break;
-
-		ret = usbg_set_interf_os_desc(f, interface, &f_os_desc);
-		/* no need to free as strings are allocated by libconfig */
-		if (ret)
-			break;
 	}
+	fputc('"', w->stream);
 
-	return ret;
+	usbg_stream_end(w);
 }
 
-static int usbg_import_function_run(usbg_gadget *g, config_setting_t *root,
-				    const char *instance, usbg_function **f)
+static void usbg_stream_open(struct usbg_stream *w, const char *name, int type)
 {
-	config_setting_t *node;
-	const char *type_str;
-	int usbg_ret;
-	int function_type;
-	int ret = USBG_ERROR_MISSING_TAG;
+	int d = w->depth;
+
+	if (d >= USBG_STREAM_MAX_DEPTH - 1) {
+		w->ret = USBG_ERROR_OTHER_ERROR;
+		return;
+	}
+
+	if (!usbg_stream_begin(w, name, type == CONFIG_TYPE_GROUP))
+		return;
+
+	switch (type) {
+	case CONFIG_TYPE_GROUP:
+		fputc('\n', w->stream);
+		if (d > 1)
+			usbg_stream_indent(w, d);
+		fputs("{\n", w->stream);
+		w->list &= ~STREAM_BIT(d);
+		break;
+	case CONFIG_TYPE_LIST:
+		fputs("( ", w->stream);
+		w->list |= STREAM_BIT(d);
+		break;
+	case CONFIG_TYPE_ARRAY:
+		fputs("[ ", w->stream);
+		w->list |= STREAM_BIT(d);
+		break;
+	}
+
+	w->nonempty &= ~STREAM_BIT(d);
+	w->depth++;
+}
 
-	/* function type is mandatory */
-	node = config_setting_get_member(root, USBG_TYPE_TAG);
-	if (!node)
-		goto out;
+static void usbg_stream_close(struct usbg_stream *w, int type)
+{
+	int d;
+
+	if (w->ret != USBG_SUCCESS)
+		return;
+
+	d = --w->depth;
+	switch (type) {
+	case CONFIG_TYPE_GROUP:
+		if (d > 1)
+			usbg_stream_indent(w, d);
+		fputc('}', w->stream);
+		break;
+	case CONFIG_TYPE_LIST:
+		if (w->nonempty & STREAM_BIT(d))
+			fputc(' ', w->stream);
+		fputc(')', w->stream);
+		break;
+	case CONFIG_TYPE_ARRAY:
+		if (w->nonempty & STREAM_BIT(d))
+			fputc(' ', w->stream);
+		fputc(']', w->stream);
+		break;
+	}
+
+	usbg_stream_end(w);
+}
 
-	type_str = config_setting_get_string(node);
-	if (!type_str) {
-		ret = USBG_ERROR_INVALID_TYPE;
-		goto out;
+/* Writes tree built by function's export() op */
+static void usbg_stream_setting(struct usbg_stream *w, config_setting_t *node)
+{
+	const char *name = config_setting_name(node);
+	int type = config_setting_type(node);
+	bool hex = config_setting_get_format(node) == CONFIG_FORMAT_HEX;
+	int i, len;
+
+	switch (type) {
+	case CONFIG_TYPE_INT:
+		usbg_stream_int(w, name, config_setting_get_int(node), hex);
+		break;
+	case CONFIG_TYPE_INT64:
+		if (!usbg_stream_begin(w, name, false))
+			break;
+		fprintf(w->stream, hex ? "0x%llXL" : "%lldL",
+			(long long)config_setting_get_int64(node));
+		usbg_stream_end(w);
+		break;
+	case CONFIG_TYPE_BOOL:
+		if (!usbg_stream_begin(w, name, false))
+			break;
+		fputs(config_setting_get_bool(node) ? "true" : "false",
+		      w->stream);
+		usbg_stream_end(w);
+		break;
+	case CONFIG_TYPE_STRING:
+		usbg_stream_string(w, name, config_setting_get_string(node));
+		break;
+	case CONFIG_TYPE_GROUP:
+	case CONFIG_TYPE_LIST:
+	case CONFIG_TYPE_ARRAY:
+		usbg_stream_open(w, name, type);
+		len = config_setting_length(node);
+		for (i = 0; i < len && w->ret == USBG_SUCCESS; ++i)
+			usbg_stream_setting(w, config_setting_get_elem(node, i));
+		usbg_stream_close(w, type);
+		break;
+	default:
+		/* Floats are never exported by library */
+		w->ret = USBG_ERROR_NOT_SUPPORTED;
+		break;
 	}
+}
 
-	/* Check if this type is supported */
-	function_type = usbg_lookup_function_type(type_str);
-	if (function_type < 0) {
-		ret = USBG_ERROR_NOT_SUPPORTED;
-		goto out;
-	}
+static int usbg_stream_function_attrs(struct usbg_stream *w, usbg_function *f)
+{
+	config_t cfg;
+	config_setting_t *node;
+	int ret = USBG_ERROR_NO_MEM;
 
-	/* All data collected, let's get to work and create this function */
-	ret = usbg_create_function(g, (usbg_function_type)function_type,
-				   instance, NULL, f);
+	if (!f->ops->export)
+		return USBG_ERROR_NOT_SUPPORTED;
 
-	if (ret != USBG_SUCCESS)
-		goto out;
+	config_init(&cfg);
 
-	/* Attrs are optional */
-	node = config_setting_get_member(root, USBG_ATTRS_TAG);
-	if (node) {
-		usbg_ret = usbg_import_function_attrs(node, *f);
-		if (usbg_ret != USBG_SUCCESS) {
-			ret = usbg_ret;
-			goto out;
-		}
-	}
+	/* Always successful */
+	node = config_setting_add(config_root_setting(&cfg), USBG_ATTRS_TAG,
+				  CONFIG_TYPE_GROUP);
+	if (!node)
+		goto out;
 
-	node = config_setting_get_member(root, USBG_OS_DESCS_TAG);
-	if (node) {
-		usbg_ret = usbg_import_function_os_descs(node, *f);
-		if (usbg_ret != USBG_SUCCESS) {
-			ret = usbg_ret;
-			goto out;
-		}
+	ret = f->ops->export(f, node);
+	if (ret == USBG_SUCCESS) {
+		usbg_stream_setting(w, node);
+		ret = w->ret;
 	}
-
 out:
+	config_destroy(&cfg);
 	return ret;
 }
 
-static usbg_function *usbg_lookup_function(usbg_gadget *g, const char *label)
+static int usbg_stream_function_os_descs(struct usbg_stream *w,
+					 usbg_function *f)
 {
-	usbg_function *f;
-	int usbg_ret;
+	struct usbg_function_os_desc f_os_desc;
+	char **iname = f->ops->os_desc_iname;
+	int ret = 0;
 
-	/* check if such function has also been imported */
-	TAILQ_FOREACH(f, &g->functions, fnode) {
-		if (f->label && !strcmp(f->label, label))
-			break;
-	}
+	while (iname && *iname) {
+		memset(&f_os_desc, 0, sizeof(f_os_desc));
 
-	/* if not let's check if label follows the naming convention */
-	if (!f) {
-		usbg_function_type type;
-		const char *instance;
+		ret = usbg_get_interf_os_desc(f, *iname, &f_os_desc);
+		if (ret)
+			break;
 
-		usbg_ret = split_function_label(label, &type, &instance);
-		if (usbg_ret != USBG_SUCCESS)
-			goto out;
+		usbg_stream_open(w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_string(w, USBG_INTERFACE_TAG, *iname);
+		if (f_os_desc.compatible_id)
+			usbg_stream_string(w, "compatible_id",
+					   f_os_desc.compatible_id);
+		if (f_os_desc.sub_compatible_id)
+			usbg_stream_string(w, "sub_compatible_id",
+					   f_os_desc.sub_compatible_id);
+		usbg_stream_close(w, CONFIG_TYPE_GROUP);
 
-		/* check if such function exist */
-		f = usbg_get_function(g, type, instance);
+		usbg_free_interf_os_desc(&f_os_desc);
+		ret = w->ret;
+		if (ret < 0)
+			break;
+		++iname;
 	}
 
-out:
-	return f;
+	return ret;
 }
 
-/* We have a string which should match with one of function names */
-static int usbg_import_binding_string(config_setting_t *root, usbg_config *c)
+static int usbg_stream_function(struct usbg_stream *w, usbg_function *f)
 {
-	const char *func_label;
-	usbg_function *target;
 	int ret;
 
-	func_label = config_setting_get_string(root);
-	if (!func_label) {
-		ret = USBG_ERROR_OTHER_ERROR;
-		goto out;
-	}
+	usbg_stream_string(w, USBG_TYPE_TAG,
+			   usbg_get_function_type_str(f->type));
 
-	target = usbg_lookup_function(c->parent, func_label);
-	if (!target) {
-		ret = USBG_ERROR_NOT_FOUND;
+	ret = usbg_stream_function_attrs(w, f);
+	if (ret)
 		goto out;
-	}
 
-	ret = usbg_add_config_function(c, target->name, target);
+	usbg_stream_open(w, USBG_OS_DESCS_TAG, CONFIG_TYPE_LIST);
+
+	/* OS Descriptors are optional */
+	ret = usbg_stream_function_os_descs(w, f);
+	if (ret == USBG_ERROR_NOT_SUPPORTED)
+		ret = USBG_SUCCESS;
+
+	usbg_stream_close(w, CONFIG_TYPE_LIST);
 out:
-	return ret;
+	return ret ? ret : w->ret;
 }
 
-static int usbg_import_binding_group(config_setting_t *root, usbg_config *c)
+static int usbg_stream_config(struct usbg_stream *w, usbg_config *c)
 {
-	config_setting_t *node;
-	const char *func_label, *name;
-	usbg_function *target;
+	struct usbg_config_attrs attrs;
+	struct usbg_config_strs strs;
+	char label[USBG_MAX_NAME_LENGTH];
+	usbg_binding *b;
+	int *langs;
+	int i, nmb;
 	int ret;
 
-	node = config_setting_get_member(root, USBG_FUNCTION_TAG);
-	if (!node) {
-		ret = USBG_ERROR_MISSING_TAG;
-		goto out;
-	}
+	usbg_stream_string(w, USBG_NAME_TAG, c->label);
 
-	/* It is allowed to provide link to existing function
-	 * or define unlabeled instance of function in this place */
-	if (usbg_config_is_string(node)) {
-		func_label = config_setting_get_string(node);
-		if (!func_label) {
-			ret = USBG_ERROR_OTHER_ERROR;
-			goto out;
-		}
+	ret = usbg_get_config_attrs(c, &attrs);
+	if (ret != USBG_SUCCESS)
+		goto out;
 
-		target = usbg_lookup_function(c->parent, func_label);
-		if (!target) {
-			ret = USBG_ERROR_NOT_FOUND;
-			goto out;
-		}
-	} else if (config_setting_is_group(node)) {
-		config_setting_t *inst_node;
-		const char *instance;
+	usbg_stream_open(w, USBG_ATTRS_TAG, CONFIG_TYPE_GROUP);
+	usbg_stream_int(w, "bmAttributes", attrs.bmAttributes, true);
+	usbg_stream_int(w, "bMaxPower", attrs.bMaxPower, true);
+	usbg_stream_close(w, CONFIG_TYPE_GROUP);
 
-		inst_node = config_setting_get_member(node, USBG_INSTANCE_TAG);
-		if (!inst_node) {
-			ret = USBG_ERROR_MISSING_TAG;
-			goto out;
-		}
+	usbg_stream_open(w, USBG_STRINGS_TAG, CONFIG_TYPE_LIST);
 
-		instance = config_setting_get_string(inst_node);
-		if (!instance) {
-			ret = USBG_ERROR_OTHER_ERROR;
-			goto out;
-		}
+	ret = usbg_get_config_strs_langs(c, &langs);
+	if (ret != USBG_SUCCESS)
+		goto out;
 
-		ret = usbg_import_function_run(c->parent, node,
-					       instance, &target);
+	for (i = 0; langs[i]; ++i) {
+		ret = usbg_get_config_strs(c, langs[i], &strs);
 		if (ret != USBG_SUCCESS)
-			goto out;
-	} else {
-		ret = USBG_ERROR_INVALID_TYPE;
-		goto out;
+			break;
+
+		usbg_stream_open(w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_int(w, USBG_LANG_TAG, langs[i], true);
+		usbg_stream_string(w, "configuration", strs.configuration);
+		usbg_stream_close(w, CONFIG_TYPE_GROUP);
+		usbg_free_config_strs(&strs);
 	}
 
-	/* Name tag is optional. When no such tag, default one will be used */
-	node = config_setting_get_member(root, USBG_NAME_TAG);
-	if (node) {
-		if (!usbg_config_is_string(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			goto out;
-		}
+	free(langs);
+	if (ret != USBG_SUCCESS)
+		goto out;
 
-		name = config_setting_get_string(node);
-		if (!name) {
+	usbg_stream_close(w, CONFIG_TYPE_LIST);
+
+	usbg_stream_open(w, USBG_FUNCTIONS_TAG, CONFIG_TYPE_LIST);
+	TAILQ_FOREACH(b, &c->bindings, bnode) {
+		nmb = generate_function_label(b->target, label, sizeof(label));
+		if (nmb >= sizeof(label)) {
 			ret = USBG_ERROR_OTHER_ERROR;
 			goto out;
 		}
-	} else {
-		name = target->name;
+
+		usbg_stream_open(w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_string(w, USBG_NAME_TAG, b->name);
+		usbg_stream_string(w, USBG_FUNCTION_TAG, label);
+		usbg_stream_close(w, CONFIG_TYPE_GROUP);
 	}
+	usbg_stream_close(w, CONFIG_TYPE_LIST);
 
-	ret = usbg_add_config_function(c, name, target);
+	ret = w->ret;
 out:
 	return ret;
 }
 
-static int usbg_import_config_bindings(config_setting_t *root, usbg_config *c)
+static int usbg_stream_gadget_strings(struct usbg_stream *w, usbg_gadget *g)
 {
-	config_setting_t *node;
-	int ret = USBG_SUCCESS;
-	int count, i;
-
-	count = config_setting_length(root);
-
-	for (i = 0; i < count; ++i) {
-		node = config_setting_get_elem(root, i);
+	struct usbg_gadget_strs strs;
+	int *langs;
+	int i, ret;
 
-		if (usbg_config_is_string(node))
-			ret = usbg_import_binding_string(node, c);
-		else if (config_setting_is_group(node))
-			ret = usbg_import_binding_group(node, c);
-		else
-			ret = USBG_ERROR_INVALID_TYPE;
+	ret = usbg_get_gadget_strs_langs(g, &langs);
+	if (ret != USBG_SUCCESS)
+		goto out;
 
+	for (i = 0; langs[i]; ++i) {
+		ret = usbg_get_gadget_strs(g, langs[i], &strs);
 		if (ret != USBG_SUCCESS)
 			break;
+
+		usbg_stream_open(w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_int(w, USBG_LANG_TAG, langs[i], true);
+		usbg_stream_string(w, "manufacturer", strs.manufacturer);
+		usbg_stream_string(w, "product", strs.product);
+		usbg_stream_string(w, "serialnumber", strs.serial);
+		usbg_stream_close(w, CONFIG_TYPE_GROUP);
+		usbg_free_gadget_strs(&strs);
 	}
 
+	free(langs);
+out:
 	return ret;
 }
 
-static int usbg_import_config_strs_lang(config_setting_t *root, usbg_config *c)
+static int usbg_stream_gadget_os_descs(struct usbg_stream *w, usbg_gadget *g)
 {
-	config_setting_t *node;
-	int lang;
-	struct usbg_config_strs c_strs = {0};
-	int ret = USBG_ERROR_INVALID_TYPE;
+	struct usbg_gadget_os_descs g_os_descs = {0};
+	int ret;
 
-	node = config_setting_get_member(root, USBG_LANG_TAG);
-	if (!node) {
-		ret = USBG_ERROR_MISSING_TAG;
+	if (g->os_desc_binding)
+		usbg_stream_int(w, USBG_CONFIG_ID_TAG,
+				g->os_desc_binding->id, false);
+
+	ret = usbg_get_gadget_os_descs(g, &g_os_descs);
+	if (ret)
 		goto out;
-	}
 
-	if (!usbg_config_is_int(node))
+	usbg_stream_int(w, "use", g_os_descs.use, false);
+	usbg_stream_string(w, "qw_sign", g_os_descs.qw_sign);
+	usbg_stream_int(w, "b_vendor_code", g_os_descs.b_vendor_code, true);
+out:
+	usbg_free_gadget_os_desc(&g_os_descs);
+	return ret;
+}
+
+static int usbg_stream_gadget(struct usbg_stream *w, usbg_gadget *g)
+{
+	struct usbg_gadget_attrs attrs;
+	char label[USBG_MAX_NAME_LENGTH];
+	usbg_function *f;
+	usbg_config *c;
+	const char *func_label;
+	int nmb;
+	int ret;
+
+	ret = usbg_get_gadget_attrs(g, &attrs);
+	if (ret)
 		goto out;
 
-	lang = config_setting_get_int(node);
+	usbg_stream_open(w, USBG_ATTRS_TAG, CONFIG_TYPE_GROUP);
+	usbg_stream_int(w, "bcdUSB", attrs.bcdUSB, true);
+	usbg_stream_int(w, "bDeviceClass", attrs.bDeviceClass, true);
+	usbg_stream_int(w, "bDeviceSubClass", attrs.bDeviceSubClass, true);
+	usbg_stream_int(w, "bDeviceProtocol", attrs.bDeviceProtocol, true);
+	usbg_stream_int(w, "bMaxPacketSize0", attrs.bMaxPacketSize0, true);
+	usbg_stream_int(w, "idVendor", attrs.idVendor, true);
+	usbg_stream_int(w, "idProduct", attrs.idProduct, true);
+	usbg_stream_int(w, "bcdDevice", attrs.bcdDevice, true);
+	usbg_stream_close(w, CONFIG_TYPE_GROUP);
 
-	/* Configuration string is optional */
-	node = config_setting_get_member(root, "configuration");
-	if (node) {
-		if (!usbg_config_is_string(node))
-			goto out;
+	usbg_stream_open(w, USBG_OS_DESCS_TAG, CONFIG_TYPE_GROUP);
+	ret = usbg_stream_gadget_os_descs(w, g);
+	if (ret && ret != USBG_ERROR_NOT_FOUND)
+		goto out;
+	usbg_stream_close(w, CONFIG_TYPE_GROUP);
 
-		c_strs.configuration = (char *)config_setting_get_string(node);
+	usbg_stream_open(w, USBG_STRINGS_TAG, CONFIG_TYPE_LIST);
+	ret = usbg_stream_gadget_strings(w, g);
+	if (ret)
+		goto out;
+	usbg_stream_close(w, CONFIG_TYPE_LIST);
+
+	usbg_stream_open(w, USBG_FUNCTIONS_TAG, CONFIG_TYPE_GROUP);
+	TAILQ_FOREACH(f, &g->functions, fnode) {
+		if (f->label) {
+			func_label = f->label;
+		} else {
+			nmb = generate_function_label(f, label, sizeof(label));
+			if (nmb >= sizeof(label)) {
+				ret = USBG_ERROR_OTHER_ERROR;
+				goto out;
+			}
+			func_label = label;
+		}
+
+		usbg_stream_open(w, func_label, CONFIG_TYPE_GROUP);
+		usbg_stream_string(w, USBG_INSTANCE_TAG, f->instance);
+		ret = usbg_stream_function(w, f);
+		if (ret)
+			goto out;
+		usbg_stream_close(w, CONFIG_TYPE_GROUP);
 	}
+	usbg_stream_close(w, CONFIG_TYPE_GROUP);
 
-	ret = usbg_set_config_strs(c, lang, &c_strs);
+	usbg_stream_open(w, USBG_CONFIGS_TAG, CONFIG_TYPE_LIST);
+	TAILQ_FOREACH(c, &g->configs, cnode) {
+		usbg_stream_open(w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_int(w, USBG_ID_TAG, c->id, false);
+		ret = usbg_stream_config(w, c);
+		if (ret)
+			goto out;
+		usbg_stream_close(w, CONFIG_TYPE_GROUP);
+	}
+	usbg_stream_close(w, CONFIG_TYPE_LIST);
 
+	ret = w->ret;
 out:
 	return ret;
 }
 
-static int usbg_import_config_strings(config_setting_t *root, usbg_config *c)
+/* Root group is implicit, settings are written from depth 1 */
+#define USBG_STREAM_INIT(s) { .stream = (s), .depth = 1 }
+
+int usbg_export_function_stream(usbg_function *f, FILE *stream)
 {
-	config_setting_t *node;
-	int ret = USBG_SUCCESS;
-	int count, i;
+	struct usbg_stream w = USBG_STREAM_INIT(stream);
 
-	count = config_setting_length(root);
+	if (!f || !stream)
+		return USBG_ERROR_INVALID_PARAM;
 
-	for (i = 0; i < count; ++i) {
-		node = config_setting_get_elem(root, i);
-		if (!config_setting_is_group(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			break;
-		}
+	return usbg_stream_function(&w, f);
+}
 
-		ret = usbg_import_config_strs_lang(node, c);
-		if (ret != USBG_SUCCESS)
-			break;
-	}
+int usbg_export_config_stream(usbg_config *c, FILE *stream)
+{
+	struct usbg_stream w = USBG_STREAM_INIT(stream);
 
-	return ret;
+	if (!c || !stream)
+		return USBG_ERROR_INVALID_PARAM;
+
+	return usbg_stream_config(&w, c);
 }
 
-static int usbg_import_config_attrs(config_setting_t *root, usbg_config *c)
+static int usbg_do_export_gadget_stream(usbg_gadget *g, FILE *stream)
 {
-	config_setting_t *node;
-	int usbg_ret;
-	int bmAttributes, bMaxPower;
-	int ret = USBG_ERROR_INVALID_TYPE;
+	struct usbg_stream w = USBG_STREAM_INIT(stream);
 
-	node = config_setting_get_member(root, "bmAttributes");
-	if (node) {
-		if (!usbg_config_is_int(node))
-			goto out;
+	if (!g || !stream)
+		return USBG_ERROR_INVALID_PARAM;
 
-		bmAttributes = config_setting_get_int(node);
-		usbg_ret = usbg_set_config_bm_attrs(c, bmAttributes);
-		if (usbg_ret != USBG_SUCCESS) {
-			ret = usbg_ret;
-			goto out;
-		}
-	}
+	return usbg_stream_gadget(&w, g);
+}
 
-	node = config_setting_get_member(root, "bMaxPower");
-	if (node) {
-		if (!usbg_config_is_int(node))
-			goto out;
+int usbg_export_gadget_stream(usbg_gadget *g, FILE *stream)
+{
+	usbg_state *st = g ? g->parent : NULL;
+	struct usbg_call call;
+	int ret;
 
-		bMaxPower = config_setting_get_int(node);
-		usbg_ret = usbg_set_config_max_power(c, bMaxPower);
-		if (usbg_ret != USBG_SUCCESS) {
-			ret = usbg_ret;
+	USBG_CALL_BEGIN_OP(&call, USBG_STAT_OP_EXPORT, g);
+	ret = usbg_do_export_gadget_stream(g, stream);
+	usbg_stats_end(&call, st, ret);
+
+	return ret;
+}
+
+static int usbg_do_export_state(usbg_state *s, int flags, FILE *stream)
+{
+	struct usbg_stream w = USBG_STREAM_INIT(stream);
+	usbg_gadget *g;
+	int ret = USBG_SUCCESS;
+
+	if (!s || !stream)
+		return USBG_ERROR_INVALID_PARAM;
+
+	usbg_stream_open(&w, USBG_GADGETS_TAG, CONFIG_TYPE_LIST);
+	TAILQ_FOREACH(g, &s->gadgets, gnode) {
+		usbg_stream_open(&w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_string(&w, USBG_NAME_TAG, g->name);
+		if ((flags & USBG_STATE_BIND) && g->udc)
+			usbg_stream_string(&w, USBG_UDC_TAG, g->udc->name);
+
+		ret = usbg_stream_gadget(&w, g);
+		if (ret != USBG_SUCCESS)
 			goto out;
-		}
+		usbg_stream_close(&w, CONFIG_TYPE_GROUP);
 	}
+	usbg_stream_close(&w, CONFIG_TYPE_LIST);
 
-	/* Empty attrs section is also considered to be valid */
-	ret = USBG_SUCCESS;
+	ret = w.ret;
 out:
 	return ret;
-
 }
 
-static int usbg_import_config_run(usbg_gadget *g, config_setting_t *root,
-				  int id, usbg_config **c)
+int usbg_export_state(usbg_state *s, int flags, FILE *stream)
 {
-	config_setting_t *node;
-	const char *name;
-	usbg_config *newc;
-	int usbg_ret;
-	int ret = USBG_ERROR_MISSING_TAG;
+	struct usbg_call call;
+	int ret;
 
-	/*
-	 * Label is mandatory,
-	 * if attrs aren't present defaults are used
-	 */
-	node = config_setting_get_member(root, USBG_NAME_TAG);
-	if (!node)
-		goto out;
+	usbg_stats_begin(&call, __func__, USBG_STAT_OP_EXPORT,
+			 s ? s->path : NULL, NULL);
+	ret = usbg_do_export_state(s, flags, stream);
+	usbg_stats_end(&call, s, ret);
 
-	name = config_setting_get_string(node);
-	if (!name) {
-		ret = USBG_ERROR_INVALID_TYPE;
-		goto out;
-	}
+	return ret;
+}
 
-	/* Required data collected, let's create our config */
-	usbg_ret = usbg_create_config(g, id, name, NULL, NULL, &newc);
-	if (usbg_ret != USBG_SUCCESS) {
-		ret = usbg_ret;
-		goto out;
+static int usbg_stream_changed_gadget(struct usbg_stream *w, usbg_gadget *g,
+				      uint64_t gen)
+{
+	usbg_function *f;
+	usbg_config *c;
+	int ret = USBG_SUCCESS;
+
+	/* Gadget's own change is exported with everything inside */
+	if (g->generation > gen) {
+		usbg_stream_open(w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_string(w, USBG_GADGET_TAG, g->name);
+		ret = usbg_stream_gadget(w, g);
+		usbg_stream_close(w, CONFIG_TYPE_GROUP);
+		return ret;
 	}
 
-	/* Attrs are optional */
-	node = config_setting_get_member(root, USBG_ATTRS_TAG);
-	if (node) {
-		if (!config_setting_is_group(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			goto error2;
-		}
+	TAILQ_FOREACH(f, &g->functions, fnode) {
+		if (f->generation <= gen)
+			continue;
+
+		usbg_stream_open(w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_string(w, USBG_GADGET_TAG, g->name);
+		usbg_stream_string(w, USBG_FUNCTION_TAG, f->name);
+		usbg_stream_string(w, USBG_INSTANCE_TAG, f->instance);
+		ret = usbg_stream_function(w, f);
+		if (ret)
+			return ret;
+		usbg_stream_close(w, CONFIG_TYPE_GROUP);
+	}
 
-		usbg_ret = usbg_import_config_attrs(node, newc);
-		if (usbg_ret != USBG_SUCCESS)
-			goto error;
+	TAILQ_FOREACH(c, &g->configs, cnode) {
+		if (c->generation <= gen)
+			continue;
+
+		usbg_stream_open(w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_string(w, USBG_GADGET_TAG, g->name);
+		usbg_stream_string(w, USBG_CONFIG_TAG, c->name);
+		usbg_stream_int(w, USBG_ID_TAG, c->id, false);
+		ret = usbg_stream_config(w, c);
+		if (ret)
+			return ret;
+		usbg_stream_close(w, CONFIG_TYPE_GROUP);
 	}
 
-	/* Strings are also optional */
-	node = config_setting_get_member(root, USBG_STRINGS_TAG);
-	if (node) {
-		if (!config_setting_is_list(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			goto error2;
-		}
+	return ret;
+}
 
-		usbg_ret = usbg_import_config_strings(node, newc);
-		if (usbg_ret != USBG_SUCCESS)
-			goto error;
-	}
+int usbg_export_changed_since(usbg_state *s, uint64_t gen, FILE *stream)
+{
+	struct usbg_stream w = USBG_STREAM_INIT(stream);
+	struct usbg_tombstone *t;
+	usbg_gadget *g;
+	int ret = USBG_SUCCESS;
 
-	/* Functions too, because some config may not be
-	 * fully configured and not contain any function */
-	node = config_setting_get_member(root, USBG_FUNCTIONS_TAG);
-	if (node) {
-		if (!config_setting_is_list(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			goto error2;
-		}
+	if (!s || !stream)
+		return USBG_ERROR_INVALID_PARAM;
 
-		usbg_ret = usbg_import_config_bindings(node, newc);
-		if (usbg_ret != USBG_SUCCESS)
-			goto error;
+	/* Removals go first, object may have been created again later */
+	usbg_stream_open(&w, USBG_REMOVED_TAG, CONFIG_TYPE_LIST);
+	TAILQ_FOREACH(t, &s->tombstones, tnode) {
+		if (t->generation <= gen)
+			continue;
+
+		usbg_stream_open(&w, NULL, CONFIG_TYPE_GROUP);
+		usbg_stream_string(&w, USBG_GADGET_TAG, t->gadget);
+		if (t->type == USBG_TOMBSTONE_CONFIG)
+			usbg_stream_string(&w, USBG_CONFIG_TAG, t->name);
+		else if (t->type == USBG_TOMBSTONE_FUNCTION)
+			usbg_stream_string(&w, USBG_FUNCTION_TAG, t->name);
+		usbg_stream_close(&w, CONFIG_TYPE_GROUP);
+	}
+	usbg_stream_close(&w, CONFIG_TYPE_LIST);
+
+	usbg_stream_open(&w, USBG_CHANGED_TAG, CONFIG_TYPE_LIST);
+	TAILQ_FOREACH(g, &s->gadgets, gnode) {
+		ret = usbg_stream_changed_gadget(&w, g, gen);
+		if (ret != USBG_SUCCESS)
+			goto out;
 	}
+	usbg_stream_close(&w, CONFIG_TYPE_LIST);
 
-	*c = newc;
-	ret = USBG_SUCCESS;
+	ret = w.ret;
 out:
 	return ret;
+}
 
-error:
-	ret = usbg_ret;
-error2:
-	/* We ignore returned value, if function fails
-	 * there is no way to handle it */
-	usbg_rm_config(newc, USBG_RM_RECURSE);
+static int split_function_label(const char *label, usbg_function_type *type,
+				const char **instance)
+{
+	const char *floor;
+	char buf[USBG_MAX_NAME_LENGTH];
+	int len;
+	int function_type;
+	int ret = USBG_ERROR_NOT_FOUND;
+
+	/* We assume that function type string doesn't contain '_' */
+	floor = strchr(label, '_');
+	/* if phrase before _ is longer than max name length we may
+	 * stop looking */
+	len = floor - label;
+	if (len >= USBG_MAX_NAME_LENGTH || floor == label)
+		goto out;
+
+	strncpy(buf, label, len);
+	buf[len] = '\0';
+
+	function_type = usbg_lookup_function_type(buf);
+	if (function_type < 0)
+		goto out;
+
+	*type = (usbg_function_type)function_type;
+	*instance = floor + 1;
+
+	ret = USBG_SUCCESS;
+out:
 	return ret;
 }
 
-static int usbg_import_gadget_configs(config_setting_t *root, usbg_gadget *g)
+static void usbg_set_failed_import(config_t **to_set, config_t *failed)
 {
-	config_setting_t *node, *id_node;
-	int id;
-	usbg_config *c;
-	int ret = USBG_SUCCESS;
-	int count, i;
+	if (*to_set != NULL) {
+		config_destroy(*to_set);
+		free(*to_set);
+	}
 
-	count = config_setting_length(root);
+	*to_set = failed;
+}
 
-	for (i = 0; i < count; ++i) {
-		node = config_setting_get_elem(root, i);
-		if (!node) {
-			ret = USBG_ERROR_OTHER_ERROR;
-			break;
-		}
+static int usbg_import_function_attrs(config_setting_t *root, usbg_function *f)
+{
+	int ret = USBG_ERROR_NOT_SUPPORTED;
 
-		if (!config_setting_is_group(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			break;
-		}
+	if (!f->ops->import)
+		goto out;
 
-		/* Look for id */
-		id_node = config_setting_get_member(node, USBG_ID_TAG);
-		if (!id_node) {
-			ret = USBG_ERROR_MISSING_TAG;
-			break;
-		}
+	ret = f->ops->import(f, root);
+out:
+	return ret;
+}
 
-		if (!usbg_config_is_int(id_node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			break;
-		}
+static int usbg_get_config_node_os_desc(config_setting_t *node,
+					struct usbg_function_os_desc *f_os_desc)
+{
+	int ret;
 
-		id = config_setting_get_int(id_node);
+	ret = usbg_get_config_node_string(node, "compatible_id",
+					  &f_os_desc->compatible_id);
+	/* if error */
+	if (ret < 0)
+		return ret;
 
-		ret = usbg_import_config_run(g, node, id, &c);
-		if (ret != USBG_SUCCESS)
-			break;
-	}
+	ret = usbg_get_config_node_string(node, "sub_compatible_id",
+					  &f_os_desc->sub_compatible_id);
+	/* if error */
+	if (ret < 0)
+		return ret;
 
-	return ret;
+	return USBG_SUCCESS;
 }
 
-static int usbg_import_gadget_functions(config_setting_t *root, usbg_gadget *g)
+static int find_string(const char *str, char **array)
 {
-	config_setting_t *node, *inst_node;
-	const char *instance;
-	const char *label;
-	usbg_function *f;
+	int i;
+
+	if (!array)
+		return -ENOENT;
+
+	for (i = 0; array[i]; ++i)
+		if (strcmp(str, array[i]) == 0)
+			return i;
+
+	return -ENOENT;
+}
+
+static int usbg_import_function_os_descs(config_setting_t *root,
+					 usbg_function *f)
+{
+	config_setting_t *node;
 	int ret = USBG_SUCCESS;
+	struct usbg_function_os_desc f_os_desc;
+	char **allowed_names = f->ops->os_desc_iname;
 	int count, i;
 
 	count = config_setting_length(root);
 
 	for (i = 0; i < count; ++i) {
+		config_setting_t *interf_node;
+		const char *interface;
+
+		memset(&f_os_desc, 0, sizeof(f_os_desc));
+
 		node = config_setting_get_elem(root, i);
 		if (!node) {
 			ret = USBG_ERROR_OTHER_ERROR;
@@ -1403,326 +1621,1911 @@ static int usbg_import_gadget_functions(config_setting_t *root, usbg_gadget *g)
 			break;
 		}
 
-		/* Look for instance name */
-		inst_node = config_setting_get_member(node, USBG_INSTANCE_TAG);
-		if (!inst_node) {
+		/* Look for interface name */
+		interf_node = config_setting_get_member(node, USBG_INTERFACE_TAG);
+		if (!interf_node) {
 			ret = USBG_ERROR_MISSING_TAG;
 			break;
 		}
 
-		if (!usbg_config_is_string(inst_node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			break;
-		}
-
-		instance = config_setting_get_string(inst_node);
-		if (!instance) {
+		interface = config_setting_get_string(interf_node);
+		if (!interface) {
 			ret = USBG_ERROR_OTHER_ERROR;
 			break;
 		}
 
-		ret = usbg_import_function_run(g, node, instance, &f);
-		if (ret != USBG_SUCCESS)
+		ret = find_string(interface, allowed_names);
+		if (ret < 0) {
+			ret = USBG_ERROR_NOT_SUPPORTED;
 			break;
+		}
 
-		/* Set the label given by user */
-		label = config_setting_name(node);
-		if (!label) {
-			ret = USBG_ERROR_OTHER_ERROR;
+		ret = usbg_get_config_node_os_desc(node, &f_os_desc);
+		if (ret)
 			break;
-		}
 
-		f->label = strdup(label);
-		if (!f->label) {
-			ret = USBG_ERROR_NO_MEM;
+		ret = usbg_set_interf_os_desc(f, interface, &f_os_desc);
+		/* no need to free as strings are allocated by libconfig */
+		if (ret)
 			break;
-		}
 	}
 
 	return ret;
 }
 
-static int usbg_import_gadget_strs_lang(config_setting_t *root, usbg_gadget *g)
+static int usbg_import_function_run(usbg_gadget *g, config_setting_t *root,
+				    const char *instance, usbg_function **f)
 {
 	config_setting_t *node;
-	int lang;
-	struct usbg_gadget_strs g_strs = {0};
-	int ret = USBG_ERROR_INVALID_TYPE;
+	const char *type_str;
+	int usbg_ret;
+	int function_type;
+	int ret = USBG_ERROR_MISSING_TAG;
 
-	node = config_setting_get_member(root, USBG_LANG_TAG);
-	if (!node) {
-		ret = USBG_ERROR_MISSING_TAG;
+	/* function type is mandatory */
+	node = config_setting_get_member(root, USBG_TYPE_TAG);
+	if (!node)
 		goto out;
-	}
 
-	if (!usbg_config_is_int(node))
+	type_str = config_setting_get_string(node);
+	if (!type_str) {
+		ret = USBG_ERROR_INVALID_TYPE;
 		goto out;
+	}
 
-	lang = config_setting_get_int(node);
-
-	/* Auto truncate the string to max length */
-#define GET_OPTIONAL_GADGET_STR(NAME, FIELD)				\
-	do {								\
-		node = config_setting_get_member(root, #NAME);		\
-		if (node) {						\
-			if (!usbg_config_is_string(node))		\
-				goto out;				\
-			g_strs.FIELD = (char *)config_setting_get_string(node); \
-		}							\
-	} while (0)
+	/* Check if this type is supported */
+	function_type = usbg_lookup_function_type(type_str);
+	if (function_type < 0) {
+		ret = USBG_ERROR_NOT_SUPPORTED;
+		goto out;
+	}
 
-	GET_OPTIONAL_GADGET_STR(manufacturer, manufacturer);
-	GET_OPTIONAL_GADGET_STR(product, product);
-	GET_OPTIONAL_GADGET_STR(serialnumber, serial);
+	/* All data collected, let's get to work and create this function */
+	ret = usbg_create_function(g, (usbg_function_type)function_type,
+				   instance, NULL, f);
 
-#undef GET_OPTIONAL_GADGET_STR
+	if (ret != USBG_SUCCESS)
+		goto out;
 
-	ret = usbg_set_gadget_strs(g, lang, &g_strs);
+	/* Attrs are optional */
+	node = config_setting_get_member(root, USBG_ATTRS_TAG);
+	if (node) {
+		usbg_ret = usbg_import_function_attrs(node, *f);
+		if (usbg_ret != USBG_SUCCESS) {
+			ret = usbg_ret;
+			goto out;
+		}
+	}
 
-out:
-	return ret;
+	node = config_setting_get_member(root, USBG_OS_DESCS_TAG);
+	if (node) {
+		usbg_ret = usbg_import_function_os_descs(node, *f);
+		if (usbg_ret != USBG_SUCCESS) {
+			ret = usbg_ret;
+			goto out;
+		}
+	}
+
+out:
+	return ret;
 }
 
-static int usbg_import_gadget_strings(config_setting_t *root, usbg_gadget *g)
+static usbg_function *usbg_lookup_function(usbg_gadget *g, const char *label)
 {
-	config_setting_t *node;
-	int ret = USBG_SUCCESS;
-	int count, i;
-
-	count = config_setting_length(root);
+	usbg_function *f;
+	int usbg_ret;
 
-	for (i = 0; i < count; ++i) {
-		node = config_setting_get_elem(root, i);
-		if (!config_setting_is_group(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
+	/* check if such function has also been imported */
+	TAILQ_FOREACH(f, &g->functions, fnode) {
+		if (f->label && !strcmp(f->label, label))
 			break;
-		}
+	}
 
-		ret = usbg_import_gadget_strs_lang(node, g);
-		if (ret != USBG_SUCCESS)
-			break;
+	/* if not let's check if label follows the naming convention */
+	if (!f) {
+		usbg_function_type type;
+		const char *instance;
+
+		usbg_ret = split_function_label(label, &type, &instance);
+		if (usbg_ret != USBG_SUCCESS)
+			goto out;
+
+		/* check if such function exist */
+		f = usbg_get_function(g, type, instance);
 	}
 
-	return ret;
+out:
+	return f;
 }
 
-
-static int usbg_import_gadget_attrs(config_setting_t *root, usbg_gadget *g)
+/* We have a string which should match with one of function names */
+static int usbg_import_binding_string(config_setting_t *root, usbg_config *c)
 {
-	config_setting_t *node;
-	int usbg_ret;
-	int val;
-	int ret = USBG_ERROR_INVALID_TYPE;
-
-#define GET_OPTIONAL_GADGET_ATTR(NAME, FUNC_END, TYPE)			\
-	do {								\
-		node = config_setting_get_member(root, #NAME);		\
-		if (node) {						\
-			if (!usbg_config_is_int(node))			\
-				goto out;				\
-			val = config_setting_get_int(node);		\
-			if (val < 0 || val > ((1L << (sizeof(TYPE)*8)) - 1)) { \
-				ret = USBG_ERROR_INVALID_VALUE;		\
-				goto out;				\
-			}						\
-			usbg_ret = usbg_set_gadget_##FUNC_END(g, (TYPE)val); \
-			if (usbg_ret != USBG_SUCCESS) {			\
-				ret = usbg_ret;				\
-				goto out;				\
-			}						\
-		}							\
-	} while (0)
+	const char *func_label;
+	usbg_function *target;
+	int ret;
 
-	GET_OPTIONAL_GADGET_ATTR(bcdUSB, device_bcd_usb, uint16_t);
-	GET_OPTIONAL_GADGET_ATTR(bDeviceClass, device_class, uint8_t);
-	GET_OPTIONAL_GADGET_ATTR(bDeviceSubClass, device_subclass, uint8_t);
-	GET_OPTIONAL_GADGET_ATTR(bDeviceProtocol, device_protocol, uint8_t);
-	GET_OPTIONAL_GADGET_ATTR(bMaxPacketSize0, device_max_packet, uint8_t);
-	GET_OPTIONAL_GADGET_ATTR(idVendor, vendor_id, uint16_t);
-	GET_OPTIONAL_GADGET_ATTR(idProduct, product_id, uint16_t);
-	GET_OPTIONAL_GADGET_ATTR(bcdDevice, device_bcd_device, uint16_t);
+	func_label = config_setting_get_string(root);
+	if (!func_label) {
+		ret = USBG_ERROR_OTHER_ERROR;
+		goto out;
+	}
 
-#undef GET_OPTIONAL_GADGET_ATTR
+	target = usbg_lookup_function(c->parent, func_label);
+	if (!target) {
+		ret = USBG_ERROR_NOT_FOUND;
+		goto out;
+	}
 
-	/* Empty attrs section is also considered to be valid */
-	ret = USBG_SUCCESS;
+	ret = usbg_add_config_function(c, target->name, target);
 out:
 	return ret;
-
 }
 
-static int usbg_import_gadget_os_descs(config_setting_t *root, usbg_gadget *g)
+static int usbg_import_binding_group(config_setting_t *root, usbg_config *c)
 {
 	config_setting_t *node;
-	int usbg_ret;
-	int val;
-	int ret = USBG_ERROR_INVALID_TYPE;
-	struct usbg_gadget_os_descs g_os_descs = {0};
+	const char *func_label, *name;
+	usbg_function *target;
+	int ret;
 
-#define GET_OPTIONAL_GADGET_ATTR(NAME, FIELD, TYPE)			\
-	do {								\
-		node = config_setting_get_member(root, #NAME);		\
-		if (node) {						\
-			if (!usbg_config_is_int(node))			\
-				goto out;				\
-			val = config_setting_get_int(node);		\
-			if (val < 0 || val > ((1L << (sizeof(TYPE)*8)) - 1)) { \
-				ret = USBG_ERROR_INVALID_VALUE;		\
-				goto out;				\
-			}						\
-			g_os_descs.FIELD = (TYPE)val;			\
-		}							\
-	} while (0)
+	node = config_setting_get_member(root, USBG_FUNCTION_TAG);
+	if (!node) {
+		ret = USBG_ERROR_MISSING_TAG;
+		goto out;
+	}
 
-	GET_OPTIONAL_GADGET_ATTR(use, use, bool);
-	GET_OPTIONAL_GADGET_ATTR(b_vendor_code, b_vendor_code, uint8_t);
+	/* It is allowed to provide link to existing function
+	 * or define unlabeled instance of function in this place */
+	if (usbg_config_is_string(node)) {
+		func_label = config_setting_get_string(node);
+		if (!func_label) {
+			ret = USBG_ERROR_OTHER_ERROR;
+			goto out;
+		}
 
-#undef GET_OPTIONAL_GADGET_ATTR
+		target = usbg_lookup_function(c->parent, func_label);
+		if (!target) {
+			ret = USBG_ERROR_NOT_FOUND;
+			goto out;
+		}
+	} else if (config_setting_is_group(node)) {
+		config_setting_t *inst_node;
+		const char *instance;
 
-	node = config_setting_get_member(root, "qw_sign");
-	if (node) {
-		if (!usbg_config_is_string(node))
+		inst_node = config_setting_get_member(node, USBG_INSTANCE_TAG);
+		if (!inst_node) {
+			ret = USBG_ERROR_MISSING_TAG;
 			goto out;
-		/*
-		 * No need to strdup() the string
-		 * as memory is owned by libconfig
-		 */
-		g_os_descs.qw_sign = (char *)config_setting_get_string(node);
-	}
+		}
 
-	ret = usbg_set_gadget_os_descs(g, &g_os_descs);
+		instance = config_setting_get_string(inst_node);
+		if (!instance) {
+			ret = USBG_ERROR_OTHER_ERROR;
+			goto out;
+		}
 
-	/*
-	 * Configs are optional, because some config may not be
-	 * fully configured and not contain any config yet
-	 */
-	node = config_setting_get_member(root, USBG_CONFIG_ID_TAG);
-	if (node) {
-		usbg_config *target;
-		if (!usbg_config_is_int(node))
+		ret = usbg_import_function_run(c->parent, node,
+					       instance, &target);
+		if (ret != USBG_SUCCESS)
 			goto out;
+	} else {
+		ret = USBG_ERROR_INVALID_TYPE;
+		goto out;
+	}
 
-		val = config_setting_get_int(node);
-		target = usbg_get_config(g, val, NULL);
-		if (!target) {
-			ret = USBG_ERROR_NOT_FOUND;
+	/* Name tag is optional. When no such tag, default one will be used */
+	node = config_setting_get_member(root, USBG_NAME_TAG);
+	if (node) {
+		if (!usbg_config_is_string(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
 			goto out;
 		}
 
-		usbg_ret = usbg_set_os_desc_config(g, target);
-		if (usbg_ret != USBG_SUCCESS)
+		name = config_setting_get_string(node);
+		if (!name) {
+			ret = USBG_ERROR_OTHER_ERROR;
 			goto out;
+		}
+	} else {
+		name = target->name;
 	}
 
+	ret = usbg_add_config_function(c, name, target);
 out:
 	return ret;
 }
 
-static int usbg_import_gadget_run(usbg_state *s, config_setting_t *root,
-				  const char *name, usbg_gadget **g)
+static int usbg_import_config_bindings(config_setting_t *root, usbg_config *c)
 {
 	config_setting_t *node;
-	usbg_gadget *newg;
-	int usbg_ret;
-	int ret = USBG_ERROR_MISSING_TAG;
+	int ret = USBG_SUCCESS;
+	int count, i;
 
-	/* There is no mandatory data in gadget so let's start with
-	 * creating a new gadget */
-	usbg_ret = usbg_create_gadget(s, name, NULL, NULL, &newg);
-	if (usbg_ret != USBG_SUCCESS) {
-		ret = usbg_ret;
+	count = config_setting_length(root);
+
+	for (i = 0; i < count; ++i) {
+		node = config_setting_get_elem(root, i);
+
+		if (usbg_config_is_string(node))
+			ret = usbg_import_binding_string(node, c);
+		else if (config_setting_is_group(node))
+			ret = usbg_import_binding_group(node, c);
+		else
+			ret = USBG_ERROR_INVALID_TYPE;
+
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	return ret;
+}
+
+static int usbg_import_config_strs_lang(config_setting_t *root, usbg_config *c)
+{
+	config_setting_t *node;
+	int lang;
+	struct usbg_config_strs c_strs = {0};
+	int ret = USBG_ERROR_INVALID_TYPE;
+
+	node = config_setting_get_member(root, USBG_LANG_TAG);
+	if (!node) {
+		ret = USBG_ERROR_MISSING_TAG;
 		goto out;
 	}
 
-	/* Attrs are optional */
+	if (!usbg_config_is_int(node))
+		goto out;
+
+	lang = config_setting_get_int(node);
+
+	/* Configuration string is optional */
+	node = config_setting_get_member(root, "configuration");
+	if (node) {
+		if (!usbg_config_is_string(node))
+			goto out;
+
+		c_strs.configuration = (char *)config_setting_get_string(node);
+	}
+
+	ret = usbg_set_config_strs(c, lang, &c_strs);
+
+out:
+	return ret;
+}
+
+static int usbg_import_config_strings(config_setting_t *root, usbg_config *c)
+{
+	config_setting_t *node;
+	int ret = USBG_SUCCESS;
+	int count, i;
+
+	count = config_setting_length(root);
+
+	for (i = 0; i < count; ++i) {
+		node = config_setting_get_elem(root, i);
+		if (!config_setting_is_group(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			break;
+		}
+
+		ret = usbg_import_config_strs_lang(node, c);
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	return ret;
+}
+
+static int usbg_import_config_attrs(config_setting_t *root, usbg_config *c)
+{
+	config_setting_t *node;
+	int usbg_ret;
+	int bmAttributes, bMaxPower;
+	int ret = USBG_ERROR_INVALID_TYPE;
+
+	node = config_setting_get_member(root, "bmAttributes");
+	if (node) {
+		if (!usbg_config_is_int(node))
+			goto out;
+
+		bmAttributes = config_setting_get_int(node);
+		usbg_ret = usbg_set_config_bm_attrs(c, bmAttributes);
+		if (usbg_ret != USBG_SUCCESS) {
+			ret = usbg_ret;
+			goto out;
+		}
+	}
+
+	node = config_setting_get_member(root, "bMaxPower");
+	if (node) {
+		if (!usbg_config_is_int(node))
+			goto out;
+
+		bMaxPower = config_setting_get_int(node);
+		usbg_ret = usbg_set_config_max_power(c, bMaxPower);
+		if (usbg_ret != USBG_SUCCESS) {
+			ret = usbg_ret;
+			goto out;
+		}
+	}
+
+	/* Empty attrs section is also considered to be valid */
+	ret = USBG_SUCCESS;
+out:
+	return ret;
+
+}
+
+static int usbg_import_config_run(usbg_gadget *g, config_setting_t *root,
+				  int id, usbg_config **c)
+{
+	config_setting_t *node;
+	const char *name;
+	usbg_config *newc;
+	int usbg_ret;
+	int ret = USBG_ERROR_MISSING_TAG;
+
+	/*
+	 * Label is mandatory,
+	 * if attrs aren't present defaults are used
+	 */
+	node = config_setting_get_member(root, USBG_NAME_TAG);
+	if (!node)
+		goto out;
+
+	name = config_setting_get_string(node);
+	if (!name) {
+		ret = USBG_ERROR_INVALID_TYPE;
+		goto out;
+	}
+
+	/* Required data collected, let's create our config */
+	usbg_ret = usbg_create_config(g, id, name, NULL, NULL, &newc);
+	if (usbg_ret != USBG_SUCCESS) {
+		ret = usbg_ret;
+		goto out;
+	}
+
+	/* Attrs are optional */
+	node = config_setting_get_member(root, USBG_ATTRS_TAG);
+	if (node) {
+		if (!config_setting_is_group(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			goto error2;
+		}
+
+		usbg_ret = usbg_import_config_attrs(node, newc);
+		if (usbg_ret != USBG_SUCCESS)
+			goto error;
+	}
+
+	/* Strings are also optional */
+	node = config_setting_get_member(root, USBG_STRINGS_TAG);
+	if (node) {
+		if (!config_setting_is_list(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			goto error2;
+		}
+
+		usbg_ret = usbg_import_config_strings(node, newc);
+		if (usbg_ret != USBG_SUCCESS)
+			goto error;
+	}
+
+	/* Functions too, because some config may not be
+	 * fully configured and not contain any function */
+	node = config_setting_get_member(root, USBG_FUNCTIONS_TAG);
+	if (node) {
+		if (!config_setting_is_list(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			goto error2;
+		}
+
+		usbg_ret = usbg_import_config_bindings(node, newc);
+		if (usbg_ret != USBG_SUCCESS)
+			goto error;
+	}
+
+	*c = newc;
+	ret = USBG_SUCCESS;
+out:
+	return ret;
+
+error:
+	ret = usbg_ret;
+error2:
+	/* We ignore returned value, if function fails
+	 * there is no way to handle it */
+	usbg_rm_config(newc, USBG_RM_RECURSE);
+	return ret;
+}
+
+static int usbg_import_gadget_configs(config_setting_t *root, usbg_gadget *g)
+{
+	config_setting_t *node, *id_node;
+	int id;
+	usbg_config *c;
+	int ret = USBG_SUCCESS;
+	int count, i;
+
+	count = config_setting_length(root);
+
+	for (i = 0; i < count; ++i) {
+		node = config_setting_get_elem(root, i);
+		if (!node) {
+			ret = USBG_ERROR_OTHER_ERROR;
+			break;
+		}
+
+		if (!config_setting_is_group(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			break;
+		}
+
+		/* Look for id */
+		id_node = config_setting_get_member(node, USBG_ID_TAG);
+		if (!id_node) {
+			ret = USBG_ERROR_MISSING_TAG;
+			break;
+		}
+
+		if (!usbg_config_is_int(id_node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			break;
+		}
+
+		id = config_setting_get_int(id_node);
+
+		ret = usbg_import_config_run(g, node, id, &c);
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	return ret;
+}
+
+static int usbg_import_gadget_functions(config_setting_t *root, usbg_gadget *g)
+{
+	config_setting_t *node, *inst_node;
+	const char *instance;
+	const char *label;
+	usbg_function *f;
+	int ret = USBG_SUCCESS;
+	int count, i;
+
+	count = config_setting_length(root);
+
+	for (i = 0; i < count; ++i) {
+		node = config_setting_get_elem(root, i);
+		if (!node) {
+			ret = USBG_ERROR_OTHER_ERROR;
+			break;
+		}
+
+		if (!config_setting_is_group(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			break;
+		}
+
+		/* Look for instance name */
+		inst_node = config_setting_get_member(node, USBG_INSTANCE_TAG);
+		if (!inst_node) {
+			ret = USBG_ERROR_MISSING_TAG;
+			break;
+		}
+
+		if (!usbg_config_is_string(inst_node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			break;
+		}
+
+		instance = config_setting_get_string(inst_node);
+		if (!instance) {
+			ret = USBG_ERROR_OTHER_ERROR;
+			break;
+		}
+
+		ret = usbg_import_function_run(g, node, instance, &f);
+		if (ret != USBG_SUCCESS)
+			break;
+
+		/* Set the label given by user */
+		label = config_setting_name(node);
+		if (!label) {
+			ret = USBG_ERROR_OTHER_ERROR;
+			break;
+		}
+
+		f->label = strdup(label);
+		if (!f->label) {
+			ret = USBG_ERROR_NO_MEM;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+static int usbg_import_gadget_strs_lang(config_setting_t *root, usbg_gadget *g)
+{
+	config_setting_t *node;
+	int lang;
+	struct usbg_gadget_strs g_strs = {0};
+	int ret = USBG_ERROR_INVALID_TYPE;
+
+	node = config_setting_get_member(root, USBG_LANG_TAG);
+	if (!node) {
+		ret = USBG_ERROR_MISSING_TAG;
+		goto out;
+	}
+
+	if (!usbg_config_is_int(node))
+		goto out;
+
+	lang = config_setting_get_int(node);
+
+	/* Auto truncate the string to max length */
+#define GET_OPTIONAL_GADGET_STR(NAME, FIELD)				\
+	do {								\
+		node = config_setting_get_member(root, #NAME);		\
+		if (node) {						\
+			if (!usbg_config_is_string(node))		\
+				goto out;				\
+			g_strs.FIELD = (char *)config_setting_get_string(node); \
+		}							\
+	} while (0)
+
+	GET_OPTIONAL_GADGET_STR(manufacturer, manufacturer);
+	GET_OPTIONAL_GADGET_STR(product, product);
+	GET_OPTIONAL_GADGET_STR(serialnumber, serial);
+
+#undef GET_OPTIONAL_GADGET_STR
+
+	ret = usbg_set_gadget_strs(g, lang, &g_strs);
+
+out:
+	return ret;
+}
+
+static int usbg_import_gadget_strings(config_setting_t *root, usbg_gadget *g)
+{
+	config_setting_t *node;
+	int ret = USBG_SUCCESS;
+	int count, i;
+
+	count = config_setting_length(root);
+
+	for (i = 0; i < count; ++i) {
+		node = config_setting_get_elem(root, i);
+		if (!config_setting_is_group(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			break;
+		}
+
+		ret = usbg_import_gadget_strs_lang(node, g);
+		if (ret != USBG_SUCCESS)
+			break;
+	}
+
+	return ret;
+}
+
+
+static int usbg_import_gadget_attrs(config_setting_t *root, usbg_gadget *g)
+{
+	config_setting_t *node;
+	int usbg_ret;
+	int val;
+	int ret = USBG_ERROR_INVALID_TYPE;
+
+#define GET_OPTIONAL_GADGET_ATTR(NAME, FUNC_END, TYPE)			\
+	do {								\
+		node = config_setting_get_member(root, #NAME);		\
+		if (node) {						\
+			if (!usbg_config_is_int(node))			\
+				goto out;				\
+			val = config_setting_get_int(node);		\
+			if (val < 0 || val > ((1L << (sizeof(TYPE)*8)) - 1)) { \
+				ret = USBG_ERROR_INVALID_VALUE;		\
+				goto out;				\
+			}						\
+			usbg_ret = usbg_set_gadget_##FUNC_END(g, (TYPE)val); \
+			if (usbg_ret != USBG_SUCCESS) {			\
+				ret = usbg_ret;				\
+				goto out;				\
+			}						\
+		}							\
+	} while (0)
+
+	GET_OPTIONAL_GADGET_ATTR(bcdUSB, device_bcd_usb, uint16_t);
+	GET_OPTIONAL_GADGET_ATTR(bDeviceClass, device_class, uint8_t);
+	GET_OPTIONAL_GADGET_ATTR(bDeviceSubClass, device_subclass, uint8_t);
+	GET_OPTIONAL_GADGET_ATTR(bDeviceProtocol, device_protocol, uint8_t);
+	GET_OPTIONAL_GADGET_ATTR(bMaxPacketSize0, device_max_packet, uint8_t);
+	GET_OPTIONAL_GADGET_ATTR(idVendor, vendor_id, uint16_t);
+	GET_OPTIONAL_GADGET_ATTR(idProduct, product_id, uint16_t);
+	GET_OPTIONAL_GADGET_ATTR(bcdDevice, device_bcd_device, uint16_t);
+
+#undef GET_OPTIONAL_GADGET_ATTR
+
+	/* Empty attrs section is also considered to be valid */
+	ret = USBG_SUCCESS;
+out:
+	return ret;
+
+}
+
+static int usbg_import_gadget_os_descs(config_setting_t *root, usbg_gadget *g)
+{
+	config_setting_t *node;
+	int usbg_ret;
+	int val;
+	int ret = USBG_ERROR_INVALID_TYPE;
+	struct usbg_gadget_os_descs g_os_descs = {0};
+
+#define GET_OPTIONAL_GADGET_ATTR(NAME, FIELD, TYPE)			\
+	do {								\
+		node = config_setting_get_member(root, #NAME);		\
+		if (node) {						\
+			if (!usbg_config_is_int(node))			\
+				goto out;				\
+			val = config_setting_get_int(node);		\
+			if (val < 0 || val > ((1L << (sizeof(TYPE)*8)) - 1)) { \
+				ret = USBG_ERROR_INVALID_VALUE;		\
+				goto out;				\
+			}						\
+			g_os_descs.FIELD = (TYPE)val;			\
+		}							\
+	} while (0)
+
+	GET_OPTIONAL_GADGET_ATTR(use, use, bool);
+	GET_OPTIONAL_GADGET_ATTR(b_vendor_code, b_vendor_code, uint8_t);
+
+#undef GET_OPTIONAL_GADGET_ATTR
+
+	node = config_setting_get_member(root, "qw_sign");
+	if (node) {
+		if (!usbg_config_is_string(node))
+			goto out;
+		/*
+		 * No need to strdup() the string
+		 * as memory is owned by libconfig
+		 */
+		g_os_descs.qw_sign = (char *)config_setting_get_string(node);
+	}
+
+	ret = usbg_set_gadget_os_descs(g, &g_os_descs);
+
+	/*
+	 * Configs are optional, because some config may not be
+	 * fully configured and not contain any config yet
+	 */
+	node = config_setting_get_member(root, USBG_CONFIG_ID_TAG);
+	if (node) {
+		usbg_config *target;
+		if (!usbg_config_is_int(node))
+			goto out;
+
+		val = config_setting_get_int(node);
+		target = usbg_get_config(g, val, NULL);
+		if (!target) {
+			ret = USBG_ERROR_NOT_FOUND;
+			goto out;
+		}
+
+		usbg_ret = usbg_set_os_desc_config(g, target);
+		if (usbg_ret != USBG_SUCCESS)
+			goto out;
+	}
+
+out:
+	return ret;
+}
+
+static int usbg_import_gadget_run(usbg_state *s, config_setting_t *root,
+				  const char *name, usbg_gadget **g)
+{
+	config_setting_t *node;
+	usbg_gadget *newg;
+	int usbg_ret;
+	int ret = USBG_ERROR_MISSING_TAG;
+
+	/* There is no mandatory data in gadget so let's start with
+	 * creating a new gadget */
+	usbg_ret = usbg_create_gadget(s, name, NULL, NULL, &newg);
+	if (usbg_ret != USBG_SUCCESS) {
+		ret = usbg_ret;
+		goto out;
+	}
+
+	/* Attrs are optional */
+	node = config_setting_get_member(root, USBG_ATTRS_TAG);
+	if (node) {
+		if (!config_setting_is_group(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			goto error2;
+		}
+
+		usbg_ret = usbg_import_gadget_attrs(node, newg);
+		if (usbg_ret != USBG_SUCCESS)
+			goto error;
+	}
+
+	/* Strings are also optional */
+	node = config_setting_get_member(root, USBG_STRINGS_TAG);
+	if (node) {
+		if (!config_setting_is_list(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			goto error2;
+		}
+
+		usbg_ret = usbg_import_gadget_strings(node, newg);
+		if (usbg_ret != USBG_SUCCESS)
+			goto error;
+	}
+
+	/* Functions too, because some gadgets may not be fully
+	* configured and don't have any function or have all functions
+	* defined inline in configurations */
+	node = config_setting_get_member(root, USBG_FUNCTIONS_TAG);
+	if (node) {
+		if (!config_setting_is_group(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			goto error2;
+		}
+		usbg_ret = usbg_import_gadget_functions(node, newg);
+		if (usbg_ret != USBG_SUCCESS)
+			goto error;
+	}
+
+	/* Some gadget may not be fully configured
+	 * so configs are also optional */
+	node = config_setting_get_member(root, USBG_CONFIGS_TAG);
+	if (node) {
+		if (!config_setting_is_list(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			goto error2;
+		}
+		usbg_ret = usbg_import_gadget_configs(node, newg);
+		if (usbg_ret != USBG_SUCCESS)
+			goto error;
+	}
+
+	/* OS Descriptors are optional too, read after configs */
+	node = config_setting_get_member(root, USBG_OS_DESCS_TAG);
+	if (node) {
+		if (!config_setting_is_group(node)) {
+			ret = USBG_ERROR_INVALID_TYPE;
+			goto error2;
+		}
+
+		usbg_ret = usbg_import_gadget_os_descs(node, newg);
+		if (usbg_ret != USBG_SUCCESS)
+			goto error;
+	}
+
+	*g = newg;
+	ret = USBG_SUCCESS;
+out:
+	return ret;
+
+error:
+	ret = usbg_ret;
+error2:
+	/* We ignore returned value, if function fails
+	 * there is no way to handle it */
+	usbg_rm_gadget(newg, USBG_RM_RECURSE);
+	return ret;
+}
+
+int usbg_import_function(usbg_gadget *g, FILE *stream, const char *instance,
+			 usbg_function **f)
+{
+	config_t *cfg;
+	config_setting_t *root;
+	usbg_function *newf;
+	int ret, cfg_ret;
+
+	if (!g || !stream || !instance)
+		return USBG_ERROR_INVALID_PARAM;
+
+	cfg = malloc(sizeof(*cfg));
+	if (!cfg)
+		return USBG_ERROR_NO_MEM;
+
+	config_init(cfg);
+
+	cfg_ret = config_read(cfg, stream);
+	if (cfg_ret != CONFIG_TRUE) {
+		usbg_set_failed_import(&g->last_failed_import, cfg);
+		ret = USBG_ERROR_INVALID_FORMAT;
+		goto out;
+	}
+
+	/* Always successful */
+	root = config_root_setting(cfg);
+
+	ret = usbg_import_function_run(g, root, instance, &newf);
+	if (ret != USBG_SUCCESS) {
+		usbg_set_failed_import(&g->last_failed_import, cfg);
+		goto out;
+	}
+
+	if (f)
+		*f = newf;
+
+	config_destroy(cfg);
+	free(cfg);
+	/* Clean last error */
+	usbg_set_failed_import(&g->last_failed_import, NULL);
+out:
+	return ret;
+
+}
+
+int usbg_import_config(usbg_gadget *g, FILE *stream, int id,  usbg_config **c)
+{
+	config_t *cfg;
+	config_setting_t *root;
+	usbg_config *newc;
+	int ret, cfg_ret;
+
+	if (!g || !stream || id < 0)
+		return USBG_ERROR_INVALID_PARAM;
+
+	cfg = malloc(sizeof(*cfg));
+	if (!cfg)
+		return USBG_ERROR_NO_MEM;
+
+	config_init(cfg);
+
+	cfg_ret = config_read(cfg, stream);
+	if (cfg_ret != CONFIG_TRUE) {
+		usbg_set_failed_import(&g->last_failed_import, cfg);
+		ret = USBG_ERROR_INVALID_FORMAT;
+		goto out;
+	}
+
+	/* Always successful */
+	root = config_root_setting(cfg);
+
+	ret = usbg_import_config_run(g, root, id, &newc);
+	if (ret != USBG_SUCCESS) {
+		usbg_set_failed_import(&g->last_failed_import, cfg);
+		goto out;
+	}
+
+	if (c)
+		*c = newc;
+
+	config_destroy(cfg);
+	free(cfg);
+	/* Clean last error */
+	usbg_set_failed_import(&g->last_failed_import, NULL);
+out:
+	return ret;
+}
+
+static int usbg_validate_gadget_run(usbg_state *s, config_setting_t *root,
+				    bool dry_run, char *buf, int len);
+
+static int usbg_do_import_gadget(usbg_state *s, FILE *stream, const char *name,
+				 usbg_gadget **g)
+{
+	config_t *cfg;
+	config_setting_t *root;
+	usbg_gadget *newg;
+	int ret, cfg_ret;
+
+	if (!s || !stream || !name)
+		return USBG_ERROR_INVALID_PARAM;
+
+	cfg = malloc(sizeof(*cfg));
+	if (!cfg)
+		return USBG_ERROR_NO_MEM;
+
+	config_init(cfg);
+
+	cfg_ret = config_read(cfg, stream);
+	if (cfg_ret != CONFIG_TRUE) {
+		usbg_set_failed_import(&s->last_failed_import, cfg);
+		ret = USBG_ERROR_INVALID_FORMAT;
+		goto out;
+	}
+
+	/* Always successful */
+	root = config_root_setting(cfg);
+
+	/* Nothing is created for a scheme which would fail midway */
+	ret = usbg_validate_gadget_run(s, root, false, NULL, 0);
+	if (ret == USBG_SUCCESS)
+		ret = usbg_import_gadget_run(s, root, name, &newg);
+	if (ret != USBG_SUCCESS) {
+		usbg_set_failed_import(&s->last_failed_import, cfg);
+		goto out;
+	}
+
+	if (g)
+		*g = newg;
+
+	config_destroy(cfg);
+	free(cfg);
+	/* Clean last error */
+	usbg_set_failed_import(&s->last_failed_import, NULL);
+out:
+	return ret;
+}
+
+int usbg_import_gadget(usbg_state *s, FILE *stream, const char *name,
+		       usbg_gadget **g)
+{
+	struct usbg_call call;
+	int ret;
+
+	usbg_stats_begin(&call, __func__, USBG_STAT_OP_IMPORT,
+			 s ? s->path : NULL, name);
+	ret = usbg_do_import_gadget(s, stream, name, g);
+	usbg_stats_end(&call, s, ret);
+
+	return ret;
+}
+
+struct usbg_import_job {
+	pthread_t thread;
+	/* Private state, so gadgets may be created concurrently */
+	usbg_state shadow;
+	config_setting_t *root;
+	const char *name;
+	const char *udc;
+	usbg_gadget *g;
+	int ret;
+	bool started;
+};
+
+static void *usbg_import_job_run(void *data)
+{
+	struct usbg_import_job *job = data;
+
+	/* Gadget is created as part of usbg_import_state() */
+	usbg_stats_worker_begin();
+	job->ret = usbg_import_gadget_run(&job->shadow, job->root, job->name,
+					  &job->g);
+	usbg_stats_worker_end();
+	return NULL;
+}
+
+/* Everything is checked before first gadget is created */
+static int usbg_import_state_prep(usbg_state *s, config_setting_t *list,
+				  int flags, struct usbg_import_job *jobs)
+{
+	struct usbg_import_job *job;
+	usbg_udc *u;
+	int i, j, n;
+	int ret;
+
+	n = config_setting_length(list);
+	for (i = 0; i < n; ++i) {
+		job = &jobs[i];
+		job->root = config_setting_get_elem(list, i);
+		if (!config_setting_is_group(job->root))
+			return USBG_ERROR_INVALID_TYPE;
+
+		ret = usbg_validate_gadget_run(s, job->root, false, NULL, 0);
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		ret = usbg_get_config_node_string(job->root, USBG_NAME_TAG,
+						  &job->name);
+		if (ret == 0)
+			return USBG_ERROR_MISSING_TAG;
+		if (ret < 0)
+			return ret;
+
+		if (usbg_get_gadget(s, job->name))
+			return USBG_ERROR_EXIST;
+
+		for (j = 0; j < i; ++j)
+			if (!strcmp(jobs[j].name, job->name))
+				return USBG_ERROR_INVALID_VALUE;
+
+		if (flags & USBG_STATE_BIND) {
+			ret = usbg_get_config_node_string(job->root,
+							  USBG_UDC_TAG,
+							  &job->udc);
+			if (ret < 0)
+				return ret;
+		}
+
+		if (job->udc) {
+			u = usbg_get_udc(s, job->udc);
+			if (!u)
+				return USBG_ERROR_NO_DEV;
+			if (u->gadget)
+				return USBG_ERROR_BUSY;
+
+			/* Only one gadget may be bound to each UDC */
+			for (j = 0; j < i; ++j)
+				if (jobs[j].udc &&
+				    !strcmp(jobs[j].udc, job->udc))
+					return USBG_ERROR_BUSY;
+		}
+
+		job->shadow = *s;
+		TAILQ_INIT(&job->shadow.gadgets);
+		TAILQ_INIT(&job->shadow.udcs);
+		job->shadow.udc_index = NULL;
+		job->shadow.udc_count = 0;
+		job->shadow.last_failed_import = NULL;
+		job->shadow.generation = 0;
+		TAILQ_INIT(&job->shadow.tombstones);
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_import_state_run(usbg_state *s, config_setting_t *root,
+				 int flags)
+{
+	struct usbg_import_job *jobs;
+	config_setting_t *list;
+	usbg_gadget *g;
+	int i, n;
+	int ret;
+
+	list = config_setting_get_member(root, USBG_GADGETS_TAG);
+	if (!list)
+		return USBG_ERROR_MISSING_TAG;
+
+	if (!config_setting_is_list(list))
+		return USBG_ERROR_INVALID_TYPE;
+
+	n = config_setting_length(list);
+	jobs = calloc(n + 1, sizeof(*jobs));
+	if (!jobs)
+		return USBG_ERROR_NO_MEM;
+
+	ret = usbg_import_state_prep(s, list, flags, jobs);
+	if (ret != USBG_SUCCESS)
+		goto out;
+
+	/* Gadgets don't depend on each other */
+	for (i = 0; i < n; ++i) {
+		if (flags & USBG_STATE_PARALLEL)
+			jobs[i].started = !pthread_create(&jobs[i].thread, NULL,
+							  usbg_import_job_run,
+							  &jobs[i]);
+		if (!jobs[i].started) {
+			usbg_import_job_run(&jobs[i]);
+			if (jobs[i].ret != USBG_SUCCESS)
+				break;
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+		if (jobs[i].ret != USBG_SUCCESS && ret == USBG_SUCCESS)
+			ret = jobs[i].ret;
+
+		/* Leftovers of gadget removed by failed import */
+		usbg_drop_tombstones(&jobs[i].shadow, UINT64_MAX);
+
+		g = jobs[i].g;
+		if (!g)
+			continue;
+
+		TAILQ_REMOVE(&jobs[i].shadow.gadgets, g, gnode);
+		g->parent = s;
+		usbg_touch_gadget(g);
+		INSERT_TAILQ_STRING_ORDER(&s->gadgets, ghead, name, g, gnode);
+	}
+
+	for (i = 0; i < n && ret == USBG_SUCCESS; ++i)
+		if (jobs[i].udc)
+			ret = usbg_enable_gadget(jobs[i].g,
+						 usbg_get_udc(s, jobs[i].udc));
+
+	/* State is imported completely or not at all */
+	if (ret != USBG_SUCCESS) {
+		for (i = 0; i < n; ++i) {
+			if (!jobs[i].g)
+				continue;
+			if (jobs[i].g->udc)
+				usbg_disable_gadget(jobs[i].g);
+			usbg_rm_gadget(jobs[i].g, USBG_RM_RECURSE);
+		}
+	}
+
+out:
+	free(jobs);
+	return ret;
+}
+
+static int usbg_do_import_state(usbg_state *s, FILE *stream, int flags)
+{
+	config_t *cfg;
+	int ret, cfg_ret;
+
+	if (!s || !stream)
+		return USBG_ERROR_INVALID_PARAM;
+
+	cfg = malloc(sizeof(*cfg));
+	if (!cfg)
+		return USBG_ERROR_NO_MEM;
+
+	config_init(cfg);
+
+	cfg_ret = config_read(cfg, stream);
+	if (cfg_ret != CONFIG_TRUE) {
+		usbg_set_failed_import(&s->last_failed_import, cfg);
+		ret = USBG_ERROR_INVALID_FORMAT;
+		goto out;
+	}
+
+	ret = usbg_import_state_run(s, config_root_setting(cfg), flags);
+	if (ret != USBG_SUCCESS) {
+		usbg_set_failed_import(&s->last_failed_import, cfg);
+		goto out;
+	}
+
+	config_destroy(cfg);
+	free(cfg);
+	/* Clean last error */
+	usbg_set_failed_import(&s->last_failed_import, NULL);
+out:
+	return ret;
+}
+
+int usbg_import_state(usbg_state *s, FILE *stream, int flags)
+{
+	struct usbg_call call;
+	int ret;
+
+	usbg_stats_begin(&call, __func__, USBG_STAT_OP_IMPORT,
+			 s ? s->path : NULL, NULL);
+	ret = usbg_do_import_state(s, stream, flags);
+	usbg_stats_end(&call, s, ret);
+
+	return ret;
+}
+
+/*
+ * Scheme validation walks the same tree as import does, but only
+ * checks it without creating anything. Import runs it first, so
+ * a scheme which would fail midway is rejected before anything is
+ * created. Dry run also checks the scheme against kernel modules
+ * and UDCs, import leaves that to configfs: availability of function
+ * types is looked up in module database of running kernel, and
+ * bandwidth and endpoint checks read maximum speed of UDCs from sysfs
+ * and their endpoints from debugfs. Attributes of functions come from
+ * the scheme itself, configfs is not touched.
+ */
+
+#define SCHEME_FAIL(ret, ...) \
+	usbg_validation_fail(buf, len, ret, __VA_ARGS__)
+
+static int usbg_validate_int_node(config_setting_t *root, const char *name,
+				  int min, int max, char *buf, int len)
+{
+	config_setting_t *node;
+	int val;
+
+	node = config_setting_get_member(root, name);
+	if (!node)
+		return USBG_SUCCESS;
+
+	if (!usbg_config_is_int(node))
+		return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+				   "line %d: %s should be an integer",
+				   config_setting_source_line(node), name);
+
+	val = config_setting_get_int(node);
+	if (val < min || val > max)
+		return SCHEME_FAIL(USBG_ERROR_INVALID_VALUE,
+				   "line %d: %s out of range",
+				   config_setting_source_line(node), name);
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_validate_string_node(config_setting_t *root, const char *name,
+				     bool mandatory, char *buf, int len)
+{
+	config_setting_t *node;
+
+	node = config_setting_get_member(root, name);
+	if (!node)
+		return mandatory ?
+			SCHEME_FAIL(USBG_ERROR_MISSING_TAG,
+				    "line %d: missing %s",
+				    config_setting_source_line(root), name)
+			: USBG_SUCCESS;
+
+	if (!usbg_config_is_string(node))
+		return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+				   "line %d: %s should be a string",
+				   config_setting_source_line(node), name);
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_validate_strings(config_setting_t *root, const char **names,
+				 char *buf, int len)
+{
+	config_setting_t *node;
+	int count, i, j, ret;
+
+	if (!config_setting_is_list(root))
+		return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+				   "line %d: strings should be a list",
+				   config_setting_source_line(root));
+
+	count = config_setting_length(root);
+	for (i = 0; i < count; ++i) {
+		node = config_setting_get_elem(root, i);
+		if (!config_setting_is_group(node))
+			return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+					   "line %d: strings should be groups",
+					   config_setting_source_line(node));
+
+		if (!config_setting_get_member(node, USBG_LANG_TAG))
+			return SCHEME_FAIL(USBG_ERROR_MISSING_TAG,
+					   "line %d: missing %s",
+					   config_setting_source_line(node),
+					   USBG_LANG_TAG);
+
+		ret = usbg_validate_int_node(node, USBG_LANG_TAG, 0, 0xffff,
+					     buf, len);
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		for (j = 0; names[j]; ++j) {
+			ret = usbg_validate_string_node(node, names[j], false,
+							buf, len);
+			if (ret != USBG_SUCCESS)
+				return ret;
+		}
+	}
+
+	return USBG_SUCCESS;
+}
+
+/* On success type and instance of function are returned */
+static int usbg_validate_function(usbg_state *s, config_setting_t *root,
+				  bool dry_run, int *type, const char **instance,
+				  char *buf, int len)
+{
+	config_setting_t *node, *interf_node;
+	const char *type_str, *interface;
+	int count, i, ret;
+
+	node = config_setting_get_member(root, USBG_INSTANCE_TAG);
+	if (!node || !usbg_config_is_string(node))
+		return SCHEME_FAIL(node ? USBG_ERROR_INVALID_TYPE
+				   : USBG_ERROR_MISSING_TAG,
+				   "line %d: function needs %s string",
+				   config_setting_source_line(root),
+				   USBG_INSTANCE_TAG);
+	*instance = config_setting_get_string(node);
+
+	node = config_setting_get_member(root, USBG_TYPE_TAG);
+	if (!node || !usbg_config_is_string(node))
+		return SCHEME_FAIL(node ? USBG_ERROR_INVALID_TYPE
+				   : USBG_ERROR_MISSING_TAG,
+				   "line %d: function needs %s string",
+				   config_setting_source_line(root),
+				   USBG_TYPE_TAG);
+	type_str = config_setting_get_string(node);
+
+	*type = usbg_lookup_function_type(type_str);
+	if (*type < 0)
+		return SCHEME_FAIL(USBG_ERROR_NOT_SUPPORTED,
+				   "line %d: unknown function type %s",
+				   config_setting_source_line(node), type_str);
+
+	if (dry_run &&
+	    usbg_function_type_available(s, *type) == USBG_ERROR_NOT_SUPPORTED)
+		return SCHEME_FAIL(USBG_ERROR_NOT_SUPPORTED,
+				   "line %d: function %s not available in kernel",
+				   config_setting_source_line(node), type_str);
+
+	node = config_setting_get_member(root, USBG_ATTRS_TAG);
+	if (node && !config_setting_is_group(node))
+		return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+				   "line %d: %s should be a group",
+				   config_setting_source_line(node),
+				   USBG_ATTRS_TAG);
+	if (node && !function_types[*type]->import)
+		return SCHEME_FAIL(USBG_ERROR_NOT_SUPPORTED,
+				   "line %d: attributes of %s cannot be imported",
+				   config_setting_source_line(node), type_str);
+
+	node = config_setting_get_member(root, USBG_OS_DESCS_TAG);
+	if (!node)
+		return USBG_SUCCESS;
+
+	count = config_setting_length(node);
+	for (i = 0; i < count; ++i) {
+		config_setting_t *os_desc = config_setting_get_elem(node, i);
+
+		if (!config_setting_is_group(os_desc))
+			return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+					   "line %d: OS descriptor should be a group",
+					   config_setting_source_line(os_desc));
+
+		interf_node = config_setting_get_member(os_desc,
+							USBG_INTERFACE_TAG);
+		interface = interf_node ?
+			config_setting_get_string(interf_node) : NULL;
+		if (!interface)
+			return SCHEME_FAIL(USBG_ERROR_MISSING_TAG,
+					   "line %d: missing %s",
+					   config_setting_source_line(os_desc),
+					   USBG_INTERFACE_TAG);
+
+		if (find_string(interface, function_types[*type]->os_desc_iname) < 0)
+			return SCHEME_FAIL(USBG_ERROR_NOT_SUPPORTED,
+					   "line %d: %s has no interface %s",
+					   config_setting_source_line(os_desc),
+					   type_str, interface);
+
+		ret = usbg_validate_string_node(os_desc, "compatible_id",
+						false, buf, len);
+		if (ret == USBG_SUCCESS)
+			ret = usbg_validate_string_node(os_desc,
+							"sub_compatible_id",
+							false, buf, len);
+		if (ret != USBG_SUCCESS)
+			return ret;
+	}
+
+	return USBG_SUCCESS;
+}
+
+/*
+ * Function defined in functions section of scheme or inline in binding,
+ * the latter has no label and may be referenced only as type_instance.
+ */
+struct usbg_scheme_func {
+	const char *label;
+	int type;
+	const char *instance;
+	config_setting_t *node;
+};
+
+static int usbg_validate_functions(usbg_state *s, config_setting_t *root,
+				   bool dry_run, struct usbg_scheme_func *funcs,
+				   int *nfuncs, char *buf, int len)
+{
+	struct usbg_scheme_func *f;
+	config_setting_t *node;
+	int count, i, j, ret;
+
+	if (!config_setting_is_group(root))
+		return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+				   "line %d: functions should be a group",
+				   config_setting_source_line(root));
+
+	count = config_setting_length(root);
+	for (i = 0; i < count; ++i) {
+		node = config_setting_get_elem(root, i);
+		if (!config_setting_is_group(node))
+			return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+					   "line %d: function should be a group",
+					   config_setting_source_line(node));
+
+		f = &funcs[*nfuncs];
+		f->label = config_setting_name(node);
+		f->node = node;
+		ret = usbg_validate_function(s, node, dry_run, &f->type,
+					     &f->instance, buf, len);
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		for (j = 0; j < *nfuncs; ++j)
+			if (funcs[j].type == f->type &&
+			    !strcmp(funcs[j].instance, f->instance))
+				return SCHEME_FAIL(USBG_ERROR_EXIST,
+						   "line %d: function %s.%s defined twice",
+						   config_setting_source_line(node),
+						   usbg_get_function_type_str(f->type),
+						   f->instance);
+		++*nfuncs;
+	}
+
+	return USBG_SUCCESS;
+}
+
+/* Same rules as usbg_lookup_function() uses during import */
+static struct usbg_scheme_func *usbg_scheme_find_function(
+	struct usbg_scheme_func *funcs, int nfuncs, const char *label)
+{
+	usbg_function_type type;
+	const char *instance;
+	int i;
+
+	for (i = 0; i < nfuncs; ++i)
+		if (funcs[i].label && !strcmp(funcs[i].label, label))
+			return &funcs[i];
+
+	if (split_function_label(label, &type, &instance) != USBG_SUCCESS)
+		return NULL;
+
+	for (i = 0; i < nfuncs; ++i)
+		if (funcs[i].type == type && !strcmp(funcs[i].instance, instance))
+			return &funcs[i];
+
+	return NULL;
+}
+
+/* Kernel default is used if attribute is not set in scheme */
+static int usbg_scheme_attr_int(config_setting_t *attrs, const char *name,
+				int def)
+{
+	config_setting_t *node;
+
+	node = attrs ? config_setting_get_member(attrs, name) : NULL;
+
+	return node && usbg_config_is_int(node) ?
+		config_setting_get_int(node) : def;
+}
+
+static uint64_t usbg_scheme_function_bandwidth(int type,
+					       config_setting_t *func,
+					       usbg_speed speed)
+{
+	config_setting_t *attrs, *node;
+	const char *sync;
+
+	attrs = config_setting_get_member(func, USBG_ATTRS_TAG);
+
+	switch (type) {
+	case USBG_F_UAC2:
+		node = attrs ? config_setting_get_member(attrs, "c_sync") : NULL;
+		sync = node && usbg_config_is_string(node) ?
+			config_setting_get_string(node) : "async";
+		return usbg_audio_bandwidth(speed,
+				usbg_scheme_attr_int(attrs, "c_chmask", 0x3),
+				usbg_scheme_attr_int(attrs, "c_srate", 48000),
+				usbg_scheme_attr_int(attrs, "c_ssize", 2),
+				usbg_scheme_attr_int(attrs, "c_hs_bint", 1),
+				!strcmp(sync, "async")) +
+			usbg_audio_bandwidth(speed,
+				usbg_scheme_attr_int(attrs, "p_chmask", 0x3),
+				usbg_scheme_attr_int(attrs, "p_srate", 48000),
+				usbg_scheme_attr_int(attrs, "p_ssize", 2),
+				usbg_scheme_attr_int(attrs, "p_hs_bint", 1),
+				false);
+	case USBG_F_UVC:
+		node = attrs ? config_setting_get_member(attrs, "config") : NULL;
+		return usbg_video_bandwidth(speed,
+				usbg_scheme_attr_int(node, "streaming_maxpacket", 1024),
+				usbg_scheme_attr_int(node, "streaming_maxburst", 0),
+				usbg_scheme_attr_int(node, "streaming_interval", 1));
+	case USBG_F_HID:
+		return usbg_hid_bandwidth(speed,
+				usbg_scheme_attr_int(attrs, "report_length", 0));
+	default:
+		return 0;
+	}
+}
+
+static void usbg_scheme_function_ep_budget(int type, config_setting_t *func,
+					   struct usbg_ep_budget *b)
+{
+	static const char *controls_names[] = {
+		"p_mute_present", "p_volume_present",
+		"c_mute_present", "c_volume_present",
+	};
+	config_setting_t *attrs, *node;
+	bool controls = false, present;
+	int i;
+
+	if (type != USBG_F_UAC2) {
+		usbg_type_ep_budget(type, b);
+		return;
+	}
+
+	attrs = config_setting_get_member(func, USBG_ATTRS_TAG);
+	node = attrs ? config_setting_get_member(attrs, "c_sync") : NULL;
+
+	/* Kernel enables all controls by default */
+	for (i = 0; i < ARRAY_SIZE(controls_names); ++i) {
+		present = true;
+		if (attrs)
+			usbg_get_config_node_bool(attrs, controls_names[i],
+						  &present);
+		controls = controls || present;
+	}
+
+	usbg_uac2_ep_budget(usbg_scheme_attr_int(attrs, "c_chmask", 0x3),
+			    usbg_scheme_attr_int(attrs, "p_chmask", 0x3),
+			    !node || !usbg_config_is_string(node) ||
+			    !strcmp(config_setting_get_string(node), "async"),
+			    controls, b);
+}
+
+/* Inline function is visible to bindings which follow it, as in import */
+static int usbg_scheme_add_inline_function(struct usbg_scheme_func **funcs,
+					   int *nfuncs, config_setting_t *node,
+					   int type, const char *instance,
+					   char *buf, int len)
+{
+	struct usbg_scheme_func *f;
+	int i;
+
+	for (i = 0; i < *nfuncs; ++i)
+		if ((*funcs)[i].type == type &&
+		    !strcmp((*funcs)[i].instance, instance))
+			return SCHEME_FAIL(USBG_ERROR_EXIST,
+					   "line %d: function %s.%s defined twice",
+					   config_setting_source_line(node),
+					   usbg_get_function_type_str(type),
+					   instance);
+
+	f = realloc(*funcs, (*nfuncs + 1) * sizeof(*f));
+	if (!f)
+		return USBG_ERROR_NO_MEM;
+
+	*funcs = f;
+	f = &f[(*nfuncs)++];
+	f->label = NULL;
+	f->type = type;
+	f->instance = instance;
+	f->node = node;
+
+	return USBG_SUCCESS;
+}
+
+/* On success type and definition of bound function are returned */
+static int usbg_validate_binding(usbg_state *s, config_setting_t *node,
+				 bool dry_run,
+				 struct usbg_scheme_func **funcs, int *nfuncs,
+				 int *type, config_setting_t **func,
+				 char *buf, int len)
+{
+	struct usbg_scheme_func *f;
+	config_setting_t *func_node;
+	const char *label;
+	int ret;
+
+	*func = NULL;
+
+	if (config_setting_is_group(node)) {
+		ret = usbg_validate_string_node(node, USBG_NAME_TAG, false,
+						buf, len);
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		func_node = config_setting_get_member(node, USBG_FUNCTION_TAG);
+		if (!func_node)
+			return SCHEME_FAIL(USBG_ERROR_MISSING_TAG,
+					   "line %d: missing %s",
+					   config_setting_source_line(node),
+					   USBG_FUNCTION_TAG);
+		node = func_node;
+
+		/* Function defined inline */
+		if (config_setting_is_group(node)) {
+			*func = node;
+			ret = usbg_validate_function(s, node, dry_run, type,
+						     &label, buf, len);
+			if (ret != USBG_SUCCESS)
+				return ret;
+
+			return usbg_scheme_add_inline_function(funcs, nfuncs,
+							       node, *type,
+							       label, buf,
+							       len);
+		}
+	}
+
+	if (!usbg_config_is_string(node))
+		return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+				   "line %d: binding should be a string or a group",
+				   config_setting_source_line(node));
+
+	label = config_setting_get_string(node);
+	f = usbg_scheme_find_function(*funcs, *nfuncs, label);
+	if (!f)
+		return SCHEME_FAIL(USBG_ERROR_NOT_FOUND,
+				   "line %d: function %s not defined",
+				   config_setting_source_line(node), label);
+
+	*type = f->type;
+	*func = f->node;
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_validate_configs(usbg_state *s, config_setting_t *root,
+				 bool dry_run,
+				 struct usbg_scheme_func **funcs, int *nfuncs,
+				 int *ids, char *buf, int len)
+{
+	static const char *str_names[] = { "configuration", NULL };
+	config_setting_t *node, *attr, *func;
+	usbg_speed speed = USBG_SPEED_UNKNOWN;
+	struct usbg_ep_budget b, total;
+	uint64_t used, available;
+	bool endpoints_read = false;
+	int endpoints = USBG_ERROR_NOT_SUPPORTED;
+	int count, nbindings, i, j, type, ret;
+
+	if (!config_setting_is_list(root))
+		return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+				   "line %d: configs should be a list",
+				   config_setting_source_line(root));
+
+	count = config_setting_length(root);
+	for (i = 0; i < count; ++i) {
+		node = config_setting_get_elem(root, i);
+		if (!config_setting_is_group(node))
+			return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+					   "line %d: config should be a group",
+					   config_setting_source_line(node));
+
+		if (!config_setting_get_member(node, USBG_ID_TAG))
+			return SCHEME_FAIL(USBG_ERROR_MISSING_TAG,
+					   "line %d: missing %s",
+					   config_setting_source_line(node),
+					   USBG_ID_TAG);
+
+		ret = usbg_validate_int_node(node, USBG_ID_TAG, 1, 255,
+					     buf, len);
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		ids[i] = config_setting_get_int(
+			config_setting_get_member(node, USBG_ID_TAG));
+		for (j = 0; j < i; ++j)
+			if (ids[j] == ids[i])
+				return SCHEME_FAIL(USBG_ERROR_EXIST,
+						   "line %d: duplicate config id %d",
+						   config_setting_source_line(node),
+						   ids[i]);
+
+		ret = usbg_validate_string_node(node, USBG_NAME_TAG, true,
+						buf, len);
+		if (ret != USBG_SUCCESS)
+			return ret;
+
+		attr = config_setting_get_member(node, USBG_ATTRS_TAG);
+		if (attr) {
+			if (!config_setting_is_group(attr))
+				return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+						   "line %d: %s should be a group",
+						   config_setting_source_line(attr),
+						   USBG_ATTRS_TAG);
+
+			ret = usbg_validate_int_node(attr, "bmAttributes",
+						     0, 0xff, buf, len);
+			if (ret == USBG_SUCCESS)
+				ret = usbg_validate_int_node(attr, "bMaxPower",
+							     0, 0xff, buf, len);
+			if (ret != USBG_SUCCESS)
+				return ret;
+		}
+
+		attr = config_setting_get_member(node, USBG_STRINGS_TAG);
+		if (attr) {
+			ret = usbg_validate_strings(attr, str_names, buf, len);
+			if (ret != USBG_SUCCESS)
+				return ret;
+		}
+
+		attr = config_setting_get_member(node, USBG_FUNCTIONS_TAG);
+		if (!attr)
+			continue;
+
+		if (!config_setting_is_list(attr))
+			return SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+					   "line %d: %s should be a list",
+					   config_setting_source_line(attr),
+					   USBG_FUNCTIONS_TAG);
+
+		used = 0;
+		total.interfaces = 0;
+		total.endpoints = 0;
+		nbindings = config_setting_length(attr);
+		for (j = 0; j < nbindings; ++j) {
+			ret = usbg_validate_binding(s,
+					config_setting_get_elem(attr, j),
+					dry_run, funcs, nfuncs, &type, &func,
+					buf, len);
+			if (ret != USBG_SUCCESS)
+				return ret;
+
+			if (!dry_run)
+				continue;
+
+			usbg_scheme_function_ep_budget(type, func, &b);
+			total.interfaces += b.interfaces;
+			total.endpoints += b.endpoints;
+
+			if (!usbg_function_type_is_periodic(type))
+				continue;
+
+			/* Scheme may be bound to any UDC, assume the best one */
+			if (speed == USBG_SPEED_UNKNOWN)
+				speed = usbg_fastest_udc_speed(s);
+			if (speed != USBG_SPEED_UNKNOWN)
+				used += usbg_scheme_function_bandwidth(type, func,
+								       speed);
+		}
+
+		if (!dry_run)
+			continue;
+
+		if (total.interfaces > USBG_MAX_CONFIG_INTERFACES)
+			return SCHEME_FAIL(USBG_ERROR_NOT_SUPPORTED,
+					   "line %d: config needs %d interfaces, only %d allowed",
+					   config_setting_source_line(node),
+					   total.interfaces,
+					   USBG_MAX_CONFIG_INTERFACES);
+
+		if (!endpoints_read) {
+			endpoints = usbg_max_udc_endpoints(s);
+			endpoints_read = true;
+		}
+		if (endpoints >= 0 && total.endpoints > endpoints)
+			return SCHEME_FAIL(USBG_ERROR_NOT_SUPPORTED,
+					   "line %d: config needs %d endpoints, UDC has only %d",
+					   config_setting_source_line(node),
+					   total.endpoints, endpoints);
+
+		available = usbg_speed_bandwidth(speed);
+		if (used > available)
+			return SCHEME_FAIL(USBG_ERROR_NOT_SUPPORTED,
+					   "line %d: config needs %llu B/s of periodic bandwidth, only %llu B/s available",
+					   config_setting_source_line(node),
+					   (unsigned long long)used,
+					   (unsigned long long)available);
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_validate_gadget_run(usbg_state *s, config_setting_t *root,
+				    bool dry_run, char *buf, int len)
+{
+	static const char *str_names[] = {
+		"manufacturer", "product", "serialnumber", NULL
+	};
+	struct usbg_scheme_func *funcs = NULL;
+	config_setting_t *node, *id_node;
+	int *ids = NULL;
+	int nfuncs = 0, nconfigs = 0;
+	int i, ret = USBG_SUCCESS;
+
 	node = config_setting_get_member(root, USBG_ATTRS_TAG);
 	if (node) {
+		static const struct {
+			const char *name;
+			int max;
+		} attrs[] = {
+			{ "bcdUSB", 0xffff },
+			{ "bDeviceClass", 0xff },
+			{ "bDeviceSubClass", 0xff },
+			{ "bDeviceProtocol", 0xff },
+			{ "bMaxPacketSize0", 0xff },
+			{ "idVendor", 0xffff },
+			{ "idProduct", 0xffff },
+			{ "bcdDevice", 0xffff },
+		};
+
 		if (!config_setting_is_group(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			goto error2;
+			ret = SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+					  "line %d: %s should be a group",
+					  config_setting_source_line(node),
+					  USBG_ATTRS_TAG);
+			goto out;
 		}
 
-		usbg_ret = usbg_import_gadget_attrs(node, newg);
-		if (usbg_ret != USBG_SUCCESS)
-			goto error;
+		for (i = 0; i < ARRAY_SIZE(attrs); ++i) {
+			ret = usbg_validate_int_node(node, attrs[i].name, 0,
+						     attrs[i].max, buf, len);
+			if (ret != USBG_SUCCESS)
+				goto out;
+		}
 	}
 
-	/* Strings are also optional */
 	node = config_setting_get_member(root, USBG_STRINGS_TAG);
 	if (node) {
-		if (!config_setting_is_list(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			goto error2;
-		}
-
-		usbg_ret = usbg_import_gadget_strings(node, newg);
-		if (usbg_ret != USBG_SUCCESS)
-			goto error;
+		ret = usbg_validate_strings(node, str_names, buf, len);
+		if (ret != USBG_SUCCESS)
+			goto out;
 	}
 
-	/* Functions too, because some gadgets may not be fully
-	* configured and don't have any function or have all functions
-	* defined inline in configurations */
 	node = config_setting_get_member(root, USBG_FUNCTIONS_TAG);
 	if (node) {
-		if (!config_setting_is_group(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			goto error2;
+		funcs = calloc(config_setting_length(node) + 1, sizeof(*funcs));
+		if (!funcs) {
+			ret = USBG_ERROR_NO_MEM;
+			goto out;
 		}
-		usbg_ret = usbg_import_gadget_functions(node, newg);
-		if (usbg_ret != USBG_SUCCESS)
-			goto error;
+
+		ret = usbg_validate_functions(s, node, dry_run, funcs, &nfuncs,
+					      buf, len);
+		if (ret != USBG_SUCCESS)
+			goto out;
 	}
 
-	/* Some gadget may not be fully configured
-	 * so configs are also optional */
 	node = config_setting_get_member(root, USBG_CONFIGS_TAG);
 	if (node) {
-		if (!config_setting_is_list(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			goto error2;
+		nconfigs = config_setting_length(node);
+		ids = calloc(nconfigs + 1, sizeof(*ids));
+		if (!ids) {
+			ret = USBG_ERROR_NO_MEM;
+			goto out;
 		}
-		usbg_ret = usbg_import_gadget_configs(node, newg);
-		if (usbg_ret != USBG_SUCCESS)
-			goto error;
+
+		ret = usbg_validate_configs(s, node, dry_run, &funcs, &nfuncs,
+					    ids, buf, len);
+		if (ret != USBG_SUCCESS)
+			goto out;
 	}
 
-	/* OS Descriptors are optional too, read after configs */
 	node = config_setting_get_member(root, USBG_OS_DESCS_TAG);
 	if (node) {
 		if (!config_setting_is_group(node)) {
-			ret = USBG_ERROR_INVALID_TYPE;
-			goto error2;
+			ret = SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+					  "line %d: %s should be a group",
+					  config_setting_source_line(node),
+					  USBG_OS_DESCS_TAG);
+			goto out;
 		}
 
-		usbg_ret = usbg_import_gadget_os_descs(node, newg);
-		if (usbg_ret != USBG_SUCCESS)
-			goto error;
+		ret = usbg_validate_int_node(node, "use", 0, 1, buf, len);
+		if (ret == USBG_SUCCESS)
+			ret = usbg_validate_int_node(node, "b_vendor_code",
+						     0, 0xff, buf, len);
+		if (ret == USBG_SUCCESS)
+			ret = usbg_validate_string_node(node, "qw_sign", false,
+							buf, len);
+		if (ret != USBG_SUCCESS)
+			goto out;
+
+		id_node = config_setting_get_member(node, USBG_CONFIG_ID_TAG);
+		if (id_node) {
+			if (!usbg_config_is_int(id_node)) {
+				ret = SCHEME_FAIL(USBG_ERROR_INVALID_TYPE,
+						  "line %d: %s should be an integer",
+						  config_setting_source_line(id_node),
+						  USBG_CONFIG_ID_TAG);
+				goto out;
+			}
+
+			for (i = 0; i < nconfigs; ++i)
+				if (ids[i] == config_setting_get_int(id_node))
+					break;
+
+			if (i == nconfigs) {
+				ret = SCHEME_FAIL(USBG_ERROR_NOT_FOUND,
+						  "line %d: no config with id %d",
+						  config_setting_source_line(id_node),
+						  config_setting_get_int(id_node));
+				goto out;
+			}
+		}
 	}
 
-	*g = newg;
-	ret = USBG_SUCCESS;
 out:
-	return ret;
-
-error:
-	ret = usbg_ret;
-error2:
-	/* We ignore returned value, if function fails
-	 * there is no way to handle it */
-	usbg_rm_gadget(newg, USBG_RM_RECURSE);
+	free(funcs);
+	free(ids);
 	return ret;
 }
 
-int usbg_import_function(usbg_gadget *g, FILE *stream, const char *instance,
-			 usbg_function **f)
+#undef SCHEME_FAIL
+
+int usbg_validate_gadget_scheme(usbg_state *s, FILE *stream,
+				char *buf, int len)
 {
 	config_t *cfg;
-	config_setting_t *root;
-	usbg_function *newf;
-	int ret, cfg_ret;
+	int ret;
 
-	if (!g || !stream || !instance)
+	if (!s || !stream)
 		return USBG_ERROR_INVALID_PARAM;
 
 	cfg = malloc(sizeof(*cfg));
@@ -1731,121 +3534,360 @@ int usbg_import_function(usbg_gadget *g, FILE *stream, const char *instance,
 
 	config_init(cfg);
 
-	cfg_ret = config_read(cfg, stream);
-	if (cfg_ret != CONFIG_TRUE) {
-		usbg_set_failed_import(&g->last_failed_import, cfg);
-		ret = USBG_ERROR_INVALID_FORMAT;
-		goto out;
-	}
-
-	/* Always successful */
-	root = config_root_setting(cfg);
-
-	ret = usbg_import_function_run(g, root, instance, &newf);
-	if (ret != USBG_SUCCESS) {
-		usbg_set_failed_import(&g->last_failed_import, cfg);
+	if (config_read(cfg, stream) != CONFIG_TRUE) {
+		ret = usbg_validation_fail(buf, len, USBG_ERROR_INVALID_FORMAT,
+					   "line %d: %s",
+					   config_error_line(cfg),
+					   config_error_text(cfg));
 		goto out;
 	}
 
-	if (f)
-		*f = newf;
+	ret = usbg_validate_gadget_run(s, config_root_setting(cfg), true,
+				       buf, len);
 
+out:
 	config_destroy(cfg);
 	free(cfg);
-	/* Clean last error */
-	usbg_set_failed_import(&g->last_failed_import, NULL);
-out:
 	return ret;
-
 }
 
-int usbg_import_config(usbg_gadget *g, FILE *stream, int id,  usbg_config **c)
+/*
+ * Template is a scheme parsed and validated only once. String settings
+ * with ${var} placeholders are recorded at compile time, instantiation
+ * only rewrites them in place and restores their original text when
+ * the gadget is created.
+ */
+struct usbg_template
 {
+	usbg_state *parent;
 	config_t *cfg;
-	config_setting_t *root;
-	usbg_config *newc;
-	int ret, cfg_ret;
+	config_setting_t **nodes;
+	char **texts;
+	int nnodes;
+};
 
-	if (!g || !stream || id < 0)
-		return USBG_ERROR_INVALID_PARAM;
+/*
+ * Type of function, binding to a label and interface of OS descriptor
+ * decide what validation checks, so they have to be known at compile
+ * time. Attributes of functions are plain values whatever their name.
+ */
+static bool usbg_template_is_key(config_setting_t *node, const char *parent)
+{
+	const char *name = config_setting_name(node);
 
-	cfg = malloc(sizeof(*cfg));
-	if (!cfg)
+	if (!name)
+		return parent && !strcmp(parent, USBG_FUNCTIONS_TAG);
+
+	return !strcmp(name, USBG_TYPE_TAG) ||
+		!strcmp(name, USBG_FUNCTION_TAG) ||
+		!strcmp(name, USBG_INTERFACE_TAG);
+}
+
+static int usbg_template_add_node(usbg_template *t, config_setting_t *node)
+{
+	config_setting_t **nodes;
+	char **texts;
+
+	nodes = realloc(t->nodes, (t->nnodes + 1) * sizeof(*nodes));
+	if (!nodes)
 		return USBG_ERROR_NO_MEM;
+	t->nodes = nodes;
 
-	config_init(cfg);
+	texts = realloc(t->texts, (t->nnodes + 1) * sizeof(*texts));
+	if (!texts)
+		return USBG_ERROR_NO_MEM;
+	t->texts = texts;
 
-	cfg_ret = config_read(cfg, stream);
-	if (cfg_ret != CONFIG_TRUE) {
-		usbg_set_failed_import(&g->last_failed_import, cfg);
-		ret = USBG_ERROR_INVALID_FORMAT;
-		goto out;
+	t->texts[t->nnodes] = strdup(config_setting_get_string(node));
+	if (!t->texts[t->nnodes])
+		return USBG_ERROR_NO_MEM;
+
+	t->nodes[t->nnodes++] = node;
+	return USBG_SUCCESS;
+}
+
+/*
+ * Each placeholder has to be terminated and may appear only in value
+ * strings. Settings containing placeholders are recorded in template.
+ */
+static int usbg_template_check(usbg_template *t, config_setting_t *root,
+			       const char *parent, bool value)
+{
+	const char *text, *p, *name;
+	int i, count;
+	int ret = USBG_SUCCESS;
+
+	if (usbg_config_is_string(root)) {
+		text = config_setting_get_string(root);
+		if (!text || !strstr(text, "${"))
+			return ret;
+
+		for (p = strstr(text, "${"); p; p = strstr(p, "${")) {
+			p = strchr(p, '}');
+			if (!p)
+				return USBG_ERROR_INVALID_FORMAT;
+		}
+
+		if (!value && usbg_template_is_key(root, parent))
+			return USBG_ERROR_NOT_SUPPORTED;
+
+		return usbg_template_add_node(t, root);
 	}
 
-	/* Always successful */
-	root = config_root_setting(cfg);
+	name = config_setting_name(root);
+	value = value || (name && !strcmp(name, USBG_ATTRS_TAG));
 
-	ret = usbg_import_config_run(g, root, id, &newc);
-	if (ret != USBG_SUCCESS) {
-		usbg_set_failed_import(&g->last_failed_import, cfg);
-		goto out;
+	count = config_setting_length(root);
+	for (i = 0; i < count && ret == USBG_SUCCESS; ++i)
+		ret = usbg_template_check(t, config_setting_get_elem(root, i),
+					  name, value);
+
+	return ret;
+}
+
+static const char *usbg_template_lookup(const struct usbg_template_var *vars,
+					const char *name, size_t len)
+{
+	for (; vars && vars->name; ++vars)
+		if (strlen(vars->name) == len && !strncmp(vars->name, name, len))
+			return vars->value;
+
+	return NULL;
+}
+
+/* Returns length of expanded text, it is written only if out is given */
+static int usbg_template_expand(const char *text,
+				const struct usbg_template_var *vars, char *out)
+{
+	const char *p = text, *end, *val;
+	size_t len;
+	int n = 0;
+
+	while (*p) {
+		if (p[0] != '$' || p[1] != '{') {
+			if (out)
+				out[n] = *p;
+			++n;
+			++p;
+			continue;
+		}
+
+		end = strchr(p + 2, '}');
+		val = usbg_template_lookup(vars, p + 2, end - p - 2);
+		if (!val)
+			return USBG_ERROR_NOT_FOUND;
+
+		len = strlen(val);
+		if (out)
+			memcpy(out + n, val, len);
+		n += len;
+		p = end + 1;
 	}
 
-	if (c)
-		*c = newc;
+	if (out)
+		out[n] = '\0';
+
+	return n;
+}
+
+/* Replace placeholders in text and store result in node */
+static int usbg_template_set_string(config_setting_t *node, const char *text,
+				    const struct usbg_template_var *vars)
+{
+	char *expanded;
+	int n;
+
+	n = usbg_template_expand(text, vars, NULL);
+	if (n < 0)
+		return n;
+
+	expanded = malloc(n + 1);
+	if (!expanded)
+		return USBG_ERROR_NO_MEM;
+
+	usbg_template_expand(text, vars, expanded);
+	n = config_setting_set_string(node, expanded);
+	free(expanded);
+
+	return n == CONFIG_TRUE ? USBG_SUCCESS : USBG_ERROR_NO_MEM;
+}
+
+static int usbg_template_copy(config_setting_t *to,
+			      const config_setting_t *from);
+
+static int usbg_template_copy_value(config_setting_t *to,
+				    const config_setting_t *from)
+{
+	int ret;
+
+	switch (config_setting_type(from)) {
+	case CONFIG_TYPE_INT:
+		ret = config_setting_set_int(to, config_setting_get_int(from));
+		break;
+	case CONFIG_TYPE_INT64:
+		ret = config_setting_set_int64(to,
+					       config_setting_get_int64(from));
+		break;
+	case CONFIG_TYPE_FLOAT:
+		ret = config_setting_set_float(to,
+					       config_setting_get_float(from));
+		break;
+	case CONFIG_TYPE_BOOL:
+		ret = config_setting_set_bool(to, config_setting_get_bool(from));
+		break;
+	case CONFIG_TYPE_STRING:
+		ret = config_setting_set_string(to,
+						config_setting_get_string(from));
+		break;
+	default:
+		return usbg_template_copy(to, from);
+	}
+
+	return ret == CONFIG_TRUE ? USBG_SUCCESS : USBG_ERROR_NO_MEM;
+}
+
+/*
+ * Copy children of from to to. Used only when instantiation fails, to
+ * keep expanded scheme as the last failed import.
+ */
+static int usbg_template_copy(config_setting_t *to,
+			      const config_setting_t *from)
+{
+	config_setting_t *elem, *node;
+	int i, count;
+	int ret = USBG_SUCCESS;
+
+	count = config_setting_length(from);
+	for (i = 0; i < count && ret == USBG_SUCCESS; ++i) {
+		elem = config_setting_get_elem(from, i);
+
+		node = config_setting_add(to, config_setting_name(elem),
+					  config_setting_type(elem));
+		if (!node)
+			return USBG_ERROR_NO_MEM;
+
+		config_setting_set_format(node, config_setting_get_format(elem));
+		ret = usbg_template_copy_value(node, elem);
+	}
 
-	config_destroy(cfg);
-	free(cfg);
-	/* Clean last error */
-	usbg_set_failed_import(&g->last_failed_import, NULL);
-out:
 	return ret;
 }
 
-int usbg_import_gadget(usbg_state *s, FILE *stream, const char *name,
-		       usbg_gadget **g)
+static void usbg_template_set_failed(usbg_template *t)
 {
 	config_t *cfg;
+
+	cfg = malloc(sizeof(*cfg));
+	if (!cfg)
+		return;
+
+	config_init(cfg);
+	usbg_template_copy(config_root_setting(cfg),
+			   config_root_setting(t->cfg));
+	usbg_set_failed_import(&t->parent->last_failed_import, cfg);
+}
+
+int usbg_compile_template(usbg_state *s, FILE *stream, usbg_template **t)
+{
+	usbg_template *newt;
 	config_setting_t *root;
-	usbg_gadget *newg;
-	int ret, cfg_ret;
+	int ret;
 
-	if (!s || !stream || !name)
+	if (!s || !stream || !t)
 		return USBG_ERROR_INVALID_PARAM;
 
-	cfg = malloc(sizeof(*cfg));
-	if (!cfg)
+	newt = calloc(1, sizeof(*newt));
+	if (!newt)
 		return USBG_ERROR_NO_MEM;
 
-	config_init(cfg);
+	newt->parent = s;
+	newt->cfg = malloc(sizeof(*newt->cfg));
+	if (!newt->cfg) {
+		free(newt);
+		return USBG_ERROR_NO_MEM;
+	}
 
-	cfg_ret = config_read(cfg, stream);
-	if (cfg_ret != CONFIG_TRUE) {
-		usbg_set_failed_import(&s->last_failed_import, cfg);
+	config_init(newt->cfg);
+
+	if (config_read(newt->cfg, stream) != CONFIG_TRUE) {
+		usbg_set_failed_import(&s->last_failed_import, newt->cfg);
+		newt->cfg = NULL;
 		ret = USBG_ERROR_INVALID_FORMAT;
-		goto out;
+		goto err;
 	}
 
 	/* Always successful */
-	root = config_root_setting(cfg);
+	root = config_root_setting(newt->cfg);
 
-	ret = usbg_import_gadget_run(s, root, name, &newg);
-	if (ret != USBG_SUCCESS) {
-		usbg_set_failed_import(&s->last_failed_import, cfg);
-		goto out;
-	}
+	ret = usbg_template_check(newt, root, NULL, false);
+	if (ret != USBG_SUCCESS)
+		goto err;
 
-	if (g)
+	/* Placeholders are left only where they cannot change the result */
+	ret = usbg_validate_gadget_run(s, root, true, NULL, 0);
+	if (ret != USBG_SUCCESS)
+		goto err;
+
+	*t = newt;
+	return USBG_SUCCESS;
+
+err:
+	usbg_destroy_template(newt);
+	return ret;
+}
+
+int usbg_instantiate_template(usbg_template *t, const char *name,
+			      const struct usbg_template_var *vars,
+			      usbg_gadget **g)
+{
+	usbg_gadget *newg;
+	int i, ret = USBG_SUCCESS;
+
+	if (!t || !name)
+		return USBG_ERROR_INVALID_PARAM;
+
+	for (i = 0; i < t->nnodes && ret == USBG_SUCCESS; ++i)
+		ret = usbg_template_set_string(t->nodes[i], t->texts[i], vars);
+
+	/* Scheme was validated at compile time */
+	if (ret == USBG_SUCCESS)
+		ret = usbg_import_gadget_run(t->parent,
+					     config_root_setting(t->cfg),
+					     name, &newg);
+	if (ret != USBG_SUCCESS)
+		usbg_template_set_failed(t);
+	else
+		/* Clean last error */
+		usbg_set_failed_import(&t->parent->last_failed_import, NULL);
+
+	for (i = 0; i < t->nnodes; ++i)
+		config_setting_set_string(t->nodes[i], t->texts[i]);
+
+	if (ret == USBG_SUCCESS && g)
 		*g = newg;
 
-	config_destroy(cfg);
-	free(cfg);
-	/* Clean last error */
-	usbg_set_failed_import(&s->last_failed_import, NULL);
-out:
 	return ret;
 }
 
+void usbg_destroy_template(usbg_template *t)
+{
+	int i;
+
+	if (!t)
+		return;
+
+	if (t->cfg) {
+		config_destroy(t->cfg);
+		free(t->cfg);
+	}
+
+	for (i = 0; i < t->nnodes; ++i)
+		free(t->texts[i]);
+	free(t->texts);
+	free(t->nodes);
+	free(t);
+}
+
 const char *usbg_get_func_import_error_text(usbg_gadget *g)
 {
 	if (!g || !g->last_failed_import)
@@ -31,6 +31,38 @@ int usbg_export_gadget(__attribute__ ((unused)) usbg_gadget *g,
 	return USBG_ERROR_NOT_SUPPORTED;
 }
 
+int usbg_export_function_stream(__attribute__ ((unused)) usbg_function *f,
+				__attribute__ ((unused)) FILE *stream)
+{
+	return USBG_ERROR_NOT_SUPPORTED;
+}
+
+int usbg_export_config_stream(__attribute__ ((unused)) usbg_config *c,
+			      __attribute__ ((unused)) FILE *stream)
+{
+	return USBG_ERROR_NOT_SUPPORTED;
+}
+
+int usbg_export_gadget_stream(__attribute__ ((unused)) usbg_gadget *g,
+			      __attribute__ ((unused)) FILE *stream)
+{
+	return USBG_ERROR_NOT_SUPPORTED;
+}
+
+int usbg_export_state(__attribute__ ((unused)) usbg_state *s,
+		      __attribute__ ((unused)) int flags,
+		      __attribute__ ((unused)) FILE *stream)
+{
+	return USBG_ERROR_NOT_SUPPORTED;
+}
+
+int usbg_export_changed_since(__attribute__ ((unused)) usbg_state *s,
+			      __attribute__ ((unused)) uint64_t gen,
+			      __attribute__ ((unused)) FILE *stream)
+{
+	return USBG_ERROR_NOT_SUPPORTED;
+}
+
 int usbg_import_function(__attribute__ ((unused)) usbg_gadget *g,
 			 __attribute__ ((unused)) FILE *stream,
 			 __attribute__ ((unused)) const char *instance,
@@ -55,6 +87,41 @@ int usbg_import_gadget(__attribute__ ((unused)) usbg_state *s,
 	return USBG_ERROR_NOT_SUPPORTED;
 }
 
+int usbg_import_state(__attribute__ ((unused)) usbg_state *s,
+		      __attribute__ ((unused)) FILE *stream,
+		      __attribute__ ((unused)) int flags)
+{
+	return USBG_ERROR_NOT_SUPPORTED;
+}
+
+int usbg_validate_gadget_scheme(__attribute__ ((unused)) usbg_state *s,
+				__attribute__ ((unused)) FILE *stream,
+				__attribute__ ((unused)) char *buf,
+				__attribute__ ((unused)) int len)
+{
+	return USBG_ERROR_NOT_SUPPORTED;
+}
+
+int usbg_compile_template(__attribute__ ((unused)) usbg_state *s,
+			  __attribute__ ((unused)) FILE *stream,
+			  __attribute__ ((unused)) usbg_template **t)
+{
+	return USBG_ERROR_NOT_SUPPORTED;
+}
+
+int usbg_instantiate_template(__attribute__ ((unused)) usbg_template *t,
+			      __attribute__ ((unused)) const char *name,
+			      __attribute__ ((unused))
+			      const struct usbg_template_var *vars,
+			      __attribute__ ((unused)) usbg_gadget **g)
+{
+	return USBG_ERROR_NOT_SUPPORTED;
+}
+
+void usbg_destroy_template(__attribute__ ((unused)) usbg_template *t)
+{
+}
+
 const char *usbg_get_func_import_error_text(
 	__attribute__ ((unused)) usbg_gadget *g)
 {
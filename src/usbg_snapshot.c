@@ -0,0 +1,676 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @file usbg_snapshot.c
+ * @brief Gadget tree published in shared memory for other processes.
+ * @details Readers never lock anything. Writer makes seq odd before
+ * it touches the region and even again when it is done, so reader
+ * knows that it has to read once again. All offsets are checked by
+ * reader, so even torn data cannot make it access memory outside of
+ * the region. The last byte of region is always zero, so each string
+ * is terminated.
+ */
+
+struct usbg_snap_builder
+{
+	char *buf;
+	size_t size;
+	/* Records grow up from header, strings grow down from the end */
+	size_t rec;
+	size_t str;
+	bool error;
+};
+
+static uint32_t usbg_snap_alloc(struct usbg_snap_builder *b, size_t n,
+				size_t size)
+{
+	uint32_t off = b->rec;
+
+	if (b->error || b->rec + n * size > b->str) {
+		b->error = true;
+		return 0;
+	}
+
+	b->rec += n * size;
+	return off;
+}
+
+static uint32_t usbg_snap_str(struct usbg_snap_builder *b, const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	if (b->error || b->str - b->rec < len) {
+		b->error = true;
+		return 0;
+	}
+
+	b->str -= len;
+	memcpy(b->buf + b->str, str, len);
+
+	return b->str;
+}
+
+#define SNAP_REC(b, type, off, i) ((type *)((b)->buf + (off)) + (i))
+
+/* Only fingerprints which are already known, configfs is not read */
+static void usbg_snap_fp(int ret, uint64_t fp, uint32_t *dst, uint32_t *has)
+{
+	*has = ret == USBG_SUCCESS;
+	dst[0] = *has ? (uint32_t)fp : 0;
+	dst[1] = *has ? (uint32_t)(fp >> 32) : 0;
+}
+
+static int usbg_snap_function_idx(usbg_gadget *g, usbg_function *f)
+{
+	usbg_function *i;
+	int idx = 0;
+
+	TAILQ_FOREACH(i, &g->functions, fnode) {
+		if (i == f)
+			return idx;
+		++idx;
+	}
+
+	return -1;
+}
+
+static int usbg_snap_gadget_idx(usbg_state *s, usbg_gadget *g)
+{
+	usbg_gadget *i;
+	int idx = 0;
+
+	TAILQ_FOREACH(i, &s->gadgets, gnode) {
+		if (i == g)
+			return idx;
+		++idx;
+	}
+
+	return -1;
+}
+
+static int usbg_snap_udc_idx(usbg_state *s, usbg_udc *u)
+{
+	usbg_udc *i;
+	int idx = 0;
+
+	TAILQ_FOREACH(i, &s->udcs, unode) {
+		if (i == u)
+			return idx;
+		++idx;
+	}
+
+	return -1;
+}
+
+static void usbg_snap_build_config(struct usbg_snap_builder *b, usbg_gadget *g,
+				   usbg_config *c, uint32_t off)
+{
+	struct usbg_snap_config *sc = SNAP_REC(b, struct usbg_snap_config, off, 0);
+	struct usbg_snap_binding *sb;
+	usbg_binding *bd;
+	uint32_t n = 0, boff;
+	uint64_t fp;
+	int i = 0;
+	int ret;
+
+	TAILQ_FOREACH(bd, &c->bindings, bnode)
+		n++;
+
+	boff = usbg_snap_alloc(b, n, sizeof(*sb));
+	sc->label = usbg_snap_str(b, c->label);
+	sc->id = c->id;
+	sc->nbindings = n;
+	sc->bindings = boff;
+	ret = usbg_get_cached_config_fingerprint(c, &fp);
+	usbg_snap_fp(ret, fp, sc->fingerprint, &sc->has_fingerprint);
+	if (b->error)
+		return;
+
+	TAILQ_FOREACH(bd, &c->bindings, bnode) {
+		sb = SNAP_REC(b, struct usbg_snap_binding, boff, i++);
+		sb->name = usbg_snap_str(b, bd->name);
+		sb->function = usbg_snap_function_idx(g, bd->target);
+	}
+}
+
+static void usbg_snap_build_gadget(struct usbg_snap_builder *b, usbg_gadget *g,
+				   uint32_t off)
+{
+	struct usbg_snap_gadget *sg = SNAP_REC(b, struct usbg_snap_gadget, off, 0);
+	struct usbg_snap_function *sf;
+	usbg_config *c;
+	usbg_function *f;
+	uint32_t nc = 0, nf = 0;
+	uint64_t fp;
+	int i;
+	int ret;
+
+	TAILQ_FOREACH(c, &g->configs, cnode)
+		nc++;
+	TAILQ_FOREACH(f, &g->functions, fnode)
+		nf++;
+
+	sg->name = usbg_snap_str(b, g->name);
+	sg->udc = g->udc ? usbg_snap_udc_idx(g->parent, g->udc) : -1;
+	sg->nconfigs = nc;
+	sg->configs = usbg_snap_alloc(b, nc, sizeof(struct usbg_snap_config));
+	sg->nfunctions = nf;
+	sg->functions = usbg_snap_alloc(b, nf, sizeof(*sf));
+	ret = usbg_get_cached_gadget_fingerprint(g, &fp);
+	usbg_snap_fp(ret, fp, sg->fingerprint, &sg->has_fingerprint);
+	if (b->error)
+		return;
+
+	i = 0;
+	TAILQ_FOREACH(f, &g->functions, fnode) {
+		sf = SNAP_REC(b, struct usbg_snap_function, sg->functions, i++);
+		sf->type = f->type;
+		sf->instance = usbg_snap_str(b, f->instance);
+		ret = usbg_get_cached_function_fingerprint(f, &fp);
+		usbg_snap_fp(ret, fp, sf->fingerprint, &sf->has_fingerprint);
+	}
+
+	i = 0;
+	TAILQ_FOREACH(c, &g->configs, cnode)
+		usbg_snap_build_config(b, g, c, sg->configs +
+				       i++ * sizeof(struct usbg_snap_config));
+}
+
+static int usbg_snap_build(usbg_publisher *p, struct usbg_snap_builder *b)
+{
+	struct usbg_snap_hdr *hdr = (struct usbg_snap_hdr *)p->buf;
+	struct usbg_snap_udc *su;
+	usbg_state *s = p->parent;
+	usbg_gadget *g;
+	usbg_udc *u;
+	uint32_t ng = 0, nu = 0;
+	int i;
+
+	b->buf = p->buf;
+	b->size = p->size;
+	b->rec = sizeof(*hdr);
+	b->str = p->size - 1;
+	b->error = false;
+	b->buf[b->str] = '\0';
+
+	TAILQ_FOREACH(g, &s->gadgets, gnode)
+		ng++;
+	TAILQ_FOREACH(u, &s->udcs, unode)
+		nu++;
+
+	hdr->magic = USBG_SNAP_MAGIC;
+	hdr->size = p->size;
+	hdr->ngadgets = ng;
+	hdr->gadgets = usbg_snap_alloc(b, ng, sizeof(struct usbg_snap_gadget));
+	hdr->nudcs = nu;
+	hdr->udcs = usbg_snap_alloc(b, nu, sizeof(*su));
+	if (b->error)
+		return USBG_ERROR_NO_MEM;
+
+	i = 0;
+	TAILQ_FOREACH(u, &s->udcs, unode) {
+		su = SNAP_REC(b, struct usbg_snap_udc, hdr->udcs, i++);
+		su->name = usbg_snap_str(b, u->name);
+		su->gadget = u->gadget ? usbg_snap_gadget_idx(s, u->gadget) : -1;
+	}
+
+	i = 0;
+	TAILQ_FOREACH(g, &s->gadgets, gnode)
+		usbg_snap_build_gadget(b, g, hdr->gadgets +
+				       i++ * sizeof(struct usbg_snap_gadget));
+
+	return b->error ? USBG_ERROR_NO_MEM : USBG_SUCCESS;
+}
+
+int usbg_publisher_create(usbg_state *s, const char *name, size_t size,
+			  usbg_publisher **p)
+{
+	usbg_publisher *new_p;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!s || !p)
+		goto out;
+
+	if (!size)
+		size = USBG_SNAPSHOT_DEFAULT_SIZE;
+	if (size < sizeof(struct usbg_snap_hdr) + 1 || size > UINT32_MAX)
+		goto out;
+
+	new_p = calloc(1, sizeof(*new_p));
+	if (!new_p) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	new_p->parent = s;
+	new_p->size = size;
+	new_p->shm = MAP_FAILED;
+
+	new_p->buf = calloc(1, size);
+	if (!new_p->buf) {
+		ret = USBG_ERROR_NO_MEM;
+		goto err;
+	}
+
+	if (name) {
+		new_p->name = strdup(name);
+		if (!new_p->name) {
+			ret = USBG_ERROR_NO_MEM;
+			goto err;
+		}
+		new_p->fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	} else {
+		new_p->fd = memfd_create("usbg-snapshot", MFD_CLOEXEC);
+	}
+
+	if (new_p->fd < 0) {
+		ret = usbg_translate_error(errno);
+		goto err;
+	}
+
+	if (ftruncate(new_p->fd, size)) {
+		ret = usbg_translate_error(errno);
+		goto err_fd;
+	}
+
+	new_p->shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			  new_p->fd, 0);
+	if (new_p->shm == MAP_FAILED) {
+		ret = usbg_translate_error(errno);
+		goto err_fd;
+	}
+
+	ret = usbg_publisher_update(new_p);
+	if (ret != USBG_SUCCESS)
+		goto err_map;
+
+	*p = new_p;
+	return USBG_SUCCESS;
+
+err_map:
+	munmap(new_p->shm, size);
+err_fd:
+	close(new_p->fd);
+	if (name)
+		shm_unlink(name);
+err:
+	free(new_p->name);
+	free(new_p->buf);
+	free(new_p);
+out:
+	return ret;
+}
+
+void usbg_publisher_destroy(usbg_publisher *p)
+{
+	if (!p)
+		return;
+
+	munmap(p->shm, p->size);
+	close(p->fd);
+	if (p->name)
+		shm_unlink(p->name);
+	free(p->name);
+	free(p->buf);
+	free(p);
+}
+
+int usbg_publisher_get_fd(usbg_publisher *p)
+{
+	return p ? p->fd : USBG_ERROR_INVALID_PARAM;
+}
+
+int usbg_publisher_update(usbg_publisher *p)
+{
+	struct usbg_snap_builder b;
+	uint32_t seq;
+	size_t data = offsetof(struct usbg_snap_hdr, size);
+	int ret;
+
+	if (!p)
+		return USBG_ERROR_INVALID_PARAM;
+
+	/* Previous snapshot stays published if the new one doesn't fit */
+	ret = usbg_snap_build(p, &b);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	seq = p->shm->seq;
+	__atomic_store_n(&p->shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy((char *)p->shm + data, p->buf + data, b.rec - data);
+	memcpy((char *)p->shm + b.str, p->buf + b.str, p->size - b.str);
+	p->shm->magic = USBG_SNAP_MAGIC;
+
+	__atomic_store_n(&p->shm->seq, seq + 2, __ATOMIC_RELEASE);
+
+	return USBG_SUCCESS;
+}
+
+int usbg_snapshot_open_fd(int fd, usbg_snapshot **snap)
+{
+	usbg_snapshot *new_snap;
+	struct stat st;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (fd < 0 || !snap)
+		goto out;
+
+	if (fstat(fd, &st)) {
+		ret = usbg_translate_error(errno);
+		goto out;
+	}
+
+	if (st.st_size < sizeof(struct usbg_snap_hdr) + 1 ||
+	    st.st_size > UINT32_MAX) {
+		ret = USBG_ERROR_INVALID_FORMAT;
+		goto out;
+	}
+
+	new_snap = malloc(sizeof(*new_snap));
+	if (!new_snap) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	new_snap->size = st.st_size;
+	new_snap->shm = mmap(NULL, new_snap->size, PROT_READ, MAP_SHARED,
+			     fd, 0);
+	if (new_snap->shm == MAP_FAILED) {
+		ret = usbg_translate_error(errno);
+		goto free_snap;
+	}
+
+	if (new_snap->shm->magic != USBG_SNAP_MAGIC) {
+		ret = USBG_ERROR_INVALID_FORMAT;
+		goto unmap;
+	}
+
+	/* Mapping stays valid after fd is closed */
+	new_snap->fd = -1;
+	*snap = new_snap;
+	return USBG_SUCCESS;
+
+unmap:
+	munmap((void *)new_snap->shm, new_snap->size);
+free_snap:
+	free(new_snap);
+out:
+	return ret;
+}
+
+int usbg_snapshot_open(const char *name, usbg_snapshot **snap)
+{
+	int fd;
+	int ret;
+
+	if (!name)
+		return USBG_ERROR_INVALID_PARAM;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return usbg_translate_error(errno);
+
+	ret = usbg_snapshot_open_fd(fd, snap);
+	close(fd);
+
+	return ret;
+}
+
+void usbg_snapshot_close(usbg_snapshot *snap)
+{
+	if (!snap)
+		return;
+
+	munmap((void *)snap->shm, snap->size);
+	free(snap);
+}
+
+uint32_t usbg_snapshot_read_begin(usbg_snapshot *snap)
+{
+	uint32_t seq;
+
+	while ((seq = __atomic_load_n(&snap->shm->seq, __ATOMIC_ACQUIRE)) & 1)
+		sched_yield();
+
+	return seq;
+}
+
+bool usbg_snapshot_read_retry(usbg_snapshot *snap, uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&snap->shm->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/* NULL if record doesn't lay within region */
+static const void *usbg_snap_rec(usbg_snapshot *snap, uint32_t off,
+				 uint32_t n, int idx, size_t size)
+{
+	if (idx < 0 || idx >= n ||
+	    off + (uint64_t)(idx + 1) * size > snap->size)
+		return NULL;
+
+	return (const char *)snap->shm + off + idx * size;
+}
+
+static const char *usbg_snap_get_str(usbg_snapshot *snap, uint32_t off)
+{
+	return off && off < snap->size ? (const char *)snap->shm + off : NULL;
+}
+
+static const struct usbg_snap_gadget *usbg_snap_gadget(usbg_snapshot *snap,
+						       int g)
+{
+	return usbg_snap_rec(snap, snap->shm->gadgets, snap->shm->ngadgets, g,
+			     sizeof(struct usbg_snap_gadget));
+}
+
+static const struct usbg_snap_config *usbg_snap_config(usbg_snapshot *snap,
+						       int g, int c)
+{
+	const struct usbg_snap_gadget *sg = usbg_snap_gadget(snap, g);
+
+	return sg ? usbg_snap_rec(snap, sg->configs, sg->nconfigs, c,
+				  sizeof(struct usbg_snap_config)) : NULL;
+}
+
+static const struct usbg_snap_function *usbg_snap_function(
+	usbg_snapshot *snap, int g, int f)
+{
+	const struct usbg_snap_gadget *sg = usbg_snap_gadget(snap, g);
+
+	return sg ? usbg_snap_rec(snap, sg->functions, sg->nfunctions, f,
+				  sizeof(struct usbg_snap_function)) : NULL;
+}
+
+static const struct usbg_snap_binding *usbg_snap_binding(usbg_snapshot *snap,
+							 int g, int c, int b)
+{
+	const struct usbg_snap_config *sc = usbg_snap_config(snap, g, c);
+
+	return sc ? usbg_snap_rec(snap, sc->bindings, sc->nbindings, b,
+				  sizeof(struct usbg_snap_binding)) : NULL;
+}
+
+static const struct usbg_snap_udc *usbg_snap_udc(usbg_snapshot *snap, int u)
+{
+	return usbg_snap_rec(snap, snap->shm->udcs, snap->shm->nudcs, u,
+			     sizeof(struct usbg_snap_udc));
+}
+
+int usbg_snapshot_get_gadget_count(usbg_snapshot *snap)
+{
+	return snap ? snap->shm->ngadgets : USBG_ERROR_INVALID_PARAM;
+}
+
+const char *usbg_snapshot_get_gadget_name(usbg_snapshot *snap, int g)
+{
+	const struct usbg_snap_gadget *sg = snap ? usbg_snap_gadget(snap, g) : NULL;
+
+	return sg ? usbg_snap_get_str(snap, sg->name) : NULL;
+}
+
+int usbg_snapshot_get_gadget_udc(usbg_snapshot *snap, int g)
+{
+	const struct usbg_snap_gadget *sg = snap ? usbg_snap_gadget(snap, g) : NULL;
+
+	return sg ? sg->udc : USBG_ERROR_NOT_FOUND;
+}
+
+static int usbg_snap_get_fp(const uint32_t *src, uint32_t has, uint64_t *fp)
+{
+	if (!fp)
+		return USBG_ERROR_INVALID_PARAM;
+
+	if (!has)
+		return USBG_ERROR_NOT_FOUND;
+
+	*fp = src[0] | (uint64_t)src[1] << 32;
+
+	return USBG_SUCCESS;
+}
+
+int usbg_snapshot_get_gadget_fingerprint(usbg_snapshot *snap, int g,
+					 uint64_t *fp)
+{
+	const struct usbg_snap_gadget *sg = snap ? usbg_snap_gadget(snap, g) : NULL;
+
+	return sg ? usbg_snap_get_fp(sg->fingerprint, sg->has_fingerprint, fp) :
+		USBG_ERROR_NOT_FOUND;
+}
+
+int usbg_snapshot_get_config_count(usbg_snapshot *snap, int g)
+{
+	const struct usbg_snap_gadget *sg = snap ? usbg_snap_gadget(snap, g) : NULL;
+
+	return sg ? sg->nconfigs : USBG_ERROR_NOT_FOUND;
+}
+
+const char *usbg_snapshot_get_config_label(usbg_snapshot *snap, int g, int c)
+{
+	const struct usbg_snap_config *sc =
+		snap ? usbg_snap_config(snap, g, c) : NULL;
+
+	return sc ? usbg_snap_get_str(snap, sc->label) : NULL;
+}
+
+int usbg_snapshot_get_config_id(usbg_snapshot *snap, int g, int c)
+{
+	const struct usbg_snap_config *sc =
+		snap ? usbg_snap_config(snap, g, c) : NULL;
+
+	return sc ? sc->id : USBG_ERROR_NOT_FOUND;
+}
+
+int usbg_snapshot_get_config_fingerprint(usbg_snapshot *snap, int g, int c,
+					 uint64_t *fp)
+{
+	const struct usbg_snap_config *sc =
+		snap ? usbg_snap_config(snap, g, c) : NULL;
+
+	return sc ? usbg_snap_get_fp(sc->fingerprint, sc->has_fingerprint, fp) :
+		USBG_ERROR_NOT_FOUND;
+}
+
+int usbg_snapshot_get_binding_count(usbg_snapshot *snap, int g, int c)
+{
+	const struct usbg_snap_config *sc =
+		snap ? usbg_snap_config(snap, g, c) : NULL;
+
+	return sc ? sc->nbindings : USBG_ERROR_NOT_FOUND;
+}
+
+const char *usbg_snapshot_get_binding_name(usbg_snapshot *snap, int g, int c,
+					   int b)
+{
+	const struct usbg_snap_binding *sb =
+		snap ? usbg_snap_binding(snap, g, c, b) : NULL;
+
+	return sb ? usbg_snap_get_str(snap, sb->name) : NULL;
+}
+
+int usbg_snapshot_get_binding_function(usbg_snapshot *snap, int g, int c,
+				       int b)
+{
+	const struct usbg_snap_binding *sb =
+		snap ? usbg_snap_binding(snap, g, c, b) : NULL;
+
+	return sb ? sb->function : USBG_ERROR_NOT_FOUND;
+}
+
+int usbg_snapshot_get_function_count(usbg_snapshot *snap, int g)
+{
+	const struct usbg_snap_gadget *sg = snap ? usbg_snap_gadget(snap, g) : NULL;
+
+	return sg ? sg->nfunctions : USBG_ERROR_NOT_FOUND;
+}
+
+int usbg_snapshot_get_function_type(usbg_snapshot *snap, int g, int f)
+{
+	const struct usbg_snap_function *sf =
+		snap ? usbg_snap_function(snap, g, f) : NULL;
+
+	return sf ? sf->type : USBG_ERROR_NOT_FOUND;
+}
+
+const char *usbg_snapshot_get_function_instance(usbg_snapshot *snap, int g,
+						int f)
+{
+	const struct usbg_snap_function *sf =
+		snap ? usbg_snap_function(snap, g, f) : NULL;
+
+	return sf ? usbg_snap_get_str(snap, sf->instance) : NULL;
+}
+
+int usbg_snapshot_get_function_fingerprint(usbg_snapshot *snap, int g, int f,
+					   uint64_t *fp)
+{
+	const struct usbg_snap_function *sf =
+		snap ? usbg_snap_function(snap, g, f) : NULL;
+
+	return sf ? usbg_snap_get_fp(sf->fingerprint, sf->has_fingerprint, fp) :
+		USBG_ERROR_NOT_FOUND;
+}
+
+int usbg_snapshot_get_udc_count(usbg_snapshot *snap)
+{
+	return snap ? snap->shm->nudcs : USBG_ERROR_INVALID_PARAM;
+}
+
+const char *usbg_snapshot_get_udc_name(usbg_snapshot *snap, int u)
+{
+	const struct usbg_snap_udc *su = snap ? usbg_snap_udc(snap, u) : NULL;
+
+	return su ? usbg_snap_get_str(snap, su->name) : NULL;
+}
+
+int usbg_snapshot_get_udc_gadget(usbg_snapshot *snap, int u)
+{
+	const struct usbg_snap_udc *su = snap ? usbg_snap_udc(snap, u) : NULL;
+
+	return su ? su->gadget : USBG_ERROR_NOT_FOUND;
+}
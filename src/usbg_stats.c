@@ -0,0 +1,182 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * @file usbg_stats.c
+ * @brief Operation counters and latency histograms.
+ * @details Public operations call each other, so nesting depth is kept
+ * per thread and only the outermost one is accounted. Counters are
+ * plain relaxed atomics, readers may see them slightly out of step.
+ * Everything goes to the counters referenced by usbg_io of the state,
+ * so states which only borrow it (e.g. import shadows) account to the
+ * owner.
+ */
+
+static __thread int usbg_stats_depth;
+
+static uint64_t usbg_stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef HAVE_SYS_SDT_H
+#define USBG_SEMAPHORE(name)						\
+	unsigned short libusbgx_##name##_semaphore			\
+	__attribute__((section(".probes"), visibility("hidden")))
+
+USBG_SEMAPHORE(api__entry);
+USBG_SEMAPHORE(api__return);
+USBG_SEMAPHORE(io__entry);
+USBG_SEMAPHORE(io__return);
+#endif
+
+static void usbg_stats_path(struct usbg_call *call, const char *dir,
+			    const char *name)
+{
+	call->path[0] = '\0';
+
+	if (!USBG_PROBE_ENABLED(api__entry) &&
+	    !USBG_PROBE_ENABLED(api__return))
+		return;
+
+	if (dir && name)
+		snprintf(call->path, sizeof(call->path), "%s/%s", dir, name);
+	else if (dir || name)
+		snprintf(call->path, sizeof(call->path), "%s",
+			 dir ? dir : name);
+}
+
+/*
+ * Clock is read only for outermost accounted call, nested ones and
+ * those which aren't accounted are timed only for a tracer.
+ */
+void usbg_stats_begin(struct usbg_call *call, const char *func, int op,
+		      const char *dir, const char *name)
+{
+	call->func = func;
+	call->op = op;
+	call->outer = false;
+	call->start = 0;
+	usbg_stats_path(call, dir, name);
+
+	USBG_PROBE(api__entry, func, call->path);
+	if (op != USBG_STAT_OP_NONE)
+		call->outer = !usbg_stats_depth++;
+
+	if (call->outer || USBG_PROBE_ENABLED(api__return))
+		call->start = usbg_stats_now();
+}
+
+/*
+ * Initialization never runs inside of other operation. Starting it from
+ * clean depth also recovers when caller jumped out of some operation,
+ * e.g. from a callback, and left the depth behind.
+ */
+void usbg_stats_begin_outer(struct usbg_call *call, const char *func,
+			    int op, const char *dir, const char *name)
+{
+	usbg_stats_depth = 0;
+	usbg_stats_begin(call, func, op, dir, name);
+}
+
+/* Worker thread continues operation of its parent, it is not an outer one */
+void usbg_stats_worker_begin(void)
+{
+	++usbg_stats_depth;
+}
+
+void usbg_stats_worker_end(void)
+{
+	--usbg_stats_depth;
+}
+
+static int usbg_stats_bucket(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int i = 0;
+
+	while (us > 1 && i < USBG_STAT_BUCKETS - 1) {
+		us >>= 1;
+		++i;
+	}
+
+	return i;
+}
+
+void usbg_stats_end(struct usbg_call *call, usbg_state *s, int ret)
+{
+	struct usbg_stat_latency *lat;
+	struct usbg_stats *stats;
+	uint64_t ns = 0;
+	int err;
+
+	if (call->op != USBG_STAT_OP_NONE)
+		--usbg_stats_depth;
+
+	if (call->start)
+		ns = usbg_stats_now() - call->start;
+	USBG_PROBE(api__return, call->func, call->path, call->op, ret, ns);
+
+	if (!call->outer || !s || !s->io.stats)
+		return;
+
+	stats = s->io.stats;
+	lat = &stats->ops[call->op];
+	usbg_stats_add(&lat->count, 1);
+	usbg_stats_add(&lat->total_ns, ns);
+	usbg_stats_add(&lat->buckets[usbg_stats_bucket(ns)], 1);
+
+	if (ret < 0) {
+		err = -ret < USBG_STAT_ERRORS - 1 ? -ret : USBG_STAT_ERRORS - 1;
+		usbg_stats_add(&stats->errors[err], 1);
+	}
+}
+
+int usbg_get_stats(usbg_state *s, struct usbg_stats *stats)
+{
+	const uint64_t *src;
+	uint64_t *dst;
+	size_t i;
+
+	if (!s || !stats)
+		return USBG_ERROR_INVALID_PARAM;
+
+	/* Structure is made of counters only */
+	src = (const uint64_t *)&s->stats;
+	dst = (uint64_t *)stats;
+	for (i = 0; i < sizeof(*stats) / sizeof(*dst); ++i)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+
+	return USBG_SUCCESS;
+}
+
+void usbg_reset_stats(usbg_state *s)
+{
+	uint64_t *dst;
+	size_t i;
+
+	if (!s)
+		return;
+
+	dst = (uint64_t *)&s->stats;
+	for (i = 0; i < sizeof(s->stats) / sizeof(*dst); ++i)
+		__atomic_store_n(&dst[i], 0, __ATOMIC_RELAXED);
+}
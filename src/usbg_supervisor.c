@@ -0,0 +1,354 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @file usbg_supervisor.c
+ * @brief Detects gadgets detached by kernel and binds them again.
+ * @details Kernel may silently unbind a gadget, for example when FFS
+ * daemon dies. configfs UDC attribute cannot be polled, but kernel
+ * notifies about every change of UDC state attribute in sysfs, so
+ * we wait for such notification and then check the UDC attribute
+ * of each watched gadget.
+ */
+
+#define MAX_EVENTS 8
+
+static uint64_t usbg_elapsed_us(const struct timespec *from)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - from->tv_sec) * 1000000ULL +
+		(now.tv_nsec - from->tv_nsec) / 1000;
+}
+
+/* Read whole attribute to receive next sysfs notification */
+static void usbg_watch_arm(struct usbg_watch *w)
+{
+	char buf[USBG_MAX_STR_LENGTH];
+
+	if (w->state_fd < 0)
+		return;
+
+	if (lseek(w->state_fd, 0, SEEK_SET) == 0)
+		while (read(w->state_fd, buf, sizeof(buf)) > 0);
+}
+
+static int usbg_watch_open_state(usbg_supervisor *sv, struct usbg_watch *w)
+{
+	char path[USBG_MAX_PATH_LENGTH];
+	struct epoll_event ev;
+	int nmb;
+
+	w->state_fd = -1;
+
+	/* Only sysfs sends notifications, emulated UDCs are just polled */
+	if (sv->parent->io.ops != &usbg_posix_ops)
+		return USBG_SUCCESS;
+
+	nmb = snprintf(path, sizeof(path), "%s/%s/state",
+		       sv->parent->udc_path, w->udc->name);
+	if (nmb >= sizeof(path))
+		return USBG_ERROR_PATH_TOO_LONG;
+
+	/*
+	 * Lack of state attribute is not an error, gadget will be
+	 * checked only when dispatch times out.
+	 */
+	w->state_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (w->state_fd < 0)
+		return USBG_SUCCESS;
+
+	usbg_watch_arm(w);
+
+	ev.events = EPOLLPRI | EPOLLERR;
+	ev.data.ptr = w;
+	if (epoll_ctl(sv->epoll_fd, EPOLL_CTL_ADD, w->state_fd, &ev)) {
+		close(w->state_fd);
+		w->state_fd = -1;
+	}
+
+	return USBG_SUCCESS;
+}
+
+static void usbg_watch_close_state(usbg_supervisor *sv, struct usbg_watch *w)
+{
+	if (w->state_fd < 0)
+		return;
+
+	epoll_ctl(sv->epoll_fd, EPOLL_CTL_DEL, w->state_fd, NULL);
+	close(w->state_fd);
+	w->state_fd = -1;
+}
+
+static struct usbg_watch *usbg_find_watch(usbg_supervisor *sv, usbg_gadget *g)
+{
+	struct usbg_watch *w;
+
+	TAILQ_FOREACH(w, &sv->watches, wnode)
+		if (w->gadget == g)
+			return w;
+
+	return NULL;
+}
+
+/* Returns true if gadget is still bound or state cannot be determined */
+static bool usbg_watch_is_bound(struct usbg_watch *w)
+{
+	usbg_gadget *g = w->gadget;
+	const struct usbg_io *io = usbg_gadget_io(g);
+	char buf[USBG_MAX_STR_LENGTH];
+	int ret;
+
+	ret = usbg_read_string(io, g->path, g->name, "UDC", buf);
+	if (ret != USBG_SUCCESS || !strcmp(buf, g->udc->name))
+		return true;
+
+	/* Kernel decided to detach this gadget */
+	g->udc->gadget = NULL;
+	g->udc = NULL;
+
+	return false;
+}
+
+/* Start listening to the UDC to which gadget has been moved */
+static void usbg_watch_move(usbg_supervisor *sv, struct usbg_watch *w,
+			    usbg_udc *udc)
+{
+	usbg_watch_close_state(sv, w);
+	w->udc = udc;
+	/* Without state attribute gadget is checked on timeout only */
+	usbg_watch_open_state(sv, w);
+}
+
+/* Returns 1 if gadget has been bound again, 0 otherwise */
+static int usbg_watch_check(usbg_supervisor *sv, struct usbg_watch *w)
+{
+	usbg_gadget *g = w->gadget;
+	uint64_t latency;
+	int ret;
+
+	if (w->gave_up)
+		return 0;
+
+	if (!w->detached) {
+		/* Gadget disabled on purpose is not supervised */
+		if (!g->udc)
+			return 0;
+		/* Follow gadget if it has been moved to other UDC */
+		if (w->udc != g->udc)
+			usbg_watch_move(sv, w, g->udc);
+
+		if (usbg_watch_is_bound(w))
+			return 0;
+
+		w->detached = true;
+		clock_gettime(CLOCK_MONOTONIC, &w->detach_ts);
+		w->stats.detaches++;
+
+		if (w->policy == USBG_RECOVERY_GIVE_UP) {
+			w->gave_up = true;
+			return 0;
+		}
+	}
+
+	if (w->policy == USBG_RECOVERY_WAIT_READY && w->ready &&
+	    !w->ready(g, w->data))
+		return 0;
+
+	if (w->udc->gadget) {
+		/* Someone else took our UDC */
+		w->stats.failed_binds++;
+		return 0;
+	}
+
+	ret = usbg_enable_gadget(g, w->udc);
+	if (ret != USBG_SUCCESS) {
+		w->stats.failed_binds++;
+		return 0;
+	}
+
+	latency = usbg_elapsed_us(&w->detach_ts);
+	w->detached = false;
+	w->stats.recoveries++;
+	w->stats.last_latency_us = latency;
+	w->stats.total_latency_us += latency;
+	if (latency > w->stats.max_latency_us)
+		w->stats.max_latency_us = latency;
+
+	return 1;
+}
+
+int usbg_supervisor_create(usbg_state *s, usbg_supervisor **sv)
+{
+	usbg_supervisor *new_sv;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!s || !sv)
+		goto out;
+
+	new_sv = malloc(sizeof(*new_sv));
+	if (!new_sv) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	new_sv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (new_sv->epoll_fd < 0) {
+		ret = usbg_translate_error(errno);
+		free(new_sv);
+		goto out;
+	}
+
+	new_sv->parent = s;
+	TAILQ_INIT(&new_sv->watches);
+	*sv = new_sv;
+	ret = USBG_SUCCESS;
+
+out:
+	return ret;
+}
+
+void usbg_supervisor_destroy(usbg_supervisor *sv)
+{
+	struct usbg_watch *w;
+
+	if (!sv)
+		return;
+
+	while (!TAILQ_EMPTY(&sv->watches)) {
+		w = TAILQ_FIRST(&sv->watches);
+		TAILQ_REMOVE(&sv->watches, w, wnode);
+		usbg_watch_close_state(sv, w);
+		free(w);
+	}
+
+	close(sv->epoll_fd);
+	free(sv);
+}
+
+int usbg_supervisor_watch(usbg_supervisor *sv, usbg_gadget *g,
+			  usbg_recovery_policy policy,
+			  usbg_ready_func ready, void *data)
+{
+	struct usbg_watch *w;
+	int ret = USBG_ERROR_INVALID_PARAM;
+
+	if (!sv || !g || !g->udc || g->parent != sv->parent)
+		goto out;
+
+	if (usbg_find_watch(sv, g)) {
+		ret = USBG_ERROR_EXIST;
+		goto out;
+	}
+
+	w = calloc(1, sizeof(*w));
+	if (!w) {
+		ret = USBG_ERROR_NO_MEM;
+		goto out;
+	}
+
+	w->gadget = g;
+	w->udc = g->udc;
+	w->policy = policy;
+	w->ready = ready;
+	w->data = data;
+
+	ret = usbg_watch_open_state(sv, w);
+	if (ret != USBG_SUCCESS) {
+		free(w);
+		goto out;
+	}
+
+	TAILQ_INSERT_TAIL(&sv->watches, w, wnode);
+
+out:
+	return ret;
+}
+
+int usbg_supervisor_unwatch(usbg_supervisor *sv, usbg_gadget *g)
+{
+	struct usbg_watch *w;
+
+	if (!sv || !g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	w = usbg_find_watch(sv, g);
+	if (!w)
+		return USBG_ERROR_NOT_FOUND;
+
+	TAILQ_REMOVE(&sv->watches, w, wnode);
+	usbg_watch_close_state(sv, w);
+	free(w);
+
+	return USBG_SUCCESS;
+}
+
+int usbg_supervisor_get_fd(usbg_supervisor *sv)
+{
+	return sv ? sv->epoll_fd : USBG_ERROR_INVALID_PARAM;
+}
+
+int usbg_supervisor_dispatch(usbg_supervisor *sv, int timeout_ms)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct usbg_watch *w;
+	int i, n;
+	int ret = 0;
+
+	if (!sv)
+		return USBG_ERROR_INVALID_PARAM;
+
+	n = epoll_wait(sv->epoll_fd, events, MAX_EVENTS, timeout_ms);
+	if (n < 0 && errno != EINTR)
+		return usbg_translate_error(errno);
+
+	for (i = 0; i < n; ++i)
+		usbg_watch_arm(events[i].data.ptr);
+
+	/*
+	 * Notification tells only that some UDC changed its state,
+	 * each gadget costs a single read so just check all of them.
+	 */
+	TAILQ_FOREACH(w, &sv->watches, wnode)
+		ret += usbg_watch_check(sv, w);
+
+	return ret;
+}
+
+int usbg_supervisor_get_stats(usbg_supervisor *sv, usbg_gadget *g,
+			      struct usbg_recovery_stats *stats)
+{
+	struct usbg_watch *w;
+
+	if (!sv || !g || !stats)
+		return USBG_ERROR_INVALID_PARAM;
+
+	w = usbg_find_watch(sv, g);
+	if (!w)
+		return USBG_ERROR_NOT_FOUND;
+
+	*stats = w->stats;
+
+	return USBG_SUCCESS;
+}
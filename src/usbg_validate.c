@@ -0,0 +1,180 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "usbg/usbg.h"
+#include "usbg/usbg_internal.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @file usbg_validate.c
+ * @brief Checks done before any expensive configfs operation.
+ */
+
+static bool usbg_gadget_has_function(usbg_gadget *g, usbg_function *f)
+{
+	usbg_function *i;
+
+	TAILQ_FOREACH(i, &g->functions, fnode)
+		if (i == f)
+			return true;
+
+	return false;
+}
+
+static bool usbg_gadget_has_config(usbg_gadget *g, usbg_config *c)
+{
+	usbg_config *i;
+
+	TAILQ_FOREACH(i, &g->configs, cnode)
+		if (i == c)
+			return true;
+
+	return false;
+}
+
+static bool usbg_config_is_periodic(usbg_config *c)
+{
+	usbg_binding *b;
+
+	TAILQ_FOREACH(b, &c->bindings, bnode)
+		if (usbg_function_type_is_periodic(b->target->type))
+			return true;
+
+	return false;
+}
+
+/* Only configs with periodic functions need speed of UDC */
+static int usbg_validate_bandwidth(usbg_gadget *g, char *buf, int len)
+{
+	struct usbg_bandwidth bw;
+	usbg_speed speed = USBG_SPEED_UNKNOWN;
+	usbg_config *c;
+	int ret;
+
+	TAILQ_FOREACH(c, &g->configs, cnode) {
+		if (!usbg_config_is_periodic(c))
+			continue;
+
+		if (speed == USBG_SPEED_UNKNOWN)
+			speed = g->udc ? usbg_get_udc_max_speed(g->udc)
+				: usbg_fastest_udc_speed(g->parent);
+		/* Nothing to compare with */
+		if (speed == USBG_SPEED_UNKNOWN)
+			break;
+
+		ret = usbg_get_config_bandwidth(c, speed, &bw);
+		if (ret != USBG_SUCCESS)
+			return usbg_validation_fail(buf, len, ret,
+						    "cannot read attributes of config %s.%d",
+						    c->label, c->id);
+
+		if (bw.headroom < 0)
+			return usbg_validation_fail(buf, len,
+						    USBG_ERROR_NOT_SUPPORTED,
+						    "config %s.%d needs %llu B/s of periodic bandwidth, only %llu B/s available",
+						    c->label, c->id,
+						    (unsigned long long)bw.used,
+						    (unsigned long long)bw.available);
+	}
+
+	return USBG_SUCCESS;
+}
+
+static int usbg_validate_endpoints(usbg_gadget *g, char *buf, int len)
+{
+	struct usbg_ep_budget b;
+	usbg_config *c;
+	int endpoints;
+	int ret;
+
+	endpoints = g->udc ? usbg_get_udc_endpoints(g->udc)
+		: usbg_max_udc_endpoints(g->parent);
+
+	TAILQ_FOREACH(c, &g->configs, cnode) {
+		ret = usbg_get_config_ep_budget(c, &b);
+		if (ret != USBG_SUCCESS)
+			return usbg_validation_fail(buf, len, ret,
+						    "cannot read attributes of config %s.%d",
+						    c->label, c->id);
+
+		if (b.interfaces > USBG_MAX_CONFIG_INTERFACES)
+			return usbg_validation_fail(buf, len,
+						    USBG_ERROR_NOT_SUPPORTED,
+						    "config %s.%d needs %d interfaces, only %d allowed",
+						    c->label, c->id, b.interfaces,
+						    USBG_MAX_CONFIG_INTERFACES);
+
+		/* Negative if inventory of UDC is unknown */
+		if (endpoints >= 0 && b.endpoints > endpoints)
+			return usbg_validation_fail(buf, len,
+						    USBG_ERROR_NOT_SUPPORTED,
+						    "config %s.%d needs %d endpoints, UDC has only %d",
+						    c->label, c->id, b.endpoints,
+						    endpoints);
+	}
+
+	return USBG_SUCCESS;
+}
+
+int usbg_validate_gadget(usbg_gadget *g, char *buf, int len)
+{
+	usbg_config *c;
+	usbg_binding *b;
+	int ret;
+
+	if (!g)
+		return USBG_ERROR_INVALID_PARAM;
+
+	if (TAILQ_EMPTY(&g->configs))
+		return usbg_validation_fail(buf, len, USBG_ERROR_NOT_FOUND,
+					    "gadget %s has no configuration",
+					    g->name);
+
+	TAILQ_FOREACH(c, &g->configs, cnode) {
+		if (c->id <= 0 || c->id > 255)
+			return usbg_validation_fail(buf, len,
+						    USBG_ERROR_INVALID_VALUE,
+						    "config %s.%d has invalid id",
+						    c->label, c->id);
+
+		if (TAILQ_EMPTY(&c->bindings))
+			return usbg_validation_fail(buf, len,
+						    USBG_ERROR_NOT_FOUND,
+						    "config %s.%d has no functions",
+						    c->label, c->id);
+
+		TAILQ_FOREACH(b, &c->bindings, bnode) {
+			if (!b->target || !usbg_gadget_has_function(g, b->target))
+				return usbg_validation_fail(buf, len,
+						USBG_ERROR_NOT_FOUND,
+						"binding %s in config %s.%d refers to unknown function",
+						b->name, c->label, c->id);
+		}
+	}
+
+	if (g->os_desc_binding && !usbg_gadget_has_config(g, g->os_desc_binding))
+		return usbg_validation_fail(buf, len, USBG_ERROR_NOT_FOUND,
+					    "OS descriptors refer to unknown config");
+
+	if (!g->udc && TAILQ_EMPTY(&g->parent->udcs))
+		return usbg_validation_fail(buf, len, USBG_ERROR_NO_DEV,
+					    "no UDC available");
+
+	ret = usbg_validate_endpoints(g, buf, len);
+	if (ret != USBG_SUCCESS)
+		return ret;
+
+	return usbg_validate_bandwidth(g, buf, len);
+}
@@ -8,7 +8,13 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
 
 #ifdef HAS_LIBCONFIG
 #include <libconfig.h>
@@ -1292,6 +1298,42 @@ static void test_set_gadget_attrs(void **state)
 	try_set_gadget_attrs(s, ts, get_random_gadget_attrs());
 }
 
+/**
+ * @brief Tests that modifications bump generation of state
+ * @details Freshly initialized state is at generation 0 and each
+ * successful setter moves it forward.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_generation(void **state)
+{
+	usbg_state *s = NULL;
+	struct test_state *ts;
+	struct test_gadget *tg;
+	usbg_gadget *g;
+	uint64_t gen, prev = 0;
+	int ret;
+
+	safe_init_with_state(state, &ts, &s);
+	assert_int_equal(usbg_get_generation(s), 0);
+
+	for (tg = ts->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		assert_non_null(g);
+
+		pull_gadget_attrs(tg, &max_gadget_attrs);
+		ret = usbg_set_gadget_attrs(g, &max_gadget_attrs);
+		assert_int_equal(ret, USBG_SUCCESS);
+
+		gen = usbg_get_generation(s);
+		assert_true(gen > prev);
+		prev = gen;
+	}
+
+	/* Nothing has been removed, so there is nothing to forget */
+	usbg_drop_tombstones(s, prev);
+	assert_int_equal(usbg_get_generation(s), prev);
+}
+
 /**
  * @brief Test setting given attributes on gadgets present in state one by one,
  * using functions specific for each attribute
@@ -1366,205 +1408,870 @@ void test_get_udc(void **state)
 	}
 }
 
-static void test_get_gadget_attr_str(void **state)
+/**
+ * @brief Tests staged binding of gadgets and connecting udc
+ * @details Gadget should be bound and disconnected first, then connected
+ * with connection time recorded.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_enable_gadget_staged(void **state)
 {
-	struct {
-		usbg_gadget_attr attr;
-		const char *str;
-	} attrs[] = {
-		{USBG_BCD_USB, "bcdUSB"},
-		{USBG_B_DEVICE_CLASS, "bDeviceClass"},
-		{USBG_B_DEVICE_SUB_CLASS, "bDeviceSubClass"},
-		{USBG_B_DEVICE_PROTOCOL, "bDeviceProtocol"},
-		{USBG_B_MAX_PACKET_SIZE_0, "bMaxPacketSize0"},
-		{USBG_ID_VENDOR, "idVendor"},
-		{USBG_ID_PRODUCT, "idProduct"},
-		{USBG_BCD_DEVICE, "bcdDevice"},
-	};
+	struct test_state *ts;
+	struct test_gadget *tg;
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	usbg_udc *u = NULL;
+	struct timespec t;
+	int ret;
 
-	const char *str;
-	int i, j;
+	safe_init_with_state(state, &ts, &s);
 
-	for (i = 0; i < ARRAY_SIZE(attrs); i++) {
-		str = usbg_get_gadget_attr_str(attrs[i].attr);
-		assert_non_null(str);
-		assert_string_equal(str, attrs[i].str);
-	}
+	for (tg = ts->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		u = usbg_get_udc(s, ts->udcs[0]);
+		assert_non_null(g);
+		assert_non_null(u);
 
-	/* Check if iteration over values works */
-	for (i = USBG_GADGET_ATTR_MIN; i < USBG_GADGET_ATTR_MAX; ++i) {
-		str = usbg_get_gadget_attr_str(i);
-		assert_non_null(str);
+		pull_gadget_udc(tg, u->name);
+		pull_udc_soft_connect(u->name, "disconnect");
+		ret = usbg_enable_gadget_staged(g, u);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_ptr_equal(u->gadget, g);
+		assert_ptr_equal(g->udc, u);
 
-		for (j = 0; j < ARRAY_SIZE(attrs); ++j)
-			if (attrs[j].attr == i) {
-				assert_string_equal(str, attrs[j].str);
-				break;
-			}
+		ret = usbg_get_udc_connect_time(u, &t);
+		assert_int_equal(ret, USBG_ERROR_NOT_FOUND);
 
-		assert_int_not_equal(j, ARRAY_SIZE(attrs));
+		pull_udc_soft_connect(u->name, "connect");
+		ret = usbg_udc_connect(u);
+		assert_int_equal(ret, USBG_SUCCESS);
+
+		ret = usbg_get_udc_connect_time(u, &t);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_true(t.tv_sec || t.tv_nsec);
+
+		/* reset for the next gadget */
+		u->connect_ts.tv_sec = 0;
+		u->connect_ts.tv_nsec = 0;
 	}
 }
 
-static void test_get_gadget_attr_str_fail(void **state)
+/**
+ * @brief Tests choosing free udc according to allocation policy
+ * @details Simple state has two udcs and the only gadget bound to the first one
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_udc_policy(void **state)
 {
-	const char *str;
+	struct test_state *ts;
+	struct test_gadget *tg;
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	usbg_udc *busy, *free_udc, *u = NULL;
+	int ret;
 
-	str = usbg_get_gadget_attr_str(USBG_GADGET_ATTR_MIN - 1);
-	assert_null(str);
+	safe_init_with_state(state, &ts, &s);
 
-	str = usbg_get_gadget_attr_str(USBG_GADGET_ATTR_MAX);
-	assert_null(str);
+	tg = ts->gadgets;
+	g = usbg_get_gadget(s, tg->name);
+	busy = usbg_get_udc(s, tg->udc);
+	free_udc = usbg_get_udc(s, ts->udcs[1]);
+	assert_non_null(g);
+	assert_ptr_equal(busy->gadget, g);
+	assert_null(free_udc->gadget);
+
+	u = usbg_find_free_udc(s, USBG_UDC_POLICY_FIRST_FREE, NULL);
+	assert_ptr_equal(u, free_udc);
+
+	u = usbg_find_free_udc(s, USBG_UDC_POLICY_PINNED, busy->name);
+	assert_null(u);
+	u = usbg_find_free_udc(s, USBG_UDC_POLICY_PINNED, free_udc->name);
+	assert_ptr_equal(u, free_udc);
+
+	push_udc_max_speed(free_udc->name, "high-speed\n");
+	u = usbg_find_free_udc(s, USBG_UDC_POLICY_FASTEST, NULL);
+	assert_ptr_equal(u, free_udc);
+	/* speed should be cached, no more reads expected */
+	assert_int_equal(usbg_get_udc_max_speed(u), USBG_SPEED_HIGH);
+
+	ret = usbg_enable_gadget_policy(g, USBG_UDC_POLICY_PINNED,
+					busy->name, &u);
+	assert_int_equal(ret, USBG_ERROR_BUSY);
+	ret = usbg_enable_gadget_policy(g, USBG_UDC_POLICY_PINNED,
+					"no_such_udc", &u);
+	assert_int_equal(ret, USBG_ERROR_NOT_FOUND);
+
+	pull_gadget_udc(tg, free_udc->name);
+	ret = usbg_enable_gadget_policy(g, USBG_UDC_POLICY_FIRST_FREE,
+					NULL, &u);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_ptr_equal(u, free_udc);
+	assert_ptr_equal(free_udc->gadget, g);
+	assert_null(busy->gadget);
 }
 
 /**
- * @brief set gadget strings
- * @details Also do it one by one
- * @param[in] data Pointer to correctly initialized
- *            test_gadget_strs_data structure
- */
-static void test_set_gadget_strs(void **data)
+ * @brief Tests validation of gadgets before binding
+ * @details Gadget is expected to be valid only if it has configs
+ * and each of them has at least one function bound.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_validate_gadget(void **state)
 {
-	struct test_gadget_strs_data *ts;
+	struct test_state *ts;
 	struct test_gadget *tg;
+	struct test_config *tc;
 	usbg_state *s = NULL;
 	usbg_gadget *g = NULL;
-	int i;
+	char buf[USBG_MAX_STR_LENGTH];
+	int expected;
 	int ret;
 
-	ts = (struct test_gadget_strs_data *)(*data);
-	*data = NULL;
-
-	init_with_state(ts->state, &s);
-	*data = s;
+	safe_init_with_state(state, &ts, &s);
 
-	for (tg = ts->state->gadgets; tg->name; tg++) {
+	for (tg = ts->gadgets; tg->name; tg++) {
 		g = usbg_get_gadget(s, tg->name);
+		assert_non_null(g);
 
-		pull_gadget_strs(tg, LANG_US_ENG, ts->strs);
-		ret = usbg_set_gadget_strs(g, LANG_US_ENG, ts->strs);
-		assert_int_equal(ret, 0);
-
-		for (i = 0; i < GADGET_STR_MAX; i++)
-			pull_gadget_string(tg, LANG_US_ENG, i,
-					   get_gadget_str(ts->strs, i));
-
-		ret = usbg_set_gadget_manufacturer(g, LANG_US_ENG,
-						   ts->strs->manufacturer);
-		assert_int_equal(ret, 0);
-
-		ret = usbg_set_gadget_product(g, LANG_US_ENG,
-					      ts->strs->product);
-		assert_int_equal(ret, 0);
-
-		ret = usbg_set_gadget_serial_number(g, LANG_US_ENG,
-						    ts->strs->serial);
-		assert_int_equal(ret, 0);
+		expected = tg->configs->label ? USBG_SUCCESS
+			: USBG_ERROR_NOT_FOUND;
+		for (tc = tg->configs; tc->label; tc++)
+			if (!tc->bindings->name)
+				expected = USBG_ERROR_NOT_FOUND;
+
+		buf[0] = '\0';
+		ret = usbg_validate_gadget(g, buf, sizeof(buf));
+		assert_int_equal(ret, expected);
+		if (expected != USBG_SUCCESS)
+			assert_true(strlen(buf) > 0);
+	}
+}
 
-		for (i = 0; i < GADGET_STR_MAX; i++)
-			pull_gadget_string(tg, LANG_US_ENG,
-					   i, get_gadget_str(ts->strs, i));
+/**
+ * @brief Tests periodic bandwidth budget of configs
+ * @details Functions in test states have no periodic endpoints,
+ * so whole bandwidth is expected to be left and no attribute read.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_config_bandwidth(void **state)
+{
+	struct test_state *ts;
+	struct test_gadget *tg;
+	struct test_config *tc;
+	struct usbg_bandwidth bw;
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	usbg_config *c = NULL;
+	int ret;
 
+	safe_init_with_state(state, &ts, &s);
 
-		ret = usbg_set_gadget_str(g, USBG_STR_MANUFACTURER,
-					  LANG_US_ENG, ts->strs->manufacturer);
-		assert_int_equal(ret, 0);
+	for (tg = ts->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		assert_non_null(g);
 
-		ret = usbg_set_gadget_str(g, USBG_STR_PRODUCT,
-					  LANG_US_ENG, ts->strs->product);
-		assert_int_equal(ret, 0);
+		for (tc = tg->configs; tc->label; tc++) {
+			c = usbg_get_config(g, tc->id, tc->label);
+			assert_non_null(c);
 
-		ret = usbg_set_gadget_str(g, USBG_STR_SERIAL_NUMBER,
-					  LANG_US_ENG, ts->strs->serial);
-		assert_int_equal(ret, 0);
+			ret = usbg_get_config_bandwidth(c, USBG_SPEED_UNKNOWN,
+							&bw);
+			assert_int_equal(ret, USBG_ERROR_INVALID_PARAM);
+
+			ret = usbg_get_config_bandwidth(c, USBG_SPEED_FULL,
+							&bw);
+			assert_int_equal(ret, USBG_SUCCESS);
+			assert_int_equal(bw.used, 0);
+			assert_int_equal(bw.available, 1350000);
+			assert_int_equal(bw.headroom, bw.available);
+
+			ret = usbg_get_config_bandwidth(c, USBG_SPEED_HIGH,
+							&bw);
+			assert_int_equal(ret, USBG_SUCCESS);
+			assert_int_equal(bw.available, 48000000);
+		}
 	}
 }
 
 /**
- * @brief get gadget strings
- * @param[in] data Pointer to correctly initialized
- *            test_gadget_strs_data structure
- */
-static void test_get_gadget_strs(void **data)
+ * @brief Tests interface and endpoint budget of configs
+ * @details Gadget with single config is expected to be valid only
+ * if UDC has enough endpoints for it.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_config_ep_budget(void **state)
 {
-	struct test_gadget_strs_data *ts;
+	struct test_state *ts;
 	struct test_gadget *tg;
+	struct test_config *tc;
+	struct test_binding *tb;
+	struct usbg_ep_budget b;
 	usbg_state *s = NULL;
 	usbg_gadget *g = NULL;
-	struct usbg_gadget_strs strs;
+	usbg_config *c = NULL;
+	usbg_udc *u;
+	int max_endpoints = 0;
+	int nbindings;
+	int ret;
 
-	ts = (struct test_gadget_strs_data *)(*data);
-	*data = NULL;
+	safe_init_with_state(state, &ts, &s);
 
-	init_with_state(ts->state, &s);
-	*data = s;
+	for (tg = ts->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		assert_non_null(g);
 
-	for (tg = ts->state->gadgets; tg->name; tg++) {
+		for (tc = tg->configs; tc->label; tc++) {
+			c = usbg_get_config(g, tc->id, tc->label);
+			assert_non_null(c);
+
+			ret = usbg_get_config_ep_budget(c, &b);
+			assert_int_equal(ret, USBG_SUCCESS);
+
+			nbindings = 0;
+			for (tb = tc->bindings; tb->name; tb++)
+				nbindings++;
+			assert_true(b.interfaces >= nbindings);
+			assert_true(b.endpoints >= nbindings);
+
+			if (b.endpoints > max_endpoints)
+				max_endpoints = b.endpoints;
+		}
+	}
+
+	usbg_for_each_udc(u, s) {
+		ret = usbg_set_udc_endpoints(u, max_endpoints - 1);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(usbg_get_udc_endpoints(u), max_endpoints - 1);
+	}
+
+	for (tg = ts->gadgets; tg->name; tg++) {
 		g = usbg_get_gadget(s, tg->name);
-		push_gadget_strs(tg, LANG_US_ENG, ts->strs);
-		usbg_get_gadget_strs(g, LANG_US_ENG, &strs);
-		assert_gadget_strs_equal(&strs, ts->strs);
-		usbg_free_gadget_strs(&strs);
+		ret = usbg_validate_gadget(g, NULL, 0);
+		assert_int_equal(ret, USBG_ERROR_NOT_SUPPORTED);
 	}
-}
 
-/**
- * @brief Get binding target
- * @details Check if given function is target of given binding
- * @param[in] tb Test function
- * @param[in] b Binding
- */
-static void try_get_binding_target(struct test_binding *tb, usbg_binding *b)
-{
-	usbg_function *f;
+	usbg_for_each_udc(u, s)
+		usbg_set_udc_endpoints(u, max_endpoints);
 
-	f = usbg_get_binding_target(b);
-	assert_non_null(f);
-	assert_func_equal(f, tb->target);
+	for (tg = ts->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		ret = usbg_validate_gadget(g, NULL, 0);
+		assert_int_equal(ret, USBG_SUCCESS);
+	}
 }
 
-/**
- * @brief Test get binding target
- * @details Test all bindings present in given state
- * @param[in, out] state Pointer to pointer to correctly initialized test state,
- * will point to usbg state when finished.
- */
-static void test_get_binding_target(void **state)
+struct test_daemon_data {
+	usbg_daemon *d;
+	volatile bool done;
+};
+
+static void *test_daemon_thread(void *data)
 {
-	usbg_state *s = NULL;
-	struct test_state *ts;
+	struct test_daemon_data *td = data;
 
-	safe_init_with_state(state, &ts, &s);
-	for_each_binding(ts, s, try_get_binding_target);
+	while (!td->done)
+		usbg_daemon_dispatch(td->d, 10);
+
+	return NULL;
 }
 
-/**
- * @brief Get binding name
- * @details Check if name of given binding is equal name of given function
- * @param[in] tb Test function
- * @param[in] b Binding
- */
-static void try_get_binding_name(struct test_binding *tb, usbg_binding *b)
+static int test_client_gadget(const struct usbg_client_gadget *g, void *data)
 {
-	const char *s;
+	struct test_gadget **tg = data;
 
-	s = usbg_get_binding_name(b);
-	assert_non_null(s);
-	assert_string_equal(s, tb->name);
+	assert_string_equal(g->name, (*tg)->name);
+	assert_string_equal(g->udc, (*tg)->udc ? (*tg)->udc : "");
+	(*tg)++;
+
+	return 0;
 }
 
 /**
- * @brief Test get bindig name from all binding present in state
- * @param[in, out] state Pointer to pointer to correctly initialized test state,
- * will point to usbg state when finished.
- */
-static void test_get_binding_name(void **state)
+ * @brief Tests listing gadgets through daemon
+ * @details Daemon answers from its state, without any configfs access.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_daemon(void **state)
 {
-	usbg_state *s = NULL;
 	struct test_state *ts;
+	struct test_gadget *tg;
+	struct test_daemon_data td = { .done = false };
+	usbg_state *s = NULL;
+	usbg_client *c = NULL;
+	pthread_t thread;
+	char path[64];
+	int ret;
 
 	safe_init_with_state(state, &ts, &s);
-	for_each_binding(ts, s, try_get_binding_name);
+
+	snprintf(path, sizeof(path), "/tmp/usbg-test-%d.sock", getpid());
+	ret = usbg_daemon_create(s, path, &td.d);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(usbg_daemon_get_fd(td.d) >= 0);
+
+	ret = pthread_create(&thread, NULL, test_daemon_thread, &td);
+	assert_int_equal(ret, 0);
+
+	ret = usbg_client_connect(path, &c);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	tg = ts->gadgets;
+	ret = usbg_client_list_gadgets(c, test_client_gadget, &tg);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_null(tg->name);
+
+	ret = usbg_client_switch_gadget(c, ts->gadgets->name, "no-such-udc");
+	assert_int_equal(ret, USBG_ERROR_NOT_FOUND);
+
+	usbg_client_close(c);
+	td.done = true;
+	pthread_join(thread, NULL);
+	usbg_daemon_destroy(td.d);
+	assert_int_not_equal(access(path, F_OK), 0);
+}
+
+/**
+ * @brief Tests cloning gadget under name which is already taken
+ * @details Source attributes are read first and then clone is refused
+ * before anything is created in configfs.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_clone_gadget_exist(void **state)
+{
+	struct test_state *ts;
+	struct test_gadget *tg;
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL, *dst = NULL;
+	int ret;
+
+	safe_init_with_state(state, &ts, &s);
+
+	ret = usbg_clone_gadget(NULL, "clone", &dst);
+	assert_int_equal(ret, USBG_ERROR_INVALID_PARAM);
+
+	for (tg = ts->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		assert_non_null(g);
+
+		ret = usbg_clone_gadget(g, NULL, &dst);
+		assert_int_equal(ret, USBG_ERROR_INVALID_PARAM);
+
+		push_gadget_attrs(tg, &max_gadget_attrs);
+		ret = usbg_clone_gadget(g, tg->name, &dst);
+		assert_int_equal(ret, USBG_ERROR_EXIST);
+		assert_null(dst);
+	}
+
+	assert_state_equal(s, ts);
+}
+
+/* Layout of binary image, as saved by usbg_save_image() */
+struct test_image
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t nrecs;
+	uint32_t strtab_len;
+	struct {
+		uint16_t type;
+		uint16_t id;
+		uint32_t key;
+		uint32_t val;
+		uint32_t len;
+	} rec;
+	char strtab[8];
+};
+
+static int open_test_image(const struct test_image *img, size_t len,
+			   usbg_image **out)
+{
+	char path[] = "/tmp/usbg-image-XXXXXX";
+	int fd, ret;
+
+	fd = mkstemp(path);
+	assert_true(fd >= 0);
+	unlink(path);
+
+	assert_int_equal(write(fd, img, len), len);
+	ret = usbg_open_image_fd(fd, out);
+	close(fd);
+
+	return ret;
+}
+
+/**
+ * @brief Tests opening and restoring of binary images
+ * @details Image without gadgets is restored without any configfs
+ * access. Images with bad header or offsets out of string table
+ * have to be refused when opened.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_image(void **state)
+{
+	struct test_state *ts;
+	usbg_state *s = NULL;
+	usbg_image *img = NULL;
+	struct test_image ti = {
+		.magic = 0x49504755,
+		.version = 1,
+		.strtab_len = 1,
+	};
+	size_t empty_len = offsetof(struct test_image, rec) + 1;
+	int ret;
+
+	safe_init_with_state(state, &ts, &s);
+
+	ret = open_test_image(&ti, empty_len, &img);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(usbg_get_image_gadget_count(img), 0);
+	assert_int_equal(usbg_restore_image(s, img, USBG_IMAGE_BIND),
+			 USBG_SUCCESS);
+	usbg_close_image(img);
+
+	ti.magic = 0;
+	ret = open_test_image(&ti, empty_len, &img);
+	assert_int_equal(ret, USBG_ERROR_INVALID_FORMAT);
+
+	/* String table has to match size of file */
+	ti.magic = 0x49504755;
+	ret = open_test_image(&ti, empty_len - 1, &img);
+	assert_int_equal(ret, USBG_ERROR_INVALID_FORMAT);
+
+	/* Gadget named by string past the end of string table */
+	ti.nrecs = 1;
+	ti.strtab_len = sizeof(ti.strtab);
+	ti.rec.key = sizeof(ti.strtab);
+	ret = open_test_image(&ti, sizeof(ti), &img);
+	assert_int_equal(ret, USBG_ERROR_INVALID_FORMAT);
+
+	/* Function which doesn't belong to any gadget */
+	ti.rec.type = 4;
+	ti.rec.key = 1;
+	strcpy(ti.strtab + 1, "acm");
+	ret = open_test_image(&ti, sizeof(ti), &img);
+	assert_int_equal(ret, USBG_ERROR_INVALID_FORMAT);
+
+	assert_state_equal(s, ts);
+}
+
+static void push_export_config(struct test_config *tc)
+{
+	struct usbg_config_strs strs = {
+		.configuration = "Tab\tand \"quotes\""
+	};
+	int langs[] = { LANG_US_ENG, 0x415, 0 };
+
+	push_config_attrs(tc, &max_config_attrs);
+	push_config_langs(tc, langs);
+	push_config_strs(tc, LANG_US_ENG, &strs);
+	push_config_strs(tc, 0x415, &strs);
+}
+
+static FILE *open_export_buf(char **buf, size_t *len)
+{
+	FILE *f;
+
+	f = open_memstream(buf, len);
+	assert_non_null(f);
+	pass_through_stream(f);
+
+	return f;
+}
+
+static void assert_export_equal(char *stream, size_t stream_len,
+				char *tree, size_t tree_len)
+{
+	assert_int_equal(stream_len, tree_len);
+	assert_memory_equal(stream, tree, tree_len);
+
+	free(tree);
+	free(stream);
+}
+
+static void export_config_to_buf(usbg_config *c, bool stream, char **buf,
+				 size_t *len)
+{
+	FILE *f;
+	int ret;
+
+	f = open_export_buf(buf, len);
+	ret = stream ? usbg_export_config_stream(c, f) :
+		usbg_export_config(c, f);
+	assert_int_equal(ret, USBG_SUCCESS);
+	fclose(f);
+}
+
+static void check_export_config_stream(usbg_config *c, struct test_config *tc)
+{
+	char *tree, *stream;
+	size_t tree_len, stream_len;
+
+	push_export_config(tc);
+	export_config_to_buf(c, false, &tree, &tree_len);
+
+	push_export_config(tc);
+	export_config_to_buf(c, true, &stream, &stream_len);
+
+	assert_export_equal(stream, stream_len, tree, tree_len);
+}
+
+/**
+ * @brief Tests streaming export of configs
+ * @details Output has to be byte identical with the one written by
+ * libconfig from exported tree.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_export_config_stream(void **state)
+{
+	struct test_state *ts;
+	usbg_state *s = NULL;
+
+	safe_init_with_state(state, &ts, &s);
+
+	/* Library built without gadget schemes */
+	if (usbg_export_config(NULL, stdout) == USBG_ERROR_NOT_SUPPORTED)
+		skip();
+
+	for_each_test_config(ts, s, check_export_config_stream);
+}
+
+/**
+ * @brief Tests reading of gadget tree published in shared memory
+ * @details Snapshot is built from state only, so no configfs access
+ * is expected. Region too small for the tree has to be refused.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_snapshot(void **state)
+{
+	struct test_state *ts;
+	struct test_gadget *tg;
+	usbg_state *s = NULL;
+	usbg_publisher *p = NULL;
+	usbg_snapshot *snap = NULL;
+	uint32_t seq;
+	int i, udc;
+	int ret;
+
+	safe_init_with_state(state, &ts, &s);
+
+	ret = usbg_publisher_create(s, NULL, 64, &p);
+	assert_int_equal(ret, USBG_ERROR_NO_MEM);
+
+	ret = usbg_publisher_create(s, NULL, 0, &p);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_snapshot_open_fd(usbg_publisher_get_fd(p), &snap);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_publisher_update(p);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	seq = usbg_snapshot_read_begin(snap);
+	assert_int_equal(seq % 2, 0);
+
+	i = 0;
+	for (tg = ts->gadgets; tg->name; tg++, i++) {
+		assert_string_equal(usbg_snapshot_get_gadget_name(snap, i),
+				    tg->name);
+		udc = usbg_snapshot_get_gadget_udc(snap, i);
+		if (tg->udc)
+			assert_string_equal(usbg_snapshot_get_udc_name(snap, udc),
+					    tg->udc);
+		else
+			assert_int_equal(udc, -1);
+	}
+	assert_int_equal(usbg_snapshot_get_gadget_count(snap), i);
+	assert_null(usbg_snapshot_get_gadget_name(snap, i));
+
+	for (i = 0; ts->udcs[i]; i++)
+		assert_string_equal(usbg_snapshot_get_udc_name(snap, i),
+				    ts->udcs[i]);
+	assert_int_equal(usbg_snapshot_get_udc_count(snap), i);
+
+	assert_false(usbg_snapshot_read_retry(snap, seq));
+
+	ret = usbg_publisher_update(p);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(usbg_snapshot_read_retry(snap, seq));
+
+	usbg_snapshot_close(snap);
+	usbg_publisher_destroy(p);
+}
+
+static bool test_gadget_ready(usbg_gadget *g, void *data)
+{
+	return *(bool *)data;
+}
+
+/**
+ * @brief Tests rebinding of gadgets detached by kernel
+ * @details Gadget is detached twice, first time it is bound again at once,
+ * second time only after ready callback allows it.
+ * @param[in] state Pointer to correctly initialized test_state structure
+ **/
+static void test_supervisor(void **state)
+{
+	struct test_state *ts;
+	struct test_gadget *tg;
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	usbg_supervisor *sv = NULL;
+	struct usbg_recovery_stats stats;
+	bool ready = false;
+	int ret;
+
+	safe_init_with_state(state, &ts, &s);
+
+	tg = ts->gadgets;
+	g = usbg_get_gadget(s, tg->name);
+	assert_non_null(g);
+
+	ret = usbg_supervisor_create(s, &sv);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_supervisor_watch(sv, g, USBG_RECOVERY_REBIND, NULL, NULL);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	push_gadget_udc(tg, tg->udc);
+	ret = usbg_supervisor_dispatch(sv, 0);
+	assert_int_equal(ret, 0);
+
+	push_gadget_udc(tg, "\n");
+	pull_gadget_udc(tg, tg->udc);
+	ret = usbg_supervisor_dispatch(sv, 0);
+	assert_int_equal(ret, 1);
+	assert_non_null(usbg_get_udc(s, tg->udc)->gadget);
+
+	ret = usbg_supervisor_get_stats(sv, g, &stats);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(stats.detaches, 1);
+	assert_int_equal(stats.recoveries, 1);
+
+	ret = usbg_supervisor_unwatch(sv, g);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_supervisor_watch(sv, g, USBG_RECOVERY_WAIT_READY,
+				    test_gadget_ready, &ready);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	push_gadget_udc(tg, "\n");
+	ret = usbg_supervisor_dispatch(sv, 0);
+	assert_int_equal(ret, 0);
+	assert_null(g->udc);
+
+	ready = true;
+	pull_gadget_udc(tg, tg->udc);
+	ret = usbg_supervisor_dispatch(sv, 0);
+	assert_int_equal(ret, 1);
+	assert_non_null(g->udc);
+
+	ret = usbg_supervisor_get_stats(sv, g, &stats);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(stats.detaches, 1);
+	assert_int_equal(stats.recoveries, 1);
+	assert_int_equal(stats.failed_binds, 0);
+
+	usbg_supervisor_destroy(sv);
+}
+
+static void test_get_gadget_attr_str(void **state)
+{
+	struct {
+		usbg_gadget_attr attr;
+		const char *str;
+	} attrs[] = {
+		{USBG_BCD_USB, "bcdUSB"},
+		{USBG_B_DEVICE_CLASS, "bDeviceClass"},
+		{USBG_B_DEVICE_SUB_CLASS, "bDeviceSubClass"},
+		{USBG_B_DEVICE_PROTOCOL, "bDeviceProtocol"},
+		{USBG_B_MAX_PACKET_SIZE_0, "bMaxPacketSize0"},
+		{USBG_ID_VENDOR, "idVendor"},
+		{USBG_ID_PRODUCT, "idProduct"},
+		{USBG_BCD_DEVICE, "bcdDevice"},
+	};
+
+	const char *str;
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(attrs); i++) {
+		str = usbg_get_gadget_attr_str(attrs[i].attr);
+		assert_non_null(str);
+		assert_string_equal(str, attrs[i].str);
+	}
+
+	/* Check if iteration over values works */
+	for (i = USBG_GADGET_ATTR_MIN; i < USBG_GADGET_ATTR_MAX; ++i) {
+		str = usbg_get_gadget_attr_str(i);
+		assert_non_null(str);
+
+		for (j = 0; j < ARRAY_SIZE(attrs); ++j)
+			if (attrs[j].attr == i) {
+				assert_string_equal(str, attrs[j].str);
+				break;
+			}
+
+		assert_int_not_equal(j, ARRAY_SIZE(attrs));
+	}
+}
+
+static void test_get_gadget_attr_str_fail(void **state)
+{
+	const char *str;
+
+	str = usbg_get_gadget_attr_str(USBG_GADGET_ATTR_MIN - 1);
+	assert_null(str);
+
+	str = usbg_get_gadget_attr_str(USBG_GADGET_ATTR_MAX);
+	assert_null(str);
+}
+
+/**
+ * @brief set gadget strings
+ * @details Also do it one by one
+ * @param[in] data Pointer to correctly initialized
+ *            test_gadget_strs_data structure
+ */
+static void test_set_gadget_strs(void **data)
+{
+	struct test_gadget_strs_data *ts;
+	struct test_gadget *tg;
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	int i;
+	int ret;
+
+	ts = (struct test_gadget_strs_data *)(*data);
+	*data = NULL;
+
+	init_with_state(ts->state, &s);
+	*data = s;
+
+	for (tg = ts->state->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+
+		pull_gadget_strs(tg, LANG_US_ENG, ts->strs);
+		ret = usbg_set_gadget_strs(g, LANG_US_ENG, ts->strs);
+		assert_int_equal(ret, 0);
+
+		for (i = 0; i < GADGET_STR_MAX; i++)
+			pull_gadget_string(tg, LANG_US_ENG, i,
+					   get_gadget_str(ts->strs, i));
+
+		ret = usbg_set_gadget_manufacturer(g, LANG_US_ENG,
+						   ts->strs->manufacturer);
+		assert_int_equal(ret, 0);
+
+		ret = usbg_set_gadget_product(g, LANG_US_ENG,
+					      ts->strs->product);
+		assert_int_equal(ret, 0);
+
+		ret = usbg_set_gadget_serial_number(g, LANG_US_ENG,
+						    ts->strs->serial);
+		assert_int_equal(ret, 0);
+
+		for (i = 0; i < GADGET_STR_MAX; i++)
+			pull_gadget_string(tg, LANG_US_ENG,
+					   i, get_gadget_str(ts->strs, i));
+
+
+		ret = usbg_set_gadget_str(g, USBG_STR_MANUFACTURER,
+					  LANG_US_ENG, ts->strs->manufacturer);
+		assert_int_equal(ret, 0);
+
+		ret = usbg_set_gadget_str(g, USBG_STR_PRODUCT,
+					  LANG_US_ENG, ts->strs->product);
+		assert_int_equal(ret, 0);
+
+		ret = usbg_set_gadget_str(g, USBG_STR_SERIAL_NUMBER,
+					  LANG_US_ENG, ts->strs->serial);
+		assert_int_equal(ret, 0);
+	}
+}
+
+/**
+ * @brief get gadget strings
+ * @param[in] data Pointer to correctly initialized
+ *            test_gadget_strs_data structure
+ */
+static void test_get_gadget_strs(void **data)
+{
+	struct test_gadget_strs_data *ts;
+	struct test_gadget *tg;
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	struct usbg_gadget_strs strs;
+
+	ts = (struct test_gadget_strs_data *)(*data);
+	*data = NULL;
+
+	init_with_state(ts->state, &s);
+	*data = s;
+
+	for (tg = ts->state->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		push_gadget_strs(tg, LANG_US_ENG, ts->strs);
+		usbg_get_gadget_strs(g, LANG_US_ENG, &strs);
+		assert_gadget_strs_equal(&strs, ts->strs);
+		usbg_free_gadget_strs(&strs);
+	}
+}
+
+/**
+ * @brief Get binding target
+ * @details Check if given function is target of given binding
+ * @param[in] tb Test function
+ * @param[in] b Binding
+ */
+static void try_get_binding_target(struct test_binding *tb, usbg_binding *b)
+{
+	usbg_function *f;
+
+	f = usbg_get_binding_target(b);
+	assert_non_null(f);
+	assert_func_equal(f, tb->target);
+}
+
+/**
+ * @brief Test get binding target
+ * @details Test all bindings present in given state
+ * @param[in, out] state Pointer to pointer to correctly initialized test state,
+ * will point to usbg state when finished.
+ */
+static void test_get_binding_target(void **state)
+{
+	usbg_state *s = NULL;
+	struct test_state *ts;
+
+	safe_init_with_state(state, &ts, &s);
+	for_each_binding(ts, s, try_get_binding_target);
+}
+
+/**
+ * @brief Get binding name
+ * @details Check if name of given binding is equal name of given function
+ * @param[in] tb Test function
+ * @param[in] b Binding
+ */
+static void try_get_binding_name(struct test_binding *tb, usbg_binding *b)
+{
+	const char *s;
+
+	s = usbg_get_binding_name(b);
+	assert_non_null(s);
+	assert_string_equal(s, tb->name);
+}
+
+/**
+ * @brief Test get bindig name from all binding present in state
+ * @param[in, out] state Pointer to pointer to correctly initialized test state,
+ * will point to usbg state when finished.
+ */
+static void test_get_binding_name(void **state)
+{
+	usbg_state *s = NULL;
+	struct test_state *ts;
+
+	safe_init_with_state(state, &ts, &s);
+	for_each_binding(ts, s, try_get_binding_name);
 }
 
 /**
@@ -1572,236 +2279,2570 @@ static void test_get_binding_name(void **state)
  * @param[in] tb Test function
  * @param[in] b Binding
  */
-static void try_get_binding_name_len(struct test_binding *tb, usbg_binding *b)
+static void try_get_binding_name_len(struct test_binding *tb, usbg_binding *b)
+{
+	int n;
+	char buf;
+
+	n = usbg_get_binding_name_s(b, &buf, 0);
+	assert_int_equal(n, strlen(tb->name));
+}
+
+/**
+ * @brief Test get binding name length from all bindings present in state
+ * @param[in, out] state Pointer to pointer to correctly initialized test state,
+ * will point to usbg state when finished.
+ */
+static void test_get_binding_name_len(void **state)
+{
+	usbg_state *s = NULL;
+	struct test_state *ts;
+
+	safe_init_with_state(state, &ts, &s);
+	for_each_binding(ts, s, try_get_binding_name_len);
+}
+
+/**
+ * @brief Set config strings
+ * @param[in] c Config on which string should be set
+ * @param[in] tc Test config containing strings to be set
+ */
+static void try_set_config_strs(usbg_config *c, struct test_config *tc)
+{
+	pull_config_strs(tc, LANG_US_ENG, tc->strs);
+	usbg_set_config_strs(c, LANG_US_ENG, tc->strs);
+}
+
+/**
+ * @brief Test setting strings
+ * @details Set strings in all configs present in state
+ * @param[in, out] state Pointer to pointer to correctly initialized test state,
+ * will point to usbg state when finished.
+ */
+static void test_set_config_strs(void **state)
+{
+	usbg_state *s = NULL;
+	struct test_state *ts;
+
+	safe_init_with_state(state, &ts, &s);
+	for_each_test_config(ts, s, try_set_config_strs);
+}
+
+/**
+ * @brief Set strings one by one on config
+ * @param[in] c Config on which string should be set
+ * @param[in] tc Test config containing strings to be set
+ */
+static void try_set_config_string(usbg_config *c, struct test_config *tc)
+{
+	pull_config_string(tc, LANG_US_ENG, tc->strs->configuration);
+	usbg_set_config_string(c, LANG_US_ENG, tc->strs->configuration);
+}
+
+/**
+ * @brief Test setting strings one by one
+ * @details Set strings on all configs present in given state
+ * @param[in, out] state Pointer to pointer to correctly initialized test state,
+ * will point to usbg state when finished.
+ */
+static void test_set_config_string(void **state)
+{
+	usbg_state *s = NULL;
+	struct test_state *ts;
+
+	safe_init_with_state(state, &ts, &s);
+	for_each_test_config(ts, s, try_set_config_string);
+}
+
+/**
+ * @brief Get config strings
+ * @details Assume that given configs have the same strings
+ * @param[in] c Config from which strings should be get
+ * @param[in] tc Test config expected to have the same string as c
+ */
+static void try_get_config_strs(usbg_config *c, struct test_config *tc)
+{
+	struct usbg_config_strs strs;
+
+	push_config_strs(tc, LANG_US_ENG, tc->strs);
+	usbg_get_config_strs(c, LANG_US_ENG, &strs);
+	assert_string_equal(tc->strs->configuration, strs.configuration);
+	usbg_free_config_strs(&strs);
+}
+
+/**
+ * @brief Test getting congig strings
+ * @details Get config strings on all configs present in given state
+ * @param[in, out] state Pointer to pointer to correctly initialized test state,
+ * will point to usbg state when finished.
+ */
+static void test_get_config_strs(void **state)
+{
+	usbg_state *s = NULL;
+	struct test_state *ts;
+
+	safe_init_with_state(state, &ts, &s);
+	for_each_test_config(ts, s, try_get_config_strs);
+}
+
+/**
+ * @brief Get config attributes
+ * @details Assume that attributes which will be returned are the same as
+ * given test state contains.
+ * @param[in] c Usbg config
+ * @param[in] tc Test config with set attributes
+ */
+static void try_get_config_attrs(usbg_config *c, struct test_config *tc)
+{
+	struct usbg_config_attrs attrs;
+
+	push_config_attrs(tc, tc->attrs);
+	usbg_get_config_attrs(c, &attrs);
+	assert_config_attrs_equal(tc->attrs, &attrs);
+}
+
+/**
+ * @brief Test getting config attributes
+ * @details Get config attributes on all configfs in state
+ * @param[in, out] state Pointer to pointer to correctly initialized test state,
+ * will point to usbg state when finished.
+ */
+static void test_get_config_attrs(void **state)
+{
+	usbg_state *s = NULL;
+	struct test_state *ts;
+
+	safe_init_with_state(state, &ts, &s);
+	for_each_test_config(ts, s, try_get_config_attrs);
+}
+
+/**
+ * @brief Set config attributes in given config
+ * @param[in] c Usbg config
+ * @param[in] tc Test config with attributes which will be set
+ */
+static void try_set_config_attrs(usbg_config *c, struct test_config *tc)
+{
+	pull_config_attrs(tc, tc->attrs);
+	usbg_set_config_attrs(c, tc->attrs);
+}
+
+/**
+ * @brief Test setting config attributes
+ * @details Set config attributes on all configs in state
+ * @param[in, out] state Pointer to pointer to correctly initialized test state,
+ * will point to usbg state when finished.
+ */
+static void test_set_config_attrs(void **state)
+{
+	usbg_state *s = NULL;
+	struct test_state *ts;
+
+	safe_init_with_state(state, &ts, &s);
+	for_each_test_config(ts, s, try_set_config_attrs);
+}
+
+/**
+ * @brieg Test creating config
+ * @details Start with empty gadgets, add all functions from given state
+ * @param[in, out] state Pointer to pointer to correctly initialized test state,
+ * will point to usbg state when finished.
+ */
+static void test_create_config(void **state)
+{
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	usbg_config *c = NULL;
+	struct test_state *ts;
+	struct test_state *empty;
+	struct test_gadget *tg;
+	struct test_config *tc;
+
+	ts = (struct test_state *)(*state);
+	*state = NULL;
+
+	empty = build_empty_gadget_state(ts);
+
+	init_with_state(empty, &s);
+	*state = s;
+
+	for (tg = ts->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		assert_non_null(g);
+		for (tc = tg->configs; tc->label; tc++) {
+			pull_create_config(tc);
+			usbg_create_config(g, tc->id, tc->label,
+					tc->attrs, tc->strs, &c);
+			assert_config_equal(c, tc);
+		}
+	}
+}
+
+/**
+ * @brief Start with empty gadget, add all functions from given one
+ */
+static void test_create_function(void **state)
+{
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	usbg_function *f = NULL;
+	struct test_state *ts;
+	struct test_state *empty;
+	struct test_gadget *tg;
+	struct test_function *tf;
+
+	ts = (struct test_state *)(*state);
+	*state = NULL;
+
+	empty = build_empty_gadget_state(ts);
+
+	init_with_state(empty, &s);
+	*state = s;
+
+	for (tg = ts->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		assert_non_null(g);
+		for (tf = tg->functions; tf->instance; tf++) {
+			pull_create_function(tf);
+			usbg_create_function(g, tf->type, tf->instance,
+					tf->attrs, &f);
+			assert_func_equal(f, tf);
+		}
+	}
+}
+
+/**
+ * @brief Start with empty gadget, add all functions from given one at once
+ * @details Workers are not used, as mocks expect calls in given order.
+ */
+static void test_create_functions(void **state)
+{
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	struct usbg_function_spec *specs;
+	struct test_state *ts;
+	struct test_state *empty;
+	struct test_gadget *tg;
+	struct test_function *tf;
+	int i, n, ret;
+
+	ts = (struct test_state *)(*state);
+	*state = NULL;
+
+	empty = build_empty_gadget_state(ts);
+
+	init_with_state(empty, &s);
+	*state = s;
+
+	for (tg = ts->gadgets; tg->name; tg++) {
+		g = usbg_get_gadget(s, tg->name);
+		assert_non_null(g);
+
+		for (n = 0; tg->functions[n].instance; ++n)
+			;
+
+		specs = calloc(n, sizeof(*specs));
+		assert_non_null(specs);
+		for (i = 0, tf = tg->functions; i < n; ++i, ++tf) {
+			specs[i].type = tf->type;
+			specs[i].instance = tf->instance;
+			specs[i].f_attrs = tf->attrs;
+			pull_create_function(tf);
+		}
+
+		ret = usbg_create_functions(g, specs, n, 0);
+		assert_int_equal(ret, USBG_SUCCESS);
+
+		for (i = 0; i < n; ++i)
+			assert_func_equal(specs[i].f, &tg->functions[i]);
+
+		free(specs);
+	}
+}
+
+/**
+ * @brief Build and bind a gadget on in-memory configfs
+ * @details No mocks are expected, emulated filesystem is not backed by libc.
+ */
+static void test_memfs_gadget(void **state)
+{
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	usbg_function *f = NULL;
+	usbg_config *c = NULL;
+	usbg_udc *u;
+	int ret;
+
+	ret = usbg_init_memfs(2, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	u = usbg_get_first_udc(s);
+	assert_non_null(u);
+	assert_string_equal(usbg_get_udc_name(u), "dummy_udc.0");
+
+	ret = usbg_create_gadget(s, "g1", NULL, NULL, &g);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_create_function(g, USBG_F_ACM, "0", NULL, &f);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	/* Gadget without configs can't be bound */
+	ret = usbg_enable_gadget(g, u);
+	assert_int_equal(ret, USBG_ERROR_INVALID_PARAM);
+
+	ret = usbg_create_config(g, 1, "c", NULL, NULL, &c);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_add_config_function(c, "acm0", f);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_add_config_function(c, "acm1", f);
+	assert_int_equal(ret, USBG_ERROR_EXIST);
+
+	ret = usbg_enable_gadget(g, u);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_ptr_equal(usbg_get_gadget_udc(g), u);
+
+	/* Linked function is busy */
+	ret = usbg_rm_function(f, 0);
+	assert_int_equal(ret, USBG_ERROR_BUSY);
+
+	ret = usbg_rm_gadget(g, USBG_RM_RECURSE);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_null(usbg_get_first_gadget(s));
+}
+
+/**
+ * @brief Check counters of state on in-memory configfs
+ * @details Gadget creation sets attributes too, but only the outer
+ * operation should be accounted.
+ */
+static void test_memfs_stats(void **state)
+{
+	struct usbg_stats st;
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	struct usbg_gadget_attrs g_attrs = {
+		.idVendor = 0x1d6b,
+		.idProduct = 0x0104,
+	};
+	int ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	ret = usbg_get_stats(s, &st);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(st.ops[USBG_STAT_OP_INIT].count, 1);
+	assert_int_equal(st.allocs, 1);
+
+	usbg_reset_stats(s);
+	ret = usbg_create_gadget(s, "g1", &g_attrs, NULL, &g);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_create_gadget(s, "g1", NULL, NULL, &g);
+	assert_int_equal(ret, USBG_ERROR_EXIST);
+
+	ret = usbg_get_stats(s, &st);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(st.ops[USBG_STAT_OP_CREATE].count, 2);
+	assert_int_equal(st.ops[USBG_STAT_OP_SET_ATTRS].count, 0);
+	assert_int_equal(st.errors[-USBG_ERROR_EXIST], 1);
+	assert_int_equal(st.allocs, 1);
+	assert_true(st.syscalls[USBG_STAT_MKDIR] >= 1);
+	assert_true(st.syscalls[USBG_STAT_WRITE] >= 2);
+	assert_true(st.bytes_written > 0);
+
+	usbg_reset_stats(s);
+	ret = usbg_get_stats(s, &st);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(st.ops[USBG_STAT_OP_CREATE].count, 0);
+	assert_int_equal(st.syscalls[USBG_STAT_MKDIR], 0);
+}
+
+/**
+ * @brief Check that states sharing one configfs count separately
+ * @details Second state uses the same in-memory filesystem. Gadgets of
+ * parallel import are created by worker threads on behalf of the state
+ * and have to be accounted to it as part of the import only.
+ */
+static void test_memfs_stats_shared(void **state)
+{
+	struct usbg_stats st1, st2;
+	usbg_state *s = NULL, *s2 = NULL;
+	usbg_gadget *g = NULL;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *stream;
+	int ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	ret = usbg_init_io(usbg_get_configfs_path(s), s->udc_path, s->io.ops,
+			   s->io.priv, &s2);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	usbg_reset_stats(s);
+	usbg_reset_stats(s2);
+
+	ret = usbg_create_gadget(s, "g1", NULL, NULL, &g);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_create_gadget(s, "g2", NULL, NULL, &g);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	usbg_get_stats(s, &st1);
+	usbg_get_stats(s2, &st2);
+	assert_int_equal(st1.ops[USBG_STAT_OP_CREATE].count, 2);
+	assert_true(st1.syscalls[USBG_STAT_MKDIR] >= 2);
+	assert_int_equal(st2.ops[USBG_STAT_OP_CREATE].count, 0);
+	assert_int_equal(st2.syscalls[USBG_STAT_MKDIR], 0);
+
+	/* Library built without gadget schemes */
+	if (usbg_export_state(NULL, 0, stdout) == USBG_ERROR_NOT_SUPPORTED)
+		goto out;
+
+	stream = open_export_buf(&buf, &len);
+	ret = usbg_export_state(s, 0, stream);
+	assert_int_equal(ret, USBG_SUCCESS);
+	fclose(stream);
+
+	while ((g = usbg_get_first_gadget(s))) {
+		ret = usbg_rm_gadget(g, USBG_RM_RECURSE);
+		assert_int_equal(ret, USBG_SUCCESS);
+	}
+
+	usbg_reset_stats(s);
+	usbg_reset_stats(s2);
+
+	stream = fmemopen(buf, len, "r");
+	assert_non_null(stream);
+	pass_through_stream(stream);
+	ret = usbg_import_state(s, stream, USBG_STATE_PARALLEL);
+	assert_int_equal(ret, USBG_SUCCESS);
+	fclose(stream);
+
+	usbg_get_stats(s, &st1);
+	usbg_get_stats(s2, &st2);
+	assert_int_equal(st1.ops[USBG_STAT_OP_IMPORT].count, 1);
+	assert_int_equal(st1.ops[USBG_STAT_OP_CREATE].count, 0);
+	assert_int_equal(st1.ops[USBG_STAT_OP_SET_ATTRS].count, 0);
+	assert_true(st1.syscalls[USBG_STAT_MKDIR] >= 2);
+	assert_int_equal(st2.ops[USBG_STAT_OP_IMPORT].count, 0);
+	assert_int_equal(st2.syscalls[USBG_STAT_MKDIR], 0);
+	assert_non_null(usbg_get_gadget(s, "g1"));
+	assert_non_null(usbg_get_gadget(s, "g2"));
+out:
+	free(buf);
+	usbg_cleanup(s2);
+}
+
+/**
+ * @brief Create gadget with a few functions on in-memory configfs
+ * @details Strings need escaping in schemes, hid report descriptor is
+ * binary and mass storage has a default lun.
+ */
+static void memfs_build_gadget(usbg_state *s, const char *name,
+			       usbg_gadget **g)
+{
+	struct usbg_gadget_attrs g_attrs = {
+		.bcdUSB = 0x0200,
+		.idVendor = 0x1d6b,
+		.idProduct = 0x0104,
+		.bcdDevice = 0x0001,
+	};
+	struct usbg_gadget_strs g_strs = {
+		.manufacturer = "Tab\tand \"quotes\"",
+		.product = "memfs",
+		.serial = "0123",
+	};
+	struct usbg_config_strs c_strs = {
+		.configuration = "c1",
+	};
+	char report[] = { 0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x00, 0xc0 };
+	struct usbg_f_hid_attrs hid_attrs = {
+		.protocol = 1,
+		.report_desc = {
+			.desc = report,
+			.len = sizeof(report),
+		},
+		.report_length = 8,
+		.subclass = 1,
+	};
+	struct {
+		usbg_function_type type;
+		const char *instance;
+		void *attrs;
+	} funcs[] = {
+		{ USBG_F_ACM, "0", NULL },
+		{ USBG_F_ECM, "usb0", NULL },
+		{ USBG_F_MASS_STORAGE, "0", NULL },
+		{ USBG_F_HID, "0", &hid_attrs },
+	};
+	usbg_function *f;
+	usbg_config *c;
+	char label[16];
+	int i, ret;
+
+	ret = usbg_create_gadget(s, name, &g_attrs, &g_strs, g);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_create_config(*g, 1, "c", NULL, &c_strs, &c);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	for (i = 0; i < ARRAY_SIZE(funcs); ++i) {
+		ret = usbg_create_function(*g, funcs[i].type,
+					   funcs[i].instance, funcs[i].attrs,
+					   &f);
+		assert_int_equal(ret, USBG_SUCCESS);
+
+		sprintf(label, "f%d", i);
+		ret = usbg_add_config_function(c, label, f);
+		assert_int_equal(ret, USBG_SUCCESS);
+	}
+}
+
+/* Create UVC function with two formats, each with two frames */
+static void memfs_create_uvc(usbg_gadget *g, const char *instance,
+			     usbg_function **f)
+{
+	struct usbg_f_uvc_frame_attrs frames[] = {
+		{
+			.bFrameIndex = 1,
+			.dwFrameInterval = 333333,
+			.dwDefaultFrameInterval = 333333,
+			.wWidth = 640,
+			.wHeight = 480,
+		}, {
+			.bFrameIndex = 2,
+			.dwFrameInterval = 666666,
+			.dwDefaultFrameInterval = 666666,
+			.wWidth = 1280,
+			.wHeight = 720,
+		},
+	};
+	struct usbg_f_uvc_frame_attrs *frame_ptrs[] = {
+		&frames[0], &frames[1], NULL,
+	};
+	struct usbg_f_uvc_format_attrs format_attrs[] = {
+		{
+			.format = "uncompressed/u",
+			.bDefaultFrameIndex = 2,
+			.frames = frame_ptrs,
+		}, {
+			.format = "mjpeg/m",
+			.bDefaultFrameIndex = 1,
+			.frames = frame_ptrs,
+		},
+	};
+	struct usbg_f_uvc_format_attrs *format_ptrs[] = {
+		&format_attrs[0], &format_attrs[1], NULL,
+	};
+	struct usbg_f_uvc_attrs uvc_attrs = {
+		.formats = format_ptrs,
+	};
+	int ret;
+
+	ret = usbg_create_function(g, USBG_F_UVC, instance, &uvc_attrs, f);
+	assert_int_equal(ret, USBG_SUCCESS);
+}
+
+/*
+ * Add OS descriptors, UVC function with two formats bound as f4 and
+ * second mass storage LUN with backing file to gadget built by
+ * memfs_build_gadget().
+ */
+static void memfs_extend_gadget(usbg_gadget *g)
+{
+	struct usbg_f_ms_lun_attrs lun = {
+		.ro = true,
+		.nofua = true,
+		.removable = true,
+		.file = "/var/lib/disk.img",
+		.inquiry_string = "memfs disk",
+	};
+	struct usbg_gadget_os_descs os_descs = {
+		.use = true,
+		.b_vendor_code = 0xcd,
+		.qw_sign = "MSFT100",
+	};
+	usbg_function *f;
+	usbg_config *c;
+	int ret;
+
+	ret = usbg_set_gadget_os_descs(g, &os_descs);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	memfs_create_uvc(g, "0", &f);
+	c = usbg_get_config(g, 1, "c");
+	assert_non_null(c);
+	ret = usbg_add_config_function(c, "f4", f);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	f = usbg_get_function(g, USBG_F_MASS_STORAGE, "0");
+	assert_non_null(f);
+	ret = usbg_f_ms_set_stall(usbg_to_ms_function(f), false);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_f_ms_create_lun(usbg_to_ms_function(f), 1, &lun);
+	assert_int_equal(ret, USBG_SUCCESS);
+}
+
+/**
+ * @brief Compare streaming export with libconfig output on memfs
+ * @details Covers whole gadget and each of its functions, which are
+ * not reachable by the simulated configfs.
+ */
+static void test_memfs_export_stream(void **state)
+{
+	usbg_state *s = NULL;
+	usbg_gadget *g;
+	usbg_function *f;
+	char *tree, *stream;
+	size_t tree_len, stream_len;
+	FILE *out;
+	int ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	/* Library built without gadget schemes */
+	if (usbg_export_gadget(NULL, stdout) == USBG_ERROR_NOT_SUPPORTED)
+		skip();
+
+	memfs_build_gadget(s, "g1", &g);
+
+	out = open_export_buf(&tree, &tree_len);
+	ret = usbg_export_gadget(g, out);
+	assert_int_equal(ret, USBG_SUCCESS);
+	fclose(out);
+
+	out = open_export_buf(&stream, &stream_len);
+	ret = usbg_export_gadget_stream(g, out);
+	assert_int_equal(ret, USBG_SUCCESS);
+	fclose(out);
+
+	assert_export_equal(stream, stream_len, tree, tree_len);
+
+	usbg_for_each_function(f, g) {
+		out = open_export_buf(&tree, &tree_len);
+		ret = usbg_export_function(f, out);
+		assert_int_equal(ret, USBG_SUCCESS);
+		fclose(out);
+
+		out = open_export_buf(&stream, &stream_len);
+		ret = usbg_export_function_stream(f, out);
+		assert_int_equal(ret, USBG_SUCCESS);
+		fclose(out);
+
+		assert_export_equal(stream, stream_len, tree, tree_len);
+	}
+}
+
+/* UVC attributes getter doesn't report frames, read them directly */
+static void assert_uvc_frame_equal(usbg_function *f1, usbg_function *f2,
+				   const char *format, const char *frame)
+{
+	static const char * const attrs[] = {
+		"wWidth", "wHeight", "dwFrameInterval",
+		"dwDefaultFrameInterval",
+	};
+	char path1[USBG_MAX_PATH_LENGTH], path2[USBG_MAX_PATH_LENGTH];
+	int i, val1, val2, ret;
+
+	snprintf(path1, sizeof(path1), "%s/%s/streaming/%s", f1->path,
+		 f1->name, format);
+	snprintf(path2, sizeof(path2), "%s/%s/streaming/%s", f2->path,
+		 f2->name, format);
+
+	for (i = 0; i < ARRAY_SIZE(attrs); ++i) {
+		ret = usbg_read_dec(usbg_function_io(f1), path1, frame,
+				    attrs[i], &val1);
+		assert_int_equal(ret, USBG_SUCCESS);
+		ret = usbg_read_dec(usbg_function_io(f2), path2, frame,
+				    attrs[i], &val2);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(val1, val2);
+	}
+}
+
+/*
+ * Compare gadget built by memfs_build_gadget() and memfs_extend_gadget()
+ * with its copy, which may be in other state.
+ */
+static void assert_memfs_gadget_equal(usbg_gadget *g, usbg_gadget *dst)
 {
-	int n;
-	char buf;
+	const char *formats[] = { "uncompressed/u", "mjpeg/m" };
+	const char *frame_dirs[] = { "frame.1", "frame.2" };
+	struct usbg_gadget_attrs g_attrs1, g_attrs2;
+	struct usbg_gadget_strs g_strs1, g_strs2;
+	struct usbg_gadget_os_descs os_descs1, os_descs2;
+	struct usbg_f_ms_attrs ms1, ms2;
+	struct usbg_f_hid_attrs hid1, hid2;
+	struct usbg_f_net_attrs net1, net2;
+	usbg_function *f, *df;
+	usbg_config *c, *dc;
+	usbg_binding *b, *db;
+	int i, j, ret;
+
+	ret = usbg_get_gadget_attrs(g, &g_attrs1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_gadget_attrs(dst, &g_attrs2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_memory_equal(&g_attrs1, &g_attrs2, sizeof(g_attrs1));
+
+	ret = usbg_get_gadget_strs(g, LANG_US_ENG, &g_strs1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_gadget_strs(dst, LANG_US_ENG, &g_strs2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_string_equal(g_strs1.manufacturer, g_strs2.manufacturer);
+	assert_string_equal(g_strs1.product, g_strs2.product);
+	assert_string_equal(g_strs1.serial, g_strs2.serial);
+	usbg_free_gadget_strs(&g_strs1);
+	usbg_free_gadget_strs(&g_strs2);
+
+	ret = usbg_get_gadget_os_descs(g, &os_descs1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_gadget_os_descs(dst, &os_descs2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(os_descs2.use);
+	assert_int_equal(os_descs2.b_vendor_code, os_descs1.b_vendor_code);
+	assert_string_equal(os_descs2.qw_sign, os_descs1.qw_sign);
+	usbg_free_gadget_os_desc(&os_descs1);
+	usbg_free_gadget_os_desc(&os_descs2);
+
+	usbg_for_each_function(f, g) {
+		df = usbg_get_function(dst, usbg_get_function_type(f),
+				       usbg_get_function_instance(f));
+		assert_non_null(df);
+
+		switch (usbg_get_function_type(f)) {
+		case USBG_F_MASS_STORAGE:
+			ret = usbg_f_ms_get_attrs(usbg_to_ms_function(f), &ms1);
+			assert_int_equal(ret, USBG_SUCCESS);
+			ret = usbg_f_ms_get_attrs(usbg_to_ms_function(df),
+						  &ms2);
+			assert_int_equal(ret, USBG_SUCCESS);
+
+			assert_false(ms2.stall);
+			assert_int_equal(ms1.nluns, 2);
+			assert_int_equal(ms2.nluns, ms1.nluns);
+			for (i = 0; i < ms1.nluns; ++i) {
+				assert_int_equal(ms2.luns[i]->id,
+						 ms1.luns[i]->id);
+				assert_int_equal(ms2.luns[i]->cdrom,
+						 ms1.luns[i]->cdrom);
+				assert_int_equal(ms2.luns[i]->ro,
+						 ms1.luns[i]->ro);
+				assert_int_equal(ms2.luns[i]->nofua,
+						 ms1.luns[i]->nofua);
+				assert_int_equal(ms2.luns[i]->removable,
+						 ms1.luns[i]->removable);
+				assert_string_equal(ms2.luns[i]->file,
+						    ms1.luns[i]->file);
+				assert_string_equal(ms2.luns[i]->inquiry_string,
+						    ms1.luns[i]->inquiry_string);
+			}
+			assert_string_equal(ms2.luns[1]->file,
+					    "/var/lib/disk.img");
+			assert_true(ms2.luns[1]->ro);
 
-	n = usbg_get_binding_name_s(b, &buf, 0);
-	assert_int_equal(n, strlen(tb->name));
+			usbg_f_ms_cleanup_attrs(&ms1);
+			usbg_f_ms_cleanup_attrs(&ms2);
+			break;
+		case USBG_F_HID:
+			ret = usbg_f_hid_get_attrs(usbg_to_hid_function(f),
+						   &hid1);
+			assert_int_equal(ret, USBG_SUCCESS);
+			ret = usbg_f_hid_get_attrs(usbg_to_hid_function(df),
+						   &hid2);
+			assert_int_equal(ret, USBG_SUCCESS);
+
+			assert_int_equal(hid2.protocol, hid1.protocol);
+			assert_int_equal(hid2.subclass, hid1.subclass);
+			assert_int_equal(hid2.report_length,
+					 hid1.report_length);
+			assert_int_equal(hid2.report_desc.len,
+					 hid1.report_desc.len);
+			assert_memory_equal(hid2.report_desc.desc,
+					    hid1.report_desc.desc,
+					    hid1.report_desc.len);
+
+			usbg_f_hid_cleanup_attrs(&hid1);
+			usbg_f_hid_cleanup_attrs(&hid2);
+			break;
+		case USBG_F_ECM:
+			ret = usbg_f_net_get_attrs(usbg_to_net_function(f),
+						   &net1);
+			assert_int_equal(ret, USBG_SUCCESS);
+			ret = usbg_f_net_get_attrs(usbg_to_net_function(df),
+						   &net2);
+			assert_int_equal(ret, USBG_SUCCESS);
+
+			assert_memory_equal(&net2.dev_addr, &net1.dev_addr,
+					    sizeof(net1.dev_addr));
+			assert_memory_equal(&net2.host_addr, &net1.host_addr,
+					    sizeof(net1.host_addr));
+			assert_int_equal(net2.qmult, net1.qmult);
+
+			usbg_f_net_cleanup_attrs(&net1);
+			usbg_f_net_cleanup_attrs(&net2);
+			break;
+		case USBG_F_UVC:
+			for (i = 0; i < ARRAY_SIZE(formats); ++i)
+				for (j = 0; j < ARRAY_SIZE(frame_dirs); ++j)
+					assert_uvc_frame_equal(f, df,
+						formats[i], frame_dirs[j]);
+			break;
+		default:
+			break;
+		}
+	}
+
+	c = usbg_get_config(g, 1, "c");
+	assert_non_null(c);
+	dc = usbg_get_config(dst, 1, "c");
+	assert_non_null(dc);
+	db = usbg_get_first_binding(dc);
+	usbg_for_each_binding(b, c) {
+		assert_non_null(db);
+		assert_string_equal(usbg_get_binding_name(db),
+				    usbg_get_binding_name(b));
+		assert_string_equal(usbg_get_binding_target(db)->name,
+				    usbg_get_binding_target(b)->name);
+		db = usbg_get_next_binding(db);
+	}
+	assert_null(db);
 }
 
 /**
- * @brief Test get binding name length from all bindings present in state
- * @param[in, out] state Pointer to pointer to correctly initialized test state,
- * will point to usbg state when finished.
+ * @brief Clone gadget on in-memory configfs and compare with source
+ * @details Besides gadget and function attributes, UVC frames and
+ * additional mass storage LUNs have to be recreated in the clone.
  */
-static void test_get_binding_name_len(void **state)
+static void test_memfs_clone(void **state)
 {
 	usbg_state *s = NULL;
-	struct test_state *ts;
+	usbg_gadget *g, *dst;
+	int ret;
 
-	safe_init_with_state(state, &ts, &s);
-	for_each_binding(ts, s, try_get_binding_name_len);
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	memfs_build_gadget(s, "g1", &g);
+	memfs_extend_gadget(g);
+
+	ret = usbg_clone_gadget(g, "g2", &dst);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_string_equal(usbg_get_gadget_name(dst), "g2");
+
+	assert_memfs_gadget_equal(g, dst);
+}
+
+static void assert_program_equal(usbg_program *p1, usbg_program *p2)
+{
+	int i;
+
+	assert_int_equal(p1->nops, p2->nops);
+	for (i = 0; i < p1->nops; ++i) {
+		assert_int_equal(p1->ops[i].type, p2->ops[i].type);
+		assert_string_equal(p1->ops[i].path, p2->ops[i].path);
+		assert_int_equal(p1->ops[i].len, p2->ops[i].len);
+		assert_memory_equal(p1->ops[i].data, p2->ops[i].data,
+				    p1->ops[i].len);
+	}
+}
+
+/* Index of first operation of given type on path, or -1 */
+static int find_program_op(usbg_program *p, int type, const char *path)
+{
+	int i;
+
+	for (i = 0; i < p->nops; ++i)
+		if (p->ops[i].type == type && !strcmp(p->ops[i].path, path))
+			return i;
+
+	return -1;
+}
+
+/* Load program made of single operation */
+static int load_test_program(int type, const char *path, const char *data,
+			     usbg_program **p)
+{
+	struct usbg_program_hdr hdr = {
+		.magic = USBG_PROGRAM_MAGIC,
+		.version = USBG_PROGRAM_VERSION,
+		.nops = 1,
+	};
+	struct usbg_program_op_hdr ohdr = {
+		.type = type,
+		.path_len = strlen(path),
+		.data_len = strlen(data),
+	};
+	char buf[128];
+	size_t len = 0;
+	FILE *stream;
+	int ret;
+
+	memcpy(buf + len, &hdr, sizeof(hdr));
+	len += sizeof(hdr);
+	memcpy(buf + len, &ohdr, sizeof(ohdr));
+	len += sizeof(ohdr);
+	memcpy(buf + len, path, ohdr.path_len);
+	len += ohdr.path_len;
+	memcpy(buf + len, data, ohdr.data_len);
+	len += ohdr.data_len;
+
+	stream = fmemopen(buf, len, "r");
+	assert_non_null(stream);
+	pass_through_stream(stream);
+	ret = usbg_load_program(stream, p);
+	fclose(stream);
+
+	return ret;
 }
 
 /**
- * @brief Set config strings
- * @param[in] c Config on which string should be set
- * @param[in] tc Test config containing strings to be set
+ * @brief Compile, save, load and run gadget program on in-memory configfs
+ * @details Each link has to be created after its target and after all
+ * links placed inside of the target, backing file of LUN after other
+ * attributes of the LUN. Gadget created by the program compiles to the
+ * same program again. Loading refuses paths and link targets which
+ * would leave gadget directory.
  */
-static void try_set_config_strs(usbg_config *c, struct test_config *tc)
+static void test_memfs_program(void **state)
 {
-	pull_config_strs(tc, LANG_US_ENG, tc->strs);
-	usbg_set_config_strs(c, LANG_US_ENG, tc->strs);
+	static const struct {
+		int type;
+		const char *path;
+		const char *data;
+		int ret;
+	} loads[] = {
+		{ USBG_OP_MKDIR, "functions/acm.1", "", USBG_SUCCESS },
+		{ USBG_OP_MKDIR, "/functions/acm.1", "",
+		  USBG_ERROR_INVALID_FORMAT },
+		{ USBG_OP_MKDIR, "functions/../../g2", "",
+		  USBG_ERROR_INVALID_FORMAT },
+		{ USBG_OP_WRITE, "..", "1", USBG_ERROR_INVALID_FORMAT },
+		{ USBG_OP_SYMLINK, "configs/c.1/f0", "functions/acm.0",
+		  USBG_SUCCESS },
+		{ USBG_OP_SYMLINK, "configs/c.1/f0", "../g2/functions/acm.0",
+		  USBG_ERROR_INVALID_FORMAT },
+		{ USBG_OP_SYMLINK, "configs/c.1/f0", "/sys/kernel/config",
+		  USBG_ERROR_INVALID_FORMAT },
+		{ USBG_OP_MAX, "UDC", "", USBG_ERROR_INVALID_FORMAT },
+	};
+	usbg_state *s = NULL;
+	usbg_gadget *g, *g2;
+	usbg_program *p, *loaded, *p2;
+	const char *path, *dir;
+	char *buf;
+	size_t len;
+	FILE *stream;
+	int i, j, ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	memfs_build_gadget(s, "g1", &g);
+	memfs_extend_gadget(g);
+
+	ret = usbg_compile_program(g, 0, &p);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(usbg_get_program_length(p), p->nops);
+
+	for (i = 0; i < p->nops; ++i) {
+		path = p->ops[i].path;
+		if (p->ops[i].type == USBG_OP_SYMLINK) {
+			j = find_program_op(p, USBG_OP_MKDIR, p->ops[i].data);
+			assert_true(j >= 0 && j < i);
+
+			len = p->ops[i].len;
+			for (j = i + 1; j < p->nops; ++j)
+				assert_false(p->ops[j].type == USBG_OP_SYMLINK &&
+					     !strncmp(p->ops[j].path,
+						      p->ops[i].data, len) &&
+					     p->ops[j].path[len] == '/');
+		} else if (p->ops[i].type == USBG_OP_WRITE &&
+			   (dir = strrchr(path, '/')) &&
+			   !strcmp(dir, "/file")) {
+			len = dir - path + 1;
+			for (j = i + 1; j < p->nops; ++j)
+				assert_false(p->ops[j].type == USBG_OP_WRITE &&
+					     !strncmp(p->ops[j].path, path,
+						      len) &&
+					     !strchr(p->ops[j].path + len,
+						     '/'));
+		}
+	}
+
+	assert_true(find_program_op(p, USBG_OP_SYMLINK,
+				    "configs/c.1/f4") >= 0);
+	assert_true(find_program_op(p, USBG_OP_WRITE,
+				    "functions/mass_storage.0/lun.1/file") >= 0);
+	/* Name of network interface is assigned by kernel */
+	assert_true(find_program_op(p, USBG_OP_WRITE,
+				    "functions/ecm.usb0/qmult") >= 0);
+	assert_int_equal(find_program_op(p, USBG_OP_WRITE,
+					 "functions/ecm.usb0/ifname"), -1);
+
+	stream = open_export_buf(&buf, &len);
+	ret = usbg_save_program(p, stream);
+	assert_int_equal(ret, USBG_SUCCESS);
+	fclose(stream);
+
+	stream = fmemopen(buf, len, "r");
+	assert_non_null(stream);
+	pass_through_stream(stream);
+	ret = usbg_load_program(stream, &loaded);
+	assert_int_equal(ret, USBG_SUCCESS);
+	fclose(stream);
+	free(buf);
+	assert_program_equal(p, loaded);
+
+	ret = usbg_run_program(s, loaded, "g2", &g2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_compile_program(g2, 0, &p2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_program_equal(p, p2);
+
+	ret = usbg_run_program(s, loaded, "g2", NULL);
+	assert_int_equal(ret, USBG_ERROR_EXIST);
+
+	usbg_destroy_program(p);
+	usbg_destroy_program(loaded);
+	usbg_destroy_program(p2);
+
+	for (i = 0; i < ARRAY_SIZE(loads); ++i) {
+		ret = load_test_program(loads[i].type, loads[i].path,
+					loads[i].data, &p);
+		assert_int_equal(ret, loads[i].ret);
+		if (ret == USBG_SUCCESS)
+			usbg_destroy_program(p);
+	}
+}
+
+/*
+ * Overwrite beginning of key or value string of the first record of
+ * given type (and operation, if not negative) and open such image.
+ */
+static int open_patched_image(const char *img, size_t len, int type, int op,
+			      bool key, const char *str)
+{
+	char path[] = "/tmp/usbg-image-XXXXXX";
+	struct usbg_image_hdr *hdr;
+	struct usbg_image_rec *rec;
+	char *buf, *strtab, *target = NULL;
+	usbg_image *out;
+	uint32_t i;
+	int fd, ret;
+
+	buf = malloc(len);
+	assert_non_null(buf);
+	memcpy(buf, img, len);
+
+	hdr = (struct usbg_image_hdr *)buf;
+	rec = (struct usbg_image_rec *)(hdr + 1);
+	strtab = (char *)(rec + hdr->nrecs);
+	for (i = 0; i < hdr->nrecs && !target; ++i, ++rec)
+		if (rec->type == type && (op < 0 || rec->id == op))
+			target = strtab + (key ? rec->key : rec->val);
+
+	assert_non_null(target);
+	assert_true(strlen(target) >= strlen(str));
+	memcpy(target, str, strlen(str));
+
+	fd = mkstemp(path);
+	assert_true(fd >= 0);
+	unlink(path);
+	assert_int_equal(write(fd, buf, len), len);
+	free(buf);
+
+	ret = usbg_open_image_fd(fd, &out);
+	close(fd);
+	if (ret == USBG_SUCCESS)
+		usbg_close_image(out);
+
+	return ret;
 }
 
 /**
- * @brief Test setting strings
- * @details Set strings in all configs present in state
- * @param[in, out] state Pointer to pointer to correctly initialized test state,
- * will point to usbg state when finished.
+ * @brief Save and restore gadget image on in-memory configfs
+ * @details Gadget is restored on other configfs, where it has to have
+ * the same attributes and export to the same scheme as the saved one.
+ * Names of network interfaces, assigned by kernel, are not saved.
+ * Images with names which are not a single directory or with function
+ * operations leaving function directory are refused when opened.
  */
-static void test_set_config_strs(void **state)
+static void test_memfs_image(void **state)
+{
+	static const struct {
+		int type;
+		int op;
+		bool key;
+		const char *str;
+		int ret;
+	} patches[] = {
+		{ USBG_IMG_FUNCTION_OP, USBG_OP_SYMLINK, false, "",
+		  USBG_SUCCESS },
+		{ USBG_IMG_GADGET, -1, true, "/", USBG_ERROR_INVALID_FORMAT },
+		{ USBG_IMG_GADGET, -1, true, "..", USBG_ERROR_INVALID_FORMAT },
+		{ USBG_IMG_FUNCTION, -1, false, "/", USBG_ERROR_INVALID_FORMAT },
+		{ USBG_IMG_CONFIG, -1, true, "/", USBG_ERROR_INVALID_FORMAT },
+		{ USBG_IMG_BINDING, -1, true, "/", USBG_ERROR_INVALID_FORMAT },
+		{ USBG_IMG_FUNCTION_OP, USBG_OP_MKDIR, true, "../",
+		  USBG_ERROR_INVALID_FORMAT },
+		{ USBG_IMG_FUNCTION_OP, USBG_OP_WRITE, true, "/",
+		  USBG_ERROR_INVALID_FORMAT },
+		{ USBG_IMG_FUNCTION_OP, USBG_OP_SYMLINK, false, "../",
+		  USBG_ERROR_INVALID_FORMAT },
+		{ USBG_IMG_FUNCTION_OP, USBG_OP_SYMLINK, false, "/",
+		  USBG_ERROR_INVALID_FORMAT },
+	};
+	char path[] = "/tmp/usbg-image-XXXXXX";
+	usbg_state *s = NULL, *s2 = NULL;
+	usbg_gadget *g, *g2;
+	usbg_function *f;
+	usbg_config *c;
+	usbg_image *img;
+	char *tree1 = NULL, *tree2, *buf;
+	size_t tree1_len, tree2_len;
+	bool schemes;
+	struct stat st;
+	FILE *out;
+	int i, fd, ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	memfs_build_gadget(s, "g1", &g);
+	memfs_extend_gadget(g);
+
+	ret = usbg_create_function(g, USBG_F_RNDIS, "rn0", NULL, &f);
+	assert_int_equal(ret, USBG_SUCCESS);
+	c = usbg_get_config(g, 1, NULL);
+	ret = usbg_add_config_function(c, "f5", f);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	schemes = usbg_export_gadget(NULL, stdout) != USBG_ERROR_NOT_SUPPORTED;
+	if (schemes) {
+		out = open_export_buf(&tree1, &tree1_len);
+		ret = usbg_export_gadget(g, out);
+		assert_int_equal(ret, USBG_SUCCESS);
+		fclose(out);
+	}
+
+	fd = mkstemp(path);
+	assert_true(fd >= 0);
+	unlink(path);
+	ret = usbg_save_gadget_image(g, fd);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_init_memfs(1, &s2);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_open_image_fd(fd, &img);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(usbg_get_image_gadget_count(img), 1);
+	ret = usbg_restore_image(s2, img, 0);
+	assert_int_equal(ret, USBG_SUCCESS);
+	usbg_close_image(img);
+
+	g2 = usbg_get_gadget(s2, "g1");
+	assert_non_null(g2);
+	assert_memfs_gadget_equal(g, g2);
+
+	if (schemes) {
+		out = open_export_buf(&tree2, &tree2_len);
+		ret = usbg_export_gadget(g2, out);
+		assert_int_equal(ret, USBG_SUCCESS);
+		fclose(out);
+		assert_export_equal(tree2, tree2_len, tree1, tree1_len);
+	}
+
+	assert_int_equal(fstat(fd, &st), 0);
+	buf = malloc(st.st_size);
+	assert_non_null(buf);
+	assert_int_equal(pread(fd, buf, st.st_size, 0), st.st_size);
+	close(fd);
+
+	/* Name of network interface is assigned by kernel */
+	assert_non_null(memmem(buf, st.st_size, "qmult", 5));
+	assert_null(memmem(buf, st.st_size, "ifname", 6));
+
+	for (i = 0; i < ARRAY_SIZE(patches); ++i) {
+		ret = open_patched_image(buf, st.st_size, patches[i].type,
+					 patches[i].op, patches[i].key,
+					 patches[i].str);
+		assert_int_equal(ret, patches[i].ret);
+	}
+
+	free(buf);
+	usbg_cleanup(s2);
+}
+
+/* Import state from buffer */
+static int memfs_import_state(usbg_state *s, const char *buf, size_t len,
+			      int flags)
+{
+	FILE *stream;
+	int ret;
+
+	stream = fmemopen((char *)buf, len, "r");
+	assert_non_null(stream);
+	pass_through_stream(stream);
+	ret = usbg_import_state(s, stream, flags);
+	fclose(stream);
+
+	return ret;
+}
+
+/**
+ * @brief Export state and import it on other in-memory configfs
+ * @details Both serial and parallel import have to recreate the same
+ * gadgets, bound to the same UDCs, which export to the same state
+ * again. State which binds two gadgets to one UDC, or to UDC which is
+ * in use, is refused before anything is created.
+ */
+static void test_memfs_import_state(void **state)
+{
+	static const int flags[] = {
+		USBG_STATE_BIND,
+		USBG_STATE_BIND | USBG_STATE_PARALLEL,
+	};
+	static const char * const names[] = { "g1", "g2" };
+	usbg_state *s = NULL, *s2;
+	usbg_gadget *g, *g2;
+	usbg_udc *u;
+	char *tree1, *tree2;
+	size_t tree1_len, tree2_len;
+	char scheme[256];
+	FILE *out;
+	int i, j, ret;
+
+	ret = usbg_init_memfs(2, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	/* Library built without gadget schemes */
+	if (usbg_export_state(NULL, 0, stdout) == USBG_ERROR_NOT_SUPPORTED)
+		skip();
+
+	u = usbg_get_first_udc(s);
+	for (i = 0; i < ARRAY_SIZE(names); ++i) {
+		memfs_build_gadget(s, names[i], &g);
+		memfs_extend_gadget(g);
+		ret = usbg_enable_gadget(g, u);
+		assert_int_equal(ret, USBG_SUCCESS);
+		u = usbg_get_next_udc(u);
+	}
+
+	out = open_export_buf(&tree1, &tree1_len);
+	ret = usbg_export_state(s, USBG_STATE_BIND, out);
+	assert_int_equal(ret, USBG_SUCCESS);
+	fclose(out);
+
+	for (i = 0; i < ARRAY_SIZE(flags); ++i) {
+		ret = usbg_init_memfs(2, &s2);
+		assert_int_equal(ret, USBG_SUCCESS);
+
+		ret = memfs_import_state(s2, tree1, tree1_len, flags[i]);
+		assert_int_equal(ret, USBG_SUCCESS);
+
+		for (j = 0; j < ARRAY_SIZE(names); ++j) {
+			g = usbg_get_gadget(s, names[j]);
+			g2 = usbg_get_gadget(s2, names[j]);
+			assert_non_null(g2);
+			assert_memfs_gadget_equal(g, g2);
+			assert_non_null(usbg_get_gadget_udc(g2));
+			assert_string_equal(
+				usbg_get_udc_name(usbg_get_gadget_udc(g2)),
+				usbg_get_udc_name(usbg_get_gadget_udc(g)));
+		}
+
+		out = open_export_buf(&tree2, &tree2_len);
+		ret = usbg_export_state(s2, USBG_STATE_BIND, out);
+		assert_int_equal(ret, USBG_SUCCESS);
+		fclose(out);
+		assert_int_equal(tree2_len, tree1_len);
+		assert_memory_equal(tree2, tree1, tree1_len);
+		free(tree2);
+
+		usbg_cleanup(s2);
+	}
+
+	ret = usbg_init_memfs(2, &s2);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	u = usbg_get_first_udc(s2);
+	snprintf(scheme, sizeof(scheme),
+		 "gadgets = ( { name = \"a\"; udc = \"%s\"; },\n"
+		 "	{ name = \"b\"; udc = \"%s\"; } );\n",
+		 usbg_get_udc_name(u), usbg_get_udc_name(u));
+	for (i = 0; i < ARRAY_SIZE(flags); ++i) {
+		ret = memfs_import_state(s2, scheme, strlen(scheme), flags[i]);
+		assert_int_equal(ret, USBG_ERROR_BUSY);
+		assert_null(usbg_get_first_gadget(s2));
+	}
+
+	/* UDC is already used by g1 */
+	u = usbg_get_first_udc(s);
+	snprintf(scheme, sizeof(scheme),
+		 "gadgets = ( { name = \"a\"; udc = \"%s\"; } );\n",
+		 usbg_get_udc_name(u));
+	ret = memfs_import_state(s, scheme, strlen(scheme), USBG_STATE_BIND);
+	assert_int_equal(ret, USBG_ERROR_BUSY);
+	assert_null(usbg_get_gadget(s, "a"));
+
+	usbg_cleanup(s2);
+	free(tree1);
+}
+
+/* Index of gadget in snapshot or -1 */
+static int snapshot_gadget_idx(usbg_snapshot *snap, const char *name)
+{
+	int i;
+
+	for (i = 0; i < usbg_snapshot_get_gadget_count(snap); ++i)
+		if (!strcmp(usbg_snapshot_get_gadget_name(snap, i), name))
+			return i;
+
+	return -1;
+}
+
+/**
+ * @brief Compare fingerprints of gadgets, functions and programs
+ * @details Gadgets with the same content have the same fingerprint
+ * regardless of their names, as have functions regardless of their
+ * instances. Fingerprint is read from configfs only after change and
+ * is published in snapshot when it is known.
+ */
+static void test_memfs_fingerprint(void **state)
 {
 	usbg_state *s = NULL;
-	struct test_state *ts;
+	usbg_gadget *g1, *g2, *g3;
+	usbg_function *f1, *f2;
+	usbg_config *c1, *c2;
+	usbg_program *p;
+	usbg_publisher *pub;
+	usbg_snapshot *snap;
+	struct usbg_stats st;
+	uint64_t fp1, fp2, fp;
+	int i, idx, ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
 
-	safe_init_with_state(state, &ts, &s);
-	for_each_test_config(ts, s, try_set_config_strs);
+	memfs_build_gadget(s, "g1", &g1);
+	memfs_extend_gadget(g1);
+	memfs_build_gadget(s, "g2", &g2);
+	memfs_extend_gadget(g2);
+
+	ret = usbg_get_gadget_fingerprint(g1, &fp1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_gadget_fingerprint(g2, &fp2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp1 == fp2);
+
+	/* Nothing has changed, so nothing is read */
+	usbg_reset_stats(s);
+	ret = usbg_get_gadget_fingerprint(g1, &fp);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp == fp1);
+	ret = usbg_get_stats(s, &st);
+	assert_int_equal(ret, USBG_SUCCESS);
+	for (i = 0; i < USBG_STAT_SYSCALL_MAX; ++i)
+		assert_int_equal(st.syscalls[i], 0);
+
+	/* Only changed function is read again */
+	f1 = usbg_get_function(g1, USBG_F_ECM, "usb0");
+	assert_non_null(f1);
+	ret = usbg_f_net_set_qmult(usbg_to_net_function(f1), 10);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	usbg_reset_stats(s);
+	ret = usbg_get_gadget_fingerprint(g1, &fp);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp != fp1);
+	ret = usbg_get_stats(s, &st);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(st.syscalls[USBG_STAT_SCANDIR], 1);
+
+	f2 = usbg_get_function(g2, USBG_F_ECM, "usb0");
+	assert_non_null(f2);
+	ret = usbg_get_function_fingerprint(f1, &fp1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_function_fingerprint(f2, &fp2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp1 != fp2);
+
+	c1 = usbg_get_config(g1, 1, "c");
+	c2 = usbg_get_config(g2, 1, "c");
+	assert_non_null(c1);
+	assert_non_null(c2);
+	ret = usbg_get_config_fingerprint(c1, &fp1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_config_fingerprint(c2, &fp2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp1 == fp2);
+
+	ret = usbg_f_net_set_qmult(usbg_to_net_function(f1), 5);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_gadget_fingerprint(g1, &fp1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_gadget_fingerprint(g2, &fp2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp1 == fp2);
+
+	/* Instance is not covered, not even by links inside of UVC */
+	f1 = usbg_get_function(g1, USBG_F_UVC, "0");
+	assert_non_null(f1);
+	memfs_create_uvc(g1, "cam", &f2);
+	ret = usbg_get_function_fingerprint(f1, &fp1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_function_fingerprint(f2, &fp);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp1 == fp);
+
+	/* Program has fingerprint of gadget which it creates */
+	ret = usbg_compile_program(g2, 0, &p);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_program_fingerprint(p, &fp);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp == fp2);
+
+	ret = usbg_run_program(s, p, "g3", &g3);
+	assert_int_equal(ret, USBG_SUCCESS);
+	usbg_destroy_program(p);
+	ret = usbg_get_gadget_fingerprint(g3, &fp);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp == fp2);
+
+	/* g1 changes after its fingerprint was computed */
+	f1 = usbg_get_function(g1, USBG_F_ECM, "usb0");
+	ret = usbg_f_net_set_qmult(usbg_to_net_function(f1), 10);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_publisher_create(s, NULL, 0, &pub);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_snapshot_open_fd(usbg_publisher_get_fd(pub), &snap);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	idx = snapshot_gadget_idx(snap, "g1");
+	assert_int_not_equal(idx, -1);
+	ret = usbg_snapshot_get_gadget_fingerprint(snap, idx, &fp);
+	assert_int_equal(ret, USBG_ERROR_NOT_FOUND);
+
+	idx = snapshot_gadget_idx(snap, "g2");
+	assert_int_not_equal(idx, -1);
+	ret = usbg_snapshot_get_gadget_fingerprint(snap, idx, &fp);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp == fp2);
+	ret = usbg_snapshot_get_config_fingerprint(snap, idx, 0, &fp);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_get_config_fingerprint(c2, &fp2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp == fp2);
+
+	i = 0;
+	usbg_for_each_function(f2, g2) {
+		ret = usbg_snapshot_get_function_fingerprint(snap, idx, i++,
+							     &fp);
+		assert_int_equal(ret, USBG_SUCCESS);
+		ret = usbg_get_function_fingerprint(f2, &fp2);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_true(fp == fp2);
+	}
+
+	ret = usbg_get_gadget_fingerprint(g1, &fp1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_publisher_update(pub);
+	assert_int_equal(ret, USBG_SUCCESS);
+	idx = snapshot_gadget_idx(snap, "g1");
+	ret = usbg_snapshot_get_gadget_fingerprint(snap, idx, &fp);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(fp == fp1);
+
+	usbg_snapshot_close(snap);
+	usbg_publisher_destroy(pub);
+}
+
+static char *memfs_export_changes(usbg_state *s, uint64_t gen,
+				  char **changed)
+{
+	char *buf;
+	size_t len;
+	FILE *out;
+	int ret;
+
+	out = open_export_buf(&buf, &len);
+	ret = usbg_export_changed_since(s, gen, out);
+	assert_int_equal(ret, USBG_SUCCESS);
+	fclose(out);
+
+	*changed = strstr(buf, "changed");
+	assert_non_null(*changed);
+
+	return buf;
+}
+
+/* Check whether what occurs in text between from and to */
+static bool memfs_has_entry(const char *from, const char *to,
+			    const char *what)
+{
+	const char *p = strstr(from, what);
+
+	return p && (!to || p < to);
+}
+
+static void test_memfs_changed_since(void **state)
+{
+	usbg_state *s = NULL;
+	usbg_gadget *g1, *g2;
+	usbg_function *f;
+	usbg_config *c;
+	char *buf, *changed;
+	const char *hid = "function = \"hid.0\"";
+	const char *cfg = "config = \"c.1\"";
+	uint64_t gen, mark;
+	int ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	/* Library built without gadget schemes */
+	if (usbg_export_state(NULL, 0, stdout) == USBG_ERROR_NOT_SUPPORTED)
+		skip();
+
+	memfs_build_gadget(s, "g1", &g1);
+	memfs_build_gadget(s, "g2", &g2);
+
+	gen = usbg_get_generation(s);
+	buf = memfs_export_changes(s, gen, &changed);
+	assert_null(strstr(buf, "gadget"));
+	free(buf);
+
+	f = usbg_get_function(g1, USBG_F_ECM, "usb0");
+	ret = usbg_f_net_set_qmult(usbg_to_net_function(f), 10);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	buf = memfs_export_changes(s, gen, &changed);
+	assert_false(memfs_has_entry(buf, changed, "gadget"));
+	assert_true(memfs_has_entry(changed, NULL, "function = \"ecm.usb0\""));
+	assert_false(memfs_has_entry(changed, NULL, "acm.0"));
+	assert_false(memfs_has_entry(changed, NULL, "config"));
+	assert_false(memfs_has_entry(changed, NULL, "\"g2\""));
+	free(buf);
+
+	/* Removed objects have to be reported before re-created ones */
+	gen = usbg_get_generation(s);
+	f = usbg_get_function(g1, USBG_F_HID, "0");
+	ret = usbg_rm_function(f, USBG_RM_RECURSE);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_create_function(g1, USBG_F_HID, "0", NULL, &f);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	c = usbg_get_config(g1, 1, NULL);
+	ret = usbg_rm_config(c, USBG_RM_RECURSE);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_create_config(g1, 1, "c", NULL, NULL, &c);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_add_config_function(c, "f3", f);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	buf = memfs_export_changes(s, gen, &changed);
+	assert_true(memfs_has_entry(buf, changed, hid));
+	assert_true(memfs_has_entry(buf, changed, cfg));
+	assert_true(memfs_has_entry(changed, NULL, hid));
+	assert_true(memfs_has_entry(changed, NULL, cfg));
+	assert_false(memfs_has_entry(buf, NULL, "ecm.usb0"));
+	assert_false(memfs_has_entry(buf, NULL, "acm.0"));
+	free(buf);
+
+	/* Removal of gadget covers removals of its children */
+	mark = usbg_get_generation(s);
+	f = usbg_get_function(g2, USBG_F_ACM, "0");
+	ret = usbg_rm_function(f, USBG_RM_RECURSE);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_rm_gadget(g2, USBG_RM_RECURSE);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	buf = memfs_export_changes(s, gen, &changed);
+	assert_true(memfs_has_entry(buf, changed, "gadget = \"g2\""));
+	assert_false(memfs_has_entry(buf, NULL, "acm.0"));
+	assert_true(memfs_has_entry(buf, changed, hid));
+	free(buf);
+
+	usbg_drop_tombstones(s, mark);
+	buf = memfs_export_changes(s, gen, &changed);
+	assert_true(memfs_has_entry(buf, changed, "gadget = \"g2\""));
+	assert_false(memfs_has_entry(buf, changed, hid));
+	assert_false(memfs_has_entry(buf, changed, cfg));
+	assert_true(memfs_has_entry(changed, NULL, hid));
+	assert_true(memfs_has_entry(changed, NULL, cfg));
+	free(buf);
+
+	usbg_drop_tombstones(s, usbg_get_generation(s));
+	buf = memfs_export_changes(s, gen, &changed);
+	assert_false(memfs_has_entry(buf, changed, "gadget"));
+	assert_true(memfs_has_entry(changed, NULL, hid));
+	free(buf);
+}
+
+/* Suffix of paths on which overridden operations of memfs fail */
+static const char *memfs_fail_path;
+static const struct usbg_io_ops *memfs_orig_ops;
+
+static bool memfs_op_fails(const char *path)
+{
+	size_t len, suffix;
+
+	if (!memfs_fail_path)
+		return false;
+
+	len = strlen(path);
+	suffix = strlen(memfs_fail_path);
+
+	return len >= suffix &&
+		!strcmp(path + len - suffix, memfs_fail_path);
+}
+
+static int memfs_failing_rmdir(void *priv, const char *path)
+{
+	if (memfs_op_fails(path)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	return memfs_orig_ops->rmdir(priv, path);
+}
+
+static int memfs_failing_unlink(void *priv, const char *path)
+{
+	if (memfs_op_fails(path)) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	return memfs_orig_ops->unlink(priv, path);
+}
+
+static int memfs_failing_read(void *priv, const char *path, char *buf,
+			      int len)
+{
+	if (memfs_op_fails(path))
+		return USBG_ERROR_IO;
+
+	return memfs_orig_ops->read(priv, path, buf, len);
+}
+
+struct teardown_errors
+{
+	int count;
+	bool gadget;
+	int function;
+};
+
+static void teardown_error_cb(const char *path, int err, void *data)
+{
+	struct teardown_errors *errs = data;
+	size_t len = strlen(path);
+
+	errs->count++;
+	if (len > 3 && !strcmp(path + len - 3, "/g1"))
+		errs->gadget = true;
+	if (strstr(path, "/functions/ecm.usb0"))
+		errs->function = err;
+}
+
+static usbg_gadget *memfs_build_bound_gadget(usbg_state *s)
+{
+	usbg_gadget *g;
+	int ret;
+
+	memfs_build_gadget(s, "g1", &g);
+	memfs_extend_gadget(g);
+	ret = usbg_enable_gadget(g, usbg_get_first_udc(s));
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	return g;
+}
+
+static void assert_memfs_no_gadgets(usbg_state *s)
+{
+	struct dirent **dent;
+	int n;
+
+	assert_null(usbg_get_first_gadget(s));
+	assert_null(usbg_get_udc_gadget(usbg_get_first_udc(s)));
+
+	n = usbg_io_scandir(&s->io, s->path, &dent, file_select, alphasort);
+	assert_int_equal(n, 0);
+	free(dent);
 }
 
 /**
- * @brief Set strings one by one on config
- * @param[in] c Config on which string should be set
- * @param[in] tc Test config containing strings to be set
+ * @brief Tear down bound gadget on in-memory configfs
+ * @details Removal is done serially, in parallel and in best effort mode,
+ * then with failures injected into emulated filesystem. Gadget which lost
+ * nothing has to keep its handles.
  */
-static void try_set_config_string(usbg_config *c, struct test_config *tc)
+static void test_memfs_teardown(void **state)
 {
-	pull_config_string(tc, LANG_US_ENG, tc->strs->configuration);
-	usbg_set_config_string(c, LANG_US_ENG, tc->strs->configuration);
+	static const int opts[] = {
+		0,
+		USBG_RM_PARALLEL,
+		USBG_RM_BEST_EFFORT,
+		USBG_RM_PARALLEL | USBG_RM_BEST_EFFORT,
+	};
+	struct teardown_errors errs;
+	struct usbg_io_ops failing_ops;
+	usbg_state *s = NULL;
+	usbg_gadget *g;
+	usbg_function *f;
+	usbg_config *c;
+	int i, ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	for (i = 0; i < ARRAY_SIZE(opts); ++i) {
+		g = memfs_build_bound_gadget(s);
+		memset(&errs, 0, sizeof(errs));
+		ret = usbg_teardown_gadget(g, opts[i], teardown_error_cb,
+					   &errs);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(errs.count, 0);
+		assert_memfs_no_gadgets(s);
+	}
+
+	memfs_orig_ops = s->io.ops;
+	failing_ops = *s->io.ops;
+	failing_ops.rmdir = memfs_failing_rmdir;
+	failing_ops.unlink = memfs_failing_unlink;
+	s->io.ops = &failing_ops;
+
+	/* The first link fails, nothing is removed */
+	g = memfs_build_bound_gadget(s);
+	f = usbg_get_function(g, USBG_F_ECM, "usb0");
+	c = usbg_get_config(g, 1, NULL);
+	memfs_fail_path = "";
+	memset(&errs, 0, sizeof(errs));
+	ret = usbg_teardown_gadget(g, 0, teardown_error_cb, &errs);
+	assert_int_equal(ret, USBG_ERROR_BUSY);
+	assert_int_equal(errs.count, 1);
+	assert_ptr_equal(usbg_get_gadget(s, "g1"), g);
+	assert_ptr_equal(usbg_get_function(g, USBG_F_ECM, "usb0"), f);
+	assert_ptr_equal(usbg_get_config(g, 1, NULL), c);
+	assert_null(usbg_get_gadget_udc(g));
+
+	/* Removal stops at the first failure, gadget is parsed again */
+	memfs_fail_path = "/functions/ecm.usb0";
+	memset(&errs, 0, sizeof(errs));
+	ret = usbg_teardown_gadget(g, USBG_RM_PARALLEL, teardown_error_cb,
+				   &errs);
+	assert_int_equal(ret, USBG_ERROR_BUSY);
+	assert_int_equal(errs.count, 1);
+	assert_int_equal(errs.function, USBG_ERROR_BUSY);
+	g = usbg_get_gadget(s, "g1");
+	assert_non_null(g);
+	assert_non_null(usbg_get_function(g, USBG_F_ECM, "usb0"));
+
+	/* Everything else goes away, gadget itself is still busy */
+	memset(&errs, 0, sizeof(errs));
+	ret = usbg_teardown_gadget(g, USBG_RM_PARALLEL | USBG_RM_BEST_EFFORT,
+				   teardown_error_cb, &errs);
+	assert_int_equal(ret, USBG_ERROR_BUSY);
+	assert_int_equal(errs.count, 2);
+	assert_int_equal(errs.function, USBG_ERROR_BUSY);
+	assert_true(errs.gadget);
+	g = usbg_get_gadget(s, "g1");
+	assert_non_null(g);
+	assert_null(usbg_get_first_config(g));
+	f = usbg_get_first_function(g);
+	assert_ptr_equal(f, usbg_get_function(g, USBG_F_ECM, "usb0"));
+	assert_null(usbg_get_next_function(f));
+
+	memfs_fail_path = NULL;
+	s->io.ops = memfs_orig_ops;
+	memset(&errs, 0, sizeof(errs));
+	ret = usbg_teardown_gadget(g, USBG_RM_BEST_EFFORT, teardown_error_cb,
+				   &errs);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(errs.count, 0);
+	assert_memfs_no_gadgets(s);
 }
 
 /**
- * @brief Test setting strings one by one
- * @details Set strings on all configs present in given state
- * @param[in, out] state Pointer to pointer to correctly initialized test state,
- * will point to usbg state when finished.
+ * @brief Run failing program on in-memory configfs
+ * @details Partially created gadget has to be removed also when it
+ * can't be parsed by library.
  */
-static void test_set_config_string(void **state)
+static void test_memfs_program_cleanup(void **state)
 {
+	struct usbg_io_ops failing_ops;
 	usbg_state *s = NULL;
-	struct test_state *ts;
+	usbg_gadget *g;
+	usbg_program *p;
+	char path[USBG_MAX_PATH_LENGTH];
+	struct stat st;
+	int i, ret;
 
-	safe_init_with_state(state, &ts, &s);
-	for_each_test_config(ts, s, try_set_config_string);
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	memfs_build_gadget(s, "g1", &g);
+	ret = usbg_compile_program(g, 0, &p);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	/* Serial port number is read only */
+	i = find_program_op(p, USBG_OP_WRITE, "functions/ecm.usb0/qmult");
+	assert_true(i >= 0);
+	free(p->ops[i].path);
+	p->ops[i].path = strdup("functions/acm.0/port_num");
+	assert_non_null(p->ops[i].path);
+
+	snprintf(path, sizeof(path), "%s/g2", s->path);
+
+	ret = usbg_run_program(s, p, "g2", NULL);
+	assert_int_equal(ret, USBG_ERROR_NO_ACCESS);
+	assert_null(usbg_get_gadget(s, "g2"));
+	assert_int_not_equal(usbg_io_lstat(&s->io, path, &st), 0);
+
+	memfs_orig_ops = s->io.ops;
+	failing_ops = *s->io.ops;
+	failing_ops.read = memfs_failing_read;
+	s->io.ops = &failing_ops;
+	memfs_fail_path = "/g2/UDC";
+
+	ret = usbg_run_program(s, p, "g2", NULL);
+	assert_int_equal(ret, USBG_ERROR_NO_ACCESS);
+	assert_null(usbg_get_gadget(s, "g2"));
+	assert_int_not_equal(usbg_io_lstat(&s->io, path, &st), 0);
+
+	memfs_fail_path = NULL;
+	s->io.ops = memfs_orig_ops;
+	usbg_destroy_program(p);
 }
 
 /**
- * @brief Get config strings
- * @details Assume that given configs have the same strings
- * @param[in] c Config from which strings should be get
- * @param[in] tc Test config expected to have the same string as c
+ * @brief Name network interfaces on in-memory configfs
+ * @details Like in kernel, ifname is unnamed until gadget is bound and
+ * only a pattern with exactly one %d may be written to it. Binding
+ * must not change program of gadget, which has to be replayed.
  */
-static void try_get_config_strs(usbg_config *c, struct test_config *tc)
+static void test_memfs_ifname(void **state)
 {
-	struct usbg_config_strs strs;
+	static const struct {
+		const char *name;
+		int ret;
+	} names[] = {
+		{ "usb0", USBG_ERROR_INVALID_PARAM },
+		{ "usb%d%d", USBG_ERROR_INVALID_PARAM },
+		{ "net%s", USBG_ERROR_INVALID_PARAM },
+		{ "my net%d", USBG_ERROR_INVALID_PARAM },
+		{ "", USBG_ERROR_INVALID_PARAM },
+		{ "very_long_name%d", USBG_ERROR_OTHER_ERROR },
+		{ "net%d\n", USBG_SUCCESS },
+	};
+	usbg_state *s = NULL;
+	usbg_gadget *g, *g2;
+	usbg_function *f;
+	usbg_config *c;
+	usbg_program *p, *p2;
+	char path[USBG_MAX_PATH_LENGTH];
+	char buf[USBG_MAX_STR_LENGTH];
+	int i, ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	memfs_build_gadget(s, "g1", &g);
+	ret = usbg_create_function(g, USBG_F_NCM, "net", NULL, &f);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_f_net_get_ifname_s(usbg_to_net_function(f), buf,
+				      sizeof(buf));
+	assert_true(ret > 0);
+	assert_string_equal(buf, "(unnamed net_device)");
+
+	snprintf(path, sizeof(path), "%s/%s/ifname", f->path, f->name);
+	for (i = 0; i < ARRAY_SIZE(names); ++i) {
+		ret = usbg_io_write(&s->io, path, names[i].name,
+				    strlen(names[i].name));
+		assert_int_equal(ret < 0 ? ret : USBG_SUCCESS, names[i].ret);
+	}
+
+	ret = usbg_f_net_get_ifname_s(usbg_to_net_function(f), buf,
+				      sizeof(buf));
+	assert_true(ret > 0);
+	assert_string_equal(buf, "net%d");
+
+	c = usbg_get_config(g, 1, NULL);
+	ret = usbg_add_config_function(c, "f5", f);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	/* Function used by config can't be renamed */
+	ret = usbg_io_write(&s->io, path, "eth%d", 5);
+	assert_int_equal(ret, USBG_ERROR_BUSY);
+
+	ret = usbg_compile_program(g, 0, &p);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_enable_gadget(g, usbg_get_first_udc(s));
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_f_net_get_ifname_s(usbg_to_net_function(f), buf,
+				      sizeof(buf));
+	assert_true(ret > 0);
+	assert_int_equal(strncmp(buf, "net", 3), 0);
+	assert_null(strchr(buf, '%'));
+
+	f = usbg_get_function(g, USBG_F_ECM, "usb0");
+	ret = usbg_f_net_get_ifname_s(usbg_to_net_function(f), buf,
+				      sizeof(buf));
+	assert_true(ret > 0);
+	assert_int_equal(strncmp(buf, "usb", 3), 0);
+	assert_null(strchr(buf, '%'));
+
+	ret = usbg_compile_program(g, 0, &p2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_program_equal(p, p2);
+
+	ret = usbg_run_program(s, p2, "g2", &g2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_non_null(usbg_get_function(g2, USBG_F_NCM, "net"));
+
+	usbg_destroy_program(p);
+	usbg_destroy_program(p2);
+}
+
+/* Send request which usbg_client API would not build */
+static int test_daemon_raw_create(const char *path, const char *name,
+				  uint32_t vid, uint32_t pid)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char buf[USBG_RPC_MAX_MSG];
+	struct usbg_rpc_msg m;
+	struct usbg_rpc_hdr hdr;
+	ssize_t n;
+	int fd;
+
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	assert_true(fd >= 0);
+	assert_int_equal(connect(fd, (struct sockaddr *)&addr,
+				 sizeof(addr)), 0);
+
+	usbg_rpc_init(&m, buf, sizeof(buf), USBG_RPC_CREATE, 0);
+	usbg_rpc_put_str(&m, name);
+	usbg_rpc_put_u32(&m, vid);
+	usbg_rpc_put_u32(&m, pid);
+	assert_int_equal(send(fd, m.buf, m.len, 0), m.len);
+
+	n = recv(fd, buf, sizeof(buf), 0);
+	close(fd);
+	assert_int_equal(usbg_rpc_parse(&m, buf, n, &hdr), USBG_SUCCESS);
+
+	return hdr.status;
+}
+
+/*
+ * Send requests without reading responses, until daemon drops the
+ * connection. Returns false if it hasn't been dropped.
+ */
+static bool test_daemon_flood(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char buf[USBG_RPC_MAX_MSG];
+	struct usbg_rpc_msg m;
+	int fd, i;
+	bool dropped = false;
+
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	assert_true(fd >= 0);
+	assert_int_equal(connect(fd, (struct sockaddr *)&addr,
+				 sizeof(addr)), 0);
+
+	usbg_rpc_init(&m, buf, sizeof(buf), USBG_RPC_CREATE, 0);
+	usbg_rpc_put_str(&m, "flood");
+	usbg_rpc_put_u32(&m, 0x10000);
+	usbg_rpc_put_u32(&m, 0x0104);
+
+	for (i = 0; i < 100000 && !dropped; ++i) {
+		if (send(fd, m.buf, m.len, MSG_NOSIGNAL | MSG_DONTWAIT) >= 0)
+			continue;
+		if (errno == EAGAIN)
+			usleep(100);
+		else
+			dropped = true;
+	}
 
-	push_config_strs(tc, LANG_US_ENG, tc->strs);
-	usbg_get_config_strs(c, LANG_US_ENG, &strs);
-	assert_string_equal(tc->strs->configuration, strs.configuration);
-	usbg_free_config_strs(&strs);
+	close(fd);
+	return dropped;
 }
 
 /**
- * @brief Test getting congig strings
- * @details Get config strings on all configs present in given state
- * @param[in, out] state Pointer to pointer to correctly initialized test state,
- * will point to usbg state when finished.
+ * @brief Tests daemon socket and requests changing in-memory configfs
+ * @details Stale socket is replaced, but regular file and socket of
+ * running daemon are not. Client which doesn't read responses is
+ * dropped without blocking others. Failed switch binds both gadgets
+ * back.
  */
-static void test_get_config_strs(void **state)
+static void test_memfs_daemon(void **state)
 {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct test_daemon_data td = { .done = false };
+	struct usbg_client_gadget cg;
 	usbg_state *s = NULL;
-	struct test_state *ts;
+	usbg_gadget *g1, *g2;
+	usbg_daemon *other;
+	usbg_client *c = NULL;
+	usbg_udc *u;
+	pthread_t thread;
+	struct stat st;
+	char path[64];
+	int fd, ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
 
-	safe_init_with_state(state, &ts, &s);
-	for_each_test_config(ts, s, try_get_config_strs);
+	memfs_build_gadget(s, "g1", &g1);
+	ret = usbg_create_gadget(s, "g2", NULL, NULL, &g2);
+	assert_int_equal(ret, USBG_SUCCESS);
+	u = usbg_get_first_udc(s);
+	ret = usbg_enable_gadget(g1, u);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	snprintf(path, sizeof(path), "/tmp/usbg-test-%d.file", getpid());
+	fd = open(path, O_CREAT | O_WRONLY | O_CLOEXEC, 0600);
+	assert_true(fd >= 0);
+	close(fd);
+	ret = usbg_daemon_create(s, path, &td.d);
+	assert_int_equal(ret, USBG_ERROR_EXIST);
+	assert_int_equal(unlink(path), 0);
+
+	/* Socket of daemon which died */
+	snprintf(path, sizeof(path), "/tmp/usbg-test-%d.sock", getpid());
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	assert_true(fd >= 0);
+	assert_int_equal(bind(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+	close(fd);
+
+	ret = usbg_daemon_create(s, path, &td.d);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(lstat(path, &st), 0);
+	assert_true(S_ISSOCK(st.st_mode));
+	assert_int_equal(st.st_mode & 0777, 0600);
+
+	ret = usbg_daemon_create(s, path, &other);
+	assert_int_equal(ret, USBG_ERROR_BUSY);
+
+	ret = pthread_create(&thread, NULL, test_daemon_thread, &td);
+	assert_int_equal(ret, 0);
+
+	ret = test_daemon_raw_create(path, "g3", 0x10000, 0x0104);
+	assert_int_equal(ret, USBG_ERROR_INVALID_VALUE);
+
+	assert_true(test_daemon_flood(path));
+
+	ret = usbg_client_connect(path, &c);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_client_get_gadget(c, "g3", &cg);
+	assert_int_equal(ret, USBG_ERROR_NOT_FOUND);
+	ret = usbg_client_create_gadget(c, "g3", 0x1d6b, 0x0104);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_client_get_gadget(c, "g3", &cg);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(cg.idVendor, 0x1d6b);
+	assert_int_equal(cg.idProduct, 0x0104);
+
+	/* Gadget without configs cannot be bound */
+	ret = usbg_client_switch_gadget(c, "g2", usbg_get_udc_name(u));
+	assert_int_not_equal(ret, USBG_SUCCESS);
+	ret = usbg_client_get_gadget(c, "g1", &cg);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_string_equal(cg.udc, usbg_get_udc_name(u));
+
+	usbg_client_close(c);
+	td.done = true;
+	pthread_join(thread, NULL);
+	usbg_daemon_destroy(td.d);
+	assert_int_not_equal(access(path, F_OK), 0);
 }
 
 /**
- * @brief Get config attributes
- * @details Assume that attributes which will be returned are the same as
- * given test state contains.
- * @param[in] c Usbg config
- * @param[in] tc Test config with set attributes
+ * @brief Periodic bandwidth of audio, video and HID on in-memory configfs
+ * @details Expected usage is computed by hand from attributes set below
+ * and default 1024 B streaming maxpacket of UVC, at full and high speed.
+ * Adding playback channels exceeds full speed budget, but still fits into
+ * high speed one.
  */
-static void try_get_config_attrs(usbg_config *c, struct test_config *tc)
+static void test_memfs_bandwidth(void **state)
 {
-	struct usbg_config_attrs attrs;
+	static const struct {
+		usbg_speed speed;
+		uint64_t uac2, uvc, hid, available;
+	} expected[] = {
+		/* 48 samples of 2 + 1 channels each ms, plus feedback */
+		{ USBG_SPEED_FULL, 196000 + 96000, 1023 * 1000, 2 * 8 * 100,
+		  1350000 },
+		/* 6 samples each 125 us, maxpacket is not limited */
+		{ USBG_SPEED_HIGH, 224000 + 96000, 1024 * 8000, 2 * 8 * 1000,
+		  48000000 },
+	};
+	union usbg_f_uac2_attr_val sync = { .c_sync = "async" };
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	usbg_config *c = NULL;
+	usbg_function *audio, *video, *hid;
+	struct usbg_bandwidth bw;
+	uint64_t used;
+	int i, ret;
 
-	push_config_attrs(tc, tc->attrs);
-	usbg_get_config_attrs(c, &attrs);
-	assert_config_attrs_equal(tc->attrs, &attrs);
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	ret = usbg_create_gadget(s, "g1", NULL, NULL, &g);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_create_config(g, 1, "c", NULL, NULL, &c);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_create_function(g, USBG_F_UAC2, "0", NULL, &audio);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_create_function(g, USBG_F_UVC, "0", NULL, &video);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_create_function(g, USBG_F_HID, "0", NULL, &hid);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_f_uac2_set_c_srate(usbg_to_uac2_function(audio), 48000);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_f_uac2_set_p_chmask(usbg_to_uac2_function(audio), 0x1);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_f_uac2_set_attr_val(usbg_to_uac2_function(audio),
+				       USBG_F_UAC2_C_SYNC, sync);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_f_hid_set_report_length(usbg_to_hid_function(hid), 8);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_add_config_function(c, "audio", audio);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_add_config_function(c, "video", video);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_add_config_function(c, "hid", hid);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	for (i = 0; i < ARRAY_SIZE(expected); ++i) {
+		ret = usbg_get_function_bandwidth(audio, expected[i].speed,
+						  &used);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(used, expected[i].uac2);
+
+		ret = usbg_get_function_bandwidth(video, expected[i].speed,
+						  &used);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(used, expected[i].uvc);
+
+		ret = usbg_get_function_bandwidth(hid, expected[i].speed,
+						  &used);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(used, expected[i].hid);
+
+		ret = usbg_get_config_bandwidth(c, expected[i].speed, &bw);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(bw.available, expected[i].available);
+		assert_int_equal(bw.used, expected[i].uac2 + expected[i].uvc +
+				 expected[i].hid);
+		assert_int_equal(bw.headroom, bw.available - bw.used);
+		assert_true(bw.headroom > 0);
+	}
+
+	/* 8 playback channels need 768 B each ms at full speed */
+	ret = usbg_f_uac2_set_p_chmask(usbg_to_uac2_function(audio), 0xff);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_get_config_bandwidth(c, USBG_SPEED_FULL, &bw);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(bw.used, 196000 + 768000 + 1023000 + 1600);
+	assert_true(bw.headroom < 0);
+
+	ret = usbg_get_config_bandwidth(c, USBG_SPEED_HIGH, &bw);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_true(bw.headroom > 0);
 }
 
 /**
- * @brief Test getting config attributes
- * @details Get config attributes on all configfs in state
- * @param[in, out] state Pointer to pointer to correctly initialized test state,
- * will point to usbg state when finished.
+ * @brief Probe function types by trial mkdir on in-memory configfs
+ * @details Emulated configfs has no module database, so only trial
+ * mkdir tells anything. Scratch gadgets should be gone afterwards,
+ * no matter if they were shared or created by each thread.
  */
-static void test_get_config_attrs(void **state)
+static void test_memfs_probe(void **state)
 {
+	static const int flags[] = { USBG_PROBE_MKDIR, USBG_PROBE_PRELOAD };
 	usbg_state *s = NULL;
-	struct test_state *ts;
+	struct dirent **dent;
+	int i, n, ret;
 
-	safe_init_with_state(state, &ts, &s);
-	for_each_test_config(ts, s, try_get_config_attrs);
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	ret = usbg_probe_function_types(s, 0);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(usbg_get_function_type_availability(s, USBG_F_ACM),
+			 USBG_FUNC_AVAIL_UNKNOWN);
+
+	for (i = 0; i < ARRAY_SIZE(flags); ++i) {
+		ret = usbg_probe_function_types(s, flags[i]);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(usbg_get_function_type_availability(s,
+								USBG_F_ACM),
+				 USBG_FUNC_AVAIL_LOADED);
+		assert_int_equal(usbg_function_type_available(s, USBG_F_HID),
+				 USBG_SUCCESS);
+
+		n = usbg_io_scandir(&s->io, s->path, &dent, file_select,
+				    alphasort);
+		assert_int_equal(n, 0);
+		free(dent);
+	}
 }
 
 /**
- * @brief Set config attributes in given config
- * @param[in] c Usbg config
- * @param[in] tc Test config with attributes which will be set
+ * @brief Import of invalid scheme on in-memory configfs
+ * @details Config refers to function which is not defined. Import
+ * should fail before any directory is created, same as validation.
  */
-static void try_set_config_attrs(usbg_config *c, struct test_config *tc)
+static void test_memfs_import_invalid(void **state)
 {
-	pull_config_attrs(tc, tc->attrs);
-	usbg_set_config_attrs(c, tc->attrs);
+	char scheme[] =
+		"attrs = { idVendor = 0x1d6b; };\n"
+		"functions = { acm0 = { instance = \"0\"; type = \"acm\"; }; };\n"
+		"configs = ( { id = 1; name = \"c\";\n"
+		"	functions = ( \"acm0\", \"ecm_usb0\" ); } );\n";
+	char buf[USBG_MAX_STR_LENGTH];
+	struct usbg_stats st;
+	usbg_state *s = NULL;
+	usbg_gadget *g = NULL;
+	FILE *stream;
+	int ret;
+
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	/* Library built without gadget schemes */
+	if (usbg_export_gadget(NULL, stdout) == USBG_ERROR_NOT_SUPPORTED)
+		skip();
+
+	stream = fmemopen(scheme, strlen(scheme), "r");
+	assert_non_null(stream);
+	pass_through_stream(stream);
+	buf[0] = '\0';
+	ret = usbg_validate_gadget_scheme(s, stream, buf, sizeof(buf));
+	assert_int_equal(ret, USBG_ERROR_NOT_FOUND);
+	assert_true(strlen(buf) > 0);
+	fclose(stream);
+
+	usbg_reset_stats(s);
+	stream = fmemopen(scheme, strlen(scheme), "r");
+	assert_non_null(stream);
+	pass_through_stream(stream);
+	ret = usbg_import_gadget(s, stream, "g1", &g);
+	assert_int_equal(ret, USBG_ERROR_NOT_FOUND);
+	fclose(stream);
+
+	usbg_get_stats(s, &st);
+	assert_int_equal(st.syscalls[USBG_STAT_MKDIR], 0);
+	assert_null(usbg_get_gadget(s, "g1"));
+}
+
+/* Validate scheme given as string and import it as g1 if it's valid */
+static int memfs_validate_import(usbg_state *s, const char *scheme,
+				 usbg_gadget **g)
+{
+	char buf[USBG_MAX_STR_LENGTH];
+	FILE *stream;
+	int ret, import_ret;
+
+	stream = fmemopen((char *)scheme, strlen(scheme), "r");
+	assert_non_null(stream);
+	pass_through_stream(stream);
+	ret = usbg_validate_gadget_scheme(s, stream, buf, sizeof(buf));
+	fclose(stream);
+
+	stream = fmemopen((char *)scheme, strlen(scheme), "r");
+	assert_non_null(stream);
+	pass_through_stream(stream);
+	import_ret = usbg_import_gadget(s, stream, "g1", g);
+	fclose(stream);
+
+	assert_int_equal(import_ret, ret);
+	return ret;
 }
 
 /**
- * @brief Test setting config attributes
- * @details Set config attributes on all configs in state
- * @param[in, out] state Pointer to pointer to correctly initialized test state,
- * will point to usbg state when finished.
+ * @brief Import scheme with functions defined inline in bindings
+ * @details Inline function may be referenced by type_instance label
+ * from later configs, but it can't duplicate function from functions
+ * section. Validation has to agree with import.
  */
-static void test_set_config_attrs(void **state)
+static void test_memfs_import_inline(void **state)
 {
+	const char *scheme =
+		"functions = { acm0 = { instance = \"0\"; type = \"acm\"; }; };\n"
+		"configs = ( { id = 1; name = \"c\";\n"
+		"	functions = ( \"acm0\", { name = \"net\";\n"
+		"		function = { instance = \"usb0\"; type = \"ecm\"; };\n"
+		"	} ); },\n"
+		"	{ id = 2; name = \"c\"; functions = ( \"ecm_usb0\" ); } );\n";
+	const char *dup =
+		"functions = { acm0 = { instance = \"0\"; type = \"acm\"; }; };\n"
+		"configs = ( { id = 1; name = \"c\";\n"
+		"	functions = ( { name = \"f0\";\n"
+		"		function = { instance = \"0\"; type = \"acm\"; };\n"
+		"	} ); } );\n";
+	struct usbg_stats st;
 	usbg_state *s = NULL;
-	struct test_state *ts;
+	usbg_gadget *g = NULL;
+	usbg_config *c;
+	usbg_binding *b;
+	int ret;
 
-	safe_init_with_state(state, &ts, &s);
-	for_each_test_config(ts, s, try_set_config_attrs);
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
+
+	/* Library built without gadget schemes */
+	if (usbg_export_gadget(NULL, stdout) == USBG_ERROR_NOT_SUPPORTED)
+		skip();
+
+	ret = memfs_validate_import(s, scheme, &g);
+	assert_int_equal(ret, USBG_SUCCESS);
+	c = usbg_get_config(g, 2, NULL);
+	assert_non_null(c);
+	b = usbg_get_first_binding(c);
+	assert_non_null(b);
+	assert_ptr_equal(usbg_get_binding_target(b),
+			 usbg_get_function(g, USBG_F_ECM, "usb0"));
+	ret = usbg_rm_gadget(g, USBG_RM_RECURSE);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	usbg_reset_stats(s);
+	ret = memfs_validate_import(s, dup, &g);
+	assert_int_equal(ret, USBG_ERROR_EXIST);
+	usbg_get_stats(s, &st);
+	assert_int_equal(st.syscalls[USBG_STAT_MKDIR], 0);
+	assert_null(usbg_get_gadget(s, "g1"));
+}
+
+/* Compile template given as string */
+static int memfs_compile_template(usbg_state *s, const char *scheme,
+				  usbg_template **t)
+{
+	FILE *stream;
+	int ret;
+
+	stream = fmemopen((char *)scheme, strlen(scheme), "r");
+	assert_non_null(stream);
+	pass_through_stream(stream);
+	ret = usbg_compile_template(s, stream, t);
+	fclose(stream);
+
+	return ret;
 }
 
 /**
- * @brieg Test creating config
- * @details Start with empty gadgets, add all functions from given state
- * @param[in, out] state Pointer to pointer to correctly initialized test state,
- * will point to usbg state when finished.
+ * @brief Instantiate gadget template on in-memory configfs
+ * @details Same compiled template is used for several gadgets, each
+ * with own values of placeholders. Missing value or failed import
+ * doesn't create gadget and is left as last failed import.
  */
-static void test_create_config(void **state)
+static void test_memfs_template(void **state)
 {
+	const char *scheme =
+		"attrs = { idVendor = 0x1d6b; idProduct = 0x0104; };\n"
+		"strings = ( { lang = 0x409; serialnumber = \"SN-${serial}\";\n"
+		"	product = \"${product} ${serial}\"; } );\n"
+		"functions = { acm = { instance = \"${port}\";\n"
+		"	type = \"acm\"; }; };\n"
+		"configs = ( { id = 1; name = \"c\";\n"
+		"	functions = ( \"acm\" ); } );\n";
+	const struct usbg_template_var vars[][4] = {
+		{
+			{ "serial", "0001" },
+			{ "product", "board" },
+			{ "port", "0" },
+			{ NULL, NULL },
+		}, {
+			{ "port", "1" },
+			{ "serial", "0002" },
+			{ "product", "" },
+			{ NULL, NULL },
+		},
+	};
+	const char *keys[] = {
+		"functions = { acm = { instance = \"0\";\n"
+		"	type = \"${type}\"; }; };\n",
+		"functions = { acm = { instance = \"0\"; type = \"acm\"; }; };\n"
+		"configs = ( { id = 1; functions = ( \"${f}\" ); } );\n",
+		"configs = ( { id = 1; functions = ( { name = \"f\";\n"
+		"	function = \"${f}\"; } ); } );\n",
+		"functions = { rndis = { instance = \"0\"; type = \"rndis\";\n"
+		"	os_descs = ( { interface = \"${i}\"; } ); }; };\n",
+	};
+	/* Serial number, product and instance of function */
+	const char *expected[][3] = {
+		{ "SN-0001", "board 0001", "0" },
+		{ "SN-0002", " 0002", "1" },
+	};
+	struct usbg_gadget_strs strs;
+	struct usbg_gadget_attrs attrs;
+	usbg_template *t = NULL;
 	usbg_state *s = NULL;
-	usbg_gadget *g = NULL;
-	usbg_config *c = NULL;
-	struct test_state *ts;
-	struct test_state *empty;
-	struct test_gadget *tg;
-	struct test_config *tc;
+	usbg_gadget *g;
+	char name[8];
+	int i, ret;
 
-	ts = (struct test_state *)(*state);
-	*state = NULL;
+	ret = usbg_init_memfs(1, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
 
-	empty = build_empty_gadget_state(ts);
+	/* Library built without gadget schemes */
+	if (usbg_export_gadget(NULL, stdout) == USBG_ERROR_NOT_SUPPORTED)
+		skip();
 
-	init_with_state(empty, &s);
-	*state = s;
+	ret = memfs_compile_template(s, "attrs = { idVendor = ; };\n", &t);
+	assert_int_equal(ret, USBG_ERROR_INVALID_FORMAT);
+	assert_non_null(usbg_get_gadget_import_error_text(s));
 
-	for (tg = ts->gadgets; tg->name; tg++) {
-		g = usbg_get_gadget(s, tg->name);
-		assert_non_null(g);
-		for (tc = tg->configs; tc->label; tc++) {
-			pull_create_config(tc);
-			usbg_create_config(g, tc->id, tc->label,
-					tc->attrs, tc->strs, &c);
-			assert_config_equal(c, tc);
-		}
+	ret = memfs_compile_template(s,
+			"strings = ( { lang = 0x409; product = \"${a\"; } );\n",
+			&t);
+	assert_int_equal(ret, USBG_ERROR_INVALID_FORMAT);
+
+	/* Placeholders which would change the result of validation */
+	for (i = 0; i < ARRAY_SIZE(keys); ++i) {
+		ret = memfs_compile_template(s, keys[i], &t);
+		assert_int_equal(ret, USBG_ERROR_NOT_SUPPORTED);
+	}
+
+	ret = memfs_compile_template(s, scheme, &t);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	/* Twice, to see that instantiation leaves template untouched */
+	for (i = 0; i < 2 * ARRAY_SIZE(vars); ++i) {
+		sprintf(name, "g%d", i);
+		ret = usbg_instantiate_template(t, name,
+						vars[i % ARRAY_SIZE(vars)], &g);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(usbg_get_gadget_import_error_line(s), -1);
+
+		ret = usbg_get_gadget_attrs(g, &attrs);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_int_equal(attrs.idProduct, 0x0104);
+
+		ret = usbg_get_gadget_strs(g, LANG_US_ENG, &strs);
+		assert_int_equal(ret, USBG_SUCCESS);
+		assert_string_equal(strs.serial,
+				    expected[i % ARRAY_SIZE(vars)][0]);
+		assert_string_equal(strs.product,
+				    expected[i % ARRAY_SIZE(vars)][1]);
+		usbg_free_gadget_strs(&strs);
+
+		assert_non_null(usbg_get_function(g, USBG_F_ACM,
+				expected[i % ARRAY_SIZE(vars)][2]));
 	}
+
+	/* Value of serial is missing */
+	ret = usbg_instantiate_template(t, "missing", &vars[0][1], &g);
+	assert_int_equal(ret, USBG_ERROR_NOT_FOUND);
+	assert_null(usbg_get_gadget(s, "missing"));
+	assert_int_not_equal(usbg_get_gadget_import_error_line(s), -1);
+
+	/* Gadget of such name already exists */
+	ret = usbg_instantiate_template(t, "g0", vars[0], NULL);
+	assert_int_equal(ret, USBG_ERROR_EXIST);
+	assert_int_not_equal(usbg_get_gadget_import_error_line(s), -1);
+
+	ret = usbg_instantiate_template(t, "last", vars[1], NULL);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(usbg_get_gadget_import_error_line(s), -1);
+
+	usbg_destroy_template(t);
 }
 
 /**
- * @brief Start with empty gadget, add all functions from given one
+ * @brief Supervise gadget moved to other UDC on in-memory configfs
+ * @details After the move kernel detaches gadget from its new UDC,
+ * supervisor should bind it there and not to the UDC it started on.
  */
-static void test_create_function(void **state)
+static void test_memfs_supervisor_move(void **state)
 {
 	usbg_state *s = NULL;
-	usbg_gadget *g = NULL;
-	usbg_function *f = NULL;
-	struct test_state *ts;
-	struct test_state *empty;
-	struct test_gadget *tg;
-	struct test_function *tf;
+	usbg_gadget *g;
+	usbg_udc *u0, *u1;
+	usbg_supervisor *sv = NULL;
+	struct usbg_recovery_stats stats;
+	int ret;
 
-	ts = (struct test_state *)(*state);
-	*state = NULL;
+	ret = usbg_init_memfs(2, &s);
+	assert_int_equal(ret, USBG_SUCCESS);
+	*state = s;
 
-	empty = build_empty_gadget_state(ts);
+	memfs_build_gadget(s, "g1", &g);
+	u0 = usbg_get_first_udc(s);
+	u1 = usbg_get_next_udc(u0);
+	assert_non_null(u1);
 
-	init_with_state(empty, &s);
-	*state = s;
+	ret = usbg_enable_gadget(g, u0);
+	assert_int_equal(ret, USBG_SUCCESS);
 
-	for (tg = ts->gadgets; tg->name; tg++) {
-		g = usbg_get_gadget(s, tg->name);
-		assert_non_null(g);
-		for (tf = tg->functions; tf->instance; tf++) {
-			pull_create_function(tf);
-			usbg_create_function(g, tf->type, tf->instance,
-					tf->attrs, &f);
-			assert_func_equal(f, tf);
-		}
-	}
+	ret = usbg_supervisor_create(s, &sv);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_supervisor_watch(sv, g, USBG_RECOVERY_REBIND, NULL, NULL);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_disable_gadget(g);
+	assert_int_equal(ret, USBG_SUCCESS);
+	ret = usbg_enable_gadget(g, u1);
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_supervisor_dispatch(sv, 0);
+	assert_int_equal(ret, 0);
+
+	/* Kernel detaches gadget behind library's back */
+	ret = usbg_write_string(&s->io, g->path, g->name, "UDC", "\n");
+	assert_int_equal(ret, USBG_SUCCESS);
+
+	ret = usbg_supervisor_dispatch(sv, 0);
+	assert_int_equal(ret, 1);
+	assert_ptr_equal(usbg_get_gadget_udc(g), u1);
+	assert_null(usbg_get_udc_gadget(u0));
+
+	ret = usbg_supervisor_get_stats(sv, g, &stats);
+	assert_int_equal(ret, USBG_SUCCESS);
+	assert_int_equal(stats.detaches, 1);
+	assert_int_equal(stats.recoveries, 1);
+
+	usbg_supervisor_destroy(sv);
 }
 
 /**
@@ -2205,6 +5246,110 @@ static struct CMUnitTest tests[] = {
 	 */
 	USBG_TEST_TS("test_get_udc_long",
 		     test_get_udc, setup_long_udc_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_enable_gadget_staged_simple,
+	 * Bind gadget without connecting it and connect it later,
+	 * usbg_enable_gadget_staged, usbg_udc_connect}
+	 */
+	USBG_TEST_TS("test_enable_gadget_staged_simple",
+		     test_enable_gadget_staged, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_udc_policy_simple,
+	 * Choose free udc and bind gadget according to policy,
+	 * usbg_find_free_udc, usbg_enable_gadget_policy}
+	 */
+	USBG_TEST_TS("test_udc_policy_simple",
+		     test_udc_policy, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_validate_gadget_simple,
+	 * Validate complete gadget before binding,
+	 * usbg_validate_gadget}
+	 */
+	USBG_TEST_TS("test_validate_gadget_simple",
+		     test_validate_gadget, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_validate_gadget_all_funcs,
+	 * Validate gadget with config without functions,
+	 * usbg_validate_gadget}
+	 */
+	USBG_TEST_TS("test_validate_gadget_all_funcs",
+		     test_validate_gadget, setup_all_funcs_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_config_bandwidth_simple,
+	 * Compute periodic bandwidth budget of configs,
+	 * usbg_get_config_bandwidth}
+	 */
+	USBG_TEST_TS("test_config_bandwidth_simple",
+		     test_config_bandwidth, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_config_ep_budget_simple,
+	 * Check interfaces and endpoints of configs against UDC,
+	 * usbg_get_config_ep_budget, usbg_set_udc_endpoints}
+	 */
+	USBG_TEST_TS("test_config_ep_budget_simple",
+		     test_config_ep_budget, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_daemon_simple,
+	 * List gadgets through daemon socket,
+	 * usbg_daemon_create, usbg_client_list_gadgets}
+	 */
+	USBG_TEST_TS("test_daemon_simple",
+		     test_daemon, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_snapshot_simple,
+	 * Read gadget tree published in shared memory,
+	 * usbg_publisher_create, usbg_snapshot_open_fd}
+	 */
+	USBG_TEST_TS("test_snapshot_simple",
+		     test_snapshot, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_clone_gadget_exist_simple,
+	 * Refuse to clone gadget under existing name,
+	 * usbg_clone_gadget}
+	 */
+	USBG_TEST_TS("test_clone_gadget_exist_simple",
+		     test_clone_gadget_exist, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_image_simple,
+	 * Open and restore binary images,
+	 * usbg_open_image_fd, usbg_restore_image}
+	 */
+	USBG_TEST_TS("test_image_simple",
+		     test_image, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_generation_simple,
+	 * Check that setting attributes bumps generation,
+	 * usbg_get_generation, usbg_set_gadget_attrs}
+	 */
+	USBG_TEST_TS("test_generation_simple",
+		     test_generation, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_export_config_stream_simple,
+	 * Compare streaming export of configs with libconfig output,
+	 * usbg_export_config_stream, usbg_export_config}
+	 */
+	USBG_TEST_TS("test_export_config_stream_simple",
+		     test_export_config_stream, setup_simple_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_supervisor_simple,
+	 * Detect detached gadget and bind it again,
+	 * usbg_supervisor_watch, usbg_supervisor_dispatch}
+	 */
+	USBG_TEST_TS("test_supervisor_simple",
+		     test_supervisor, setup_simple_state),
 	/**
 	 * @usbg_test
 	 * @test_desc{test_get_gadget_attr_str,
@@ -2507,6 +5652,162 @@ static struct CMUnitTest tests[] = {
 	 */
 	USBG_TEST_TS("test_create_all_functions",
 		     test_create_function, setup_all_funcs_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_create_all_functions_bulk,
+	 * Create full set of functions in empty state with one call,
+	 * usbg_create_functions}
+	 */
+	USBG_TEST_TS("test_create_all_functions_bulk",
+		     test_create_functions, setup_all_funcs_state),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_gadget,
+	 * Create and bind gadget on in-memory configfs,
+	 * usbg_init_memfs}
+	 */
+	USBG_TEST_TS("test_memfs_gadget", test_memfs_gadget, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_stats,
+	 * Count operations and filesystem accesses of state,
+	 * usbg_get_stats}
+	 */
+	USBG_TEST_TS("test_memfs_stats", test_memfs_stats, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_stats_shared,
+	 * Count operations of two states on one configfs and of parallel
+	 * import, usbg_get_stats, usbg_import_state}
+	 */
+	USBG_TEST_TS("test_memfs_stats_shared", test_memfs_stats_shared, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_export_stream,
+	 * Compare streaming export of gadget and functions with libconfig
+	 * output, usbg_export_gadget_stream, usbg_export_function_stream}
+	 */
+	USBG_TEST_TS("test_memfs_export_stream", test_memfs_export_stream,
+		     NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_clone,
+	 * Clone gadget with UVC frames and mass storage LUNs and compare
+	 * attributes with source, usbg_clone_gadget}
+	 */
+	USBG_TEST_TS("test_memfs_clone", test_memfs_clone, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_program,
+	 * Check order of compiled operations, save, load and replay program
+	 * and refuse paths leaving gadget, usbg_compile_program,
+	 * usbg_load_program, usbg_run_program}
+	 */
+	USBG_TEST_TS("test_memfs_program", test_memfs_program, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_image,
+	 * Save and restore gadget image and refuse images with unsafe
+	 * names or paths, usbg_save_gadget_image, usbg_restore_image}
+	 */
+	USBG_TEST_TS("test_memfs_image", test_memfs_image, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_import_state,
+	 * Export state and import it serially and in parallel, refuse
+	 * state binding gadgets to busy UDC, usbg_import_state}
+	 */
+	USBG_TEST_TS("test_memfs_import_state", test_memfs_import_state,
+		     NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_fingerprint,
+	 * Compare fingerprints of gadgets, functions, programs and
+	 * snapshot, usbg_get_gadget_fingerprint}
+	 */
+	USBG_TEST_TS("test_memfs_fingerprint", test_memfs_fingerprint, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_changed_since,
+	 * Remove and re-create function and config and check exported
+	 * removed and changed lists, usbg_export_changed_since}
+	 */
+	USBG_TEST_TS("test_memfs_changed_since", test_memfs_changed_since,
+		     NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_teardown,
+	 * Tear down bound gadget serially, in parallel and in best effort
+	 * mode, also with injected failures, usbg_teardown_gadget}
+	 */
+	USBG_TEST_TS("test_memfs_teardown", test_memfs_teardown, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_program_cleanup,
+	 * Remove partially created gadget of failing program, also if
+	 * it can't be parsed, usbg_run_program}
+	 */
+	USBG_TEST_TS("test_memfs_program_cleanup", test_memfs_program_cleanup,
+		     NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_ifname,
+	 * Refuse invalid names of network interfaces, name them on bind
+	 * and replay bound gadget, usbg_run_program}
+	 */
+	USBG_TEST_TS("test_memfs_ifname", test_memfs_ifname, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_daemon,
+	 * Replace stale socket, refuse out of range IDs and roll back
+	 * failed switch, usbg_daemon_create, usbg_client_switch_gadget}
+	 */
+	USBG_TEST_TS("test_memfs_daemon", test_memfs_daemon, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_bandwidth,
+	 * Compute periodic bandwidth of UAC2, UVC and HID at full and
+	 * high speed, usbg_get_config_bandwidth}
+	 */
+	USBG_TEST_TS("test_memfs_bandwidth", test_memfs_bandwidth, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_probe,
+	 * Probe function types by serial and parallel trial mkdir,
+	 * usbg_probe_function_types}
+	 */
+	USBG_TEST_TS("test_memfs_probe", test_memfs_probe, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_import_invalid,
+	 * Reject invalid scheme before creating anything,
+	 * usbg_import_gadget, usbg_validate_gadget_scheme}
+	 */
+	USBG_TEST_TS("test_memfs_import_invalid", test_memfs_import_invalid,
+		     NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_import_inline,
+	 * Refer to inline function from later config and refuse inline
+	 * duplicate of defined function, usbg_validate_gadget_scheme}
+	 */
+	USBG_TEST_TS("test_memfs_import_inline", test_memfs_import_inline,
+		     NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_template,
+	 * Instantiate one compiled template with different placeholder
+	 * values and fail on missing value, usbg_instantiate_template}
+	 */
+	USBG_TEST_TS("test_memfs_template", test_memfs_template, NULL),
+	/**
+	 * @usbg_test
+	 * @test_desc{test_memfs_supervisor_move,
+	 * Rebind gadget detached after it has been moved to other UDC,
+	 * usbg_supervisor_dispatch}
+	 */
+	USBG_TEST_TS("test_memfs_supervisor_move", test_memfs_supervisor_move,
+		     NULL),
 	/**
 	 * @usbg_test
 	 * @test_desc{test_get_gadget_str_name,
@@ -11,8 +11,48 @@
 
 typedef int (*fwrite_f_type)(const void *ptr, size_t size,
 			     size_t nmemb, FILE *stream);
+typedef size_t (*fread_f_type)(void *ptr, size_t size,
+			       size_t nmemb, FILE *stream);
 typedef int (*fflush_f_type)(FILE *);
 typedef fflush_f_type ferror_f_type;
+typedef fflush_f_type fclose_f_type;
+
+#define MAX_PASS_THROUGH 8
+
+static FILE *pass_through[MAX_PASS_THROUGH];
+
+/**
+ * @brief Let libc handle given stream
+ * @details Memory streams used by tests are read and written for real,
+ * until they are closed.
+ */
+void pass_through_stream(FILE *stream)
+{
+	int i;
+
+	for (i = 0; i < MAX_PASS_THROUGH; ++i) {
+		if (!pass_through[i]) {
+			pass_through[i] = stream;
+			return;
+		}
+	}
+
+	fail();
+}
+
+static int is_pass_through(FILE *stream)
+{
+	int i;
+
+	if (stream == stderr || stream == stdout)
+		return 1;
+
+	for (i = 0; i < MAX_PASS_THROUGH; ++i)
+		if (stream && pass_through[i] == stream)
+			return 1;
+
+	return 0;
+}
 
 /**
  * @brief Simulates opening file
@@ -31,6 +71,19 @@ FILE *fopen(const char *path, const char *mode)
  */
 int fclose(FILE *fp)
 {
+	int i;
+
+	if (is_pass_through(fp)) {
+		fclose_f_type orig_fclose;
+
+		for (i = 0; i < MAX_PASS_THROUGH; ++i)
+			if (pass_through[i] == fp)
+				pass_through[i] = NULL;
+
+		orig_fclose = (fclose_f_type)dlsym(RTLD_NEXT, "fclose");
+		return orig_fclose(fp);
+	}
+
 	check_expected(fp);
 	return mock_type(int);
 }
@@ -46,6 +99,12 @@ size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream)
 	int len;
 	size_t ret;
 
+	if (is_pass_through(stream)) {
+		fread_f_type orig_fread;
+		orig_fread = (fread_f_type)dlsym(RTLD_NEXT, "fread");
+		return orig_fread(ptr, size, nmemb, stream);
+	}
+
 	check_expected(stream);
 	data = mock_ptr_type(char *);
 	len = mock_type(int);
@@ -172,7 +231,7 @@ size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream)
 	 * Cmocka (or anything else) may want to print some errors.
 	 * Especially when running fwrite() itself
 	 */
-	if (stream == stderr || stream == stdout) {
+	if (is_pass_through(stream)) {
 		fwrite_f_type orig_fwrite;
 		orig_fwrite = (fwrite_f_type)dlsym(RTLD_NEXT, "fwrite");
 		return orig_fwrite(ptr, size, nmemb, stream);
@@ -199,7 +258,7 @@ int mkdir(const char *pathname, mode_t mode)
  */
 int fflush(FILE *stream)
 {
-	if (stream == stderr || stream == stdout) {
+	if (is_pass_through(stream)) {
 		fflush_f_type orig_fflush;
 		orig_fflush = (fflush_f_type)dlsym(RTLD_NEXT, "fflush");
 		return orig_fflush(stream);
@@ -210,7 +269,7 @@ int fflush(FILE *stream)
 
 int ferror(FILE *stream)
 {
-	if (stream == stderr || stream == stdout) {
+	if (is_pass_through(stream)) {
 		ferror_f_type orig_ferror;
 		orig_ferror = (ferror_f_type)dlsym(RTLD_NEXT, "ferror");
 		return orig_ferror(stream);
@@ -924,6 +924,38 @@ void pull_gadget_strs(struct test_gadget *gadget, int lang,
 				lang, get_gadget_str(strs, i));
 }
 
+void push_gadget_udc(struct test_gadget *gadget, const char *udc)
+{
+	char *path;
+
+	safe_asprintf(&path, "%s/%s/UDC", gadget->path, gadget->name);
+	PUSH_FILE_STR(path, udc);
+}
+
+void pull_gadget_udc(struct test_gadget *gadget, const char *udc)
+{
+	char *path;
+
+	safe_asprintf(&path, "%s/%s/UDC", gadget->path, gadget->name);
+	EXPECT_WRITE_STR(path, udc);
+}
+
+void pull_udc_soft_connect(const char *udc, const char *op)
+{
+	char *path;
+
+	safe_asprintf(&path, "/sys/class/udc/%s/soft_connect", udc);
+	EXPECT_WRITE_STR(path, op);
+}
+
+void push_udc_max_speed(const char *udc, const char *speed)
+{
+	char *path;
+
+	safe_asprintf(&path, "/sys/class/udc/%s/maximum_speed", udc);
+	PUSH_FILE_STR(path, speed);
+}
+
 static void push_gadget_str_dir(struct test_gadget *gadget, int lang)
 {
 	char *dir;
@@ -1005,6 +1037,23 @@ void push_config_strs(struct test_config *config, int lang,
 	push_config_string(config, lang, strs->configuration);
 }
 
+void push_config_langs(struct test_config *config, int *langs)
+{
+	char *path;
+	char *lang;
+	int n;
+
+	for (n = 0; langs[n]; n++);
+
+	safe_asprintf(&path, "%s/%s/strings", config->path, config->name);
+	PUSH_DIR(path, n);
+
+	for (n = 0; langs[n]; n++) {
+		safe_asprintf(&lang, "0x%x", langs[n]);
+		PUSH_DIR_ENTRY(lang, DT_DIR);
+	}
+}
+
 void assert_config_attrs_equal(struct usbg_config_attrs *actual,
 			       struct usbg_config_attrs *expected)
 {
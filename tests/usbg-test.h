@@ -7,6 +7,9 @@
 #include <usbg/function/ffs.h>
 #include <usbg/function/phonet.h>
 #include <usbg/function/midi.h>
+#include <usbg/function/hid.h>
+#include <usbg/function/uac2.h>
+#include <usbg/function/uvc.h>
 
 #include <sys/queue.h>
 #include "usbg/usbg_internal.h"
@@ -279,6 +282,34 @@ void pull_gadget_string(struct test_gadget *gadget, int lang,
 void pull_gadget_strs(struct test_gadget *gadget, int lang,
 		      struct usbg_gadget_strs *strs);
 
+/**
+ * @brief Prepare filesystem for reading udc to which gadget is bound
+ * @param[in] gadget Gadget which UDC attribute will be read
+ * @param[in] udc Content of UDC attribute
+ */
+void push_gadget_udc(struct test_gadget *gadget, const char *udc);
+
+/**
+ * @brief Prepare filesystem for binding gadget to given udc
+ * @param[in] gadget Gadget which will be bound
+ * @param[in] udc Name of udc expected to be written
+ */
+void pull_gadget_udc(struct test_gadget *gadget, const char *udc);
+
+/**
+ * @brief Prepare filesystem for changing udc soft_connect state
+ * @param[in] udc Name of udc
+ * @param[in] op Expected operation ("connect" or "disconnect")
+ */
+void pull_udc_soft_connect(const char *udc, const char *op);
+
+/**
+ * @brief Prepare filesystem for reading udc maximum speed
+ * @param[in] udc Name of udc
+ * @param[in] speed Speed string as reported by kernel
+ */
+void push_udc_max_speed(const char *udc, const char *speed);
+
 /**
  * @brief prepare for reading gadget's strings
  */
@@ -321,6 +352,13 @@ void push_config_string(struct test_config *config, int lang, const char *str);
 void push_config_strs(struct test_config *config, int lang,
 		      struct usbg_config_strs *strs);
 
+/**
+ * @brief Prepare for listing languages of config strings
+ * @param[in] config from which languages will be get
+ * @param[in] langs Languages which should be returned, terminated by 0
+ */
+void push_config_langs(struct test_config *config, int *langs);
+
 /**
  * @brief Prepare for creating config
  * @param[in] tc Test config to be created
@@ -522,6 +560,12 @@ typedef void (*GadgetTestFunc)(usbg_gadget *g, struct test_gadget *tg);
  */
 void for_each_test_gadget(struct test_state *ts, usbg_state *s, GadgetTestFunc fun);
 
+/**
+ * @brief Bypass simulated stdio for given stream until it's closed
+ * @param[in] stream Stream opened by test, e.g. with open_memstream()
+ */
+void pass_through_stream(FILE *stream);
+
 static inline void *safe_calloc(int count, size_t size)
 {
 	void *ptr;